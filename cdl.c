@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cdl.h"
+#include "ppu.h"
+#include "rp2a03.h"
+
+static size_t
+cdl_size(struct nes *nes)
+{
+    return nes->cartridge.s_prg_rom_16 * 0x4000 +
+           nes->cartridge.s_chr_rom_8 * 0x2000;
+}
+
+/*
+ * Rebuilds everything that picks between the logging and plain variants
+ */
+static void
+cdl_select(struct nes *nes)
+{
+    rp2a03_remap(nes->core);
+    ppu_select_clock(nes->ppu);
+}
+
+int
+cdl_open(struct nes *nes, const char *path)
+{
+    size_t size = cdl_size(nes);
+    u8    *log  = calloc(1, size);
+    FILE  *file = fopen(path, "rb");
+
+    if (file)
+    {
+        fseek(file, 0, SEEK_END);
+        long have = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        if (have != (long)size || fread(log, size, 1, file) != 1)
+        {
+            fclose(file);
+            free(log);
+            return 0;
+        }
+        fclose(file);
+    }
+
+    nes->cdl      = log;
+    nes->cdl_path = path;
+    cdl_select(nes);
+    return 1;
+}
+
+int
+cdl_save(struct nes *nes)
+{
+    FILE *file = fopen(nes->cdl_path, "wb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    size_t ok = fwrite(nes->cdl, cdl_size(nes), 1, file);
+    return (fclose(file) == 0) & (ok == 1);
+}
+
+void
+cdl_close(struct nes *nes)
+{
+    size_t sprg = nes->cartridge.s_prg_rom_16 * 0x4000;
+    size_t code = 0, data = 0;
+
+    for (size_t i = 0; i < sprg; i++)
+    {
+        code += (nes->cdl[i] & CDL_CODE) != 0;
+        data += (nes->cdl[i] & CDL_DATA) != 0;
+    }
+
+    if (cdl_save(nes))
+    {
+        fprintf(stderr, "CDL written to %s: %zu code, %zu data of %zu bytes\n",
+                nes->cdl_path, code, data, sprg);
+    }
+    else
+    {
+        fprintf(stderr, "Can't write CDL to %s\n", nes->cdl_path);
+    }
+
+    free(nes->cdl);
+    nes->cdl = NULL;
+    cdl_select(nes);
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_CDL_H_
+#define NES_CDL_H_
+
+/*! @file cdl.h
+ * Code/data logger
+ *
+ * Keeps one byte of flags for every PRG-ROM and CHR-ROM byte, in the layout
+ * of FCEUX .cdl files: all of PRG-ROM, then all of CHR-ROM. PRG bytes are
+ * marked when run as an opcode or operand or read as data, along with the CPU
+ * bank they were mapped at. CHR bytes are marked when fetched for rendering
+ * or read through $2007.
+ *
+ * Nothing is logged, and nothing is tested for, while nes->cdl is NULL:
+ * rp2a03_run() and ppu_select_clock() switch to logging copies of the
+ * interpreter dispatch table and the PPU clock only while it is set.
+ */
+
+#include <stddef.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#define CDL_CODE     0x01 //!< PRG: run as an opcode or operand
+#define CDL_DATA     0x02 //!< PRG: read as data
+#define CDL_RENDERED 0x01 //!< CHR: fetched by the PPU for rendering
+#define CDL_READ     0x02 //!< CHR: read by the CPU through $2007
+
+//! PRG: mapped at $8000, $A000, $C000 or $E000 (0-3) when accessed
+#define CDL_BANK(_a) ((((_a) >> 13) & 0x03) << 2)
+
+/*!
+ * Starts logging into path. An existing log of the right size is loaded and
+ * added to, like FCEUX does. Must be called after the ROM is loaded
+ *
+ * @returns 1 on success, 0 if path exists but isn't a log for this ROM
+ */
+int
+cdl_open(struct nes *nes, const char *path);
+
+/*!
+ * Writes the log to the file it was opened from
+ *
+ * @returns 1 on success
+ */
+int
+cdl_save(struct nes *nes);
+
+/*!
+ * Saves the log and stops logging
+ */
+void
+cdl_close(struct nes *nes);
+
+/*!
+ * Marks the CHR byte at p, if p points into CHR-ROM
+ */
+static inline void
+cdl_chr(struct nes *nes, const u8 *p, u8 flag)
+{
+    const u8 *chr  = nes->cartridge.chr;
+    size_t    schr = nes->cartridge.s_chr_rom_8 * 0x2000;
+    u8       *log  = nes->cdl + nes->cartridge.s_prg_rom_16 * 0x4000;
+
+    if (p >= chr && p < chr + schr && !(log[p - chr] & flag))
+    {
+        log[p - chr] |= flag;
+    }
+}
+
+#endif // NES_CDL_H_
@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cheat.h"
+#include "rp2a03.h"
+#include "util.h"
+
+#define CHEAT_PAGE(_a) ((_a) >> 11) //!< 2KB page, as in rp2a03_remap()
+
+struct cheats *
+cheat_create(struct nes *nes)
+{
+    if (nes->mode_libcpu)
+    {
+        return NULL;
+    }
+
+    struct cheats *chs = calloc(1, sizeof(struct cheats));
+
+    pthread_mutex_init(&chs->lock, NULL);
+
+    nes->cheats = chs;
+    return chs;
+}
+
+/*
+ * Frees every patched copy. Whatever points into them has to go as well
+ */
+static void
+cheat_drop(struct cheats *chs)
+{
+    for (u32 i = 0; i < chs->ncopies; i++)
+    {
+        free(chs->copies[i]);
+    }
+
+    free(chs->copies);
+    chs->copies  = NULL;
+    chs->ncopies = 0;
+}
+
+void
+cheat_free(struct nes *nes)
+{
+    struct cheats *chs = nes->cheats;
+
+    cheat_drop(chs);
+    pthread_mutex_destroy(&chs->lock);
+    free(chs);
+    nes->cheats = NULL;
+}
+
+/*
+ * Letter value, in the order the Game Genie has them
+ */
+static int
+cheat_letter(char c)
+{
+    const char *at = strchr("APZLGITYEOXUKSVN", toupper((unsigned char)c));
+
+    return c && at ? at - "APZLGITYEOXUKSVN" : -1;
+}
+
+static int
+cheat_genie(const char *code, struct cheat *ch)
+{
+    size_t len = strlen(code);
+    int    n[8];
+
+    if (len != 6 && len != 8)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if ((n[i] = cheat_letter(code[i])) < 0)
+        {
+            return 0;
+        }
+    }
+
+    ch->addr = 0x8000 | ((n[3] & 7) << 12) | ((n[5] & 7) << 8)
+             | ((n[4] & 8) << 8) | ((n[2] & 7) << 4) | ((n[1] & 8) << 4)
+             | (n[4] & 7) | (n[3] & 8);
+    ch->value       = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7);
+    ch->has_compare = len == 8;
+
+    // the 8th letter takes the place of the 6th for the value's top bit
+    if (len == 6)
+    {
+        ch->value |= n[5] & 8;
+    }
+    else
+    {
+        ch->value |= n[7] & 8;
+        ch->compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7)
+                    | (n[5] & 8);
+    }
+
+    return 1;
+}
+
+/*
+ * AAAA:VV or AAAA?CC:VV
+ */
+static int
+cheat_raw(const char *code, struct cheat *ch)
+{
+    unsigned addr, value, compare;
+    int      end = 0;
+
+    if (sscanf(code, "%4x?%2x:%2x%n", &addr, &compare, &value, &end) == 3
+        && code[end] == '\0')
+    {
+        ch->compare     = compare;
+        ch->has_compare = 1;
+    }
+    else if (sscanf(code, "%4x:%2x%n", &addr, &value, &end) == 2
+             && code[end] == '\0')
+    {
+        ch->has_compare = 0;
+    }
+    else
+    {
+        return 0;
+    }
+
+    // below $8000 is RAM or the mapper's, not ROM
+    if (addr < 0x8000)
+    {
+        return 0;
+    }
+
+    ch->addr  = addr;
+    ch->value = value;
+    return 1;
+}
+
+int
+cheat_parse(const char *code, struct cheat *ch)
+{
+    memset(ch, 0, sizeof(struct cheat));
+    if (strlen(code) >= sizeof(ch->code))
+    {
+        return 0;
+    }
+
+    if (!cheat_genie(code, ch) && !cheat_raw(code, ch))
+    {
+        return 0;
+    }
+
+    strcpy(ch->code, code);
+    return 1;
+}
+
+int
+cheat_add(struct cheats *chs, const char *code)
+{
+    struct cheat ch;
+
+    if (!cheat_parse(code, &ch))
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&chs->lock);
+    if (chs->npending == CHEAT_MAX)
+    {
+        pthread_mutex_unlock(&chs->lock);
+        return 0;
+    }
+
+    chs->pending[chs->npending++] = ch;
+    __atomic_store_n(&chs->dirty, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&chs->lock);
+    return 1;
+}
+
+int
+cheat_remove(struct cheats *chs, u32 n)
+{
+    pthread_mutex_lock(&chs->lock);
+    if (n >= chs->npending)
+    {
+        pthread_mutex_unlock(&chs->lock);
+        return 0;
+    }
+
+    memmove(&chs->pending[n], &chs->pending[n + 1],
+            (chs->npending - n - 1) * sizeof(struct cheat));
+    chs->npending -= 1;
+    __atomic_store_n(&chs->dirty, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&chs->lock);
+    return 1;
+}
+
+void
+cheat_print(struct cheats *chs)
+{
+    pthread_mutex_lock(&chs->lock);
+    if (chs->npending == 0)
+    {
+        printf("No cheats\n");
+    }
+
+    for (u32 i = 0; i < chs->npending; i++)
+    {
+        const struct cheat *ch = &chs->pending[i];
+
+        printf("%2u %-10s $%04X = %02X", i, ch->code, ch->addr, ch->value);
+        if (ch->has_compare) printf(" if %02X", ch->compare);
+        printf("\n");
+    }
+    pthread_mutex_unlock(&chs->lock);
+}
+
+void
+cheat_apply(struct cheats *chs, struct nes *nes)
+{
+    struct rp2a03 *c = nes->core;
+
+    pthread_mutex_lock(&chs->lock);
+    memcpy(chs->list, chs->pending, sizeof(chs->list));
+    chs->count = chs->npending;
+    __atomic_store_n(&chs->dirty, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&chs->lock);
+
+    chs->pages = 0;
+    for (u32 i = 0; i < chs->count; i++)
+    {
+        chs->pages |= 1u << CHEAT_PAGE(chs->list[i].addr);
+    }
+
+    // blocks are keyed by where they were decoded from, and a new copy may
+    // land where an old one was
+    cheat_drop(chs);
+    rp2a03_invalidate_all(c);
+}
+
+u8 *
+cheat_page(struct cheats *chs, u8 page, u8 *src)
+{
+    if (!src)
+    {
+        return NULL;
+    }
+
+    for (u32 i = 0; i < chs->ncopies; i++)
+    {
+        if (chs->copies[i]->src == src && chs->copies[i]->page == page)
+        {
+            return chs->copies[i]->bytes;
+        }
+    }
+
+    struct cheat_copy *cp = malloc(sizeof(struct cheat_copy));
+
+    cp->src  = src;
+    cp->page = page;
+    memcpy(cp->bytes, src, sizeof(cp->bytes));
+
+    // compare values are against the bank, so two cheats on one address can
+    // each patch a different bank
+    for (u32 i = 0; i < chs->count; i++)
+    {
+        const struct cheat *ch  = &chs->list[i];
+        u16                 off = ch->addr & 0x07FF;
+
+        if (CHEAT_PAGE(ch->addr) != page)
+        {
+            continue;
+        }
+        if (!ch->has_compare || src[off] == ch->compare)
+        {
+            cp->bytes[off] = ch->value;
+        }
+    }
+
+    chs->copies = realloc(chs->copies,
+                          (chs->ncopies + 1) * sizeof(struct cheat_copy *));
+    chs->copies[chs->ncopies++] = cp;
+    return cp->bytes;
+}
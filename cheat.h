@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_CHEAT_H_
+#define NES_CHEAT_H_
+
+/*! @file cheat.h
+ * Game Genie and raw cheats
+ *
+ * A cheat replaces the byte CPU reads see at one address in $8000-$FFFF,
+ * optionally only while the bank mapped there holds a given byte (a compare
+ * value). Codes come from -G, once per code, or from the debugger console,
+ * either as 6 or 8 letter Game Genie codes or raw, in hex: AAAA:VV, or
+ * AAAA?CC:VV with a compare value.
+ *
+ * Nothing checks for cheats when memory is read. rp2a03_remap() points the
+ * page table entry of every 2KB page with a cheat in it at a patched copy of
+ * the ROM that is mapped there instead of at the ROM itself, so reads of
+ * those pages cost what any other read does. As compare values only depend
+ * on the ROM, they are checked once when the copy is made. Copies are kept
+ * for every bank that has been mapped under a cheat, and a bank switch picks
+ * the one for the new bank. OAM DMA reads ROM through the mapper and sees
+ * no cheats.
+ *
+ * The console only edits a pending list. The game loop copies it into the
+ * one the page tables are built from between two CPU slices, then drops the
+ * copies and every cached block, as copies may come back at the same
+ * address with other bytes in them. Needs the in-tree core (not -l).
+ */
+
+#include <pthread.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#define CHEAT_MAX 64
+
+struct cheat
+{
+    u16  addr;
+    u8   value;
+    u8   compare;
+    u8   has_compare;
+    char code[16]; //!< As entered
+};
+
+/*
+ * Patched copy of the 2KB ROM page src, for CPU page page
+ */
+struct cheat_copy
+{
+    const u8 *src;
+    u8        page;
+    u8        bytes[0x800];
+};
+
+/*!
+ * @struct cheats
+ * Cheats in effect, the copies made for them, and the console's edits
+ */
+struct cheats
+{
+    struct cheat list[CHEAT_MAX]; //!< Game loop only
+    u32          count;
+    u32          pages; //!< Bit per CPU page with a cheat in it
+
+    struct cheat_copy **copies; //!< Game loop only
+    u32                 ncopies;
+
+    struct cheat    pending[CHEAT_MAX]; //!< Under lock
+    u32             npending;
+    u8              dirty; //!< pending changed since the game loop took it
+    pthread_mutex_t lock;
+};
+
+/*!
+ * Sets up an empty list and stores it in nes->cheats
+ *
+ * @returns NULL with -l
+ */
+struct cheats *
+cheat_create(struct nes *nes);
+
+void
+cheat_free(struct nes *nes);
+
+/*!
+ * Decodes a Game Genie or raw code
+ *
+ * @returns 0 if code is neither
+ */
+int
+cheat_parse(const char *code, struct cheat *ch);
+
+/*!
+ * Adds code to the pending list. Safe from any thread
+ *
+ * @returns 0 if code can't be parsed or the list is full
+ */
+int
+cheat_add(struct cheats *chs, const char *code);
+
+/*!
+ * Removes pending cheat n. Safe from any thread
+ *
+ * @returns 0 if there is no such cheat
+ */
+int
+cheat_remove(struct cheats *chs, u32 n);
+
+/*!
+ * Prints the pending list to stdout. Safe from any thread
+ */
+void
+cheat_print(struct cheats *chs);
+
+/*
+ * Takes the pending list, see cheat_update()
+ */
+void
+cheat_apply(struct cheats *chs, struct nes *nes);
+
+/*!
+ * Called by the game loop between two CPU slices. Puts edits to the list in
+ * effect
+ */
+static inline void
+cheat_update(struct cheats *chs, struct nes *nes)
+{
+    if (__atomic_load_n(&chs->dirty, __ATOMIC_ACQUIRE))
+    {
+        cheat_apply(chs, nes);
+    }
+}
+
+/*!
+ * What rp2a03_remap() maps CPU page page to, when it has a cheat in it and
+ * src is mapped there
+ */
+u8 *
+cheat_page(struct cheats *chs, u8 page, u8 *src);
+
+#endif // NES_CHEAT_H_
@@ -0,0 +1,220 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "clone.h"
+#include "ppu.h"
+#include "rp2a03.h"
+
+#define CLONE_PAGE 4096
+
+void *
+clone_alloc(size_t size)
+{
+    size_t pages = (size + CLONE_PAGE - 1) / CLONE_PAGE;
+
+    return aligned_alloc(CLONE_PAGE, (pages ? pages : 1) * CLONE_PAGE);
+}
+
+static void
+clone_region(struct clone_mark *m, u8 *live, u8 *saved, size_t size)
+{
+    int r = m->nregions++;
+
+    m->regions[r].live  = live;
+    m->regions[r].saved = saved;
+    m->regions[r].size  = size;
+    m->regions[r].first = r ? m->regions[r - 1].first +
+                                m->regions[r - 1].size / CLONE_COW
+                            : 0;
+}
+
+int
+clone_mark(struct nes *nes, struct clone_mark *m)
+{
+    if (nes->mode_libcpu || nes->mode_pipeline || nes->rewind ||
+        nes->runahead || nes->movie || nes->netplay)
+    {
+        return 0;
+    }
+
+    state_save_regs(nes, &m->s);
+
+    m->copied   = 0;
+    m->nregions = 0;
+    clone_region(m, nes->ppu->vram, m->s.ppu.vram, sizeof(m->s.ppu.vram));
+    clone_region(m, nes->cpu->mem + 0x4000, m->s.mem, sizeof(m->s.mem));
+    clone_region(m, nes->cartridge.prg_ram, m->s.prg_ram,
+                 sizeof(m->s.prg_ram));
+    if (nes->cartridge.s_chr_rom_8 == 0)
+    {
+        clone_region(m, nes->cartridge.chr, m->s.chr_ram,
+                     sizeof(m->s.chr_ram));
+    }
+
+    // PRG-RAM leaves wrmap until it has been copied
+    nes->mark = m;
+    rp2a03_remap(nes->core);
+    return 1;
+}
+
+void
+clone_back(struct nes *nes)
+{
+    struct clone_mark *m = nes->mark;
+
+    for (int r = 0; r < m->nregions; r++)
+    {
+        for (size_t off = 0; off < m->regions[r].size; off += CLONE_COW)
+        {
+            if (m->copied >> (m->regions[r].first + off / CLONE_COW) & 1)
+            {
+                memcpy(m->regions[r].live + off, m->regions[r].saved + off,
+                       CLONE_COW);
+            }
+        }
+    }
+
+    // copied pages keep what they were copied for, only the next clone_back()
+    // writes them again
+    state_load_regs(nes, &m->s);
+}
+
+void
+clone_drop(struct nes *nes)
+{
+    nes->mark = NULL;
+    rp2a03_remap(nes->core);
+}
+
+int
+clone_pending(const struct clone_mark *m, const u8 *p, size_t len)
+{
+    for (int r = 0; r < m->nregions; r++)
+    {
+        size_t off = (uintptr_t)p - (uintptr_t)m->regions[r].live;
+
+        if (off < m->regions[r].size)
+        {
+            int first = m->regions[r].first + off / CLONE_COW;
+            int last  = m->regions[r].first + (off + len - 1) / CLONE_COW;
+
+            for (int i = first; i <= last; i++)
+            {
+                if (!(m->copied >> i & 1)) return 1;
+            }
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+void
+clone_touch(struct clone_mark *m, const u8 *p)
+{
+    for (int r = 0; r < m->nregions; r++)
+    {
+        size_t off = (uintptr_t)p - (uintptr_t)m->regions[r].live;
+
+        if (off < m->regions[r].size)
+        {
+            u64 bit = 1ULL << (m->regions[r].first + off / CLONE_COW);
+
+            if (!(m->copied & bit))
+            {
+                off &= ~(size_t)(CLONE_COW - 1);
+                memcpy(m->regions[r].saved + off, m->regions[r].live + off,
+                       CLONE_COW);
+                m->copied |= bit;
+            }
+            return;
+        }
+    }
+}
+
+int
+clone_fork(struct nes *nes, struct clone *cl)
+{
+    int fds[2];
+
+    if (nes->mode_pipeline || nes->rewind || nes->movie || nes->netplay ||
+        nes->core->trace)
+    {
+        return -1;
+    }
+
+    // whatever is buffered would be written twice otherwise
+    fflush(NULL);
+
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+
+    cl->pid = fork();
+    if (cl->pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (cl->pid == 0)
+    {
+        close(fds[0]);
+        cl->fd = fds[1];
+        return 0;
+    }
+
+    close(fds[1]);
+    cl->fd = fds[0];
+    return 1;
+}
+
+void
+clone_exit(struct clone *cl, const void *res, size_t len)
+{
+    const u8 *p = res;
+
+    while (len)
+    {
+        ssize_t n = write(cl->fd, p, len);
+        if (n <= 0)
+        {
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+
+    // no atexit handlers or stdio flushes, those belong to the parent
+    _exit(len != 0);
+}
+
+int
+clone_wait(struct clone *cl, void *res, size_t len)
+{
+    u8    *p   = res;
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t n = read(cl->fd, p + got, len - got);
+        if (n <= 0)
+        {
+            break;
+        }
+        got += n;
+    }
+
+    close(cl->fd);
+    waitpid(cl->pid, NULL, 0);
+
+    return got == len;
+}
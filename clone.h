@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_CLONE_H_
+#define NES_CLONE_H_
+
+/*! @file clone.h
+ * Copy-on-write clones
+ *
+ * A mark (clone_mark()) is a branch point within the process: the machine
+ * runs on, and clone_back() returns it to the mark as often as needed. Only
+ * the registers and the 2KB of internal RAM, which nearly every frame
+ * writes, are copied when the mark is set. VRAM, $4000-$7FFF, PRG-RAM and
+ * CHR-RAM are copied CLONE_COW bytes at a time, on the first write to each
+ * page after the mark, and going back copies only those pages. The core
+ * leaves pages still to be copied out of wrmap (see rp2a03_remap()), so its
+ * writes to them take the slow path, and the PPU and the I/O latches check
+ * nes->mark themselves. Setting a mark and going back each cost well under a
+ * save or a load (see state.h), which copy all 50KB every time.
+ *
+ * clone_fork() instead branches a running machine by forking the process.
+ * The clone gets the whole instance as it is, and the kernel shares every
+ * page between the two until one of them writes it. That costs the fork
+ * itself, tens of microseconds however little memory is in use, and one page
+ * copy for each page written afterwards, so it only pays off when the clone
+ * goes on in parallel on another core, with its own JIT and block cache
+ * already warm. ROM is never copied, as nothing writes it, and clone_alloc()
+ * keeps it off pages shared with anything that is written.
+ *
+ * A clone is a process with one thread, the one that called clone_fork(), so
+ * the machine has to be run by that thread alone: no PPU pipeline, rewind or
+ * window. Open files would be shared, so there can be no trace, movie or
+ * netplay either. The clone reports back through a pipe with clone_exit(),
+ * and the parent collects that with clone_wait(). Marks need the in-tree
+ * core and exclude the PPU pipeline, rewind, run-ahead, movies and netplay,
+ * all of which load states behind its back.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#include "state.h"
+
+#define CLONE_COW         0x400 //!< Bytes a mark copies at a time
+#define CLONE_COW_REGIONS 4
+
+/*!
+ * @struct clone_mark
+ * A branch point. The pages of each region that were copied so far are in
+ * the matching arrays of s
+ */
+struct clone_mark
+{
+    struct state s;      //!< Registers and RAM as of the mark, copied pages
+    u64          copied; //!< One bit per CLONE_COW page, in region order
+
+    struct
+    {
+        u8    *live;  //!< The machine's memory
+        u8    *saved; //!< Its copy in s
+        size_t size;
+        int    first; //!< Bit of its first page in copied
+    } regions[CLONE_COW_REGIONS];
+    int nregions;
+};
+
+/*!
+ * @struct clone
+ * One side of a clone
+ */
+struct clone
+{
+    pid_t pid; //!< Clone, in the parent
+    int   fd;  //!< Read end in the parent, write end in the clone
+};
+
+/*!
+ * Allocates size bytes on pages of their own, for data nothing writes
+ */
+void *
+clone_alloc(size_t size);
+
+/*!
+ * Forks the machine
+ *
+ * @returns 1 in the parent, 0 in the clone, -1 if nes can't be cloned (see
+ *          above) or fork() failed
+ */
+int
+clone_fork(struct nes *nes, struct clone *cl);
+
+/*!
+ * Sets a mark at the current state of nes, replacing any other one. Has to be
+ * called between two rp2a03_run() calls, m has to stay around until
+ * clone_drop()
+ *
+ * @returns 0 if nes can't be marked, see above
+ */
+int
+clone_mark(struct nes *nes, struct clone_mark *m);
+
+/*!
+ * Returns nes to its mark, which stays set. Has to be called between two
+ * rp2a03_run() calls
+ */
+void
+clone_back(struct nes *nes);
+
+/*!
+ * Forgets the mark, the machine stays as it is
+ */
+void
+clone_drop(struct nes *nes);
+
+/*!
+ * Whether a write to any of the len bytes at p would copy a page first
+ */
+int
+clone_pending(const struct clone_mark *m, const u8 *p, size_t len);
+
+/*!
+ * Copies the page holding p into the mark unless that happened already. Has
+ * to come before every write to memory a mark tracks, does nothing for other
+ * memory
+ */
+void
+clone_touch(struct clone_mark *m, const u8 *p);
+
+/*!
+ * Sends len bytes of result to the parent and ends the clone
+ */
+void
+clone_exit(struct clone *cl, const void *res, size_t len)
+  __attribute__((noreturn));
+
+/*!
+ * Waits for a clone to end and reads its result into res
+ *
+ * @returns 0 if the clone ended without sending len bytes
+ */
+int
+clone_wait(struct clone *cl, void *res, size_t len);
+
+#endif // NES_CLONE_H_
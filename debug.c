@@ -1,10 +1,226 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <nes.h>
 #include "debug.h"
+#include "ppu.h"
+#include "ramsearch.h"
+#include "cheat.h"
+#include "rp2a03.h"
+#include "util.h"
+
+/*
+ * Rebuilds the page flags from the point table. Called with the lock held
+ */
+static void
+debug_rebuild(struct debug *dbg)
+{
+    u8 pages[RP2A03_PAGES] = {0};
+    u8 ppu = 0, oam = 0;
+
+    for (int i = 0; i < DEBUG_POINTS; i++)
+    {
+        const struct debug_point *p = &dbg->points[i];
+
+        if (!p->used)
+        {
+            continue;
+        }
+
+        switch (p->space)
+        {
+            case DEBUG_CPU:
+                for (int pg = p->lo >> 11; pg <= p->hi >> 11; pg++)
+                {
+                    pages[pg] |= p->flags;
+                }
+                break;
+            case DEBUG_PPU:
+                ppu |= p->flags;
+                break;
+            case DEBUG_OAM:
+                oam |= p->flags;
+                break;
+        }
+    }
+
+    // a point on RAM or a PPU register is hit through all of its mirrors
+    for (int pg = 1; pg < 4; pg++)
+    {
+        pages[0] |= pages[pg];
+        pages[4] |= pages[4 + pg];
+    }
+    for (int pg = 1; pg < 4; pg++)
+    {
+        pages[pg]     = pages[0];
+        pages[4 + pg] = pages[4];
+    }
+
+    memcpy(dbg->pages, pages, sizeof(pages));
+    dbg->ppu = ppu;
+    dbg->oam = oam;
+    __atomic_store_n(&dbg->dirty, 1, __ATOMIC_RELEASE);
+}
+
+struct debug *
+debug_create(struct nes *nes)
+{
+    struct debug *dbg = calloc(1, sizeof(struct debug));
+
+    dbg->nes = nes;
+    pthread_mutex_init(&dbg->lock, NULL);
+    pthread_cond_init(&dbg->wake, NULL);
+
+    nes->debug = dbg;
+    return dbg;
+}
+
+void
+debug_detach(struct debug *dbg)
+{
+    pthread_mutex_lock(&dbg->lock);
+    for (int i = 0; i < DEBUG_POINTS; i++)
+    {
+        dbg->points[i].used = 0;
+    }
+    debug_rebuild(dbg);
+
+    dbg->step    = 0;
+    dbg->stopped = 0;
+    dbg->on_stop = NULL;
+    pthread_cond_broadcast(&dbg->wake);
+    pthread_mutex_unlock(&dbg->lock);
+}
+
+void
+debug_free(struct debug *dbg)
+{
+    dbg->nes->debug = NULL;
+    pthread_mutex_destroy(&dbg->lock);
+    pthread_cond_destroy(&dbg->wake);
+    free(dbg);
+}
 
 int
-nes_debug_loop(void *in)
+debug_add(struct debug *dbg, u8 space, u8 flags, u16 lo, u16 hi)
 {
-    return 0;
+    int id = -1;
+
+    pthread_mutex_lock(&dbg->lock);
+    for (int i = 0; i < DEBUG_POINTS; i++)
+    {
+        struct debug_point *p = &dbg->points[i];
+
+        if (!p->used)
+        {
+            p->lo    = MIN(lo, hi);
+            p->hi    = MAX(lo, hi);
+            p->space = space;
+            p->flags = flags;
+            __atomic_store_n(&p->used, 1, __ATOMIC_RELEASE);
+
+            debug_rebuild(dbg);
+            id = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dbg->lock);
+
+    return id;
+}
+
+int
+debug_remove(struct debug *dbg, int id)
+{
+    if (id < 0 || id >= DEBUG_POINTS)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&dbg->lock);
+    int used = dbg->points[id].used;
+
+    __atomic_store_n(&dbg->points[id].used, 0, __ATOMIC_RELEASE);
+    debug_rebuild(dbg);
+    pthread_mutex_unlock(&dbg->lock);
+
+    return used;
+}
+
+int
+debug_find(struct debug *dbg, u8 space, u8 kind, u16 lo, u16 hi)
+{
+    for (int i = 0; i < DEBUG_POINTS; i++)
+    {
+        const struct debug_point *p = &dbg->points[i];
+
+        if (__atomic_load_n(&p->used, __ATOMIC_ACQUIRE) && p->space == space &&
+            (p->flags & kind) && p->lo <= hi && lo <= p->hi)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void
+debug_break(struct debug *dbg)
+{
+    __atomic_store_n(&dbg->step, 1, __ATOMIC_RELEASE);
+}
+
+void
+debug_continue(struct debug *dbg, int step)
+{
+    pthread_mutex_lock(&dbg->lock);
+    if (dbg->stopped)
+    {
+        dbg->step    = step;
+        dbg->stopped = 0;
+        pthread_cond_broadcast(&dbg->wake);
+    }
+    pthread_mutex_unlock(&dbg->lock);
+}
+
+void
+debug_wait(struct debug *dbg, const struct debug_stop *stop)
+{
+    pthread_mutex_lock(&dbg->lock);
+    dbg->stop    = *stop;
+    dbg->step    = 0;
+    dbg->stopped = 1;
+    pthread_mutex_unlock(&dbg->lock);
+
+    if (dbg->on_stop)
+    {
+        dbg->on_stop(dbg, dbg->arg);
+    }
+
+    pthread_mutex_lock(&dbg->lock);
+    while (dbg->stopped)
+    {
+        pthread_cond_wait(&dbg->wake, &dbg->lock);
+    }
+    pthread_mutex_unlock(&dbg->lock);
+}
+
+/*
+ * Console
+ */
+
+static const char *const debug_spaces[] = {"cpu", "ppu", "oam"};
+
+static void
+debug_print_regs(struct nes *nes)
+{
+    struct rp2a03 *c = nes->core;
+
+    printf("PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n", c->PC,
+           c->A, c->X, c->Y, c->P, c->SP, (unsigned long long)c->cycles);
 }
 
 void
@@ -12,7 +228,328 @@ debug_print_oam(struct nes *nes)
 {
     struct ppu *ppu = nes->ppu;
 
-    for (int i = 0; i < 8; i++)
+    for (int i = 0; i < 64; i++)
+    {
+        const u8 *s = &ppu->oam[i * 4];
+
+        printf("%02d: Y:%02X T:%02X A:%02X X:%02X%s", i, s[0], s[1], s[2], s[3],
+               (i & 3) == 3 ? "\n" : "  ");
+    }
+}
+
+/*
+ * Prints CPU memory, without touching I/O: pages that aren't RAM or
+ * cartridge memory show up as --
+ */
+static void
+debug_print_mem(struct nes *nes, u16 addr, int n)
+{
+    struct rp2a03 *c = nes->core;
+
+    for (int i = 0; i < n; i++, addr++)
+    {
+        const u8 *p = c->rdmem[addr >> 11];
+
+        if (i % 16 == 0) printf("%04X:", addr);
+        if (p)
+            printf(" %02X", p[addr & 0x07FF]);
+        else
+            printf(" --");
+        if (i % 16 == 15 || i == n - 1) printf("\n");
+    }
+}
+
+static void
+debug_console_stop(struct debug *dbg, void *arg)
+{
+    const struct debug_stop *s = &dbg->stop;
+
+    if (s->id < 0)
     {
+        printf("Stopped\n");
     }
+    else
+    {
+        printf("Stopped by point %d: %s %s $%04X\n", s->id,
+               debug_spaces[s->space],
+               s->kind & DEBUG_EXEC    ? "exec"
+               : s->kind & DEBUG_WRITE ? "write"
+                                       : "read",
+               s->addr);
+    }
+
+    debug_print_regs(dbg->nes);
+    fflush(stdout);
+}
+
+/*
+ * Parses "[cpu|ppu|oam] lo[-hi]"
+ */
+static int
+debug_parse_range(const char *s, u8 *space, u16 *lo, u16 *hi)
+{
+    unsigned a, b;
+
+    while (*s == ' ')
+    {
+        s++;
+    }
+
+    // none of the names are valid hex, so they can't be mistaken for one
+    *space = DEBUG_CPU;
+    for (int i = 0; i < 3; i++)
+    {
+        if (strncmp(s, debug_spaces[i], 3) == 0 && s[3] == ' ')
+        {
+            *space = i;
+            s += 3;
+        }
+    }
+
+    switch (sscanf(s, " %x - %x", &a, &b))
+    {
+        case 1:
+            b = a;
+            // fall through
+        case 2:
+            *lo = a;
+            *hi = b;
+            return a <= 0xFFFF && b <= 0xFFFF;
+    }
+
+    return 0;
+}
+
+static void
+debug_help(void)
+{
+    printf("b addr[-addr]               break on execution\n"
+           "r [cpu|ppu|oam] addr[-addr] watch reads\n"
+           "w [cpu|ppu|oam] addr[-addr] watch writes\n"
+           "a [cpu|ppu|oam] addr[-addr] watch reads and writes\n"
+           "d id                        delete a point\n"
+           "l                           list points\n"
+           "p                           pause\n"
+           "c                           continue\n"
+           "s                           step one instruction\n"
+           "x                           registers\n"
+           "m addr [count]              CPU memory\n"
+           "o                           OAM\n"
+           "fn                          new RAM search\n"
+           "f+ f- f! f. [frames]        keep bytes that increased, decreased,\n"
+           "                            changed, stayed (in each frame)\n"
+           "f= f< f> value [frames]     keep bytes equal to, below, above\n"
+           "fl                          list what's left\n"
+           "fh addr [count]             addr over the last frames\n"
+           "g code                      add a Game Genie or raw cheat\n"
+           "gd n                        delete a cheat\n"
+           "gl                          list cheats\n");
+}
+
+/*
+ * The f commands, a search over the RAM snapshots of ramsearch.h
+ */
+static void
+debug_search(struct nes *nes, const char *s)
+{
+    struct ramsearch *rs = nes->ramsearch;
+    unsigned          a, n = 0;
+    int               left;
+
+    if (rs == NULL)
+    {
+        printf("RAM search needs the in-tree core, not -l\n");
+        return;
+    }
+
+    switch (s[0])
+    {
+        case 'n':
+            if (ramsearch_start(rs))
+                printf("%u candidates\n", RAMSEARCH_SIZE);
+            else
+                printf("No frame yet\n");
+            return;
+        case 'l':
+            ramsearch_list(rs);
+            return;
+        case 'h':
+            n = 16;
+            if (sscanf(s + 1, "%x %u", &a, &n) < 1 || a > 0xFFFF)
+            {
+                printf("Bad address\n");
+                return;
+            }
+            ramsearch_history(rs, a, n);
+            return;
+        case '=':
+        case '<':
+        case '>':
+            if (sscanf(s + 1, "%x %u", &a, &n) < 1 || a > 0xFF)
+            {
+                printf("Bad value\n");
+                return;
+            }
+            left = ramsearch_filter(rs, s[0], a, n);
+            break;
+        case '+':
+        case '-':
+        case '!':
+        case '.':
+            sscanf(s + 1, "%u", &n);
+            left = ramsearch_filter(rs, s[0], 0, n);
+            break;
+        default:
+            debug_help();
+            return;
+    }
+
+    if (left < 0)
+        printf("No search, fn starts one\n");
+    else
+        printf("%d left\n", left);
+}
+
+/*
+ * The g commands, see cheat.h. Edits are put in effect by the game loop
+ */
+static void
+debug_cheat(struct nes *nes, const char *s)
+{
+    struct cheats *chs = nes->cheats;
+    char           code[32];
+    unsigned       n;
+
+    if (chs == NULL)
+    {
+        printf("Cheats need the in-tree core and no movie (-l, -m, -M)\n");
+        return;
+    }
+
+    if (s[0] == 'l')
+    {
+        cheat_print(chs);
+    }
+    else if (s[0] == 'd')
+    {
+        if (sscanf(s + 1, "%u", &n) != 1 || !cheat_remove(chs, n))
+        {
+            printf("No such cheat\n");
+        }
+    }
+    else if (sscanf(s, " %31s", code) == 1)
+    {
+        if (!cheat_add(chs, code))
+        {
+            printf("Bad code, or too many cheats\n");
+        }
+    }
+    else
+    {
+        debug_help();
+    }
+}
+
+int
+nes_debug_loop(void *in)
+{
+    struct nes   *nes = (struct nes *)in;
+    struct debug *dbg = nes->debug;
+    char          line[128];
+
+    dbg->on_stop = debug_console_stop;
+    debug_help();
+
+    while (fgets(line, sizeof(line), stdin))
+    {
+        u8       space, flags = 0;
+        u16      lo, hi;
+        unsigned a, n;
+        int      id;
+
+        switch (line[0])
+        {
+            case 'b':
+                flags = DEBUG_EXEC;
+                break;
+            case 'r':
+                flags = DEBUG_READ;
+                break;
+            case 'w':
+                flags = DEBUG_WRITE;
+                break;
+            case 'a':
+                flags = DEBUG_READ | DEBUG_WRITE;
+                break;
+            case 'd':
+                if (sscanf(line + 1, "%d", &id) != 1 || !debug_remove(dbg, id))
+                {
+                    printf("No such point\n");
+                }
+                break;
+            case 'l':
+                for (int i = 0; i < DEBUG_POINTS; i++)
+                {
+                    const struct debug_point *p = &dbg->points[i];
+                    if (!p->used) continue;
+                    printf("%d: %s $%04X-$%04X %s%s%s\n", i,
+                           debug_spaces[p->space], p->lo, p->hi,
+                           p->flags & DEBUG_EXEC ? "x" : "",
+                           p->flags & DEBUG_READ ? "r" : "",
+                           p->flags & DEBUG_WRITE ? "w" : "");
+                }
+                break;
+            case 'p':
+                debug_break(dbg);
+                break;
+            case 'c':
+                debug_continue(dbg, 0);
+                break;
+            case 's':
+                debug_continue(dbg, 1);
+                break;
+            case 'x':
+                debug_print_regs(nes);
+                break;
+            case 'm':
+                n = 16;
+                if (sscanf(line + 1, "%x %u", &a, &n) >= 1)
+                {
+                    debug_print_mem(nes, a, MIN(n, 0x10000));
+                }
+                break;
+            case 'o':
+                debug_print_oam(nes);
+                break;
+            case 'f':
+                debug_search(nes, line + 1);
+                break;
+            case 'g':
+                debug_cheat(nes, line + 1);
+                break;
+            default:
+                debug_help();
+                break;
+        }
+
+        if (flags)
+        {
+            if (!debug_parse_range(line + 1, &space, &lo, &hi) ||
+                (space != DEBUG_CPU && (flags & DEBUG_EXEC)))
+            {
+                printf("Bad range\n");
+            }
+            else if ((id = debug_add(dbg, space, flags, lo, hi)) < 0)
+            {
+                printf("Too many points\n");
+            }
+            else
+            {
+                printf("%d\n", id);
+            }
+        }
+        fflush(stdout);
+    }
+
+    return 0;
 }
@@ -1,6 +1,187 @@
+/* SPDX-License-Identifier: MIT */
+
 #ifndef NES_DEBUG_H_
 #define NES_DEBUG_H_
 
+/*! @file debug.h
+ * Breakpoints and watchpoints
+ *
+ * Points are kept in a small fixed table that the emulation thread reads
+ * without locking. Each change also rebuilds a flags byte per 2KB CPU page
+ * (plus one for PPU space and one for OAM), and the table is only searched
+ * for accesses to a flagged page.
+ *
+ * rp2a03_run() picks its hooked dispatch table per block, for blocks in a
+ * page with a breakpoint or while a stop is pending. Other blocks run as
+ * usual, native code included. Watched pages are left out of the core's page
+ * tables instead (see rp2a03_remap()), so only their accesses take the slow
+ * way. Native code reads zero page and absolute RAM operands, the stack and
+ * the pointers of (zp,X) and (zp),Y directly, so while RAM is watched, blocks
+ * that touch any of those are interpreted.
+ *
+ * A breakpoint stops the emulation thread before the instruction runs, a
+ * watchpoint right after the instruction that made the access, so the state
+ * seen by the debugger is always at an exact instruction boundary. Only CPU
+ * data accesses are watched, the stack and the pointers of (zp,X) and (zp),Y
+ * included, but not instruction and vector fetches. PPU and OAM points see
+ * $2007, $2004 and $4014, but not rendering. RAM and PPU register mirrors
+ * match their canonical address ($0000-$07FF, $2000-$2007).
+ */
+
+#include <pthread.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#include "rp2a03.h"
+
+#define DEBUG_EXEC  0x01 //!< Instruction fetch (breakpoint)
+#define DEBUG_READ  0x02
+#define DEBUG_WRITE 0x04
+
+#define DEBUG_CPU 0 //!< CPU address space
+#define DEBUG_PPU 1 //!< PPU address space, through $2007
+#define DEBUG_OAM 2 //!< OAM index, through $2004 and $4014
+
+#define DEBUG_POINTS 64
+
+struct debug_point
+{
+    u16 lo;
+    u16 hi; //!< Last address, inclusive
+    u8  space;
+    u8  flags;
+    u8  used; //!< Set last, cleared first, the table is read unlocked
+};
+
+/*!
+ * Why the emulation stopped
+ */
+struct debug_stop
+{
+    int id;    //!< Point that was hit, or -1 for a step or break request
+    u8  space; //!< Of the access that hit
+    u8  kind;  //!< DEBUG_EXEC, DEBUG_READ or DEBUG_WRITE
+    u16 addr;  //!< Address that hit, canonical for mirrors
+};
+
+struct debug
+{
+    struct debug_point points[DEBUG_POINTS];
+
+    u8 pages[RP2A03_PAGES]; //!< Union of point flags for each CPU page
+    u8 ppu;                 //!< Union of PPU space point flags
+    u8 oam;                 //!< Union of OAM point flags
+    u8 dirty;               //!< Flags changed since rp2a03_remap() read them
+
+    u8 step;    //!< Stop before the next instruction
+    u8 stopped; //!< The emulation thread is waiting in debug_wait()
+
+    struct debug_stop stop;    //!< Valid while stopped
+    struct debug_stop watch;   //!< Hit by the last instruction, if watched
+    u8                watched; //!< Emulation thread only
+
+    /*!
+     * Called on the emulation thread when it stops, before it waits. The
+     * console prints the stop, other front ends can report it
+     */
+    void (*on_stop)(struct debug *dbg, void *arg);
+    void *arg;
+
+    struct nes     *nes;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+};
+
+/*!
+ * Sets up an empty point table for nes and stores it in nes->debug
+ */
+struct debug *
+debug_create(struct nes *nes);
+
+/*!
+ * Releases a stopped emulation thread and clears every point. Called before
+ * the emulation thread is joined
+ */
+void
+debug_detach(struct debug *dbg);
+
+void
+debug_free(struct debug *dbg);
+
+/*!
+ * Adds a point
+ *
+ * @param dbg
+ * @param space DEBUG_CPU, DEBUG_PPU or DEBUG_OAM
+ * @param flags DEBUG_EXEC, DEBUG_READ and/or DEBUG_WRITE
+ * @param lo First address
+ * @param hi Last address
+ *
+ * @returns The point's id, or -1 if the table is full
+ */
+int
+debug_add(struct debug *dbg, u8 space, u8 flags, u16 lo, u16 hi);
+
+/*!
+ * @returns 1 if id was a point
+ */
+int
+debug_remove(struct debug *dbg, int id);
+
+/*!
+ * Finds a point in space with one of the flags in kind that covers any of
+ * lo-hi. Called by the CPU core once the page flags say there may be one
+ *
+ * @returns The point's id, or -1
+ */
+int
+debug_find(struct debug *dbg, u8 space, u8 kind, u16 lo, u16 hi);
+
+/*!
+ * Asks the emulation to stop before its next instruction
+ */
+void
+debug_break(struct debug *dbg);
+
+/*!
+ * Resumes a stopped emulation thread
+ *
+ * @param dbg
+ * @param step Stop again after one instruction
+ */
+void
+debug_continue(struct debug *dbg, int step);
+
+/*!
+ * Emulation thread side of a stop: reports it through on_stop and waits for
+ * debug_continue()
+ */
+void
+debug_wait(struct debug *dbg, const struct debug_stop *stop);
+
+/*!
+ * Folds RAM and PPU register mirrors onto the address points are set on
+ */
+static inline u16
+debug_canon(u16 addr)
+{
+    if (addr < 0x2000) return addr & 0x07FF;
+    if (addr < 0x4000) return 0x2000 | (addr & 0x0007);
+    return addr;
+}
+
+/*!
+ * Prints all 64 OAM entries to stdout
+ */
+void
+debug_print_oam(struct nes *nes);
+
+/*!
+ * Debugger console on stdin, started by -d
+ *
+ * @param in Void pointer to a struct nes
+ */
 int
 nes_debug_loop(void *in);
 
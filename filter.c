@@ -0,0 +1,596 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define FILTER_SSE2 1
+#endif
+
+#define SWAP(_a, _b)                                                           \
+    do                                                                         \
+    {                                                                          \
+        int _t = (_a);                                                         \
+        (_a)   = (_b);                                                         \
+        (_b)   = _t;                                                           \
+    } while (0)
+
+int
+filter_parse(const char *name)
+{
+    if (strcmp(name, "none") == 0) return FILTER_NONE;
+    if (strcmp(name, "nearest") == 0) return FILTER_NEAREST;
+    if (strcmp(name, "scale2x") == 0) return FILTER_SCALE2X;
+    if (strcmp(name, "ntsc") == 0) return FILTER_NTSC;
+    return -1;
+}
+
+int
+filter_scale(enum filter_mode mode, int scale)
+{
+    switch (mode)
+    {
+        case FILTER_NEAREST:
+            if (scale == 0) return 3;
+            return scale >= 1 && scale <= 4 ? scale : 0;
+        case FILTER_SCALE2X:
+        case FILTER_NTSC:
+            return scale == 0 || scale == 2 ? 2 : 0;
+        default:
+            return scale >= 0 && scale <= 8 ? 1 : 0;
+    }
+}
+
+static inline void
+filter_row_argb(struct filter *f, const u16 *in, u32 *out)
+{
+    for (int x = 0; x < NES_WIDTH; x++)
+    {
+        out[x] = f->pal[in[x]];
+    }
+}
+
+/*
+ * Nearest neighbor, any integer scale. 2x (the common case) doubles pixels
+ * 4 at a time where there is SSE2
+ */
+static void
+filter_nearest(struct filter *f, const u16 *src, u32 *dst, int y0, int y1)
+{
+    int s = f->scale;
+    u32 row[NES_WIDTH];
+
+    for (int y = y0; y < y1; y++)
+    {
+        u32 *out = dst + (y * s) * f->out_w;
+
+        filter_row_argb(f, src + y * NES_WIDTH, row);
+
+#ifdef FILTER_SSE2
+        if (s == 2)
+        {
+            for (int x = 0; x < NES_WIDTH; x += 4)
+            {
+                __m128i p = _mm_loadu_si128((const __m128i *)(row + x));
+                _mm_storeu_si128((__m128i *)(out + x * 2),
+                                 _mm_unpacklo_epi32(p, p));
+                _mm_storeu_si128((__m128i *)(out + x * 2 + 4),
+                                 _mm_unpackhi_epi32(p, p));
+            }
+        }
+        else
+#endif
+        {
+            for (int x = 0; x < NES_WIDTH; x++)
+            {
+                for (int i = 0; i < s; i++) out[x * s + i] = row[x];
+            }
+        }
+
+        for (int i = 1; i < s; i++)
+        {
+            memcpy(out + i * f->out_w, out, f->out_w * sizeof(u32));
+        }
+    }
+}
+
+#ifdef FILTER_SSE2
+static inline __m128i
+filter_select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+/*
+ * Scale2x (EPX). For every source pixel E with neighbours
+ *
+ *        B
+ *      D E F
+ *        H
+ *
+ * the four output pixels take the color of an edge that runs through the
+ * corner. Rows are padded by one pixel on each side so that 4 pixels can be
+ * compared at a time (with SSE2) without special cases at the screen edges
+ */
+static void
+filter_scale2x(struct filter *f, const u16 *src, u32 *dst, int y0, int y1)
+{
+    u32 rows[3][NES_WIDTH + 2];
+
+    for (int y = y0; y < y1; y++)
+    {
+        for (int r = 0; r < 3; r++)
+        {
+            int sy = y + r - 1;
+            sy     = sy < 0 ? 0 : sy >= NES_HEIGHT ? NES_HEIGHT - 1 : sy;
+
+            filter_row_argb(f, src + sy * NES_WIDTH, rows[r] + 1);
+            rows[r][0]             = rows[r][1];
+            rows[r][NES_WIDTH + 1] = rows[r][NES_WIDTH];
+        }
+
+        u32 *o0 = dst + (y * 2) * f->out_w;
+        u32 *o1 = o0 + f->out_w;
+
+#ifdef FILTER_SSE2
+        for (int x = 0; x < NES_WIDTH; x += 4)
+        {
+            __m128i B = _mm_loadu_si128((const __m128i *)(rows[0] + x + 1));
+            __m128i D = _mm_loadu_si128((const __m128i *)(rows[1] + x));
+            __m128i E = _mm_loadu_si128((const __m128i *)(rows[1] + x + 1));
+            __m128i F = _mm_loadu_si128((const __m128i *)(rows[1] + x + 2));
+            __m128i H = _mm_loadu_si128((const __m128i *)(rows[2] + x + 1));
+
+            __m128i db = _mm_cmpeq_epi32(D, B);
+            __m128i bf = _mm_cmpeq_epi32(B, F);
+            __m128i dh = _mm_cmpeq_epi32(D, H);
+            __m128i hf = _mm_cmpeq_epi32(H, F);
+
+            // E0 = D == B && B != F && D != H ? D : E, and so on
+            __m128i e0 = filter_select(
+              _mm_andnot_si128(_mm_or_si128(bf, dh), db), D, E);
+            __m128i e1 = filter_select(
+              _mm_andnot_si128(_mm_or_si128(db, hf), bf), F, E);
+            __m128i e2 = filter_select(
+              _mm_andnot_si128(_mm_or_si128(db, hf), dh), D, E);
+            __m128i e3 = filter_select(
+              _mm_andnot_si128(_mm_or_si128(dh, bf), hf), F, E);
+
+            _mm_storeu_si128((__m128i *)(o0 + x * 2),
+                             _mm_unpacklo_epi32(e0, e1));
+            _mm_storeu_si128((__m128i *)(o0 + x * 2 + 4),
+                             _mm_unpackhi_epi32(e0, e1));
+            _mm_storeu_si128((__m128i *)(o1 + x * 2),
+                             _mm_unpacklo_epi32(e2, e3));
+            _mm_storeu_si128((__m128i *)(o1 + x * 2 + 4),
+                             _mm_unpackhi_epi32(e2, e3));
+        }
+#else
+        for (int x = 0; x < NES_WIDTH; x++)
+        {
+            u32 B = rows[0][x + 1], D = rows[1][x], E = rows[1][x + 1];
+            u32 F = rows[1][x + 2], H = rows[2][x + 1];
+
+            o0[x * 2]     = D == B && B != F && D != H ? D : E;
+            o0[x * 2 + 1] = B == F && D != B && H != F ? F : E;
+            o1[x * 2]     = D == H && D != B && H != F ? D : E;
+            o1[x * 2 + 1] = H == F && D != H && B != F ? F : E;
+        }
+#endif
+    }
+}
+
+#ifdef FILTER_SSE2
+
+static inline __m128
+filter_rgb(__m128i p, int shift)
+{
+    __m128i c = _mm_and_si128(_mm_srli_epi32(p, shift), _mm_set1_epi32(0xFF));
+    return _mm_cvtepi32_ps(c);
+}
+
+static inline __m128
+filter_mad(__m128 acc, float k, __m128 v)
+{
+    return _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(k), v));
+}
+
+/*
+ * Packs 4 pixels of clamped channels into ARGB. Truncates like a cast to u32
+ */
+static inline __m128i
+filter_pack(__m128 r, __m128 g, __m128 b)
+{
+    __m128i p = _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(r), 16),
+                             _mm_slli_epi32(_mm_cvttps_epi32(g), 8));
+    p         = _mm_or_si128(p, _mm_cvttps_epi32(b));
+    return _mm_or_si128(p, _mm_set1_epi32(0xFF000000));
+}
+
+/*
+ * 7-tap 1 2 3 4 3 2 1 low-pass of the 4 samples at p
+ */
+static inline __m128
+filter_chroma(const float *p)
+{
+    __m128 s = _mm_add_ps(_mm_loadu_ps(p - 3), _mm_loadu_ps(p + 3));
+    s        = filter_mad(s, 2.0f,
+                          _mm_add_ps(_mm_loadu_ps(p - 2), _mm_loadu_ps(p + 2)));
+    s        = filter_mad(s, 3.0f,
+                          _mm_add_ps(_mm_loadu_ps(p - 1), _mm_loadu_ps(p + 1)));
+    s        = filter_mad(s, 4.0f, _mm_loadu_ps(p));
+    return _mm_mul_ps(s, _mm_set1_ps(0.0625f));
+}
+
+/*
+ * Composite video approximation. Luma gets a light low-pass and chroma a much
+ * wider one, which gives the color bleeding of a composite signal. The output
+ * is doubled horizontally and every second line is darkened. Every pass works
+ * on 4 pixels at a time with SSE2
+ */
+static void
+filter_ntsc(struct filter *f, const u16 *src, u32 *dst, int y0, int y1)
+{
+    u32   row[NES_WIDTH];
+    float Y[NES_WIDTH + 6], I[NES_WIDTH + 6], Q[NES_WIDTH + 6];
+    float r[NES_WIDTH + 1], g[NES_WIDTH + 1], b[NES_WIDTH + 1];
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max  = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 dark = _mm_set1_ps(0.75f);
+
+    for (int y = y0; y < y1; y++)
+    {
+        filter_row_argb(f, src + y * NES_WIDTH, row);
+
+        for (int x = 0; x < NES_WIDTH; x += 4)
+        {
+            __m128i p  = _mm_loadu_si128((const __m128i *)(row + x));
+            __m128  pr = filter_rgb(p, 16);
+            __m128  pg = filter_rgb(p, 8);
+            __m128  pb = filter_rgb(p, 0);
+
+            __m128 vy = _mm_mul_ps(_mm_set1_ps(0.299f), pr);
+            __m128 vi = _mm_mul_ps(_mm_set1_ps(0.596f), pr);
+            __m128 vq = _mm_mul_ps(_mm_set1_ps(0.211f), pr);
+            vy        = filter_mad(filter_mad(vy, 0.587f, pg), 0.114f, pb);
+            vi        = filter_mad(filter_mad(vi, -0.274f, pg), -0.322f, pb);
+            vq        = filter_mad(filter_mad(vq, -0.523f, pg), 0.312f, pb);
+
+            _mm_storeu_ps(Y + x + 3, vy);
+            _mm_storeu_ps(I + x + 3, vi);
+            _mm_storeu_ps(Q + x + 3, vq);
+        }
+        for (int x = 0; x < 3; x++)
+        {
+            Y[x] = Y[3], I[x] = I[3], Q[x] = Q[3];
+            Y[NES_WIDTH + 3 + x] = Y[NES_WIDTH + 2];
+            I[NES_WIDTH + 3 + x] = I[NES_WIDTH + 2];
+            Q[NES_WIDTH + 3 + x] = Q[NES_WIDTH + 2];
+        }
+
+        for (int x = 0; x < NES_WIDTH; x += 4)
+        {
+            const float *py = Y + x + 3;
+
+            __m128 fy = _mm_add_ps(_mm_loadu_ps(py - 1), _mm_loadu_ps(py + 1));
+            fy        = filter_mad(fy, 2.0f, _mm_loadu_ps(py));
+            fy        = _mm_mul_ps(fy, _mm_set1_ps(0.25f));
+
+            __m128 fi = filter_chroma(I + x + 3);
+            __m128 fq = filter_chroma(Q + x + 3);
+
+            __m128 vr = filter_mad(filter_mad(fy, 0.956f, fi), 0.621f, fq);
+            __m128 vg = filter_mad(filter_mad(fy, -0.272f, fi), -0.647f, fq);
+            __m128 vb = filter_mad(filter_mad(fy, -1.106f, fi), 1.703f, fq);
+
+            _mm_storeu_ps(r + x, _mm_min_ps(_mm_max_ps(vr, zero), max));
+            _mm_storeu_ps(g + x, _mm_min_ps(_mm_max_ps(vg, zero), max));
+            _mm_storeu_ps(b + x, _mm_min_ps(_mm_max_ps(vb, zero), max));
+        }
+        r[NES_WIDTH] = r[NES_WIDTH - 1];
+        g[NES_WIDTH] = g[NES_WIDTH - 1];
+        b[NES_WIDTH] = b[NES_WIDTH - 1];
+
+        u32 *o0 = dst + (y * 2) * f->out_w;
+        u32 *o1 = o0 + f->out_w;
+
+        for (int x = 0; x < NES_WIDTH; x += 4)
+        {
+            __m128 vr = _mm_loadu_ps(r + x);
+            __m128 vg = _mm_loadu_ps(g + x);
+            __m128 vb = _mm_loadu_ps(b + x);
+
+            // the in-between pixel is the average of its two neighbours
+            __m128 hr = _mm_add_ps(vr, _mm_loadu_ps(r + x + 1));
+            __m128 hg = _mm_add_ps(vg, _mm_loadu_ps(g + x + 1));
+            __m128 hb = _mm_add_ps(vb, _mm_loadu_ps(b + x + 1));
+            hr        = _mm_mul_ps(hr, half);
+            hg        = _mm_mul_ps(hg, half);
+            hb        = _mm_mul_ps(hb, half);
+
+            __m128i p = filter_pack(vr, vg, vb);
+            __m128i h = filter_pack(hr, hg, hb);
+            __m128i d = filter_pack(_mm_mul_ps(vr, dark), _mm_mul_ps(vg, dark),
+                                    _mm_mul_ps(vb, dark));
+            __m128i e = filter_pack(_mm_mul_ps(hr, dark), _mm_mul_ps(hg, dark),
+                                    _mm_mul_ps(hb, dark));
+
+            _mm_storeu_si128((__m128i *)(o0 + x * 2), _mm_unpacklo_epi32(p, h));
+            _mm_storeu_si128((__m128i *)(o0 + x * 2 + 4),
+                             _mm_unpackhi_epi32(p, h));
+            _mm_storeu_si128((__m128i *)(o1 + x * 2), _mm_unpacklo_epi32(d, e));
+            _mm_storeu_si128((__m128i *)(o1 + x * 2 + 4),
+                             _mm_unpackhi_epi32(d, e));
+        }
+    }
+}
+#else
+static inline float
+filter_clamp(float v)
+{
+    return MIN(MAX(v, 0.0f), 255.0f);
+}
+
+static inline u32
+filter_pack(float r, float g, float b)
+{
+    return 0xFF000000 | ((u32)r << 16) | ((u32)g << 8) | (u32)b;
+}
+
+/*
+ * Same as above one pixel at a time, where there is no SSE2
+ */
+static void
+filter_ntsc(struct filter *f, const u16 *src, u32 *dst, int y0, int y1)
+{
+    u32   row[NES_WIDTH];
+    float Y[NES_WIDTH + 6], I[NES_WIDTH + 6], Q[NES_WIDTH + 6];
+    float r[NES_WIDTH + 1], g[NES_WIDTH + 1], b[NES_WIDTH + 1];
+
+    for (int y = y0; y < y1; y++)
+    {
+        filter_row_argb(f, src + y * NES_WIDTH, row);
+
+        for (int x = 0; x < NES_WIDTH; x++)
+        {
+            float pr = (row[x] >> 16) & 0xFF;
+            float pg = (row[x] >> 8) & 0xFF;
+            float pb = row[x] & 0xFF;
+
+            Y[x + 3] = 0.299f * pr + 0.587f * pg + 0.114f * pb;
+            I[x + 3] = 0.596f * pr - 0.274f * pg - 0.322f * pb;
+            Q[x + 3] = 0.211f * pr - 0.523f * pg + 0.312f * pb;
+        }
+        for (int x = 0; x < 3; x++)
+        {
+            Y[x] = Y[3], I[x] = I[3], Q[x] = Q[3];
+            Y[NES_WIDTH + 3 + x] = Y[NES_WIDTH + 2];
+            I[NES_WIDTH + 3 + x] = I[NES_WIDTH + 2];
+            Q[NES_WIDTH + 3 + x] = Q[NES_WIDTH + 2];
+        }
+
+        for (int x = 0; x < NES_WIDTH; x++)
+        {
+            const float *py = Y + x + 3, *pi = I + x + 3, *pq = Q + x + 3;
+
+            float fy = (py[-1] + 2.0f * py[0] + py[1]) * 0.25f;
+            float fi = (pi[-3] + pi[3] + 2.0f * (pi[-2] + pi[2]) +
+                        3.0f * (pi[-1] + pi[1]) + 4.0f * pi[0]) *
+                       0.0625f;
+            float fq = (pq[-3] + pq[3] + 2.0f * (pq[-2] + pq[2]) +
+                        3.0f * (pq[-1] + pq[1]) + 4.0f * pq[0]) *
+                       0.0625f;
+
+            r[x] = filter_clamp(fy + 0.956f * fi + 0.621f * fq);
+            g[x] = filter_clamp(fy - 0.272f * fi - 0.647f * fq);
+            b[x] = filter_clamp(fy - 1.106f * fi + 1.703f * fq);
+        }
+        r[NES_WIDTH] = r[NES_WIDTH - 1];
+        g[NES_WIDTH] = g[NES_WIDTH - 1];
+        b[NES_WIDTH] = b[NES_WIDTH - 1];
+
+        u32 *o0 = dst + (y * 2) * f->out_w;
+        u32 *o1 = o0 + f->out_w;
+
+        for (int x = 0; x < NES_WIDTH; x++)
+        {
+            // the in-between pixel is the average of its two neighbours
+            float hr = (r[x] + r[x + 1]) * 0.5f;
+            float hg = (g[x] + g[x + 1]) * 0.5f;
+            float hb = (b[x] + b[x + 1]) * 0.5f;
+
+            o0[x * 2]     = filter_pack(r[x], g[x], b[x]);
+            o0[x * 2 + 1] = filter_pack(hr, hg, hb);
+            o1[x * 2]     = filter_pack(r[x] * 0.75f, g[x] * 0.75f,
+                                        b[x] * 0.75f);
+            o1[x * 2 + 1] = filter_pack(hr * 0.75f, hg * 0.75f, hb * 0.75f);
+        }
+    }
+}
+#endif
+
+/*
+ * Starts filtering the queued frame. Must be called with the lock held and
+ * no job running
+ */
+static void
+filter_start(struct filter *f)
+{
+    SWAP(f->in_work, f->in_mid);
+    f->in_fresh = 0;
+    f->pending  = f->nthreads;
+    f->job += 1;
+    pthread_cond_broadcast(&f->wake);
+}
+
+static void *
+filter_worker(void *in)
+{
+    struct filter_band *band = in;
+    struct filter      *f    = band->f;
+
+    u32 seen = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&f->lock);
+        while (f->job == seen && !f->quit)
+        {
+            pthread_cond_wait(&f->wake, &f->lock);
+        }
+        if (f->quit)
+        {
+            pthread_mutex_unlock(&f->lock);
+            break;
+        }
+        seen = f->job;
+
+        const u16 *src = f->in[f->in_work];
+        u32       *dst = f->out[f->out_work];
+        pthread_mutex_unlock(&f->lock);
+
+        int y0 = band->first;
+        int y1 = band->first + band->count;
+
+        switch (f->mode)
+        {
+            case FILTER_NEAREST:
+                filter_nearest(f, src, dst, y0, y1);
+                break;
+            case FILTER_SCALE2X:
+                filter_scale2x(f, src, dst, y0, y1);
+                break;
+            case FILTER_NTSC:
+                filter_ntsc(f, src, dst, y0, y1);
+                break;
+            default:
+                break;
+        }
+
+        pthread_mutex_lock(&f->lock);
+        f->pending -= 1;
+        if (f->pending == 0)
+        {
+            // last band done, publish the frame and pick up the next one
+            SWAP(f->out_work, f->out_mid);
+            f->out_fresh = 1;
+
+            if (f->in_fresh)
+            {
+                filter_start(f);
+            }
+        }
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    return NULL;
+}
+
+struct filter *
+filter_create(enum filter_mode mode, int scale, const u32 *pal)
+{
+    struct filter *f = calloc(1, sizeof(struct filter));
+
+    f->mode  = mode;
+    f->scale = filter_scale(mode, scale);
+    f->out_w = NES_WIDTH * f->scale;
+    f->out_h = NES_HEIGHT * f->scale;
+
+    memcpy(f->pal, pal, sizeof(f->pal));
+
+    for (int i = 0; i < 3; i++)
+    {
+        f->in[i]  = calloc(NES_RES, sizeof(u16));
+        f->out[i] = calloc(f->out_w * f->out_h, sizeof(u32));
+    }
+    f->in_p = 0, f->in_mid = 1, f->in_work = 2;
+    f->out_p = 0, f->out_mid = 1, f->out_work = 2;
+
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->wake, NULL);
+
+    long ncpu   = sysconf(_SC_NPROCESSORS_ONLN);
+    f->nthreads = MIN(MAX(ncpu - 1, 1), FILTER_THREADS_MAX);
+
+    for (int i = 0; i < f->nthreads; i++)
+    {
+        f->bands[i].f     = f;
+        f->bands[i].first = NES_HEIGHT * i / f->nthreads;
+        f->bands[i].count = NES_HEIGHT * (i + 1) / f->nthreads -
+                            f->bands[i].first;
+
+        pthread_create(&f->threads[i], NULL, filter_worker, &f->bands[i]);
+    }
+
+    return f;
+}
+
+void
+filter_free(struct filter *f)
+{
+    pthread_mutex_lock(&f->lock);
+    f->quit = 1;
+    pthread_cond_broadcast(&f->wake);
+    pthread_mutex_unlock(&f->lock);
+
+    for (int i = 0; i < f->nthreads; i++)
+    {
+        pthread_join(f->threads[i], NULL);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        free(f->in[i]);
+        free(f->out[i]);
+    }
+
+    pthread_cond_destroy(&f->wake);
+    pthread_mutex_destroy(&f->lock);
+    free(f);
+}
+
+void
+filter_submit(struct filter *f, const u16 *frame)
+{
+    memcpy(f->in[f->in_p], frame, NES_RES * sizeof(u16));
+
+    pthread_mutex_lock(&f->lock);
+    SWAP(f->in_p, f->in_mid);
+    f->submitted += 1;
+    if (f->in_fresh)
+    {
+        f->dropped += 1;
+    }
+    f->in_fresh = 1;
+
+    if (f->pending == 0)
+    {
+        filter_start(f);
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+const u32 *
+filter_fetch(struct filter *f)
+{
+    const u32 *r = NULL;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->out_fresh)
+    {
+        SWAP(f->out_p, f->out_mid);
+        f->out_fresh = 0;
+        r            = f->out[f->out_p];
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    return r;
+}
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_FILTER_H_
+#define NES_FILTER_H_
+
+/*! @file filter.h
+ * Post-processing of finished frames (scaling and NTSC emulation) on a pool
+ * of worker threads. Each frame is split into bands of rows, one per thread
+ */
+
+#include <pthread.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#define FILTER_THREADS_MAX 8
+
+/*!
+ * Available post-processing filters
+ */
+enum filter_mode
+{
+    FILTER_NONE,    //!< No filter, the window loop uploads nes->pixels rows
+    FILTER_NEAREST, //!< Integer nearest-neighbor scaling
+    FILTER_SCALE2X, //!< Scale2x (EPX) edge-directed 2x scaling
+    FILTER_NTSC     //!< Composite video approximation, 2x with scanlines
+};
+
+struct filter;
+
+/*!
+ * One band of rows handed to a worker thread
+ */
+struct filter_band
+{
+    struct filter *f;
+    int            first; //!< First source row
+    int            count; //!< Number of source rows
+};
+
+/*!
+ * @struct filter
+ * Worker pool and triple-buffered frames. The PPU owns in[in_p], the
+ * presenter out[out_p], the workers own in[in_work] and out[out_work], and
+ * the middle buffers are swapped under the lock
+ */
+struct filter
+{
+    enum filter_mode mode;
+
+    int scale; //!< Output scale, see filter_scale()
+    int out_w; //!< Output width in pixels
+    int out_h; //!< Output height in pixels
+
+    u32 pal[0x200]; //!< Copy of ppu->pal_emph
+
+    u16 *in[3];
+    u32 *out[3];
+    int  in_p, in_mid, in_work;
+    int  out_p, out_mid, out_work;
+    u8   in_fresh;  //!< in[in_mid] holds a frame nobody has filtered yet
+    u8   out_fresh; //!< out[out_mid] holds a frame nobody has fetched yet
+
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    int                nthreads;
+    pthread_t          threads[FILTER_THREADS_MAX];
+    struct filter_band bands[FILTER_THREADS_MAX];
+
+    u32 job;     //!< Bumped whenever a new frame is started
+    int pending; //!< Bands of the current job still running
+    u8  quit;
+
+    u64 submitted; //!< Frames handed to filter_submit()
+    u64 dropped;   //!< Frames replaced before a worker got to them
+};
+
+/*!
+ * Parses a filter name as given on the command line
+ *
+ * @returns the filter, or -1 if the name is unknown
+ */
+int
+filter_parse(const char *name);
+
+/*!
+ * Works out the scale a filter renders at. FILTER_NEAREST takes 1-4 and
+ * defaults to 3, FILTER_SCALE2X and FILTER_NTSC only render at 2. Unfiltered
+ * frames are stretched to the window by SDL, so FILTER_NONE takes any window
+ * scale (1-8) and renders at 1. With any other filter the window takes the
+ * scale returned here, so the output is never resampled
+ *
+ * @param mode
+ * @param scale As given with -s, or 0 for the default
+ * @returns the output scale, or 0 if mode can't do scale
+ */
+int
+filter_scale(enum filter_mode mode, int scale);
+
+/*!
+ * Creates a filter and starts its worker threads
+ *
+ * @param mode Filter to run
+ * @param scale As given with -s, or 0. Must be accepted by filter_scale()
+ * @param pal 512-entry ARGB palette, normally ppu->pal_emph
+ */
+struct filter *
+filter_create(enum filter_mode mode, int scale, const u32 *pal);
+
+/*!
+ * Stops the worker threads and frees everything
+ */
+void
+filter_free(struct filter *f);
+
+/*!
+ * Hands a finished frame to the workers. Never waits for them: if they are
+ * still busy, the frame replaces any other one that is queued. Called by the
+ * thread drawing the frame once its last line is done, as the frame is copied
+ *
+ * @param f
+ * @param frame NES_WIDTH x NES_HEIGHT frame, normally nes->pixels
+ */
+void
+filter_submit(struct filter *f, const u16 *frame);
+
+/*!
+ * Gets the most recent filtered frame
+ *
+ * @returns an out_w x out_h ARGB frame that stays valid until the next call,
+ *          or NULL if nothing new has been finished since the last call
+ */
+const u32 *
+filter_fetch(struct filter *f);
+
+#endif // NES_FILTER_H_
@@ -0,0 +1,562 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <nes.h>
+#include "debug.h"
+#include "gdbstub.h"
+#include "rp2a03.h"
+#include "util.h"
+
+#define GDB_PACKET 0x1000 //!< Largest packet either way
+
+#define GDB_STOPPED 0 //!< Keep handling packets
+#define GDB_RESUMED 1 //!< The target runs until the next stop
+#define GDB_DETACH  2 //!< End the session
+
+// clang-format off
+static const char gdb_target[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target><feature name=\"org.nes.6502\">"
+    "<reg name=\"a\" bitsize=\"8\" regnum=\"0\"/>"
+    "<reg name=\"x\" bitsize=\"8\"/>"
+    "<reg name=\"y\" bitsize=\"8\"/>"
+    "<reg name=\"p\" bitsize=\"8\"/>"
+    "<reg name=\"sp\" bitsize=\"8\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "</feature></target>";
+// clang-format on
+
+struct gdb
+{
+    struct nes    *nes;
+    struct debug  *dbg;
+    struct rp2a03 *core;
+
+    int fd;      //!< Connection to the debugger
+    int wake[2]; //!< Written on the emulation thread for every stop
+
+    u8 ours[DEBUG_POINTS]; //!< Points set through Z packets
+
+    char in[GDB_PACKET + 1];
+    char out[GDB_PACKET + 1];
+
+    char rbuf[256];
+    int  rlen;
+    int  rpos;
+};
+
+static void
+gdb_on_stop(struct debug *dbg, void *arg)
+{
+    struct gdb *g = arg;
+
+    if (write(g->wake[1], "s", 1) != 1)
+    {
+        perror("gdb");
+    }
+}
+
+/*
+ * Next byte from the debugger, or -1 once it has gone away
+ */
+static int
+gdb_getc(struct gdb *g)
+{
+    if (g->rpos == g->rlen)
+    {
+        g->rlen = recv(g->fd, g->rbuf, sizeof(g->rbuf), 0);
+        g->rpos = 0;
+        if (g->rlen <= 0)
+        {
+            g->rlen = 0;
+            return -1;
+        }
+    }
+
+    return (u8)g->rbuf[g->rpos++];
+}
+
+/*
+ * Reads the next packet into g->in and acknowledges it. Acks from the
+ * debugger and anything else outside a packet are skipped. TCP already
+ * checks the data, so the checksum isn't
+ *
+ * Returns the packet length, or -1 once the debugger has gone away
+ */
+static int
+gdb_recv(struct gdb *g)
+{
+    int c, n = 0;
+
+    do
+    {
+        if ((c = gdb_getc(g)) < 0) return -1;
+    } while (c != '$');
+
+    while ((c = gdb_getc(g)) != '#')
+    {
+        if (c < 0) return -1;
+        if (n < GDB_PACKET) g->in[n++] = c;
+    }
+    g->in[n] = '\0';
+
+    if (gdb_getc(g) < 0 || gdb_getc(g) < 0)
+    {
+        return -1;
+    }
+
+    send(g->fd, "+", 1, MSG_NOSIGNAL);
+    return n;
+}
+
+static void
+gdb_send(struct gdb *g, const char *data)
+{
+    char   frame[GDB_PACKET + 5];
+    u8     sum = 0;
+    size_t n   = strlen(data);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += (u8)data[i];
+    }
+
+    n = snprintf(frame, sizeof(frame), "$%s#%02x", data, sum);
+    send(g->fd, frame, n, MSG_NOSIGNAL);
+}
+
+/*
+ * Parses n little-endian hex bytes, the way registers are sent
+ */
+static unsigned
+gdb_hex_le(const char *s, int n)
+{
+    unsigned v = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned byte = 0;
+        sscanf(s + i * 2, "%2x", &byte);
+        v |= byte << (i * 8);
+    }
+
+    return v;
+}
+
+/*
+ * Waits for the target to stop. A ^C from the debugger asks it to. Anything
+ * else that comes in first (packets sent right after attaching) is left for
+ * gdb_recv()
+ *
+ * Returns 0 if the debugger went away first
+ */
+static int
+gdb_wait(struct gdb *g)
+{
+    struct pollfd fds[2] = {
+        {.fd = g->wake[0], .events = POLLIN},
+        {.fd = g->fd, .events = POLLIN},
+    };
+    char c;
+
+    for (;;)
+    {
+        int pending = g->rpos < g->rlen;
+
+        if (pending && g->rbuf[g->rpos] == 0x03)
+        {
+            g->rpos += 1;
+            debug_break(g->dbg);
+            continue;
+        }
+
+        fds[1].revents = 0;
+        if (poll(fds, pending ? 1 : 2, -1) < 0)
+        {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            return read(g->wake[0], &c, 1) == 1;
+        }
+
+        if (fds[1].revents)
+        {
+            if (gdb_getc(g) < 0) return 0;
+            g->rpos -= 1;
+        }
+    }
+}
+
+static void
+gdb_stop_reply(struct gdb *g)
+{
+    const struct debug_stop *s = &g->dbg->stop;
+
+    if (s->id >= 0 && s->space == DEBUG_CPU && s->kind != DEBUG_EXEC)
+    {
+        const char *kind = s->kind == DEBUG_WRITE  ? "watch"
+                           : s->kind == DEBUG_READ ? "rwatch"
+                                                   : "awatch";
+
+        snprintf(g->out, sizeof(g->out), "T05%s:%04x;", kind, s->addr);
+        gdb_send(g, g->out);
+        return;
+    }
+
+    gdb_send(g, "S05");
+}
+
+/*
+ * Formats all registers into g->out, in target.xml order
+ */
+static void
+gdb_regs(struct gdb *g)
+{
+    struct rp2a03 *c = g->core;
+
+    snprintf(g->out, sizeof(g->out), "%02x%02x%02x%02x%02x%02x%02x", c->A,
+             c->X, c->Y, c->P, c->SP, c->PC & 0xFF, c->PC >> 8);
+}
+
+/*
+ * Sets register n from little-endian hex
+ */
+static int
+gdb_set_reg(struct gdb *g, unsigned n, const char *hex)
+{
+    struct rp2a03 *c = g->core;
+
+    switch (n)
+    {
+        case 0:
+            c->A = gdb_hex_le(hex, 1);
+            break;
+        case 1:
+            c->X = gdb_hex_le(hex, 1);
+            break;
+        case 2:
+            c->Y = gdb_hex_le(hex, 1);
+            break;
+        case 3:
+            c->P = gdb_hex_le(hex, 1);
+            break;
+        case 4:
+            c->SP = gdb_hex_le(hex, 1);
+            break;
+        case 5:
+            c->PC = gdb_hex_le(hex, 2);
+            break;
+        default:
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Z and z packets. Breakpoints (types 0 and 1) cover one address, watchpoints
+ * (types 2-4) cover kind bytes
+ */
+static void
+gdb_point(struct gdb *g, int add)
+{
+    static const u8 flags[] = {
+        DEBUG_EXEC, DEBUG_EXEC, DEBUG_WRITE, DEBUG_READ,
+        DEBUG_READ | DEBUG_WRITE,
+    };
+
+    unsigned type, addr, kind;
+
+    if (sscanf(g->in + 1, "%u,%x,%x", &type, &addr, &kind) != 3 || type > 4)
+    {
+        gdb_send(g, "");
+        return;
+    }
+
+    u16 lo = addr;
+    u16 hi = type < 2 || kind == 0 ? addr : addr + kind - 1;
+
+    if (add)
+    {
+        int id = debug_add(g->dbg, DEBUG_CPU, flags[type], lo, hi);
+        if (id < 0)
+        {
+            gdb_send(g, "E01");
+            return;
+        }
+        g->ours[id] = 1;
+        gdb_send(g, "OK");
+        return;
+    }
+
+    for (int i = 0; i < DEBUG_POINTS; i++)
+    {
+        const struct debug_point *p = &g->dbg->points[i];
+
+        if (g->ours[i] && p->lo == lo && p->hi == hi && p->flags == flags[type])
+        {
+            debug_remove(g->dbg, i);
+            g->ours[i] = 0;
+            break;
+        }
+    }
+    gdb_send(g, "OK");
+}
+
+static void
+gdb_query(struct gdb *g)
+{
+    const char *q = g->in + 1;
+    unsigned    off, len;
+
+    if (strncmp(q, "Supported", 9) == 0)
+    {
+        snprintf(g->out, sizeof(g->out),
+                 "PacketSize=%x;qXfer:features:read+", GDB_PACKET);
+        gdb_send(g, g->out);
+    }
+    else if (sscanf(q, "Xfer:features:read:target.xml:%x,%x", &off, &len) == 2)
+    {
+        size_t size = sizeof(gdb_target) - 1;
+
+        off = MIN(off, size);
+        len = MIN(len, MIN(size - off, GDB_PACKET - 1));
+        g->out[0] = off + len < size ? 'm' : 'l';
+        memcpy(g->out + 1, gdb_target + off, len);
+        g->out[len + 1] = '\0';
+        gdb_send(g, g->out);
+    }
+    else if (strcmp(q, "Attached") == 0)
+    {
+        gdb_send(g, "1");
+    }
+    else if (strcmp(q, "C") == 0)
+    {
+        gdb_send(g, "QC1");
+    }
+    else if (strcmp(q, "fThreadInfo") == 0)
+    {
+        gdb_send(g, "m1");
+    }
+    else if (strcmp(q, "sThreadInfo") == 0)
+    {
+        gdb_send(g, "l");
+    }
+    else
+    {
+        gdb_send(g, "");
+    }
+}
+
+/*
+ * Handles the packet in g->in. The target is stopped
+ */
+static int
+gdb_handle(struct gdb *g)
+{
+    struct rp2a03 *c = g->core;
+    unsigned       addr, len, n;
+    char          *p;
+
+    switch (g->in[0])
+    {
+        case '?':
+            gdb_stop_reply(g);
+            break;
+        case 'g':
+            gdb_regs(g);
+            gdb_send(g, g->out);
+            break;
+        case 'G':
+            if (strlen(g->in + 1) < 14)
+            {
+                gdb_send(g, "E01");
+                break;
+            }
+            for (n = 0; n < 6; n++)
+            {
+                gdb_set_reg(g, n, g->in + 1 + n * 2);
+            }
+            gdb_send(g, "OK");
+            break;
+        case 'p':
+            if (sscanf(g->in + 1, "%x", &n) != 1 || n > 5)
+            {
+                gdb_send(g, "E01");
+                break;
+            }
+            // all 8-bit but pc, which comes last
+            gdb_regs(g);
+            memmove(g->out, g->out + n * 2, n == 5 ? 4 : 2);
+            g->out[n == 5 ? 4 : 2] = '\0';
+            gdb_send(g, g->out);
+            break;
+        case 'P':
+            p = strchr(g->in, '=');
+            sscanf(g->in + 1, "%x", &n);
+            gdb_send(g, p && gdb_set_reg(g, n, p + 1) ? "OK" : "E01");
+            break;
+        case 'm':
+            if (sscanf(g->in + 1, "%x,%x", &addr, &len) != 2)
+            {
+                gdb_send(g, "E01");
+                break;
+            }
+            len = MIN(len, GDB_PACKET / 2);
+            for (n = 0; n < len; n++)
+            {
+                sprintf(g->out + n * 2, "%02x", rp2a03_peek(c, addr + n));
+            }
+            g->out[len * 2] = '\0';
+            gdb_send(g, g->out);
+            break;
+        case 'M':
+            p = strchr(g->in, ':');
+            if (sscanf(g->in + 1, "%x,%x", &addr, &len) != 2 || p == NULL ||
+                strlen(p + 1) < len * 2)
+            {
+                gdb_send(g, "E01");
+                break;
+            }
+            for (n = 0; n < len; n++)
+            {
+                rp2a03_poke(c, addr + n, gdb_hex_le(p + 1 + n * 2, 1));
+            }
+            gdb_send(g, "OK");
+            break;
+        case 'c':
+        case 's':
+            if (sscanf(g->in + 1, "%x", &addr) == 1)
+            {
+                c->PC = addr;
+            }
+            debug_continue(g->dbg, g->in[0] == 's');
+            return GDB_RESUMED;
+        case 'Z':
+        case 'z':
+            gdb_point(g, g->in[0] == 'Z');
+            break;
+        case 'q':
+            gdb_query(g);
+            break;
+        case 'H':
+        case 'T':
+            gdb_send(g, "OK");
+            break;
+        case 'D':
+            gdb_send(g, "OK");
+            return GDB_DETACH;
+        case 'k':
+            return GDB_DETACH;
+        default:
+            gdb_send(g, "");
+            break;
+    }
+
+    return GDB_STOPPED;
+}
+
+/*
+ * One debugger connection, from the stop on attach to the detach. The target
+ * is always left running
+ */
+static void
+gdb_session(struct gdb *g)
+{
+    char c;
+
+    // stops nobody waited for
+    while (read(g->wake[0], &c, 1) == 1)
+    {
+    }
+
+    debug_break(g->dbg);
+    if (!gdb_wait(g))
+    {
+        goto out;
+    }
+
+    while (gdb_recv(g) >= 0)
+    {
+        int r = gdb_handle(g);
+
+        if (r == GDB_DETACH)
+        {
+            break;
+        }
+        if (r == GDB_RESUMED)
+        {
+            if (!gdb_wait(g)) goto out;
+            gdb_stop_reply(g);
+        }
+    }
+
+out:
+    for (int i = 0; i < DEBUG_POINTS; i++)
+    {
+        if (g->ours[i]) debug_remove(g->dbg, i);
+        g->ours[i] = 0;
+    }
+
+    __atomic_store_n(&g->dbg->step, 0, __ATOMIC_RELEASE);
+    debug_continue(g->dbg, 0);
+}
+
+int
+gdb_loop(void *in)
+{
+    struct nes *nes = (struct nes *)in;
+    struct gdb *g   = calloc(1, sizeof(struct gdb));
+
+    g->nes  = nes;
+    g->dbg  = nes->debug;
+    g->core = nes->core;
+
+    int                fd  = socket(AF_INET, SOCK_STREAM, 0);
+    int                one = 1;
+    struct sockaddr_in sa  = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(nes->gdb_port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || pipe(g->wake) != 0 ||
+        fcntl(g->wake[0], F_SETFL, O_NONBLOCK) != 0 ||
+        bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(fd, 1) != 0)
+    {
+        perror("gdb");
+        free(g);
+        return 1;
+    }
+
+    g->dbg->arg     = g;
+    g->dbg->on_stop = gdb_on_stop;
+    fprintf(stderr, "Waiting for gdb on 127.0.0.1:%d\n", nes->gdb_port);
+
+    for (;;)
+    {
+        g->fd = accept(fd, NULL, NULL);
+        if (g->fd < 0)
+        {
+            continue;
+        }
+
+        g->rlen = g->rpos = 0;
+        gdb_session(g);
+        close(g->fd);
+    }
+
+    return 0;
+}
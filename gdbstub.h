@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_GDBSTUB_H_
+#define NES_GDBSTUB_H_
+
+/*! @file gdbstub.h
+ * GDB remote serial protocol server
+ *
+ * Listens on a loopback TCP port and serves one debugger at a time, on top
+ * of the points and stops of debug.h. All packet handling happens on the
+ * stub's own thread: the emulation thread only ever stops in debug_wait(),
+ * at an instruction boundary, and wakes the stub through a pipe. While the
+ * target runs, the stub just waits for a stop or a ^C, so an attached
+ * debugger costs nothing per cycle.
+ *
+ * The target is the 6502 view of the NES: registers a, x, y, p, sp (8 bits)
+ * and pc (16 bits), in that order, and the 64KB CPU address space. Memory
+ * reads don't have side effects, so I/O reads as 0. Supported: ?, g, G, p,
+ * P, m, M, c, s, Z0-Z4, z0-z4, D, k and ^C. Attaching stops the target,
+ * detaching removes the stub's points and lets it run.
+ */
+
+#include <nes.h>
+
+/*!
+ * Thread function, started by -g
+ *
+ * @param in Void pointer to a struct nes. nes->debug must be set and
+ *           nes->gdb_port holds the port
+ */
+int
+gdb_loop(void *in);
+
+#endif // NES_GDBSTUB_H_
@@ -69,7 +69,32 @@
 #define NES_HEIGHT 240
 #define NES_RES    (NES_WIDTH * NES_HEIGHT)
 
+#define NES_FRAME_CYCLES 29781 //!< CPU cycles in a frame, rounded up
+#define NES_FRAME_US     16639 //!< us in a frame, 29780.5 cycles at 1.79 MHz
+
+// nes.btns, in the order the controller shifts them out
+#define NES_BTN_A   0x80
+#define NES_BTN_B   0x40
+#define NES_BTN_SEL 0x20
+#define NES_BTN_STR 0x10
+#define NES_BTN_UP  0x08
+#define NES_BTN_DN  0x04
+#define NES_BTN_LF  0x02
+#define NES_BTN_RT  0x01
+
 struct ppu;
+struct rp2a03;
+struct debug;
+struct netplay;
+struct ramsearch;
+struct prof;
+struct latency;
+struct rewind;
+struct runahead;
+struct movie;
+struct cheats;
+struct clone_mark;
+struct filter;
 
 /*!
  * @struct nes
@@ -77,8 +102,9 @@ struct ppu;
  */
 struct nes
 {
-    struct cpu *cpu; //!< 6502 CPU data structure
-    struct ppu *ppu; //!< PPU structure
+    struct cpu    *cpu;  //!< 6502 CPU data structure
+    struct ppu    *ppu;  //!< PPU structure
+    struct rp2a03 *core; //!< In-tree CPU core, see rp2a03.h
 
     struct
     {
@@ -89,29 +115,89 @@ struct nes
         u8 *prg;
         u8 *chr;
         u8 prg_ram[0x2000];
-    } cartridge; //!< Contains all ROM cartridge data
+
+        u64 hash; //!< Of PRG and CHR, see rp2a03_aot_hash()
+    } cartridge;  //!< Contains all ROM cartridge data
 
     u16 mirror;
 
-    void **mappers; //!< Function array for memory mappers
+    void **mappers;       //!< Function array for memory mappers
+    void **mapper_writes; //!< Register write handlers, NULL if none
+    u8     mapreg[8];     //!< Mapper registers
 
     int offs;
 
     u8 enable;
 
-    u32 pixels[NES_WIDTH * NES_HEIGHT];
+    u16 pixels[NES_WIDTH * NES_HEIGHT]; //!< Palette index + emphasis per pixel
+
+    u64 line_hash[NES_HEIGHT]; //!< Hash of each finished scanline
+    u32 line_gen[NES_HEIGHT];  //!< Bumped whenever a scanline changes
+    u32 frame_gen;             //!< Bumped after every frame that changed
+    u8  frame_changed;
+
+    struct
+    {
+        u64 frames;  //!< Window loop iterations
+        u64 skipped; //!< Iterations with no texture upload at all
+        u64 rows;    //!< Rows uploaded
+    } stats_present; //!< Presenter statistics, see nes_present_dirty()
+
+    struct
+    {
+        u64 busy;    //!< us spent emulating
+        u64 sleep;   //!< us asked of usleep()
+        u64 slept;   //!< us usleep() actually took
+        u64 sleeps;  //!< usleep() calls
+        u64 stalled; //!< CPU cycles skipped over OAM DMA
+        u64 ahead;   //!< us spent running ahead, see runahead.h
+        u64 resim;   //!< us spent re-simulating, see netplay.h
+    } stats_emu;     //!< Game loop statistics, see stats.h
 
     uint64_t cycle;
+    u16      dma_stall; //!< CPU cycles an OAM DMA still has to stall for
 
     u8 pal;
     u8 btns;
     u8 btn_latch;
+    u8 btn_latch2; //!< Second controller, only plugged in by netplay.h
 
     u8 btn_speed;
 
     u8 frame_complete;
 
     u8 mode_debug;
+    u8 mode_jit;      //!< Compile hot blocks to native code, see rp2a03jit.h
+    u8 mode_libcpu;   //!< Use the 6502 library instead of rp2a03.c
+    u8 mode_filter;   //!< Post-processing filter, see filter.h
+    u8 mode_pipeline; //!< Render on a second thread, see ppupipe.h
+    u8 mode_headless; //!< No window, stats on stderr, see stats.h
+    u8 scale;         //!< Integer window scale, 0 for the default
+
+    const char *trace_path;   //!< Where the i key writes the trace, see trace.h
+    u8          trace_toggle; //!< Start/stop the trace, set by the i key
+
+    const char *state_path;    //!< Where F5 saves and F7 loads, see state.h
+    u8          state_request; //!< Save or load, set by F5 and F7
+    u8          rewinding;     //!< The r key is held, see rewind.h
+
+    u8         *cdl;      //!< Code/data log, see cdl.h. NULL when off
+    const char *cdl_path; //!< Where the code/data log is saved
+
+    struct debug *debug;    //!< Breakpoints and watchpoints, see debug.h
+    u16           gdb_port; //!< Serve gdb on this port, see gdbstub.h
+
+    struct prof     *prof;     //!< Instrumentation stats, see prof.h, or NULL
+    struct latency  *latency;  //!< Input latency probe, see latency.h, or NULL
+    struct rewind   *rewind;   //!< Rewind ring, see rewind.h, or NULL
+    struct runahead *runahead; //!< Run-ahead, see runahead.h, or NULL
+    struct movie    *movie;    //!< Input movie, see movie.h, or NULL
+    struct netplay  *netplay;  //!< Rollback netplay, see netplay.h, or NULL
+
+    struct ramsearch  *ramsearch; //!< RAM snapshots, see ramsearch.h, or NULL
+    struct cheats     *cheats;    //!< Game Genie codes, see cheat.h, or NULL
+    struct clone_mark *mark;      //!< Branch point, see clone.h, or NULL
+    struct filter     *filter;    //!< Post-processing, see filter.h, or NULL
 };
 
 void
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "latency.h"
+#include "util.h"
+
+static void
+lat_add(struct lat_hist *h, u64 from, u64 to)
+{
+    u64 us = to - from;
+
+    h->n[MIN(us / 1000, LAT_BUCKETS - 1)] += 1;
+    h->count += 1;
+    h->sum += us;
+    h->max = MAX(h->max, us);
+}
+
+void
+lat_init(struct nes *nes)
+{
+    nes->latency = calloc(1, sizeof(struct latency));
+}
+
+void
+lat_key(struct latency *lat, u8 btns)
+{
+    if (lat == NULL)
+    {
+        return;
+    }
+
+    u16 stage = __atomic_load_n(&lat->stage, __ATOMIC_ACQUIRE);
+
+    // the game never latched the last change, measure from this one instead.
+    // Fails if the game latched it meanwhile
+    if (LAT_STAGE(stage) == LAT_KEY &&
+        !__atomic_compare_exchange_n(&lat->stage, &stage, LAT_IDLE, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    if (LAT_STAGE(stage) == LAT_IDLE || LAT_STAGE(stage) == LAT_KEY)
+    {
+        lat->key = util_now_us();
+        __atomic_store_n(&lat->stage, LAT_KEY | btns << 8, __ATOMIC_RELEASE);
+    }
+}
+
+void
+lat_step(struct latency *lat, u16 from)
+{
+    if (LAT_STAGE(from) == LAT_LATCH)
+    {
+        lat->frame = util_now_us();
+        __atomic_store_n(&lat->stage, LAT_FRAME, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // the window loop may have replaced the probe since from was read. The
+    // time is taken after, so it can't be older than lat->key
+    if (__atomic_compare_exchange_n(&lat->stage, &from, LAT_LATCH, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+        lat->latch = util_now_us();
+    }
+}
+
+void
+lat_present(struct latency *lat)
+{
+    if (lat == NULL ||
+        __atomic_load_n(&lat->stage, __ATOMIC_ACQUIRE) != LAT_FRAME)
+    {
+        return;
+    }
+
+    u64 now = util_now_us();
+
+    lat_add(&lat->input, lat->key, lat->latch);
+    lat_add(&lat->emu, lat->latch, lat->frame);
+    lat_add(&lat->present, lat->frame, now);
+    lat_add(&lat->total, lat->key, now);
+
+    __atomic_store_n(&lat->stage, LAT_IDLE, __ATOMIC_RELEASE);
+}
+
+static void
+lat_print_avg(const char *name, const struct lat_hist *h)
+{
+    fprintf(stderr, "%-8s avg %6.2f ms  max %6.2f ms\n", name,
+            h->sum / 1000.0 / h->count, h->max / 1000.0);
+}
+
+void
+lat_close(struct nes *nes)
+{
+    struct latency *lat = nes->latency;
+    const u32      *n   = lat->total.n;
+
+    if (lat->total.count)
+    {
+        fprintf(stderr, "Input latency over %u changes:\n", lat->total.count);
+        lat_print_avg("input", &lat->input);
+        lat_print_avg("emulate", &lat->emu);
+        lat_print_avg("present", &lat->present);
+        lat_print_avg("total", &lat->total);
+
+        for (int i = 0; i < LAT_BUCKETS; i++)
+        {
+            if (n[i] == 0) continue;
+            if (i == LAT_BUCKETS - 1)
+                fprintf(stderr, "%2d+ ms %6u\n", i, n[i]);
+            else
+                fprintf(stderr, "%2d-%2d ms %6u\n", i, i + 1, n[i]);
+        }
+    }
+
+    free(lat);
+    nes->latency = NULL;
+}
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_LATENCY_H_
+#define NES_LATENCY_H_
+
+/*! @file latency.h
+ * Input to photon latency
+ *
+ * With -L, a probe follows one button change at a time through four
+ * timestamps:
+ *
+ * 1. key: the window loop is about to change nes->btns
+ * 2. latch: the first $4016 strobe that copies exactly the new state
+ * 3. frame: the next frame_complete, the first frame drawn after the game
+ *    read it
+ * 4. present: the next SDL_RenderPresent()
+ *
+ * Each step is owned by one thread and hands the probe to the next one with
+ * a release store of the stage, so no lock is taken. A change the game never
+ * latched, like a tap shorter than a frame, gives way to the next one; changes
+ * made once a probe is past the latch aren't measured. The histograms are
+ * printed to stderr on exit, for comparing pacing, filter and pipeline
+ * settings.
+ */
+
+#include <cpu.h>
+#include <nes.h>
+
+#define LAT_BUCKETS 64 //!< 1ms each, the last one also counts the rest
+
+#define LAT_IDLE  0
+#define LAT_KEY   1 //!< Waiting for the latch
+#define LAT_LATCH 2 //!< Waiting for the frame
+#define LAT_FRAME 3 //!< Waiting for the present
+
+/*
+ * The stage is in the low byte of latency.stage. At LAT_KEY the high byte
+ * holds the buttons the probe waits for, so a strobe can't be mistaken for the
+ * latch of a probe that was replaced since it looked
+ */
+#define LAT_STAGE(s) ((s) & 0xFF)
+
+struct lat_hist
+{
+    u32 n[LAT_BUCKETS];
+    u32 count;
+    u64 sum; //!< us
+    u64 max; //!< us
+};
+
+struct latency
+{
+    u16 stage; //!< See LAT_STAGE()
+    u64 key;   //!< us, see lat_now()
+    u64 latch; //!< us
+    u64 frame; //!< us
+
+    struct lat_hist input;   //!< key to latch
+    struct lat_hist emu;     //!< latch to frame
+    struct lat_hist present; //!< frame to present
+    struct lat_hist total;   //!< key to present
+};
+
+/*!
+ * Sets up nes->latency
+ */
+void
+lat_init(struct nes *nes);
+
+/*!
+ * Window loop, right before an event changes nes->btns to btns
+ */
+void
+lat_key(struct latency *lat, u8 btns);
+
+/*
+ * Moves the probe on from stage from, see lat_latch() and lat_frame()
+ */
+void
+lat_step(struct latency *lat, u16 from);
+
+/*!
+ * Game thread, at a $4016 strobe that latched the buttons in latched. With
+ * netplay that is the pad of the local player, not necessarily controller 1
+ */
+static inline void
+lat_latch(struct latency *lat, u8 latched)
+{
+    if (lat && __atomic_load_n(&lat->stage, __ATOMIC_ACQUIRE) ==
+                   (LAT_KEY | latched << 8))
+    {
+        lat_step(lat, LAT_KEY | latched << 8);
+    }
+}
+
+/*!
+ * Game thread, when the PPU sets frame_complete
+ */
+static inline void
+lat_frame(struct latency *lat)
+{
+    if (lat && __atomic_load_n(&lat->stage, __ATOMIC_ACQUIRE) == LAT_LATCH)
+    {
+        lat_step(lat, LAT_LATCH);
+    }
+}
+
+/*!
+ * Window loop, after SDL_RenderPresent()
+ */
+void
+lat_present(struct latency *lat);
+
+/*!
+ * Prints the histograms to stderr and frees nes->latency
+ */
+void
+lat_close(struct nes *nes);
+
+#endif // NES_LATENCY_H_
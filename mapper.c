@@ -4,14 +4,27 @@
 
 #include "util.h"
 #include "mapper.h"
+#include "ppu.h"
+#include "rp2a03.h"
 
 #define MODE(_a) if (mode == _a)
 
+// MMC1 registers, kept in nes->mapreg
+#define MMC1_SHIFT   0
+#define MMC1_COUNT   1
+#define MMC1_CONTROL 2
+#define MMC1_CHR0    3
+#define MMC1_CHR1    4
+#define MMC1_PRG     5
+
 void
 mappers_init(struct nes *nes)
 {
     MAP_DECL(00);
     MAP_DECL(01);
+
+    MAP_DECL_WRITE(00);
+    MAP_DECL_WRITE(01);
 }
 
 void
@@ -20,6 +33,7 @@ mapper_init(struct nes *nes)
     switch (nes->cartridge.mapper)
     {
         case 1:
+            nes->mapreg[MMC1_CONTROL] = 0x0C; // last PRG bank fixed at $C000
             break;
     }
 }
@@ -47,8 +61,16 @@ MAP_FUNC(00)
     return (mem + addr);
 }
 
+MAP_WRITE(00)
+{
+    // PRG-ROM is read only. Decoded blocks in rp2a03.c count on that
+    return addr >= 0x8000;
+}
+
 MAP_FUNC(01)
 {
+    u8 *reg = nes->mapreg;
+
     MODE(MAP_MODE_CPU)
     {
         IFINRANGE(addr, 0x6000, 0x7FFF)
@@ -56,11 +78,106 @@ MAP_FUNC(01)
             return nes->cartridge.prg_ram + (addr - 0x6000);
         }
 
-        IFINRANGE(addr, 0x8000, 0xBFFF) {}
+        IFINRANGE(addr, 0x8000, 0xFFFF)
+        {
+            u8  banks = MAX(nes->cartridge.s_prg_rom_16, 1);
+            u8  bank  = reg[MMC1_PRG] & 0x0F;
+            u8  hi    = addr >= 0xC000;
+            u32 off   = addr & 0x3FFF;
+
+            switch ((reg[MMC1_CONTROL] >> 2) & 0x03)
+            {
+                case 0:
+                case 1: // 32KB
+                    bank = (bank & 0x0E) | hi;
+                    break;
+                case 2: // first bank fixed at $8000
+                    bank = hi ? bank : 0;
+                    break;
+                case 3: // last bank fixed at $C000
+                    bank = hi ? banks - 1 : bank;
+                    break;
+            }
+
+            return nes->cartridge.prg + (bank % banks) * 0x4000 + off;
+        }
     }
 
-    MODE(MAP_MODE_PPU) {}
+    MODE(MAP_MODE_PPU)
+    {
+        IFINRANGE(addr, 0x0000, 0x1FFF)
+        {
+            // 4KB banks; CHR-RAM carts have a single 8KB bank
+            u8 banks = MAX(nes->cartridge.s_chr_rom_8, 1) * 2;
+            u8 bank;
+
+            if (reg[MMC1_CONTROL] & 0x10)
+            {
+                bank = addr < 0x1000 ? reg[MMC1_CHR0] : reg[MMC1_CHR1];
+            }
+            else
+            {
+                bank = (reg[MMC1_CHR0] & 0x1E) | (addr >= 0x1000);
+            }
+
+            return nes->cartridge.chr + (bank % banks) * 0x1000 +
+                   (addr & 0x0FFF);
+        }
+    }
 
     return (mem + addr);
 }
 
+MAP_WRITE(01)
+{
+    u8 *reg = nes->mapreg;
+
+    if (addr < 0x8000)
+    {
+        return 0;
+    }
+
+    if (val & 0x80)
+    {
+        reg[MMC1_SHIFT] = 0;
+        reg[MMC1_COUNT] = 0;
+        reg[MMC1_CONTROL] |= 0x0C;
+    }
+    else
+    {
+        reg[MMC1_SHIFT] |= (val & 0x01) << reg[MMC1_COUNT];
+        reg[MMC1_COUNT] += 1;
+
+        if (reg[MMC1_COUNT] < 5)
+        {
+            return 1;
+        }
+
+        reg[MMC1_CONTROL + ((addr >> 13) & 0x03)] = reg[MMC1_SHIFT];
+        reg[MMC1_SHIFT]                           = 0;
+        reg[MMC1_COUNT]                           = 0;
+    }
+
+    switch (reg[MMC1_CONTROL] & 0x03)
+    {
+        case 0:
+        case 1:
+            // single screen. The upper screen can't be expressed as a mask,
+            // so both use the lower one
+            nes->mirror = 0x23FF;
+            break;
+        case 2:
+            nes->mirror = MIRROR_VERTICAL;
+            break;
+        case 3:
+            nes->mirror = MIRROR_HORIZONTAL;
+            break;
+    }
+
+    if (nes->core)
+    {
+        rp2a03_remap(nes->core);
+    }
+
+    return 1;
+}
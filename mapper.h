@@ -42,10 +42,33 @@
 
 typedef u8 *(*mapcall)(MAP_FUNC_HEADER);
 
+/*
+ * Register writes. Returns nonzero if the mapper took the write, otherwise it
+ * goes to the memory returned by the MAP_FUNC
+ */
+#define MAP_WRITE_HEADER struct nes *nes, u16 addr, u8 val
+#define MAP_WRITE(name)  u8 mapwrite_##name(MAP_WRITE_HEADER)
+
+#define MAP_DECL_WRITE(name) nes->mapper_writes[0x##name] = mapwrite_##name
+#define MAP_WRITE_CALL(_nes, name, ...)                                        \
+    ((mapwrite)_nes->mapper_writes[name])(_nes, __VA_ARGS__)
+
+typedef u8 (*mapwrite)(MAP_WRITE_HEADER);
+
 MAP_FUNC(00);
 MAP_FUNC(01);
 
+MAP_WRITE(00);
+MAP_WRITE(01);
+
 void
 mappers_init(struct nes *nes);
 
+/*!
+ * Puts the cartridge's mapper in its power on state. Called once the ROM has
+ * been loaded
+ */
+void
+mapper_init(struct nes *nes);
+
 #endif // NES_MAPPER_H_
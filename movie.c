@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdlib.h>
+
+#include "movie.h"
+#include "ppu.h"
+#include "rp2a03aot.h"
+#include "state.h"
+
+/*
+ * Hash of the whole machine, what a recording and its playback have to agree
+ * on
+ */
+static u64
+movie_hash(struct nes *nes)
+{
+    struct state s;
+
+    state_save(nes, &s);
+    return rp2a03_aot_hash((const u8 *)&s, sizeof(s), NULL, 0);
+}
+
+static void
+movie_report(struct movie *m, struct nes *nes, const char *what)
+{
+    double frames = nes->ppu->dot * 2 / 178683.0; // see stats.c
+    u64    busy   = __atomic_load_n(&nes->stats_emu.busy, __ATOMIC_RELAXED);
+
+    fprintf(stderr,
+            "Movie %s %s: %llu strobes, %.0f frames, %.2f ms per frame, "
+            "machine %016llx at cycle %llu\n",
+            m->path, what, (unsigned long long)m->strobes, frames,
+            frames ? busy / 1e3 / frames : 0.0,
+            (unsigned long long)movie_hash(nes),
+            (unsigned long long)nes->core->cycles);
+}
+
+struct movie *
+movie_open(struct nes *nes, const char *path, u8 play)
+{
+    struct state s;
+    struct movie m = {.path = path, .play = play};
+
+    if (nes->mode_libcpu || nes->mode_pipeline)
+    {
+        fprintf(stderr, "Movies need the in-tree core and no -p\n");
+        return NULL;
+    }
+
+    m.file = fopen(path, play ? "rb" : "wb");
+    if (m.file == NULL)
+    {
+        fprintf(stderr, "Can't open movie %s\n", path);
+        return NULL;
+    }
+
+    if (play)
+    {
+        if (fread(&m.hdr, sizeof(m.hdr), 1, m.file) != 1 ||
+            fread(&s, sizeof(s), 1, m.file) != 1 ||
+            m.hdr.magic != MOVIE_MAGIC || m.hdr.version != MOVIE_VERSION ||
+            m.hdr.rom != nes->cartridge.hash || !state_load(nes, &s))
+        {
+            fprintf(stderr, "%s isn't a movie of this ROM\n", path);
+            fclose(m.file);
+            return NULL;
+        }
+    }
+    else
+    {
+        // the header is finished by movie_close()
+        m.hdr.magic   = MOVIE_MAGIC;
+        m.hdr.version = MOVIE_VERSION;
+        m.hdr.rom     = nes->cartridge.hash;
+
+        state_save(nes, &s);
+        fwrite(&m.hdr, sizeof(m.hdr), 1, m.file);
+        fwrite(&s, sizeof(s), 1, m.file);
+    }
+
+    nes->movie  = malloc(sizeof(struct movie));
+    *nes->movie = m;
+    return nes->movie;
+}
+
+void
+movie_end(struct movie *m, struct nes *nes)
+{
+    movie_report(m, nes, "ended");
+    __atomic_store_n(&m->done, 1, __ATOMIC_RELEASE);
+}
+
+void
+movie_close(struct nes *nes)
+{
+    struct movie *m = nes->movie;
+
+    if (!m->play)
+    {
+        m->hdr.strobes = m->strobes;
+        m->hdr.end     = nes->core->cycles;
+
+        fseek(m->file, 0, SEEK_SET);
+        fwrite(&m->hdr, sizeof(m->hdr), 1, m->file);
+        movie_report(m, nes, "recorded");
+    }
+    else if (!m->done)
+    {
+        movie_report(m, nes, "stopped");
+    }
+
+    if (fclose(m->file) != 0)
+    {
+        fprintf(stderr, "Can't write movie %s\n", m->path);
+    }
+    free(m);
+    nes->movie = NULL;
+}
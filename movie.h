@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_MOVIE_H_
+#define NES_MOVIE_H_
+
+/*! @file movie.h
+ * Input movies
+ *
+ * A movie is the controller state at every $4016 strobe, starting from a
+ * known state of the machine. -m file records one from power on. -M file
+ * loads the state it starts from and takes the buttons from the movie instead
+ * of the keyboard until it ends. After that the keyboard takes over again,
+ * or, headless (-H), the emulator quits. Games only see the buttons through
+ * the strobe, so a movie takes the machine through exactly the same states
+ * every time it plays, and real games become repeatable workloads.
+ *
+ * File: a struct movie_header, the struct state it starts from (see
+ * state.h), then one byte of buttons per strobe, all in host byte order. The
+ * header also has the CPU cycle recording stopped at. Playback stops there
+ * too, and both print a hash of the machine at that cycle, which has to
+ * match, along with the time spent emulating each frame.
+ *
+ * Loading a state (F7), rewind, run-ahead and cheats would take the machine
+ * off the recorded path, so they are off while a movie records or plays. Like
+ * save states, movies need the in-tree core and no -p.
+ */
+
+#include <stdio.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#include "rp2a03.h"
+
+#define MOVIE_MAGIC   0x4D53454E //!< "NESM"
+#define MOVIE_VERSION 1
+
+struct movie_header
+{
+    u32 magic;   //!< MOVIE_MAGIC
+    u32 version; //!< MOVIE_VERSION
+    u64 rom;     //!< nes->cartridge.hash
+    u64 strobes; //!< Bytes of buttons after the state
+    u64 end;     //!< CPU cycle recording stopped at
+};
+
+/*!
+ * @struct movie
+ * A movie being recorded or played
+ */
+struct movie
+{
+    FILE               *file;
+    const char         *path;
+    struct movie_header hdr;
+    u64                 strobes; //!< Recorded or played so far
+    u8                  play;
+    u8                  done; //!< Played to the end, the keyboard is back
+};
+
+/*!
+ * Starts recording to path, or loads the start of the movie in path for
+ * playback, and stores the movie in nes->movie
+ *
+ * @returns NULL if path can't be used, see stderr
+ */
+struct movie *
+movie_open(struct nes *nes, const char *path, u8 play);
+
+/*!
+ * Finishes the header of a recording and frees nes->movie. Called once the
+ * game loop stopped
+ */
+void
+movie_close(struct nes *nes);
+
+/*
+ * Ends playback, see movie_tick()
+ */
+void
+movie_end(struct movie *m, struct nes *nes);
+
+/*!
+ * Buttons to latch at a $4016 strobe, given the ones held on the keyboard
+ */
+static inline u8
+movie_strobe(struct movie *m, u8 btns)
+{
+    if (m->done)
+    {
+        return btns;
+    }
+
+    m->strobes += 1;
+    if (!m->play)
+    {
+        putc_unlocked(btns, m->file);
+        return btns;
+    }
+
+    int c = getc_unlocked(m->file);
+    return c == EOF ? btns : c;
+}
+
+/*!
+ * Called by the game loop between two CPU slices, ends playback at the cycle
+ * recording ended at
+ */
+static inline void
+movie_tick(struct movie *m, struct nes *nes)
+{
+    if (m->play && !m->done && nes->core->cycles >= m->hdr.end)
+    {
+        movie_end(m, nes);
+    }
+}
+
+/*!
+ * Whether a movie played to its end. Safe from any thread
+ */
+static inline int
+movie_over(struct movie *m)
+{
+    return m && __atomic_load_n(&m->done, __ATOMIC_ACQUIRE);
+}
+
+#endif // NES_MOVIE_H_
@@ -37,10 +37,10 @@
 #include <cpu.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
 
 #include <unistd.h>
 #include <time.h>
-#include <sys/time.h>
 
 #include <pthread.h>
 
@@ -48,26 +48,39 @@
 #include "ppu.h"
 #include "util.h"
 #include "nescpu.h"
+#include "rp2a03.h"
+#include "rp2a03jit.h"
+#include "rp2a03aot.h"
 #include "mapper.h"
 #include "debug.h"
+#include "gdbstub.h"
+#include "filter.h"
+#include "ppupipe.h"
+#include "trace.h"
+#include "cdl.h"
+#include "prof.h"
+#include "stats.h"
+#include "latency.h"
+#include "state.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "netplay.h"
+#include "ramsearch.h"
+#include "cheat.h"
+#include "rom.h"
+#include "movie.h"
 
 #define SDL_MAIN_HANDLED
 #include <SDL.h>
 
-#define NES_BTN_A   0x80
-#define NES_BTN_B   0x40
-#define NES_BTN_SEL 0x20
-#define NES_BTN_STR 0x10
-#define NES_BTN_UP  0x08
-#define NES_BTN_DN  0x04
-#define NES_BTN_LF  0x02
-#define NES_BTN_RT  0x01
-
 #define ASPECT   (float)(16 / 15)
 #define ALTN(_n) ((_n) = (_n) == 0 ? 1 : 0)
 
 #define NS_CLOCK 558
 
+#define NES_STATE_SAVE 1
+#define NES_STATE_LOAD 2
+
 #define RECT_DECL(_name, _x, _y, _w, _h)                                       \
     struct SDL_Rect nesrect_##_name = {                                        \
         .x = (_x), .y = (_y), .w = (_w), .h = (_h)                             \
@@ -77,8 +90,6 @@
 // or  BUTTON_SET(btnreg, NES_BTN_A, & ~); to clear
 #define BUTTON_SET(_reg, _btn, _op) ((_reg) = ((_reg)_op(_btn)))
 
-void
-debug_print_oam(struct nes *nes);
 // i don't wanna type this twice(once for keyup, once for keydown
 #define BUTTON_AUTOSET(_reg, _op)                                              \
     switch (ev.key.keysym.sym)                                                 \
@@ -111,9 +122,6 @@ debug_print_oam(struct nes *nes);
         case SDLK_SPACE:                                                       \
             BUTTON_SET(nes->btn_speed, 0x01, _op);                             \
             break;                                                             \
-        case SDLK_i:                                                           \
-            cpu_echooff = cpu_echooff == 0 ? 1 : 0;                            \
-            break;                                                             \
         case SDLK_f:                                                           \
             debug_print_oam(nes);                                              \
             break;                                                             \
@@ -136,14 +144,139 @@ extern struct nes *NES;
 uint64_t
 nes_time_get()
 {
-    struct timeval tv;
+    return util_now_us();
+}
+
+/*!
+ * Starts or stops the instruction trace. Only ever called from the game loop,
+ * between two rp2a03_run() calls
+ *
+ * @see trace.h
+ */
+static void
+nes_trace_toggle(struct nes *nes)
+{
+    struct rp2a03 *core = nes->core;
 
-    if (gettimeofday(&tv, NULL))
+    if (core->trace)
     {
-        fputs("nes_time_get failed!\n", stderr);
+        // both owned by this thread
+        u64 records = core->trace->head;
+        u64 stalls  = core->trace->stalls;
+
+        trace_close(core->trace);
+        core->trace = NULL;
+        fprintf(stderr,
+                "Trace written to %s, %llu instructions, waited on the "
+                "writer %llu times\n",
+                nes->trace_path, (unsigned long long)records,
+                (unsigned long long)stalls);
+        return;
+    }
+
+    core->trace = trace_open(nes->trace_path);
+    if (core->trace == NULL)
+    {
+        fprintf(stderr, "Can't write trace to %s\n", nes->trace_path);
+    }
+}
+
+/*!
+ * Saves or loads nes->state_path for F5 and F7. Only ever called from the game
+ * loop, between two rp2a03_run() calls
+ *
+ * @see state.h
+ */
+static void
+nes_state(struct nes *nes, u8 request)
+{
+    if (request == NES_STATE_SAVE)
+    {
+        if (state_write(nes, nes->state_path))
+            fprintf(stderr, "State saved to %s\n", nes->state_path);
+        else
+            fprintf(stderr, "Can't save state to %s\n", nes->state_path);
+    }
+    else if (nes->movie)
+    {
+        fprintf(stderr, "Can't load states while a movie runs\n");
+    }
+    else if (nes->netplay)
+    {
+        fprintf(stderr, "Can't load states during netplay\n");
+    }
+    else
+    {
+        if (state_read(nes, nes->state_path))
+            fprintf(stderr, "State loaded from %s\n", nes->state_path);
+        else
+            fprintf(stderr, "Can't load state from %s\n", nes->state_path);
+    }
+}
+
+/*!
+ * Steps back a frame per frame time while r is held, and resumes from there
+ * once it's let go. Only ever called from the game loop
+ *
+ * @see rewind.h
+ *
+ * @returns 1 while rewinding, in place of running the CPU
+ */
+static int
+nes_rewind(struct nes *nes)
+{
+    if (!__atomic_load_n(&nes->rewinding, __ATOMIC_ACQUIRE))
+    {
+        rewind_end(nes->rewind, nes);
         return 0;
     }
-    return 1000000 * tv.tv_sec + tv.tv_usec;
+
+    uint64_t last = nes_time_get();
+    rewind_step(nes->rewind, nes);
+
+    uint64_t busy = nes_time_get() - last;
+    if (busy < NES_FRAME_US)
+    {
+        usleep(NES_FRAME_US - busy);
+    }
+    return 1;
+}
+
+/*
+ * Runs about 1000 CPU cycles, and the PPU along with them, on whichever core
+ * was picked
+ */
+static void
+nes_slice(struct nes *nes)
+{
+    if (!nes->mode_libcpu)
+    {
+        u64 until = nes->core->cycles + 1000;
+        if (nes->netplay)
+        {
+            // frames end on exact cycles, see netplay.h
+            until = MIN(until, nes->netplay->next);
+        }
+        rp2a03_run(nes->core, until);
+        return;
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        PROF_ENTER(PROF_PPU);
+        ppu_clock(nes->ppu);
+        ppu_clock(nes->ppu);
+        ppu_clock(nes->ppu);
+        PROF_LEAVE(PROF_PPU);
+
+        cpu_clock(nes->cpu);
+
+        if (nes->ppu->nmi)
+        {
+            nes->ppu->nmi = 0;
+            cpu_nmi(nes->cpu);
+        }
+    }
 }
 
 /*!
@@ -152,7 +285,8 @@ nes_time_get()
  * Times the loop so that the clock speed of the CPU is 1.79MHz
  *
  * Runs 3 ppu clocks then runs a single CPU clock, as was the timing on the
- * original NES
+ * original NES. The in-tree core does the same interleaving itself, see
+ * rp2a03_run()
  *
  * @see ppu_clock
  *
@@ -165,36 +299,334 @@ nes_game_loop(void *in)
     struct nes *nes = (struct nes *)in;
 
     uint64_t last = 0;
+    uint64_t owed = 0; // us of run-ahead or rollback not yet slept off
 
     while (nes->enable)
     {
+        if (__atomic_exchange_n(&nes->trace_toggle, 0, __ATOMIC_ACQ_REL))
+        {
+            nes_trace_toggle(nes);
+        }
+
+        u8 request = __atomic_exchange_n(&nes->state_request, 0,
+                                         __ATOMIC_ACQ_REL);
+        if (request)
+        {
+            nes_state(nes, request);
+        }
+
+        if (nes->cheats)
+        {
+            cheat_update(nes->cheats, nes);
+        }
+
+        if (nes->rewind && nes_rewind(nes))
+        {
+            continue;
+        }
+
         last = nes_time_get();
         // time 1000 cpu clocks
-        for (int i = 0; i < 1000; i++)
+        PROF_ENTER(PROF_CPU);
+        nes_slice(nes);
+
+        uint64_t ahead = 0;
+        if (nes->runahead)
         {
-            ppu_clock(nes->ppu);
-            ppu_clock(nes->ppu);
-            ppu_clock(nes->ppu);
+            ahead = runahead_frame(nes->runahead, nes);
+        }
+        if (nes->netplay)
+        {
+            ahead = netplay_tick(nes->netplay, nes);
+        }
+        PROF_LEAVE(PROF_CPU);
 
-            cpu_clock(nes->cpu);
+        if (nes->rewind)
+        {
+            rewind_capture(nes->rewind, nes);
+        }
 
-            if (nes->ppu->nmi)
-            {
-                nes->ppu->nmi = 0;
-                cpu_nmi(nes->cpu);
-            }
+        if (nes->movie)
+        {
+            movie_tick(nes->movie, nes);
+        }
+
+        if (nes->ramsearch)
+        {
+            ramsearch_capture(nes->ramsearch, nes);
         }
-        uint64_t sleept = NS_CLOCK - (nes_time_get() - last);
+
+        uint64_t busy   = nes_time_get() - last;
+        uint64_t sleept = NS_CLOCK - (busy - ahead);
         sleept          = MIN(sleept, NS_CLOCK);
+
+        // a burst of run-ahead or rollback takes a lot longer than a slice,
+        // spread it
+        owed += ahead;
+        uint64_t paid = MIN(owed, sleept);
+        owed -= paid;
+        sleept -= paid;
+
+        PROF_ENTER(PROF_SLEEP);
         if (usleep(sleept) != 0)
         {
             printf("usleep error: %d // %s\n", errno, strerror(errno));
         }
+        PROF_LEAVE(PROF_SLEEP);
+
+        stats_add(&nes->stats_emu.busy, busy);
+        stats_add(&nes->stats_emu.sleep, sleept);
+        stats_add(&nes->stats_emu.slept, nes_time_get() - last - busy);
+        stats_add(&nes->stats_emu.sleeps, 1);
     }
 
     return 0;
 }
 
+/*!
+ * Uploads the rows of the screen texture that changed since the last call.
+ * Frames that are identical to the one already uploaded are skipped entirely
+ *
+ * @param nes
+ * @param tex Screen texture
+ * @param screen ARGB staging buffer for the texture
+ * @param seen Presenter's copy of nes->line_gen, with nes->frame_gen appended
+ */
+static void
+nes_present_dirty(struct nes *nes, SDL_Texture *tex, u32 *screen, u32 *seen)
+{
+    nes->stats_present.frames += 1;
+
+    if (seen[NES_HEIGHT] == nes->frame_gen)
+    {
+        nes->stats_present.skipped += 1;
+        return;
+    }
+    seen[NES_HEIGHT] = nes->frame_gen;
+
+    int y = 0;
+    while (y < NES_HEIGHT)
+    {
+        if (seen[y] == nes->line_gen[y])
+        {
+            y++;
+            continue;
+        }
+
+        // upload the whole run of changed rows at once
+        int first = y;
+        while (y < NES_HEIGHT && seen[y] != nes->line_gen[y])
+        {
+            seen[y] = nes->line_gen[y];
+            y++;
+        }
+
+        struct SDL_Rect rect = {
+            .x = 0, .y = first, .w = NES_WIDTH, .h = y - first
+        };
+        u32 *rows = screen + first * NES_WIDTH;
+
+        ppu_frame_to_argb(nes->ppu, nes->pixels, screen, NES_WIDTH * 4,
+                          first, y - first);
+        SDL_UpdateTexture(tex, &rect, rows, NES_WIDTH * 4);
+
+        nes->stats_present.rows += y - first;
+    }
+}
+
+/*!
+ * Uploads the latest filtered frame, if the workers finished a new one. The
+ * frames themselves are submitted by the PPU, see ppu_line_done()
+ *
+ * @param nes
+ * @param tex Filter output texture
+ */
+static void
+nes_present_filter(struct nes *nes, SDL_Texture *tex)
+{
+    struct filter *f   = nes->filter;
+    const u32     *out = filter_fetch(f);
+
+    nes->stats_present.frames += 1;
+
+    if (!out)
+    {
+        nes->stats_present.skipped += 1;
+        return;
+    }
+
+    SDL_UpdateTexture(tex, NULL, out, f->out_w * 4);
+    nes->stats_present.rows += NES_HEIGHT;
+}
+
+/*
+ * Starts the emulation thread, the PPU pipeline and the debugger front end
+ * that were asked for. Shared by the window and the headless loop
+ */
+static SDL_Thread *
+nes_start(struct nes *nes, struct ppu_pipe **pipe)
+{
+    *pipe = NULL;
+    if (nes->mode_pipeline)
+    {
+        *pipe = ppu_pipe_start(nes);
+    }
+
+    SDL_Thread *game =
+      SDL_CreateThread(nes_game_loop, "NES_GAME_LOOP", (void *)nes);
+
+    // init the buttons
+    nes->btns      = 0x00;
+    nes->btn_latch = 0x00;
+
+    if (nes->gdb_port)
+    {
+        debug_create(nes);
+        SDL_CreateThread(gdb_loop, "NES_GDB", (void *)nes);
+    }
+    else if (nes->mode_debug)
+    {
+        debug_create(nes);
+        SDL_CreateThread(nes_debug_loop, "NES_DEBUG_LOOP", (void *)nes);
+    }
+
+    return game;
+}
+
+/*
+ * Joins the emulation thread once nes->enable is cleared, writes out the
+ * trace, code/data log and profile, and frees nes
+ */
+static void
+nes_stop(struct nes *nes, SDL_Thread *game, struct ppu_pipe *pipe)
+{
+    if (nes->debug)
+    {
+        debug_detach(nes->debug);
+    }
+    SDL_WaitThread(game, NULL);
+    if (nes->core->trace)
+    {
+        nes_trace_toggle(nes);
+    }
+    if (pipe)
+    {
+        ppu_pipe_stop(pipe);
+    }
+    if (nes->cdl)
+    {
+        cdl_close(nes);
+    }
+    prof_print(nes);
+    free(nes->prof);
+    if (nes->latency)
+    {
+        lat_close(nes);
+    }
+    if (nes->rewind)
+    {
+        rewind_free(nes->rewind);
+    }
+    if (nes->runahead)
+    {
+        runahead_close(nes);
+    }
+    if (nes->movie)
+    {
+        movie_close(nes);
+    }
+    if (nes->netplay)
+    {
+        netplay_close(nes);
+    }
+    if (nes->ramsearch)
+    {
+        ramsearch_free(nes);
+    }
+    if (nes->cheats)
+    {
+        cheat_free(nes);
+    }
+
+    ppu_free(nes->ppu);
+    free(nes->cpu->mem);
+    free(nes->cpu);
+    free(nes->mappers);
+    free(nes->mapper_writes);
+    rp2a03_free(nes->core);
+    free(nes);
+}
+
+static volatile sig_atomic_t nes_quit;
+
+static void
+nes_on_signal(int sig)
+{
+    nes_quit = 1;
+}
+
+/*!
+ * Runs the emulation without a window until SIGINT or SIGTERM, with a
+ * statistics line on stderr once a second
+ *
+ * @see stats.h
+ */
+void
+nes_headless_loop(struct nes *nes)
+{
+    struct ppu_pipe *pipe;
+    struct stats     stats;
+
+    signal(SIGINT, nes_on_signal);
+    signal(SIGTERM, nes_on_signal);
+
+    SDL_Thread *game = nes_start(nes, &pipe);
+    stats_init(&stats, nes, nes_time_get());
+
+    while (!nes_quit && !movie_over(nes->movie))
+    {
+        usleep(STATS_PERIOD / 10);
+        if (stats_update(&stats, nes, nes_time_get()))
+        {
+            fprintf(stderr, "%s\n", stats.line);
+        }
+    }
+
+    nes->enable = 0;
+    nes_stop(nes, game, pipe);
+}
+
+/*
+ * -b: runs the given number of frames as fast as the host can, on this
+ * thread, with no window, PPU pipeline or sleeping, and prints how long that
+ * took. Meant for comparing the cores: -l against the in-tree one, with or
+ * without -j or -a
+ */
+static void
+nes_bench(struct nes *nes, unsigned frames)
+{
+    u64 cycles = (u64)frames * NES_FRAME_CYCLES;
+    u64 ran    = 0;
+    u64 at     = nes_time_get();
+
+    while (ran < cycles)
+    {
+        u64 before = nes->core->cycles;
+
+        nes_slice(nes);
+        ran += nes->mode_libcpu ? 1000 : nes->core->cycles - before;
+    }
+
+    double secs = (nes_time_get() - at) / 1e6;
+
+    printf("bench core=%s frames=%u s=%.3f fps=%.1f mhz=%.2f\n",
+           nes->mode_libcpu ? "lib6502"
+           : nes->core->aot ? "rp2a03+aot"
+           : nes->core->jit ? "rp2a03+jit"
+                            : "rp2a03",
+           frames, secs, frames / secs, ran / secs / 1e6);
+}
+
 /*!
  * Main window loop for the entire NES program.
  *
@@ -206,7 +638,14 @@ nes_game_loop(void *in)
 void
 nes_window_loop(struct nes *nes)
 {
-    float SCALE         = 2.9f;
+    /*
+     * A filter renders at an integer scale and the window takes the same one,
+     * so SDL only copies its output. Unfiltered frames are stretched
+     */
+    int   fscale        = filter_scale(nes->mode_filter, nes->scale);
+    float SCALE         = nes->mode_filter != FILTER_NONE ? fscale
+                          : nes->scale                    ? nes->scale
+                                                          : 2.9f;
     float WINDOW_HEIGHT = (float)NES_HEIGHT * SCALE;
     float NES_OUT_WIDTH = (float)NES_WIDTH * SCALE;
     int   WINDOW_WIDTH  = NES_OUT_WIDTH;
@@ -245,13 +684,40 @@ nes_window_loop(struct nes *nes)
                                                 NES_WIDTH,
                                                 NES_HEIGHT);
 
+    u32 *screen = malloc(NES_RES * sizeof(u32)); // ARGB copy of nes->pixels
+
+    /*
+     * With a filter, the PPU hands finished frames to the workers and this
+     * loop only uploads what comes back
+     */
+    struct filter *filter  = NULL;
+    SDL_Texture   *tex_out = tex_screen;
+    if (nes->mode_filter != FILTER_NONE)
+    {
+        filter = filter_create(nes->mode_filter, nes->scale,
+                               nes->ppu->pal_emph);
+        tex_out = SDL_CreateTexture(renderer,
+                                    SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_STREAMING,
+                                    filter->out_w,
+                                    filter->out_h);
+        nes->filter = filter;
+
+        fprintf(stderr, "Filter renders at %dx\n", filter->scale);
+    }
+
+    // generations last uploaded, start out stale so the first frame goes up
+    u32 seen[NES_HEIGHT + 1];
+    memset(seen, 0xFF, sizeof(seen));
+
     RECT_DECL(screen, 0, 0, NES_OUT_WIDTH, WINDOW_HEIGHT);
     /*
      * Second thread for actual NES operation
      * The current thread is for SDL only
      */
 
-    SDL_CreateThread(nes_game_loop, "NES_GAME_LOOP", (void *)nes);
+    struct ppu_pipe *pipe;
+    SDL_Thread      *game = nes_start(nes, &pipe);
 
     //
     // Infinite loop timing
@@ -260,14 +726,8 @@ nes_window_loop(struct nes *nes)
     uint64_t last = 0;
     uint64_t now  = 0;
 
-    // init the buttons
-    nes->btns      = 0x00;
-    nes->btn_latch = 0x00;
-
-    if (nes->mode_debug)
-    {
-        SDL_CreateThread(nes_debug_loop, "NES_DEBUG_LOOP", (void *)nes);
-    }
+    struct stats stats;
+    stats_init(&stats, nes, nes_time_get());
 
     for (;;)
     {
@@ -278,6 +738,8 @@ nes_window_loop(struct nes *nes)
 
         while (SDL_PollEvent(&ev))
         {
+            u8 btns = nes->btns;
+
             if (ev.type == SDL_QUIT)
             {
                 nes->enable = 0;
@@ -285,11 +747,42 @@ nes_window_loop(struct nes *nes)
             }
             if (ev.type == SDL_KEYDOWN)
             {
-                BUTTON_AUTOSET(nes->btns, |);
+                BUTTON_AUTOSET(btns, |);
+
+                if (ev.key.keysym.sym == SDLK_i && !ev.key.repeat)
+                {
+                    __atomic_store_n(&nes->trace_toggle, 1, __ATOMIC_RELEASE);
+                }
+                if (ev.key.keysym.sym == SDLK_F5 && !ev.key.repeat)
+                {
+                    __atomic_store_n(&nes->state_request, NES_STATE_SAVE,
+                                     __ATOMIC_RELEASE);
+                }
+                if (ev.key.keysym.sym == SDLK_F7 && !ev.key.repeat)
+                {
+                    __atomic_store_n(&nes->state_request, NES_STATE_LOAD,
+                                     __ATOMIC_RELEASE);
+                }
+                if (ev.key.keysym.sym == SDLK_r)
+                {
+                    __atomic_store_n(&nes->rewinding, 1, __ATOMIC_RELEASE);
+                }
             }
             if (ev.type == SDL_KEYUP)
             {
-                BUTTON_AUTOSET(nes->btns, &~);
+                BUTTON_AUTOSET(btns, &~);
+
+                if (ev.key.keysym.sym == SDLK_r)
+                {
+                    __atomic_store_n(&nes->rewinding, 0, __ATOMIC_RELEASE);
+                }
+            }
+
+            // armed first, so the strobe that latches btns is never missed
+            if (nes->btns != btns)
+            {
+                lat_key(nes->latency, btns);
+                nes->btns = btns;
             }
         }
 
@@ -321,25 +814,42 @@ nes_window_loop(struct nes *nes)
         // Update the PT pixels and textures
         //
 
-        SDL_UpdateTexture(tex_screen, NULL, nes->pixels, NES_WIDTH * 4);
+        if (filter)
+        {
+            nes_present_filter(nes, tex_out);
+        }
+        else
+        {
+            nes_present_dirty(nes, tex_screen, screen, seen);
+        }
 
         //
         // Copy the textures to the renderer
         //
 
-        SDL_RenderCopy(renderer, tex_screen, NULL, &nesrect_screen);
+        SDL_RenderCopy(renderer, tex_out, NULL, &nesrect_screen);
 
+        stats_present(&stats, nes);
         SDL_RenderPresent(renderer);
+        lat_present(nes->latency);
+
+        if (stats_update(&stats, nes, now))
+        {
+            SDL_SetWindowTitle(window, stats.title);
+        }
 
         last = now;
     }
 
 out:
-    ppu_free(nes->ppu);
-    free(nes->cpu->mem);
-    free(nes->cpu);
-    free(nes->mappers);
-    free(nes);
+    nes_stop(nes, game, pipe);
+    if (filter)
+    {
+        nes->filter = NULL;
+        filter_free(filter);
+        SDL_DestroyTexture(tex_out);
+    }
+    free(screen);
 
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -349,7 +859,7 @@ out:
 /*!
  * Entrypoint for the NES emulator
  *
- * Branches to #nes_window_loop
+ * Branches to #nes_window_loop, or #nes_headless_loop with -H
  */
 int
 main(int argc, char **argv)
@@ -357,44 +867,124 @@ main(int argc, char **argv)
     // *******************
     // EMULATOR & CPU INIT
     // *******************
-    struct nes *nes = NES;
-
-    nes               = malloc(sizeof(struct nes));
-    nes->cpu          = malloc(sizeof(struct cpu));
-    nes->ppu          = malloc(sizeof(struct ppu));
-    nes->cpu->mem     = malloc(MEM_SIZE);
-    nes->mappers      = malloc(0xFF * sizeof(void *));
-    nes->offs         = 0;
-    nes->cpu->echooff = 0;
-    nes->enable       = 1;
-    nes->cycle        = 0;
-
-    nes->cpu->cpu_read  = nes_cpu_read;
-    nes->cpu->cpu_write = nes_cpu_write;
-
-    nes->cpu->fw = nes;
-    nes->ppu->fw = nes;
-
-    memset(nes->cpu->mem, 0, MEM_SIZE);
-
-    mappers_init(nes);
-    ppu_init(nes->ppu);
+    struct nes *nes = rom_create();
 
     // ********
     // LOAD ROM
     // ********
 
-    int opt;
-
-    while ((opt = getopt(argc, argv, "d")) != -1)
+    int         opt;
+    const char *aot       = NULL;
+    const char *cdl       = NULL;
+    unsigned    sample    = 1;
+    unsigned    rewind_mb = 0;
+    unsigned    ahead     = 0;
+    unsigned    bench     = 0;
+    const char *movie     = NULL;
+    u8          play      = 0;
+    const char *netplay   = NULL;
+    const char *filter    = "none";
+    const char *codes[CHEAT_MAX];
+    unsigned    ncodes = 0;
+
+    nes->trace_path = "nes.trace";
+    nes->state_path = "nes.state";
+
+    while ((opt = getopt(argc, argv, "A:a:b:c:df:g:G:HjlLm:M:N:pP:R:s:t:")) !=
+           -1)
     {
         switch (opt)
         {
+            case 'A':
+                ahead = MAX(atoi(optarg), 1);
+                break;
+            case 'a':
+                aot = optarg;
+                break;
+            case 'b':
+                bench = MAX(atoi(optarg), 1);
+                break;
+            case 'c':
+                cdl = optarg;
+                break;
             case 'd':
                 nes->mode_debug = 1;
                 break;
+            case 'f':
+                opt = filter_parse(optarg);
+                if (opt < 0)
+                {
+                    fprintf(stderr, "Unknown filter: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                nes->mode_filter = opt;
+                filter           = optarg;
+                break;
+            case 'g':
+                nes->gdb_port = atoi(optarg);
+                break;
+            case 'G':
+                if (ncodes == CHEAT_MAX)
+                {
+                    fprintf(stderr, "At most %d cheats\n", CHEAT_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                codes[ncodes++] = optarg;
+                break;
+            case 'H':
+                nes->mode_headless = 1;
+                break;
+            case 'j':
+                nes->mode_jit = 1;
+                break;
+            case 'l':
+                nes->mode_libcpu = 1;
+                break;
+            case 'L':
+                lat_init(nes);
+                break;
+            case 'm':
+            case 'M':
+                movie = optarg;
+                play  = opt == 'M';
+                break;
+            case 'N':
+                netplay = optarg;
+                break;
+            case 'p':
+                nes->mode_pipeline = 1;
+                break;
+            case 'P':
+#ifndef NES_PROF
+                fprintf(stderr, "Built without NES_PROF, -P does nothing\n");
+#endif
+                sample = MAX(atoi(optarg), 1);
+                break;
+            case 'R':
+                rewind_mb = MAX(atoi(optarg), 1);
+                break;
+            case 's':
+                opt = atoi(optarg);
+                if (opt < 1 || opt > 8)
+                {
+                    fprintf(stderr, "-s takes a scale from 1 to 8\n");
+                    exit(EXIT_FAILURE);
+                }
+                nes->scale = opt;
+                break;
+            case 't':
+                nes->trace_path   = optarg;
+                nes->trace_toggle = 1;
+                break;
             default: /* '?' */
-                fprintf(stderr, "Usage: %s [-t nsecs] [-n] name\n", argv[0]);
+                fprintf(stderr,
+                        "Usage: %s [-A frames] [-a aotdir] [-b frames] "
+                        "[-c cdlfile] [-d] "
+                        "[-f none|nearest|scale2x|ntsc] [-g port] [-G code] "
+                        "[-H] [-j] [-l] [-L] [-m|-M movie] "
+                        "[-N player:port:host:port] [-p] [-P sample] "
+                        "[-R megabytes] [-s scale] [-t tracefile] <filename>\n",
+                        argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -405,59 +995,131 @@ main(int argc, char **argv)
         return 1;
     }
 
-    struct
+    if (!filter_scale(nes->mode_filter, nes->scale))
     {
-        u8 name[4]; // useless
-        u8 s_prg_rom_16;
-        u8 s_chr_rom_8;
-        u8 flags6;
-        u8 flags7;
-        u8 flags8;
-        u8 flags9;
-        u8 flags10;
-        u8 padding[5];
-    } header_rom;
+        fprintf(stderr,
+                "-f %s can't render at -s %d (nearest takes 1-4, scale2x and "
+                "ntsc only 2)\n",
+                filter, nes->scale);
+        return 1;
+    }
 
-    FILE *file = fopen(argv[1], "rb");
-    if (file == NULL)
+    if (!rom_load(nes, argv[optind]))
     {
-        printf("File open failed\n");
         return 1;
     }
 
-    // read INES header
-    fread(&header_rom, 16, 1, file);
-    nes->cartridge.mapper =
-      (header_rom.flags7 & 0xF0) | (header_rom.flags6 >> 0x04);
-    nes->mirror =
-      (header_rom.flags6 & 0x01) > 0 ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+    if (nes->mode_jit && !rp2a03_jit_init(nes->core))
+    {
+        fprintf(stderr, "No JIT for this platform, interpreting\n");
+    }
 
-    if (header_rom.flags6 & 0x04)
+    if (aot && !rp2a03_aot_load(nes->core, aot))
     {
-        fseek(file, 512, SEEK_CUR); // skip trainer
+        fprintf(stderr, "No AOT module for this ROM in %s\n", aot);
     }
 
+    if ((nes->gdb_port || nes->mode_debug) && nes->mode_libcpu)
+    {
+        fprintf(stderr, "The debugger needs the in-tree core, not -l\n");
+    }
 
-    nes->cartridge.s_prg_rom_16 = header_rom.s_prg_rom_16;
-    nes->cartridge.s_chr_rom_8  = header_rom.s_chr_rom_8;
+    if (cdl && !cdl_open(nes, cdl))
+    {
+        fprintf(stderr, "%s isn't a code/data log for this ROM\n", cdl);
+        return 1;
+    }
 
-    int sprg = nes->cartridge.s_prg_rom_16 * 0x4000;
-    int schr = nes->cartridge.s_chr_rom_8 * 0x2000;
+    prof_init(nes, sample);
 
-    nes->cartridge.chr = malloc(schr);
-    nes->cartridge.prg = malloc(sprg);
+    // searched from the debugger console
+    if (nes->mode_debug)
+    {
+        ramsearch_create(nes);
+    }
 
-    fread(nes->cartridge.prg, sprg, 1, file);
-    fread(nes->cartridge.chr, schr, 1, file);
+    // movies only hold the buttons, a cheat would make them play back wrong
+    if (movie && ncodes)
+    {
+        fprintf(stderr, "Movies can't be combined with -G\n");
+        return 1;
+    }
+
+    // in effect from the reset vector on, and edited from the console
+    if ((ncodes || (nes->mode_debug && !movie)) && !cheat_create(nes) &&
+        ncodes)
+    {
+        fprintf(stderr, "Cheats need the in-tree core, not -l\n");
+        return 1;
+    }
+    for (unsigned i = 0; i < ncodes; i++)
+    {
+        if (!cheat_add(nes->cheats, codes[i]))
+        {
+            fprintf(stderr, "Not a Game Genie or AAAA[?CC]:VV code: %s\n",
+                    codes[i]);
+            return 1;
+        }
+    }
+    if (nes->cheats)
+    {
+        cheat_update(nes->cheats, nes);
+    }
+
+    if (rewind_mb && !rewind_create(nes, (u64)rewind_mb << 20))
+    {
+        fprintf(stderr, "Rewind needs the in-tree core and no -p\n");
+    }
+
+    if (ahead && !runahead_create(nes, ahead))
+    {
+        fprintf(stderr, "Run-ahead needs the in-tree core and no -p\n");
+    }
 
     cpu_reset(nes->cpu);
+    rp2a03_reset(nes->core);
+
+    if (movie && (nes->rewind || nes->runahead))
+    {
+        fprintf(stderr, "Movies can't be combined with -A or -R\n");
+        return 1;
+    }
 
-    fclose(file);
+    // records from power on, or plays from wherever the movie starts
+    if (movie && !movie_open(nes, movie, play))
+    {
+        return 1;
+    }
+
+    if (netplay && (movie || nes->rewind || nes->runahead))
+    {
+        fprintf(stderr, "Netplay can't be combined with -A, -m, -M or -R\n");
+        return 1;
+    }
+
+    // both sides start from power on
+    if (netplay && !netplay_open(nes, netplay))
+    {
+        return 1;
+    }
+
+    if (bench)
+    {
+        nes_bench(nes, bench);
+        return 0;
+    }
 
     // ************
     // START WINDOW
     // ************
-    nes_window_loop(nes);
+    if (nes->mode_headless)
+    {
+        nes_headless_loop(nes);
+    }
+    else
+    {
+        nes_window_loop(nes);
+    }
 
     return 0;
 }
@@ -29,9 +29,16 @@
 
 #include <nes.h>
 #include "ppu.h"
+#include "ppupipe.h"
 #include "util.h"
 
 #include "mapper.h"
+#include "prof.h"
+#include "stats.h"
+#include "latency.h"
+#include "movie.h"
+#include "netplay.h"
+#include "clone.h"
 
 #define CPU    cpu
 #define PC     CPU->PC
@@ -46,9 +53,10 @@
 #define DBG_FLAG(flag) GETFLAG(CPU, flag) ? #flag[sizeof(#flag) - 2] : '-'
 
 u8
-nes_cpu_read(struct cpu *cpu, u16 addr)
+nes_bus_read(struct nes *em, u16 addr)
 {
-    struct nes *em = (struct nes *)CPU->fw;
+    struct cpu *cpu = em->cpu;
+
     IFINRANGE(addr, 0x0000, 0x1FFF) //
     {
         return *(MM + (addr & 0x07FF));
@@ -59,27 +67,32 @@ nes_cpu_read(struct cpu *cpu, u16 addr)
         return ppu_cpu_read(em->ppu, addr);
     }
 
-    if (addr == 0x4016)
+    if (addr == 0x4016 || addr == 0x4017)
     {
-        u8 r   = *(MM + addr);
-        u8 tmp = (em->btn_latch & 0x80) > 0;
+        u8 *latch = addr == 0x4016 ? &em->btn_latch : &em->btn_latch2;
+        u8  r     = *(MM + addr);
+        u8  tmp   = (*latch & 0x80) > 0;
         r &= 0xE0;
         r |= (tmp);
-        em->btn_latch <<= 1;
-        em->btn_latch |= tmp;
+        *latch <<= 1;
+        *latch |= tmp;
 
         return r;
     }
 
-    return *MAP_CALL(em, em->cartridge.mapper, addr, MM, MAP_MODE_CPU);
+    PROF_ENTER(PROF_MAPPER);
+    u8 *p = MAP_CALL(em, em->cartridge.mapper, addr, MM, MAP_MODE_CPU);
+    PROF_LEAVE(PROF_MAPPER);
+
+    return *p;
 }
 
 void
-nes_cpu_write(struct cpu *cpu, u16 addr, u8 val)
+nes_bus_write(struct nes *em, u16 addr, u8 val)
 {
-    u8 *mem = MM;
+    struct cpu *cpu = em->cpu;
+    u8         *mem = MM;
 
-    struct nes *em = (struct nes *)CPU->fw;
     IFINRANGE(addr, 0x0000, 0x1FFF) //
     {
         mem += (addr & 0x07FF);
@@ -100,27 +113,84 @@ nes_cpu_write(struct cpu *cpu, u16 addr, u8 val)
 
         struct ppu *ppu = em->ppu;
 
+        PROF_ENTER(PROF_DMA);
+
         u16 hi = 0x0000 | val;
         hi <<= 8;
         u16 i;
         for (i = 0; i <= 0xFF; i++)
         {
-            ppu->oam[(i + ppu->registers.oamaddr) & 0xFF] = nes_cpu_read(CPU, hi | i);
+            u8 idx = (i + ppu->registers.oamaddr) & 0xFF;
+
+            ppu->oam[idx] = nes_bus_read(em, hi | i);
+            if (ppu->pipe)
+            {
+                ppu_pipe_log(ppu->pipe, ppu->dot, PPU_PIPE_OAM, idx,
+                             ppu->oam[idx]);
+            }
         }
-        
+
+        PROF_LEAVE(PROF_DMA);
+
         // Takes a few cycles to do this, so just delay things
-        cpu->cycles += 513 + ((em->cycle & 1) == 1 ? 1 : 0);
+        em->dma_stall = 513 + ((em->cycle & 1) == 1 ? 1 : 0);
+        stats_add(&em->stats_emu.stalled, em->dma_stall);
         return;
     }
     else if (addr == 0x4016 && (val & 0x01) == 0x00)
     {
-        em->btn_latch = em->btns;
+        if (em->netplay)
+        {
+            em->btn_latch  = em->netplay->pads[0];
+            em->btn_latch2 = em->netplay->pads[1];
+        }
+        else
+        {
+            em->btn_latch = em->movie ? movie_strobe(em->movie, em->btns)
+                                      : em->btns;
+        }
+        // the probe waits for the keyboard, which drives the local pad
+        lat_latch(em->latency, em->netplay
+                                 ? em->netplay->pads[em->netplay->player]
+                                 : em->btn_latch);
         return;
     }
     else
     { //
+        PROF_ENTER(PROF_MAPPER);
+        if (em->mapper_writes[em->cartridge.mapper] &&
+            MAP_WRITE_CALL(em, em->cartridge.mapper, addr, val))
+        {
+            // banks and mirroring have to change on the same dot for the
+            // replica, see ppupipe.h
+            if (em->ppu->pipe)
+            {
+                ppu_pipe_mapper(em->ppu->pipe, em, em->ppu->dot);
+            }
+            PROF_LEAVE(PROF_MAPPER);
+            return;
+        }
         mem = MAP_CALL(em, em->cartridge.mapper, addr, mem, MAP_MODE_CPU);
+        PROF_LEAVE(PROF_MAPPER);
     }
 
+    if (em->mark) clone_touch(em->mark, mem);
     *mem = val;
 }
+
+u8
+nes_cpu_read(struct cpu *cpu, u16 addr)
+{
+    return nes_bus_read((struct nes *)CPU->fw, addr);
+}
+
+void
+nes_cpu_write(struct cpu *cpu, u16 addr, u8 val)
+{
+    struct nes *em = (struct nes *)CPU->fw;
+
+    nes_bus_write(em, addr, val);
+
+    CYCLES += em->dma_stall;
+    em->dma_stall = 0;
+}
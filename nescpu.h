@@ -70,4 +70,27 @@ nes_cpu_read(struct cpu *cpu, u16 addr);
 void
 nes_cpu_write(struct cpu *cpu, u16 addr, u8 val);
 
+/*!
+ * Reads a byte from the NES bus: RAM, PPU and I/O registers, then whatever the
+ * mapper puts at addr. Shared by both CPU cores
+ *
+ * @param nes
+ * @param addr 16-bit address to be read
+ *
+ * @returns 8-bit value stored in memory at addr
+ */
+u8
+nes_bus_read(struct nes *nes, u16 addr);
+
+/*!
+ * Writes a byte to the NES bus. An OAM DMA leaves the number of cycles the CPU
+ * has to be stalled for in nes->dma_stall
+ *
+ * @param nes
+ * @param addr 16-bit address to be written to
+ * @param val 8-bit value to be written
+ */
+void
+nes_bus_write(struct nes *nes, u16 addr, u8 val);
+
 #endif // NES_CPU_H_
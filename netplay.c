@@ -0,0 +1,418 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "netplay.h"
+#include "ppu.h"
+#include "rp2a03.h"
+#include "stats.h"
+#include "util.h"
+
+/*
+ * Opens the socket and fills in the link of np from spec
+ */
+static int
+netplay_link(struct netplay *np, const char *spec)
+{
+    char host[256];
+    int  player, port, peer, delay = 0, loss = 0;
+
+    int n = sscanf(spec, "%d:%d:%255[^:]:%d:%d:%d", &player, &port, host,
+                   &peer, &delay, &loss);
+    if (n < 4 || player < 1 || player > 2 || port <= 0 || port > 0xFFFF ||
+        peer <= 0 || peer > 0xFFFF || delay < 0 || loss < 0 || loss > 100)
+    {
+        fprintf(stderr, "Bad netplay spec %s, want "
+                        "player:port:host:port[:delay[:loss]]\n",
+                spec);
+        return 0;
+    }
+
+    struct addrinfo  hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo *res;
+
+    if (getaddrinfo(host, NULL, &hints, &res) != 0)
+    {
+        fprintf(stderr, "Can't resolve %s\n", host);
+        return 0;
+    }
+
+    np->peer          = *(struct sockaddr_in *)res->ai_addr;
+    np->peer.sin_port = htons(peer);
+    freeaddrinfo(res);
+
+    struct sockaddr_in self = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    np->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (np->fd < 0 || bind(np->fd, (struct sockaddr *)&self, sizeof(self)))
+    {
+        fprintf(stderr, "Can't bind UDP port %d: %s\n", port,
+                strerror(errno));
+        if (np->fd >= 0) close(np->fd);
+        return 0;
+    }
+    fcntl(np->fd, F_SETFL, fcntl(np->fd, F_GETFL) | O_NONBLOCK);
+
+    np->player = player - 1;
+    np->delay  = delay * 1000;
+    np->loss   = loss;
+    np->seed   = port;
+
+    return 1;
+}
+
+struct netplay *
+netplay_open(struct nes *nes, const char *spec)
+{
+    if (nes->mode_libcpu || nes->mode_pipeline)
+    {
+        fprintf(stderr, "Netplay needs the in-tree core and no -p\n");
+        return NULL;
+    }
+
+    struct netplay *np = calloc(1, sizeof(struct netplay));
+
+    if (!netplay_link(np, spec))
+    {
+        free(np);
+        return NULL;
+    }
+
+    // frame 0 runs with no buttons on either side, there's nothing to predict
+    np->rom       = nes->cartridge.hash;
+    np->base      = nes->core->cycles;
+    np->next      = np->base + NES_FRAME_CYCLES;
+    np->confirmed = 1;
+    np->acked     = 1;
+    np->rollback  = NETPLAY_NONE;
+    state_save(nes, &np->states[0]);
+
+    nes->netplay = np;
+    return np;
+}
+
+void
+netplay_close(struct nes *nes)
+{
+    struct netplay *np = nes->netplay;
+
+    fprintf(stderr,
+            "Netplay over %u frames: %llu rollbacks, %.2f frames deep on "
+            "average, %llu at most\n",
+            np->frame, (unsigned long long)np->rollbacks,
+            np->rollbacks ? (double)np->depth / np->rollbacks : 0.0,
+            (unsigned long long)np->depth_max);
+    fprintf(stderr,
+            "Re-simulating: %.3f ms per frame, %.2f ms per rollback, %.2f ms "
+            "at most. Stalled %.2f s, waited %llu frames\n",
+            np->frame ? np->resim / 1e3 / np->frame : 0.0,
+            np->rollbacks ? np->resim / 1e3 / np->rollbacks : 0.0,
+            np->resim_max / 1e3, np->stalled / 1e6,
+            (unsigned long long)np->waits);
+    fprintf(stderr, "Packets: %llu sent, %llu lost, %llu received\n",
+            (unsigned long long)np->sent, (unsigned long long)np->lost,
+            (unsigned long long)np->received);
+
+    close(np->fd);
+    free(np);
+    nes->netplay = NULL;
+}
+
+/*
+ * Sends the packets the injected delay held back long enough
+ */
+static void
+netplay_flush(struct netplay *np, u64 now)
+{
+    while (np->q_count && np->queue[np->q_head].due <= now)
+    {
+        struct netplay_delayed *d = &np->queue[np->q_head];
+
+        sendto(np->fd, &d->pkt, d->len, 0, (struct sockaddr *)&np->peer,
+               sizeof(np->peer));
+        np->q_head = (np->q_head + 1) % NETPLAY_QUEUE;
+        np->q_count -= 1;
+    }
+}
+
+/*
+ * Sends every local input the peer doesn't have yet, up to the running frame
+ */
+static void
+netplay_send(struct netplay *np)
+{
+    struct netplay_packet p;
+    u64                   now = util_now_us();
+
+    p.magic = NETPLAY_MAGIC;
+    p.frame = np->frame;
+    p.rom   = np->rom;
+    p.first = np->acked;
+    p.ack   = np->confirmed;
+    p.lead  = (int32_t)(np->frame - np->heard);
+    p.count = np->frame + 1 - np->acked;
+    for (u32 i = 0; i < p.count; i++)
+    {
+        p.inputs[i] = np->local[(p.first + i) % NETPLAY_RING];
+    }
+
+    u32 len = offsetof(struct netplay_packet, inputs) + p.count;
+
+    np->sent_at = now;
+    np->sent += 1;
+
+    if (np->loss && (u32)rand_r(&np->seed) % 100 < np->loss)
+    {
+        np->lost += 1;
+    }
+    else if (np->delay == 0)
+    {
+        sendto(np->fd, &p, len, 0, (struct sockaddr *)&np->peer,
+               sizeof(np->peer));
+    }
+    else if (np->q_count == NETPLAY_QUEUE)
+    {
+        np->lost += 1;
+    }
+    else
+    {
+        struct netplay_delayed *d =
+          &np->queue[(np->q_head + np->q_count) % NETPLAY_QUEUE];
+
+        d->due = now + np->delay;
+        d->len = len;
+        memcpy(&d->pkt, &p, len);
+        np->q_count += 1;
+    }
+}
+
+/*
+ * Takes in every packet waiting, and notes the oldest frame that ran with an
+ * input other than the one that arrived for it
+ */
+static void
+netplay_recv(struct netplay *np)
+{
+    struct netplay_packet p;
+    ssize_t               len;
+
+    netplay_flush(np, util_now_us());
+
+    while ((len = recv(np->fd, &p, sizeof(p), 0)) > 0)
+    {
+        if (len < (ssize_t)offsetof(struct netplay_packet, inputs) ||
+            p.magic != NETPLAY_MAGIC || p.count > NETPLAY_RING ||
+            len < (ssize_t)offsetof(struct netplay_packet, inputs) + p.count)
+        {
+            continue;
+        }
+        if (p.rom != np->rom)
+        {
+            if (!np->warned) fprintf(stderr, "Netplay peer runs another ROM\n");
+            np->warned = 1;
+            continue;
+        }
+
+        np->received += 1;
+        np->acked = MAX(np->acked, p.ack);
+        if (p.frame >= np->heard)
+        {
+            np->heard = p.frame;
+            np->lead  = p.lead;
+        }
+
+        // only in order, anything after a gap comes again
+        for (u32 i = 0; i < p.count; i++)
+        {
+            u32 f = p.first + i;
+            u8  v = p.inputs[i];
+
+            if (f != np->confirmed)
+            {
+                continue;
+            }
+
+            np->remote[f % NETPLAY_RING] = v;
+            np->confirmed += 1;
+
+            if (f < np->frame && np->used[f % NETPLAY_RING] != v)
+            {
+                np->rollback = MIN(np->rollback, f);
+            }
+        }
+    }
+}
+
+/*
+ * Sets the controllers for frame f, guessing the peer held on to its last
+ * input if it isn't known yet
+ */
+static void
+netplay_pads(struct netplay *np, u32 f)
+{
+    u8 remote = f < np->confirmed
+                  ? np->remote[f % NETPLAY_RING]
+                  : np->remote[(np->confirmed - 1) % NETPLAY_RING];
+
+    np->used[f % NETPLAY_RING] = remote;
+    np->pads[np->player]       = np->local[f % NETPLAY_RING];
+    np->pads[!np->player]      = remote;
+}
+
+/*
+ * Runs every frame from the oldest one mispredicted up to the running one
+ * again, and starts the running one over
+ */
+static u64
+netplay_resim(struct netplay *np, struct nes *nes)
+{
+    struct rp2a03 *c    = nes->core;
+    struct ppu    *ppu  = nes->ppu;
+    u64            at   = util_now_us();
+    u64            dot  = ppu->dot;
+    u32            from = np->rollback;
+
+    state_load(nes, &np->states[from % NETPLAY_WINDOW]);
+    ppu_set_hidden(ppu, 1);
+
+    for (u32 f = from; f < np->frame; f++)
+    {
+        if (f > from)
+        {
+            state_save(nes, &np->states[f % NETPLAY_WINDOW]);
+        }
+        if (f == np->frame - 1)
+        {
+            ppu_set_hidden(ppu, 0);
+        }
+
+        netplay_pads(np, f);
+        rp2a03_run(c, np->base + (u64)(f + 1) * NES_FRAME_CYCLES);
+    }
+
+    // frames run again don't count as emulated, see stats.h
+    __atomic_store_n(&ppu->dot, dot, __ATOMIC_RELAXED);
+
+    u64 us    = util_now_us() - at;
+    u32 depth = np->frame - from;
+
+    np->rollback = NETPLAY_NONE;
+    np->rollbacks += 1;
+    np->depth += depth;
+    np->depth_max = MAX(np->depth_max, depth);
+    np->resim += us;
+    np->resim_max = MAX(np->resim_max, us);
+    stats_add(&nes->stats_emu.resim, us);
+
+    return us;
+}
+
+/*
+ * Waits a little for packets, resending the local inputs every
+ * NETPLAY_RESEND us
+ */
+static void
+netplay_wait(struct netplay *np)
+{
+    struct pollfd pfd = {.fd = np->fd, .events = POLLIN};
+
+    if (util_now_us() - np->sent_at >= NETPLAY_RESEND)
+    {
+        netplay_send(np);
+    }
+    poll(&pfd, 1, 1);
+    netplay_recv(np);
+}
+
+/*
+ * Whether the running frame is too far ahead of the peer to go on. Only the
+ * last NETPLAY_WINDOW frames can be rolled back to, and only NETPLAY_RING
+ * inputs fit in a packet. The peer can be ahead as well
+ */
+static int
+netplay_ahead(struct netplay *np)
+{
+    return (int32_t)(np->frame - np->confirmed) >= NETPLAY_WINDOW - 1 ||
+           (int32_t)(np->frame - np->acked) >= NETPLAY_RING - 1;
+}
+
+u64
+netplay_frame(struct netplay *np, struct nes *nes)
+{
+    u64 us = 0;
+    u32 f  = np->frame + 1;
+
+    np->frame = f;
+    np->next  = np->base + (u64)(f + 1) * NES_FRAME_CYCLES;
+    np->local[f % NETPLAY_RING] = __atomic_load_n(&nes->btns, __ATOMIC_RELAXED);
+
+    netplay_recv(np);
+
+    if (netplay_ahead(np))
+    {
+        u64 at = util_now_us();
+        while (nes->enable && netplay_ahead(np))
+        {
+            netplay_wait(np);
+        }
+        np->stalled += util_now_us() - at;
+    }
+
+    netplay_send(np);
+
+    if (np->rollback != NETPLAY_NONE)
+    {
+        us = netplay_resim(np, nes);
+    }
+
+    netplay_pads(np, f);
+    state_save(nes, &np->states[f % NETPLAY_WINDOW]);
+
+    // both sides see themselves ahead by the link's latency, anything over
+    // that is one running faster than the other
+    int32_t lead = (int32_t)(f - np->heard);
+    if (f % NETPLAY_SYNC == 0 && (lead - np->lead) / 2 >= 1)
+    {
+        np->waits += 1;
+        usleep(NES_FRAME_US);
+    }
+
+    return us;
+}
+
+void
+netplay_sync(struct netplay *np, struct nes *nes)
+{
+    netplay_recv(np);
+    while (nes->enable &&
+           (np->confirmed < np->frame || np->acked < np->frame))
+    {
+        netplay_wait(np);
+    }
+
+    if (np->rollback != NETPLAY_NONE)
+    {
+        netplay_resim(np, nes);
+        netplay_pads(np, np->frame);
+        state_save(nes, &np->states[np->frame % NETPLAY_WINDOW]);
+    }
+
+    u64 at = util_now_us();
+    while (nes->enable && util_now_us() - at < NETPLAY_LINGER)
+    {
+        netplay_wait(np);
+    }
+}
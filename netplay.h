@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_NETPLAY_H_
+#define NES_NETPLAY_H_
+
+/*! @file netplay.h
+ * Rollback netplay
+ *
+ * With -N, two instances play the same ROM from power on, each driving one
+ * controller from its keyboard. Time is cut into frames of NES_FRAME_CYCLES
+ * CPU cycles, counted from the cycle netplay started at, and the controllers
+ * only change where one frame ends and the next starts. As the core always
+ * stops on the first instruction at or past the cycle it runs to, whatever
+ * the slices in between, each frame is a pure function of the state at its
+ * start and the two inputs it runs with.
+ *
+ * At the start of every frame the game loop saves the machine, sends the
+ * local inputs the peer hasn't acknowledged yet in one UDP packet, and runs
+ * the frame with the last input heard from the peer for every frame it
+ * hasn't heard of yet. When an input arrives that differs from the one a
+ * frame ran with, the machine is loaded back to the start of that frame and
+ * every frame since is run again hidden (see ppu_set_hidden()), drawing only
+ * the last. A frame can run at most NETPLAY_WINDOW - 1 frames ahead of the
+ * peer's inputs. Past that the game loop stalls until they arrive, resending
+ * its own inputs meanwhile, so a packet that is lost costs a few frames of
+ * rollback instead of a desync.
+ *
+ * Each packet also carries how far the sender thinks it is ahead of its
+ * peer. When this side is further ahead than the peer by two frames or more,
+ * it waits a frame now and then so the other side can catch up, rather than
+ * rolling back every frame.
+ *
+ * For testing on one machine, every packet sent can be delayed by a fixed
+ * time and dropped at random. The time re-simulating shows as resim= on the
+ * stats line (see stats.h), and rollback depth and cost are summed up on
+ * exit. tools/nesnet plays two instances against each other over loopback
+ * and checks that both end in the same state as a plain run.
+ *
+ * Packets are struct netplay_packet in host byte order. Needs the in-tree
+ * core and no -p, like save states, and the machine can't be changed from
+ * outside while it runs: no movie, rewind, run-ahead or loading states.
+ */
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#include "rp2a03.h"
+#include "state.h"
+
+#define NETPLAY_MAGIC  0x504E454E //!< "NENP"
+#define NETPLAY_WINDOW 16         //!< States kept, one more than the lead
+#define NETPLAY_RING   64         //!< Inputs kept, the most sent at once
+#define NETPLAY_QUEUE  256        //!< Packets held back by the injected delay
+#define NETPLAY_RESEND 5000       //!< us between two packets while stalled
+#define NETPLAY_LINGER 250000     //!< us netplay_sync() keeps answering for
+#define NETPLAY_SYNC   30         //!< Frames between two checks of the lead
+#define NETPLAY_NONE   0xFFFFFFFF //!< No frame ran on a wrong prediction
+
+struct netplay_packet
+{
+    u32     magic; //!< NETPLAY_MAGIC
+    u32     frame; //!< Frame the sender is running
+    u64     rom;   //!< nes->cartridge.hash
+    u32     first; //!< Frame of inputs[0]
+    u32     ack;   //!< Frames of the receiver's inputs the sender has
+    int32_t lead;  //!< Sender's frame minus the newest frame it heard of
+    u16     count; //!< Bytes in inputs, the rest isn't sent
+    u8      inputs[NETPLAY_RING];
+};
+
+struct netplay_delayed
+{
+    u64                   due; //!< us
+    u32                   len;
+    struct netplay_packet pkt;
+};
+
+/*!
+ * @struct netplay
+ * Both sides' inputs, the states to roll back to, and the link to the peer
+ */
+struct netplay
+{
+    int                fd;
+    struct sockaddr_in peer;
+    u8                 player; //!< Controller the keyboard drives, 0 or 1
+    u32                delay;  //!< us added to every packet sent
+    u32                loss;   //!< Percent of packets dropped
+    unsigned           seed;   //!< rand_r() state of the loss
+    u64                rom;    //!< nes->cartridge.hash
+
+    u64     base;      //!< CPU cycle frame 0 started at
+    u64     next;      //!< CPU cycle the running frame ends at
+    u32     frame;     //!< Frame running
+    u32     confirmed; //!< Remote inputs known, all frames before this one
+    u32     acked;     //!< Local inputs the peer has, same
+    u32     heard;     //!< Newest frame the peer said it was running
+    int32_t lead;      //!< Peer's lead, from its last packet
+    u32     rollback;  //!< Oldest frame run on a wrong input, or NETPLAY_NONE
+    u8      warned;    //!< Said that the peer runs another ROM
+
+    u8 pads[2]; //!< Controllers for the running frame, latched at strobes
+
+    u8 local[NETPLAY_RING];  //!< Frame f at f % NETPLAY_RING
+    u8 remote[NETPLAY_RING]; //!< Same, valid before confirmed
+    u8 used[NETPLAY_RING];   //!< Remote input each frame last ran with
+
+    struct state states[NETPLAY_WINDOW]; //!< At the start of each frame
+
+    struct netplay_delayed queue[NETPLAY_QUEUE];
+    u32                    q_head;
+    u32                    q_count;
+    u64                    sent_at; //!< us, last packet sent
+
+    u64 rollbacks;
+    u64 depth;     //!< Frames re-simulated
+    u64 depth_max;
+    u64 resim;     //!< us
+    u64 resim_max; //!< us
+    u64 stalled;   //!< us waiting for the peer's inputs
+    u64 waits;     //!< Frames waited for the peer to catch up
+    u64 sent;
+    u64 lost; //!< Dropped on purpose, or by a full queue
+    u64 received;
+};
+
+/*!
+ * Parses spec, player:port:host:port[:delay[:loss]], binds the first port,
+ * starts frame 0 and stores the netplay in nes->netplay. player is 1 or 2,
+ * delay is in ms and loss in percent. Called right after power on, the
+ * same on both sides
+ *
+ * @returns NULL if spec or the machine can't be used, see stderr
+ */
+struct netplay *
+netplay_open(struct nes *nes, const char *spec);
+
+/*!
+ * Prints rollback depth and cost to stderr, closes the socket and frees
+ * nes->netplay. Called once the game loop stopped
+ */
+void
+netplay_close(struct nes *nes);
+
+/*
+ * Starts the next frame, see netplay_tick()
+ */
+u64
+netplay_frame(struct netplay *np, struct nes *nes);
+
+/*!
+ * Waits until both sides have all inputs before the running frame and rolls
+ * back if that was mispredicted, so the machine is where a plain run with the
+ * same inputs would be. Then keeps answering the peer for NETPLAY_LINGER us,
+ * so it can do the same
+ */
+void
+netplay_sync(struct netplay *np, struct nes *nes);
+
+/*!
+ * Called by the game loop between two CPU slices, which never run past
+ * np->next. Starts the next frame once the running one is over
+ *
+ * @returns us spent re-simulating, 0 if nothing was rolled back
+ */
+static inline u64
+netplay_tick(struct netplay *np, struct nes *nes)
+{
+    return nes->core->cycles >= np->next ? netplay_frame(np, nes) : 0;
+}
+
+#endif // NES_NETPLAY_H_
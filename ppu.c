@@ -25,11 +25,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include <cpu.h>
 #include <em6502.h>
 
 #include "ppu.h"
+#include "ppupipe.h"
 #include "mapper.h"
+#include "cdl.h"
+#include "clone.h"
+#include "filter.h"
+#include "prof.h"
+#include "latency.h"
 #include "util.h"
 
 #define PAL                ppu->pal
@@ -39,10 +49,21 @@
 #define PCOLREAD(_pal, _pix)                                                   \
     PAL[ppu_read(ppu, 0x3F00 + ((_pal) << 0x02) + _pix)]
 
+#define PPU_EMPH_ATTN 0.816328f // NTSC color emphasis attenuation
+
 #define PPUFLAG(_ppu, _reg, _flag)    ((_ppu->registers._reg & (_flag)) ? 1 : 0)
 #define PPUSETFLAG(_ppu, _reg, _mask) _ppu->registers._reg |= (_mask)
 #define CLPPUFLAG(_ppu, _reg, _mask)  _ppu->registers._reg &= (~(_mask))
 
+#define PPUV_BG     0x01 // background enabled (PPUMASK_b)
+#define PPUV_SP     0x02 // sprites enabled (PPUMASK_s)
+#define PPUV_TALL   0x04 // 8x16 sprites (PPUCTRL_H)
+#define PPUV_CLIP   0x08 // left column clipping (PPUMASK_M | PPUMASK_m)
+#define PPUV_NOPIX  0x10 // no pixel output (pipeline timing PPU, hidden)
+#define PPUV_LITE   0x20 // no fetches or pixel mux (timing PPU, no sprite 0)
+#define PPUV_CDL    0x40 // log pattern fetches, see cdl.h
+#define PPUV_RENDER (PPUV_BG | PPUV_SP)
+
 #define BYTE_FLIP(_i)                                                          \
     _i = (_i & 0xF0) >> 4 | (_i & 0x0F) << 4;                                  \
     _i = (_i & 0xCC) >> 2 | (_i & 0x33) << 2;                                  \
@@ -75,12 +96,24 @@ ppu_cpu_read(struct ppu *ppu, u16 addr)
             {
                 r         = ppu->data;
                 ppu->data = ppu_read(ppu, ppu->vaddr);
+
+                if (ppu->fw->cdl && ppu->vaddr < 0x2000)
+                {
+                    cdl_chr(ppu->fw, ppu_get_mempointer(ppu, ppu->vaddr),
+                            CDL_READ);
+                }
             }
 
             ppu->vaddr += PPUFLAG(ppu, ppuctrl, PPUCTRL_I) ? 32 : 1;
             break;
     }
 
+    // these reads change PPU state, so the replica needs to see them too
+    if (ppu->pipe && (addr == PPUSTATUS || addr == PPUDATA))
+    {
+        ppu_pipe_log(ppu->pipe, ppu->dot, PPU_PIPE_READ, addr, 0);
+    }
+
     return r;
 }
 
@@ -92,6 +125,11 @@ ppu_cpu_write(struct ppu *ppu, u16 addr, u8 data)
 
     u16 d = 0x0000 | data;
 
+    if (ppu->pipe)
+    {
+        ppu_pipe_log(ppu->pipe, ppu->dot, PPU_PIPE_WRITE, addr, data);
+    }
+
     switch (addr)
     {
         case PPUCTRL: // $2000
@@ -101,9 +139,11 @@ ppu_cpu_write(struct ppu *ppu, u16 addr, u8 data)
             // clear nametable select
             ppu->taddr &= (~0x0C00);
             ppu->taddr |= ((d & 0x03) << 10);
+            ppu_select_clock(ppu);
             break;
         case PPUMASK: // $2001
             ppu->registers.ppumask = data;
+            ppu_select_clock(ppu);
             break;
         case OAMADDR: // $2003
             ppu->registers.oamaddr = data;
@@ -154,7 +194,7 @@ ppu_get_mempointer(struct ppu *ppu, u16 addr)
 {
     u8 *mem = ppu->vram;
 
-    struct nes *em = ppu->fw;
+    struct nes *em = ppu->map;
 
     IFINRANGE(addr, 0x2000, 0x3EFF) // nametable mirroring
     {
@@ -191,7 +231,11 @@ ppu_read(struct ppu *ppu, u16 addr)
 void
 ppu_write(struct ppu *ppu, u16 addr, u8 val)
 {
-    *ppu_get_mempointer(ppu, addr) = val;
+    u8         *p  = ppu_get_mempointer(ppu, addr);
+    struct nes *em = ppu->map;
+
+    if (em->mark) clone_touch(em->mark, p);
+    *p = val;
 }
 
 u32 *
@@ -238,6 +282,19 @@ ppu_get_patterntable(struct ppu *ppu, u8 i, u8 pal)
     return ppu->pattern_tables_pix[i];
 }
 
+/*
+ * Pattern table fetch for rendering. The CDL variants mark the byte as
+ * rendered
+ */
+static inline u8
+ppu_fetch_chr(struct ppu *ppu, u16 addr, const u8 v)
+{
+    u8 *p = ppu_get_mempointer(ppu, addr);
+
+    if (v & PPUV_CDL) cdl_chr(ppu->fw, p, CDL_RENDERED);
+    return *p;
+}
+
 static inline void
 ppu_reset_shifters(struct ppu *ppu)
 {
@@ -252,9 +309,9 @@ ppu_reset_shifters(struct ppu *ppu)
 }
 
 static inline void
-ppu_update_shifters(struct ppu *ppu)
+ppu_update_shifters(struct ppu *ppu, const u8 v)
 {
-    if (PPUFLAG(ppu, ppumask, PPUMASK_b))
+    if (v & PPUV_BG)
     {
         ppu->bg_shift_plo <<= 1;
         ppu->bg_shift_phi <<= 1;
@@ -264,9 +321,9 @@ ppu_update_shifters(struct ppu *ppu)
 }
 
 static inline void
-ppu_scroll_inc_x(struct ppu *ppu)
+ppu_scroll_inc_x(struct ppu *ppu, const u8 v)
 {
-    if (PPUFLAG(ppu, ppumask, PPUMASK_b) || PPUFLAG(ppu, ppumask, PPUMASK_s))
+    if (v & PPUV_RENDER)
     {
         if (((ppu->vaddr) & 0x1F) == 31)
         {
@@ -281,10 +338,9 @@ ppu_scroll_inc_x(struct ppu *ppu)
 }
 
 static inline void
-transfer_address_x(struct ppu *ppu)
-
+transfer_address_x(struct ppu *ppu, const u8 v)
 {
-    if (PPUFLAG(ppu, ppumask, PPUMASK_b) || PPUFLAG(ppu, ppumask, PPUMASK_s))
+    if (v & PPUV_RENDER)
     {
         u16 taxmask = ((PPULOOPY_X | PPULOOPY_CX));
         ppu->vaddr &= (~taxmask);
@@ -293,9 +349,9 @@ transfer_address_x(struct ppu *ppu)
 }
 
 static inline void
-transfer_address_y(struct ppu *ppu)
+transfer_address_y(struct ppu *ppu, const u8 v)
 {
-    if (PPUFLAG(ppu, ppumask, PPUMASK_b) || PPUFLAG(ppu, ppumask, PPUMASK_s))
+    if (v & PPUV_RENDER)
     {
         u16 taymask = ((PPULOOPY_FY | PPULOOPY_Y | PPULOOPY_CY));
         ppu->vaddr &= (~taymask);
@@ -304,9 +360,9 @@ transfer_address_y(struct ppu *ppu)
 }
 
 static inline void
-ppu_scroll_inc_y(struct ppu *ppu)
+ppu_scroll_inc_y(struct ppu *ppu, const u8 v)
 {
-    if (PPUFLAG(ppu, ppumask, PPUMASK_b) || PPUFLAG(ppu, ppumask, PPUMASK_s))
+    if (v & PPUV_RENDER)
     {
         if (((ppu->vaddr) & PPULOOPY_FY) != PPULOOPY_FY)
         {
@@ -335,7 +391,7 @@ ppu_scroll_inc_y(struct ppu *ppu)
 }
 
 static inline void
-ppu_clock_background(struct ppu *ppu)
+ppu_clock_background(struct ppu *ppu, const u8 v)
 {
     struct nes *nes = ppu->fw;
     /*
@@ -348,7 +404,7 @@ ppu_clock_background(struct ppu *ppu)
         CLPPUFLAG(ppu, ppustatus, PPUSTATUS_S);
         CLPPUFLAG(ppu, ppustatus, PPUSTATUS_O);
 
-        nes->frame_complete = 0;
+        if (!ppu->replica) nes->frame_complete = 0;
 
         memset(ppu->sp_shift_lo, 0, 16);
     }
@@ -356,15 +412,16 @@ ppu_clock_background(struct ppu *ppu)
     {
         u16 vaddr = ppu->vaddr & 0x7FFF;
         u16 tmp;
-        ppu_update_shifters(ppu);
+        if (!(v & PPUV_LITE)) ppu_update_shifters(ppu, v);
         switch ((ppu->cycle - 1) & 0x7)
         {
             case 0:
+                if (v & PPUV_LITE) break;
                 ppu_reset_shifters(ppu);
                 ppu->bg_id = ppu_read(ppu, 0x2000 | (vaddr & 0x0FFF));
                 break;
             case 2:
-                if (PPUFLAG(ppu, ppumask, PPUMASK_b))
+                if ((v & PPUV_BG) && !(v & PPUV_LITE))
                 {
                     // attributes start at $23C0 on the nametable,
                     // then we select the nametable (0000 or 0C00 and so
@@ -385,50 +442,52 @@ ppu_clock_background(struct ppu *ppu)
                 }
                 break;
             case 4:
+                if (v & PPUV_LITE) break;
                 tmp = 0x0000 | (ppu->bg_id);
                 ppu->bg_lsb =
-                  ppu_read(ppu,                                          //
-                           ((u16)PPUFLAG(ppu, ppuctrl, PPUCTRL_B) << 12) //
-                             + (tmp << 4)                                //
-                             + ((vaddr >> 12) & 0x07));
+                  ppu_fetch_chr(ppu,
+                                ((u16)PPUFLAG(ppu, ppuctrl, PPUCTRL_B) << 12) +
+                                  (tmp << 4) + ((vaddr >> 12) & 0x07),
+                                v);
                 break;
             case 6:
+                if (v & PPUV_LITE) break;
                 tmp = 0x0000 | (ppu->bg_id);
                 ppu->bg_msb =
-                  ppu_read(ppu,                                          //
-                           ((u16)PPUFLAG(ppu, ppuctrl, PPUCTRL_B) << 12) //
-                             + (tmp << 4)                                //
-                             + ((vaddr >> 12) & 0x07) + 8);
+                  ppu_fetch_chr(ppu,
+                                ((u16)PPUFLAG(ppu, ppuctrl, PPUCTRL_B) << 12) +
+                                  (tmp << 4) + ((vaddr >> 12) & 0x07) + 8,
+                                v);
                 break;
             case 7:
-                ppu_scroll_inc_x(ppu);
+                ppu_scroll_inc_x(ppu, v);
                 break;
         }
         if (ppu->cycle == 256)
         {
-            ppu_scroll_inc_y(ppu);
+            ppu_scroll_inc_y(ppu, v);
         }
     }
 
     if (ppu->cycle == 257)
     {
-        ppu_reset_shifters(ppu);
-        transfer_address_x(ppu);
+        if (!(v & PPUV_LITE)) ppu_reset_shifters(ppu);
+        transfer_address_x(ppu, v);
     }
 
-    if (ppu->cycle == 338 || ppu->cycle == 340)
+    if (!(v & PPUV_LITE) && (ppu->cycle == 338 || ppu->cycle == 340))
     {
         ppu->bg_id = ppu_read(ppu, 0x2000 | (ppu->vaddr & 0x0FFF));
     }
 
     if (ppu->scanline == -1 && INRANGE(ppu->cycle, 280, 304))
     {
-        transfer_address_y(ppu);
+        transfer_address_y(ppu, v);
     }
 }
 
 static inline void
-ppu_clock_foreground(struct ppu *ppu)
+ppu_clock_foreground(struct ppu *ppu, const u8 v)
 {
     /*
      * S-OAM init to $FF
@@ -447,6 +506,7 @@ ppu_clock_foreground(struct ppu *ppu)
         ppu->soam_true          = 0;
         ppu->soam_write_disable = 0;
         ppu->sprite_count       = 0;
+        ppu->inc_sprite0        = 0;
     }
 
     /*
@@ -467,7 +527,7 @@ ppu_clock_foreground(struct ppu *ppu)
             {
                 // tell the ppu to write to the soam next 7 ppu->cycles
                 // if the sprite is in range
-                IFINRANGE(diff, 0, 7 + 8 * PPUFLAG(ppu, ppuctrl, PPUCTRL_H))
+                IFINRANGE(diff, 0, (v & PPUV_TALL) ? 15 : 7)
                 { //
                     ppu->soam_true = 1;
                     if (ppu->n_oam == 0)
@@ -532,7 +592,13 @@ ppu_clock_foreground(struct ppu *ppu)
      * registers that we can actually use to render data
      */
 
-    IFINRANGE(ppu->cycle, 257, 320) //
+    // sprite 0 was (or was not) found for the line we're about to fetch
+    if (ppu->cycle == 257)
+    {
+        ppu->ren_sprite0 = ppu->inc_sprite0;
+    }
+
+    if (!(v & PPUV_LITE) && INRANGE(ppu->cycle, 257, 320)) //
     {
         // 8 sprites total, 8 ppu->cycles per sprite
         u16 tcycle = ppu->cycle - 257; // 0-63
@@ -565,11 +631,12 @@ ppu_clock_foreground(struct ppu *ppu)
                     attr = (ppu->soam[sindex * 4 + 2]);
                     u16 ypos = 0x0000 | (ppu->scanline - ppu->soam[sindex * 4]);
 
-                    // vertical sprite mirroring
-                    u8 h = PPUFLAG(ppu, ppuctrl, PPUCTRL_H);
+                    // empty slots ($FF) still fetch, keep them inside CHR
+                    ypos &= (v & PPUV_TALL) ? 0x0F : 0x07;
 
+                    // vertical sprite mirroring
                     if (attr & 0x80) ypos = 7 - ypos;
-                    if (h)
+                    if (v & PPUV_TALL)
                     {
                         addr     = ppu->soam[sindex * 4 + 1];
                         u16 bank = (addr & 0x01) << 12;
@@ -590,7 +657,7 @@ ppu_clock_foreground(struct ppu *ppu)
                         addr |= ypos;
                     }
 
-                    out = ppu_read(ppu, addr);
+                    out = ppu_fetch_chr(ppu, addr, v);
                     // horizontal sprite mirroring
                     if (attr & 0x40)
                     {
@@ -612,20 +679,97 @@ ppu_clock_foreground(struct ppu *ppu)
     }
 }
 
-void
-ppu_clock(struct ppu *ppu)
+/*
+ * Hashes a scanline once its last pixel is out, so the presenter can tell
+ * which rows (if any) changed since the frame it last uploaded
+ */
+static void
+ppu_line_done(struct ppu *ppu, int y)
+{
+    struct nes *nes  = ppu->fw;
+    const u16  *line = nes->pixels + y * NES_WIDTH;
+
+    u64 h = 0;
+    for (int i = 0; i < NES_WIDTH; i += 4)
+    {
+        u64 w;
+        memcpy(&w, line + i, sizeof(w));
+        h = (h + w) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    if (h != nes->line_hash[y])
+    {
+        nes->line_hash[y] = h;
+        nes->line_gen[y] += 1;
+        nes->frame_changed = 1;
+    }
+
+    if (y == NES_HEIGHT - 1 && nes->frame_changed)
+    {
+        nes->frame_changed = 0;
+        nes->frame_gen += 1;
+
+        // copied here, before the next frame starts drawing over it
+        if (nes->filter) filter_submit(nes->filter, nes->pixels);
+    }
+}
+
+/*
+ * Decides at the start of every line whether the timing PPU of the pipeline
+ * needs to do the full fetch and pixel work on it. That is only the case
+ * where sprite 0 can be evaluated or drawn and could still set the sprite 0
+ * hit flag, everything else is drawn by the replica alone
+ */
+static void
+ppu_timing_line(struct ppu *ppu)
+{
+    int y0 = ppu->oam[0];
+    int h  = PPUFLAG(ppu, ppuctrl, PPUCTRL_H) ? 16 : 8;
+    u8  lite = 1;
+
+    if (PPUFLAG(ppu, ppumask, PPUMASK_b) && PPUFLAG(ppu, ppumask, PPUMASK_s) &&
+        !PPUFLAG(ppu, ppustatus, PPUSTATUS_S) &&
+        INRANGE(ppu->scanline, y0 - 1, y0 + h))
+    {
+        lite = 0;
+    }
+
+    if (lite != ppu->lite)
+    {
+        ppu->lite = lite;
+        ppu_select_clock(ppu);
+    }
+}
+
+static inline __attribute__((always_inline)) void
+ppu_clock_generic(struct ppu *ppu, const u8 v)
 {
     struct nes *nes = ppu->fw;
 
+    if ((v & PPUV_NOPIX) && ppu->cycle == 0)
+    {
+        ppu_timing_line(ppu);
+    }
+
     /* https://www.nesdev.org/wiki/PPU_frame_timing */
     if (ppu->scanline == -1 && ppu->cycle == 0 && ppu->odd_frame)
     {
         ppu->cycle += 1;
     }
 
-    IFINRANGE(ppu->scanline, -1, 239) { ppu_clock_background(ppu); }
+    IFINRANGE(ppu->scanline, -1, 239)
+    {
+        PROF_ENTER(PROF_PPU_BG);
+        ppu_clock_background(ppu, v);
+        PROF_LEAVE(PROF_PPU_BG);
+    }
 
-    IFINRANGE(ppu->scanline, 0, 239) { ppu_clock_foreground(ppu); }
+    IFINRANGE(ppu->scanline, 0, 239)
+    {
+        PROF_ENTER(PROF_PPU_FG);
+        ppu_clock_foreground(ppu, v);
+        PROF_LEAVE(PROF_PPU_FG);
+    }
 
     /*
      * Cause a CPU NMI if NMI enable flag is 1
@@ -639,9 +783,11 @@ ppu_clock(struct ppu *ppu)
         }
     }
 
+    PROF_ENTER(PROF_PIXEL);
+
     u8 bgpix = 0;
     u8 bgpal = 0;
-    if (PPUFLAG(ppu, ppumask, PPUMASK_b))
+    if ((v & PPUV_BG) && !(v & PPUV_LITE))
     {
         u16 bit_mux = 0x8000 >> ppu->fxscroll;
 
@@ -657,7 +803,7 @@ ppu_clock(struct ppu *ppu)
 
     if (bgpix == 0) bgpal = 0;
 
-    if (PPUFLAG(ppu, ppumask, PPUMASK_s))
+    if ((v & PPUV_SP) && !(v & PPUV_LITE))
     {
         for (u8 i = 0; i < 8; i++)
         {
@@ -683,14 +829,11 @@ ppu_clock(struct ppu *ppu)
                 //    background
                 //
                 // sorry for overexplaining this statement :^)
-                if (pix > 0 && bgpix > 0 && i == 0 && ppu->inc_sprite0 //
-                    && !INRANGE(ppu->cycle, 1, 8) &&
-                    PPUFLAG(ppu, ppumask, PPUMASK_b))
+                if ((v & PPUV_BG) && pix > 0 && bgpix > 0 && i == 0 &&
+                    ppu->ren_sprite0 && !INRANGE(ppu->cycle, 1, 8))
                 {
-                    if ((INRANGE(ppu->cycle, 9, 257) &&
-                         !(ppu->registers.ppumask & 0x06)) || //
-                        (INRANGE(ppu->cycle, 1, 258) &&
-                         (ppu->registers.ppumask & 0x06)))
+                    if ((v & PPUV_CLIP) ? INRANGE(ppu->cycle, 1, 258)
+                                        : INRANGE(ppu->cycle, 9, 257))
                     {
                         PPUSETFLAG(ppu, ppustatus, PPUSTATUS_S); // set sprite 0
                                                                  //
@@ -707,19 +850,31 @@ ppu_clock(struct ppu *ppu)
         }
     }
 
-    if (INRANGE((ppu->cycle - 1), 0, NES_WIDTH - 1) &&
+    if (!(v & PPUV_NOPIX) && INRANGE((ppu->cycle - 1), 0, NES_WIDTH - 1) &&
         INRANGE(ppu->scanline, 0, NES_HEIGHT - 1))
     {
-        u32 pix = PCOLREAD(bgpal, bgpix);
+        // 6-bit color plus the 3 emphasis bits, see ppu_frame_to_argb
+        u16 pix = ppu_read(ppu, 0x3F00 + (bgpal << 2) + bgpix);
+        pix |= (ppu->registers.ppumask & PPUMASK_BGR) << 1;
         nes->pixels[(ppu->cycle - 1) + ppu->scanline * NES_WIDTH] = pix;
+
+        if (ppu->cycle == NES_WIDTH)
+        {
+            ppu_line_done(ppu, ppu->scanline);
+        }
     }
 
-    if (ppu->cycle == NES_WIDTH - 1 && ppu->scanline == NES_HEIGHT - 1)
+    PROF_LEAVE(PROF_PIXEL);
+
+    if (!ppu->replica && ppu->cycle == NES_WIDTH - 1 &&
+        ppu->scanline == NES_HEIGHT - 1)
     {
         nes->frame_complete = 1;
+        prof_publish(nes);
+        lat_frame(nes->latency);
     }
 
-    IFINRANGE(ppu->cycle, 1, 256)
+    if (!(v & PPUV_LITE) && INRANGE(ppu->cycle, 1, 256))
     {
         for (u8 i = 0; i < 8; i++)
         {
@@ -736,6 +891,12 @@ ppu_clock(struct ppu *ppu)
     }
 
     ppu->cycle += 1;
+    ppu->dot += 1;
+
+    if ((v & PPUV_NOPIX) && ppu->pipe)
+    {
+        __atomic_store_n(&ppu->pipe->dot, ppu->dot, __ATOMIC_RELEASE);
+    }
 
     if (ppu->cycle > 340)
     {
@@ -750,6 +911,103 @@ ppu_clock(struct ppu *ppu)
     }
 }
 
+/*
+ * One copy of ppu_clock_generic for every rendering state. v is a constant in
+ * each of them, so the PPUMASK/PPUCTRL tests above are resolved at compile time
+ *
+ * The t and l copies are for the timing PPU of the pipeline, see ppupipe.h, and
+ * for hidden frames. The c copies log pattern fetches for the code/data logger,
+ * see cdl.h
+ */
+#define PPU_CLOCK_VARIANT(_v)                                                  \
+    static void ppu_clock_##_v(struct ppu *ppu)                                \
+    {                                                                          \
+        ppu_clock_generic(ppu, 0x##_v);                                        \
+    }                                                                          \
+    static void ppu_clock_t##_v(struct ppu *ppu)                               \
+    {                                                                          \
+        ppu_clock_generic(ppu, 0x##_v | PPUV_NOPIX);                           \
+    }                                                                          \
+    static void ppu_clock_l##_v(struct ppu *ppu)                               \
+    {                                                                          \
+        ppu_clock_generic(ppu, 0x##_v | PPUV_NOPIX | PPUV_LITE);               \
+    }                                                                          \
+    static void ppu_clock_c##_v(struct ppu *ppu)                               \
+    {                                                                          \
+        ppu_clock_generic(ppu, 0x##_v | PPUV_CDL);                             \
+    }
+
+PPU_CLOCK_VARIANT(0)
+PPU_CLOCK_VARIANT(1)
+PPU_CLOCK_VARIANT(2)
+PPU_CLOCK_VARIANT(3)
+PPU_CLOCK_VARIANT(4)
+PPU_CLOCK_VARIANT(5)
+PPU_CLOCK_VARIANT(6)
+PPU_CLOCK_VARIANT(7)
+PPU_CLOCK_VARIANT(8)
+PPU_CLOCK_VARIANT(9)
+PPU_CLOCK_VARIANT(A)
+PPU_CLOCK_VARIANT(B)
+PPU_CLOCK_VARIANT(C)
+PPU_CLOCK_VARIANT(D)
+PPU_CLOCK_VARIANT(E)
+PPU_CLOCK_VARIANT(F)
+
+static const ppuclock ppu_clock_variants[4][16] = {
+    {
+      ppu_clock_0, ppu_clock_1, ppu_clock_2, ppu_clock_3,
+      ppu_clock_4, ppu_clock_5, ppu_clock_6, ppu_clock_7,
+      ppu_clock_8, ppu_clock_9, ppu_clock_A, ppu_clock_B,
+      ppu_clock_C, ppu_clock_D, ppu_clock_E, ppu_clock_F,
+    },
+    {
+      ppu_clock_t0, ppu_clock_t1, ppu_clock_t2, ppu_clock_t3,
+      ppu_clock_t4, ppu_clock_t5, ppu_clock_t6, ppu_clock_t7,
+      ppu_clock_t8, ppu_clock_t9, ppu_clock_tA, ppu_clock_tB,
+      ppu_clock_tC, ppu_clock_tD, ppu_clock_tE, ppu_clock_tF,
+    },
+    {
+      ppu_clock_l0, ppu_clock_l1, ppu_clock_l2, ppu_clock_l3,
+      ppu_clock_l4, ppu_clock_l5, ppu_clock_l6, ppu_clock_l7,
+      ppu_clock_l8, ppu_clock_l9, ppu_clock_lA, ppu_clock_lB,
+      ppu_clock_lC, ppu_clock_lD, ppu_clock_lE, ppu_clock_lF,
+    },
+    {
+      ppu_clock_c0, ppu_clock_c1, ppu_clock_c2, ppu_clock_c3,
+      ppu_clock_c4, ppu_clock_c5, ppu_clock_c6, ppu_clock_c7,
+      ppu_clock_c8, ppu_clock_c9, ppu_clock_cA, ppu_clock_cB,
+      ppu_clock_cC, ppu_clock_cD, ppu_clock_cE, ppu_clock_cF,
+    },
+};
+
+void
+ppu_select_clock(struct ppu *ppu)
+{
+    u8 v = 0;
+
+    if (PPUFLAG(ppu, ppumask, PPUMASK_b)) v |= PPUV_BG;
+    if (PPUFLAG(ppu, ppumask, PPUMASK_s)) v |= PPUV_SP;
+    if (PPUFLAG(ppu, ppuctrl, PPUCTRL_H)) v |= PPUV_TALL;
+    if (ppu->registers.ppumask & (PPUMASK_M | PPUMASK_m)) v |= PPUV_CLIP;
+
+    // the timing PPU of the pipeline doesn't render, the replica logs instead
+    int row = ppu->fw->cdl ? 3 : 0;
+
+    if (ppu->timing || ppu->hidden) row = 1 + ppu->lite;
+    ppu->clock = ppu_clock_variants[row][v];
+}
+
+void
+ppu_set_hidden(struct ppu *ppu, u8 hidden)
+{
+    // lite is only decided at the start of a line, so the rest of this one
+    // does the full work
+    ppu->hidden = hidden;
+    ppu->lite   = 0;
+    ppu_select_clock(ppu);
+}
+
 void
 pal_init(struct ppu *ppu)
 {
@@ -817,12 +1075,113 @@ pal_init(struct ppu *ppu)
     PAL[0x3D] = 0xFFA0A2A0;
     PAL[0x3E] = 0xFF000000;
     PAL[0x3F] = 0xFF000000;
+
+    /*
+     * Expand the palette with the PPUMASK emphasis bits (index bits 6-8 are
+     * red, green and blue). Every emphasized color dims the other two
+     * channels
+     */
+    FOR(e, 0, 8)
+    {
+        FOR(c, 0, 0x40)
+        {
+            u32   col = PAL[c];
+            float r   = (col >> 16) & 0xFF;
+            float g   = (col >> 8) & 0xFF;
+            float b   = col & 0xFF;
+
+            if (e & 0x01) g *= PPU_EMPH_ATTN, b *= PPU_EMPH_ATTN;
+            if (e & 0x02) r *= PPU_EMPH_ATTN, b *= PPU_EMPH_ATTN;
+            if (e & 0x04) r *= PPU_EMPH_ATTN, g *= PPU_EMPH_ATTN;
+
+            ppu->pal_emph[(e << 6) | c] =
+              0xFF000000 | ((u32)r << 16) | ((u32)g << 8) | (u32)b;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * One row of ppu_frame_to_argb(). SSE2 has no gather, so this looks the 8
+ * colors up one at a time, but still reads and writes whole vectors
+ */
+static void
+ppu_row_sse2(const u32 *pal, const u16 *in, u32 *out)
+{
+    for (int x = 0; x < NES_WIDTH; x += 8)
+    {
+        __m128i w  = _mm_loadu_si128((const __m128i *)(in + x));
+        __m128i lo = _mm_setr_epi32(
+          pal[_mm_extract_epi16(w, 0)], pal[_mm_extract_epi16(w, 1)],
+          pal[_mm_extract_epi16(w, 2)], pal[_mm_extract_epi16(w, 3)]);
+        __m128i hi = _mm_setr_epi32(
+          pal[_mm_extract_epi16(w, 4)], pal[_mm_extract_epi16(w, 5)],
+          pal[_mm_extract_epi16(w, 6)], pal[_mm_extract_epi16(w, 7)]);
+
+        _mm_storeu_si128((__m128i *)(out + x), lo);
+        _mm_storeu_si128((__m128i *)(out + x + 4), hi);
+    }
+}
+
+/*
+ * Same with one gather per 8 pixels. Built for AVX2 whatever the flags are
+ * and only picked when the host has it, see ppu_frame_to_argb()
+ */
+static __attribute__((target("avx2"))) void
+ppu_row_avx2(const u32 *pal, const u16 *in, u32 *out)
+{
+    for (int x = 0; x < NES_WIDTH; x += 8)
+    {
+        __m128i w = _mm_loadu_si128((const __m128i *)(in + x));
+        __m256i i = _mm256_cvtepu16_epi32(w);
+        __m256i c = _mm256_i32gather_epi32((const int *)pal, i, 4);
+        _mm256_storeu_si256((__m256i *)(out + x), c);
+    }
+}
+#else
+/*
+ * One row of ppu_frame_to_argb(), a plain lookup per pixel
+ */
+static void
+ppu_row(const u32 *pal, const u16 *in, u32 *out)
+{
+    for (int x = 0; x < NES_WIDTH; x++)
+    {
+        out[x] = pal[in[x]];
+    }
+}
+#endif
+
+void
+ppu_frame_to_argb(struct ppu *ppu, const u16 *src, u32 *dst, int pitch,
+                  int first, int count)
+{
+    const u32 *pal = ppu->pal_emph;
+#if defined(__x86_64__) || defined(__i386__)
+    int avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    for (int y = first; y < first + count; y++)
+    {
+        const u16 *in  = src + y * NES_WIDTH;
+        u32       *out = (u32 *)((u8 *)dst + y * pitch);
+
+#if defined(__x86_64__) || defined(__i386__)
+        if (avx2)
+            ppu_row_avx2(pal, in, out);
+        else
+            ppu_row_sse2(pal, in, out);
+#else
+        ppu_row(pal, in, out);
+#endif
+    }
 }
 
 void
 ppu_init(struct ppu *ppu)
 {
     ppu->vram = malloc(0x4000); // 2kB vram for nametables
+    ppu->map  = ppu->fw;
 
     FOR(i, 0, 2) ppu->pattern_tables_pix[i] = malloc(0x1000 * 32); //
 
@@ -851,6 +1210,17 @@ ppu_init(struct ppu *ppu)
     ppu->bg_shift_alo = 0;
     ppu->bg_shift_ahi = 0;
 
+    ppu->inc_sprite0 = 0;
+    ppu->ren_sprite0 = 0;
+
+    ppu->dot     = 0;
+    ppu->pipe    = NULL;
+    ppu->timing  = 0;
+    ppu->lite    = 0;
+    ppu->replica = 0;
+    ppu->hidden  = 0;
+
+    ppu_select_clock(ppu);
     pal_init(ppu);
 }
 
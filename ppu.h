@@ -71,6 +71,11 @@
 
 #define PPURMASK(_a) ((_a) == PPUSTATUS ? (0xE0) : 0xFF)
 
+struct ppu;
+struct ppu_pipe;
+
+typedef void (*ppuclock)(struct ppu *ppu);
+
 /*!
  * @struct ppu
  * Data structure representation of the PPU
@@ -113,9 +118,21 @@ struct __attribute__((__packed__)) ppu
     int cycle;    //!< Cycle count
     int scanline; //!< Current scanline in rendering
 
-    u32 pal[0x40]; //!< All 64 colors the NES can display
+    u32 pal[0x40];       //!< All 64 colors the NES can display
+    u32 pal_emph[0x200]; //!< pal under each of the 8 color emphasis settings
+
+    struct nes *fw;  //!< NES data structure that also contains this structure
+    struct nes *map; //!< Mapper state fetches go through, fw but on a replica
+
+    ppuclock clock; //!< ppu_clock variant for the current rendering state
+
+    u64 dot; //!< Number of ppu_clock calls since power on
 
-    struct nes *fw; //!< NES data structure that also contains this structure
+    struct ppu_pipe *pipe; //!< Write log of the render pipeline, if enabled
+    u8               timing;  //!< Runs only the timing-relevant work
+    u8               lite;    //!< timing, and no sprite 0 on this line
+    u8               replica; //!< Renders from the pipeline's write log
+    u8               hidden;  //!< Frame nobody sees, works like timing
 
     /*
      * 8-bit registers that store the info for the next tile
@@ -204,6 +221,27 @@ ppu_cpu_read(struct ppu *ppu, u16 addr);
 void
 ppu_init(struct ppu *ppu);
 
+/*!
+ * Picks the specialized ppu_clock variant matching the rendering state in
+ * PPUMASK (background, sprites, left column clipping) and PPUCTRL (8x16
+ * sprites). Called whenever either register is written
+ *
+ * @param ppu
+ */
+void
+ppu_select_clock(struct ppu *ppu);
+
+/*!
+ * Stops or restarts pixel output. While hidden, the PPU only does the work
+ * the timing PPU of the pipeline does: no pixels, and no fetches or pixel mux
+ * on lines where sprite 0 can't hit. For run-ahead frames, see runahead.h
+ *
+ * @param ppu
+ * @param hidden
+ */
+void
+ppu_set_hidden(struct ppu *ppu, u8 hidden);
+
 void
 ppu_free(struct ppu *ppu);
 
@@ -219,6 +257,32 @@ ppu_free(struct ppu *ppu);
 u32 *
 ppu_get_patterntable(struct ppu *ppu, u8 i, u8 pal);
 
+/*!
+ * Converts a frame written by ppu_clock into 32-bit ARGB. The PPU itself only
+ * stores a 9-bit value per pixel (palette color in bits 0-5, PPUMASK emphasis
+ * in bits 6-8), so this runs only for frames that are actually shown
+ *
+ * @param ppu
+ * @param src NES_WIDTH x NES_HEIGHT frame, normally nes->pixels
+ * @param dst ARGB output
+ * @param pitch Length of one row of dst in bytes
+ * @param first First row to convert
+ * @param count Number of rows to convert
+ */
+void
+ppu_frame_to_argb(struct ppu *ppu, const u16 *src, u32 *dst, int pitch,
+                  int first, int count);
+
+/*!
+ * Resolves an address in the PPU's addressable range to the byte behind it,
+ * after nametable mirroring, palette mirroring and the mapper
+ *
+ * @param ppu
+ * @param addr
+ */
+u8 *
+ppu_get_mempointer(struct ppu *ppu, u16 addr);
+
 /*!
  * Reads from somewhere in the PPU's addressable range
  *
@@ -274,9 +338,20 @@ ppu_write(struct ppu *ppu, u16 addr, u8 val);
  *      single number I computed myself.
  *
  *
+ * ### Variants:
+ *
+ *      The actual work is done by one of 16 copies of the clock function,
+ *      each compiled for a fixed combination of the PPUMASK/PPUCTRL bits it
+ *      depends on. ppu_select_clock() keeps ppu->clock pointing at the right
+ *      one, so none of those bits are tested per dot.
+ *
+ *
  * @param ppu
  */
-void
-ppu_clock(struct ppu *ppu);
+static inline void
+ppu_clock(struct ppu *ppu)
+{
+    ppu->clock(ppu);
+}
 
 #endif // NES_PPU_H_
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppu.h"
+#include "ppupipe.h"
+
+static inline void
+ppu_pipe_replay(struct ppu *ppu, struct ppu_pipe_entry *e)
+{
+    switch (e->kind)
+    {
+        case PPU_PIPE_WRITE:
+            ppu_cpu_write(ppu, e->addr, e->val);
+            break;
+        case PPU_PIPE_READ:
+            ppu_cpu_read(ppu, e->addr);
+            break;
+        case PPU_PIPE_OAM:
+            ppu->oam[e->addr & 0xFF] = e->val;
+            break;
+        case PPU_PIPE_MAPREG:
+            ppu->map->mapreg[e->addr] = e->val;
+            break;
+        case PPU_PIPE_MIRROR:
+            ppu->map->mirror = e->addr;
+            break;
+    }
+}
+
+/*
+ * Render thread. Runs the replica up to the last dot the timing PPU has
+ * finished, replaying each logged access right before the dot it happened on
+ */
+static void *
+ppu_pipe_loop(void *in)
+{
+    struct ppu_pipe *pipe = in;
+    struct ppu      *ppu  = pipe->replica;
+
+    u64 tail = pipe->tail;
+
+    while (pipe->enable)
+    {
+        // every entry stamped before this dot is already in the log
+        u64 limit = __atomic_load_n(&pipe->dot, __ATOMIC_ACQUIRE);
+        u64 head  = __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE);
+
+        if (ppu->dot >= limit)
+        {
+            sched_yield();
+            continue;
+        }
+
+        while (ppu->dot < limit)
+        {
+            if (tail != head)
+            {
+                while (tail != head &&
+                       pipe->log[tail & (PPU_PIPE_SIZE - 1)].dot <= ppu->dot)
+                {
+                    ppu_pipe_replay(ppu,
+                                    &pipe->log[tail & (PPU_PIPE_SIZE - 1)]);
+                    tail += 1;
+                }
+                __atomic_store_n(&pipe->tail, tail, __ATOMIC_RELEASE);
+            }
+
+            ppu_clock(ppu);
+        }
+    }
+
+    return NULL;
+}
+
+struct ppu_pipe *
+ppu_pipe_start(struct nes *nes)
+{
+    struct ppu_pipe *pipe = calloc(1, sizeof(struct ppu_pipe));
+    struct ppu      *ppu  = nes->ppu;
+
+    pipe->timing  = ppu;
+    pipe->replica = malloc(sizeof(struct ppu));
+
+    // the replica starts out as an exact copy, with its own VRAM
+    memcpy(pipe->replica, ppu, sizeof(struct ppu));
+    pipe->replica->vram = malloc(0x4000);
+    memcpy(pipe->replica->vram, ppu->vram, 0x4000);
+
+    // and its own mapper state. Only what CHR and nametable fetches use is
+    // ever looked at in the copy
+    pipe->map = malloc(sizeof(struct nes));
+    memcpy(pipe->map, nes, sizeof(struct nes));
+    memcpy(pipe->mapreg, nes->mapreg, sizeof(pipe->mapreg));
+    pipe->mirror = nes->mirror;
+
+    if (nes->cartridge.s_chr_rom_8 == 0)
+    {
+        pipe->chr                = 1;
+        pipe->map->cartridge.chr = malloc(0x2000);
+        memcpy(pipe->map->cartridge.chr, nes->cartridge.chr, 0x2000);
+    }
+
+    pipe->replica->map     = pipe->map;
+    pipe->replica->replica = 1;
+    pipe->replica->pipe    = NULL;
+    pipe->replica->timing  = 0;
+    ppu_select_clock(pipe->replica);
+
+    pipe->dot   = ppu->dot;
+    ppu->pipe   = pipe;
+    ppu->timing = 1;
+    ppu->lite   = 0;
+    ppu_select_clock(ppu);
+
+    pipe->enable = 1;
+    pthread_create(&pipe->thread, NULL, ppu_pipe_loop, pipe);
+
+    return pipe;
+}
+
+void
+ppu_pipe_stop(struct ppu_pipe *pipe)
+{
+    pipe->enable = 0;
+    pthread_join(pipe->thread, NULL);
+
+    pipe->timing->pipe   = NULL;
+    pipe->timing->timing = 0;
+    ppu_select_clock(pipe->timing);
+
+    // pattern_tables_pix is shared with the timing PPU
+    free(pipe->replica->vram);
+    free(pipe->replica);
+    if (pipe->chr)
+    {
+        free(pipe->map->cartridge.chr);
+    }
+    free(pipe->map);
+    free(pipe);
+}
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_PPUPIPE_H_
+#define NES_PPUPIPE_H_
+
+/*! @file ppupipe.h
+ * Pipelined PPU rendering
+ *
+ * The PPU on the emulation thread is switched into "timing" mode: it keeps
+ * VBlank/NMI, scrolling, sprite evaluation and $2002/$2007 exact, but draws
+ * nothing, and only does the full fetch and pixel work on lines where sprite
+ * 0 could set the hit flag.
+ *
+ * Every CPU access that changes PPU state is appended to a single-producer,
+ * single-consumer log, stamped with the PPU dot it happened on. A replica PPU
+ * on a second thread replays the log at the same dots and produces the
+ * pixels, trailing the emulation by up to about a frame.
+ *
+ * As it trails, the replica can't look at anything the emulation thread
+ * changes. Besides its own VRAM and OAM, it has its own copy of the mapper
+ * state (CHR banks and nametable mirroring) and of CHR-RAM. Writes through
+ * $2007 reach its CHR-RAM when their entry is replayed, and mapper register
+ * writes log whatever they changed as entries of their own.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#define PPU_PIPE_SIZE 0x10000 // entries, power of 2
+
+#define PPU_PIPE_WRITE  0 //!< CPU write to $2000-$2007
+#define PPU_PIPE_READ   1 //!< CPU read of $2002 or $2007
+#define PPU_PIPE_OAM    2 //!< OAM DMA byte, addr is the OAM index
+#define PPU_PIPE_MAPREG 3 //!< Mapper register, addr is its index in mapreg
+#define PPU_PIPE_MIRROR 4 //!< Nametable mirroring, addr is the new mask
+
+struct ppu;
+
+struct ppu_pipe_entry
+{
+    u64 dot;  //!< PPU dot the access happened before
+    u16 addr; //!< CPU address, or OAM index
+    u8  val;
+    u8  kind; //!< PPU_PIPE_*
+};
+
+/*!
+ * @struct ppu_pipe
+ * Write log between the timing PPU and the replica
+ */
+struct ppu_pipe
+{
+    struct ppu *timing;  //!< PPU on the emulation thread
+    struct ppu *replica; //!< PPU on the render thread
+    struct nes *map;     //!< Mapper state of the replica, see ppu->map
+    u8          chr;     //!< map has a CHR-RAM of its own
+
+    u8  mapreg[8]; //!< Mapper state as last logged, owned by the emulation
+    u16 mirror;    //!< thread
+
+    struct ppu_pipe_entry log[PPU_PIPE_SIZE];
+
+    u64 head; //!< Next entry to write, owned by the emulation thread
+    u64 tail; //!< Next entry to replay, owned by the render thread
+    u64 dot;  //!< Dots finished by the timing PPU
+
+    u64 stalls; //!< Times the log was full and the emulation had to wait
+
+    u8        enable;
+    pthread_t thread;
+};
+
+/*!
+ * Switches nes->ppu into timing mode and starts the render thread. Must be
+ * called before the emulation thread starts
+ *
+ * @returns the pipeline, also stored in nes->ppu->pipe
+ */
+struct ppu_pipe *
+ppu_pipe_start(struct nes *nes);
+
+/*!
+ * Stops the render thread and frees the replica
+ */
+void
+ppu_pipe_stop(struct ppu_pipe *pipe);
+
+/*!
+ * Appends an access to the log. Only waits if the render thread is a whole
+ * log behind
+ *
+ * @param pipe
+ * @param dot Current dot of the timing PPU
+ * @param kind PPU_PIPE_*
+ * @param addr
+ * @param val
+ */
+static inline void
+ppu_pipe_log(struct ppu_pipe *pipe, u64 dot, u8 kind, u16 addr, u8 val)
+{
+    u64 head = pipe->head;
+
+    while (head - __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) >=
+           PPU_PIPE_SIZE)
+    {
+        pipe->stalls += 1;
+        sched_yield();
+    }
+
+    struct ppu_pipe_entry *e = &pipe->log[head & (PPU_PIPE_SIZE - 1)];
+
+    e->dot  = dot;
+    e->addr = addr;
+    e->val  = val;
+    e->kind = kind;
+
+    __atomic_store_n(&pipe->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*!
+ * Logs what a mapper register write changed. Called after every write a
+ * mapper takes
+ */
+static inline void
+ppu_pipe_mapper(struct ppu_pipe *pipe, struct nes *nes, u64 dot)
+{
+    for (u16 i = 0; i < sizeof(pipe->mapreg); i++)
+    {
+        if (nes->mapreg[i] != pipe->mapreg[i])
+        {
+            pipe->mapreg[i] = nes->mapreg[i];
+            ppu_pipe_log(pipe, dot, PPU_PIPE_MAPREG, i, nes->mapreg[i]);
+        }
+    }
+
+    if (nes->mirror != pipe->mirror)
+    {
+        pipe->mirror = nes->mirror;
+        ppu_pipe_log(pipe, dot, PPU_PIPE_MIRROR, nes->mirror, 0);
+    }
+}
+
+#endif // NES_PPUPIPE_H_
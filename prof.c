@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "prof.h"
+
+#ifdef NES_PROF
+
+#include <stdio.h>
+#include <stdlib.h>
+
+__thread struct prof_thread prof_self;
+
+static const char *const prof_names[PROF_N] = {
+    "other", "cpu", "ppu", "ppu bg", "ppu fg", "pixel", "mapper", "dma",
+    "sleep",
+};
+
+void
+prof_init(struct nes *nes, unsigned sample)
+{
+    struct prof *p = calloc(1, sizeof(struct prof));
+
+    p->sample = sample ? sample : 1;
+    p->tick0  = prof_tick();
+    p->ns0    = util_now_ns();
+
+    nes->prof = p;
+}
+
+void
+prof_publish(struct nes *nes)
+{
+    struct prof        *p = nes->prof;
+    struct prof_thread *t = &prof_self;
+    u64                 now;
+
+    if (p == NULL)
+    {
+        return;
+    }
+
+    now = prof_tick();
+    if (t->on)
+    {
+        t->ticks[t->cur] += now - t->last;
+    }
+
+    // rdtsc runs at a fixed rate, measured against the clock since prof_init
+    double scale = 1.0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (now > p->tick0)
+    {
+        scale = (double)(util_now_ns() - p->ns0) / (double)(now - p->tick0);
+    }
+#endif
+
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    p->last.frame = t->frame;
+    p->total.frame += 1;
+    if (t->on)
+    {
+        p->last.timed = t->frame;
+        p->total.timed += 1;
+    }
+
+    for (int i = 0; i < PROF_N; i++)
+    {
+        if (t->on)
+        {
+            p->last.ns[i] = t->ticks[i] * scale;
+            p->total.ns[i] += p->last.ns[i];
+        }
+        p->last.calls[i] = t->calls[i];
+        p->total.calls[i] += t->calls[i];
+
+        t->ticks[i] = 0;
+        t->calls[i] = 0;
+    }
+
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+
+    t->frame += 1;
+    t->on   = t->frame % p->sample == 0;
+    t->last = prof_tick();
+}
+
+void
+prof_print(struct nes *nes)
+{
+    struct prof_frame total;
+    u64               sum = 0;
+
+    if (nes->prof == NULL)
+    {
+        return;
+    }
+
+    prof_read(nes->prof, NULL, &total);
+    if (total.timed == 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < PROF_N; i++)
+    {
+        sum += total.ns[i];
+    }
+
+    fprintf(stderr, "%llu frames, %llu timed, per frame:\n",
+            (unsigned long long)total.frame, (unsigned long long)total.timed);
+    for (int i = 0; i < PROF_N; i++)
+    {
+        fprintf(stderr, "%-8s %10.0f calls %10.1f us %5.1f%%\n", prof_names[i],
+                (double)total.calls[i] / total.frame,
+                total.ns[i] / 1000.0 / total.timed,
+                sum ? 100.0 * total.ns[i] / sum : 0.0);
+    }
+}
+
+#endif // NES_PROF
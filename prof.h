@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_PROF_H_
+#define NES_PROF_H_
+
+/*! @file prof.h
+ * Instrumentation counters and timers
+ *
+ * Only built in with -DNES_PROF (make PROF=1). Without it every PROF_ macro
+ * and prof_ call below expands to nothing and nes->prof stays NULL.
+ *
+ * Each instrumented region is a PROF_ENTER()/PROF_LEAVE() pair that counts
+ * the call and charges the time since the last transition to the region that
+ * was running. The times are exclusive: the CPU slice doesn't include the PPU
+ * dots it catches up on, the PPU doesn't include its background, sprite and
+ * pixel work. Timestamps come from rdtsc where there is one and from
+ * util_now_ns() otherwise. Ticks are converted to nanoseconds once per
+ * frame.
+ *
+ * The accumulators are per thread and are only touched by their own thread.
+ * When the PPU finishes a frame, prof_publish() copies them into the
+ * nes->prof block under a sequence counter. The writer never waits and
+ * readers retry on a torn copy, see prof_read(). Only the emulation thread
+ * publishes, so in pipeline mode (see ppupipe.h) the replica PPU's thread
+ * isn't measured.
+ *
+ * Timing every dot costs about as much as the dot itself. Sampling mode
+ * (-P n) only reads the clock during one frame in n. Calls are still counted
+ * in every frame, the per-frame times are those of the last timed frame.
+ */
+
+#include <cpu.h>
+#include <nes.h>
+
+#include "util.h"
+
+enum prof_id
+{
+    PROF_OTHER,  //!< Game loop bookkeeping outside every other region
+    PROF_CPU,    //!< CPU emulation, the rest of rp2a03_run() or cpu_clock()
+    PROF_PPU,    //!< ppu_clock() outside the three regions below
+    PROF_PPU_BG, //!< ppu_clock_background()
+    PROF_PPU_FG, //!< ppu_clock_foreground()
+    PROF_PIXEL,  //!< Sprite priority, palette lookup and pixel write
+    PROF_MAPPER, //!< Mapper calls on the CPU bus
+    PROF_DMA,    //!< OAM DMA copies
+    PROF_SLEEP,  //!< usleep() in the game loop
+    PROF_N,
+};
+
+/*!
+ * Aggregates over one frame, or summed over all of them
+ */
+struct prof_frame
+{
+    u64 frame;         //!< Frame number, or the number of frames
+    u64 timed;         //!< Frame ns[] was measured in, or the number of them
+    u64 ns[PROF_N];    //!< Exclusive time in each region
+    u64 calls[PROF_N]; //!< PROF_ENTER() count of each region
+};
+
+/*!
+ * Stats block shared with readers on other threads
+ */
+struct prof
+{
+    u32 seq;    //!< Odd while prof_publish() is writing
+    u32 sample; //!< Time one frame in sample
+
+    struct prof_frame last;  //!< Most recently finished frame
+    struct prof_frame total; //!< Sums since prof_init()
+
+    u64 tick0; //!< Clock at prof_init(), for the tick to ns ratio
+    u64 ns0;
+};
+
+#ifdef NES_PROF
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*!
+ * Accumulators of the calling thread
+ */
+struct prof_thread
+{
+    u64 last;          //!< Tick of the last transition
+    u64 ticks[PROF_N]; //!< Since the last prof_publish()
+    u64 calls[PROF_N]; //!< Since the last prof_publish()
+    u64 frame;         //!< Frames published by this thread
+    u8  cur;           //!< Region that is running
+    u8  on;            //!< This frame is timed
+};
+
+extern __thread struct prof_thread prof_self;
+
+static inline u64
+prof_tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return util_now_ns();
+#endif
+}
+
+/*
+ * Switches to region id
+ *
+ * @returns The region to return to
+ */
+static inline u8
+prof_enter(u8 id)
+{
+    struct prof_thread *t    = &prof_self;
+    u8                  prev = t->cur;
+
+    if (t->on)
+    {
+        u64 now = prof_tick();
+        t->ticks[prev] += now - t->last;
+        t->last = now;
+    }
+    t->cur = id;
+    t->calls[id] += 1;
+
+    return prev;
+}
+
+static inline void
+prof_leave(u8 prev)
+{
+    struct prof_thread *t = &prof_self;
+
+    if (t->on)
+    {
+        u64 now = prof_tick();
+        t->ticks[t->cur] += now - t->last;
+        t->last = now;
+    }
+    t->cur = prev;
+}
+
+// one pair per region and scope, the saved region is named after the id
+#define PROF_ENTER(_id) u8 prof_prev_##_id = prof_enter(_id)
+#define PROF_LEAVE(_id) prof_leave(prof_prev_##_id)
+
+/*!
+ * Sets up nes->prof
+ *
+ * @param nes
+ * @param sample Time one frame in sample, 0 or 1 to time all of them
+ */
+void
+prof_init(struct nes *nes, unsigned sample);
+
+/*!
+ * Publishes the calling thread's accumulators as the frame that just ended
+ * and starts the next one. Called by the PPU once a frame is complete
+ */
+void
+prof_publish(struct nes *nes);
+
+/*!
+ * Prints the per-frame averages to stderr
+ */
+void
+prof_print(struct nes *nes);
+
+#else
+
+#define PROF_ENTER(_id)          ((void)0)
+#define PROF_LEAVE(_id)          ((void)0)
+#define prof_init(_nes, _sample) ((void)(_sample))
+#define prof_publish(_nes)       ((void)0)
+#define prof_print(_nes)         ((void)0)
+
+#endif // NES_PROF
+
+/*!
+ * Consistent copy of the stats block, callable from any thread
+ *
+ * @param p nes->prof
+ * @param last Receives the last finished frame, may be NULL
+ * @param total Receives the sums, may be NULL
+ */
+static inline void
+prof_read(const struct prof *p, struct prof_frame *last,
+          struct prof_frame *total)
+{
+    u32 seq;
+
+    do
+    {
+        while ((seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE)) & 1)
+        {
+        }
+
+        if (last) *last = p->last;
+        if (total) *total = p->total;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) != seq);
+}
+
+#endif // NES_PROF_H_
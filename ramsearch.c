@@ -0,0 +1,330 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+#include "ramsearch.h"
+#include "mapper.h"
+#include "rp2a03.h"
+#include "util.h"
+
+_Static_assert(RAMSEARCH_SIZE % 16 == 0, "snapshots go 16 bytes at a time");
+
+struct ramsearch *
+ramsearch_create(struct nes *nes)
+{
+    if (nes->mode_libcpu)
+    {
+        return NULL;
+    }
+
+    struct ramsearch *rs = aligned_alloc(16, sizeof(struct ramsearch));
+
+    memset(rs, 0, sizeof(struct ramsearch));
+    pthread_mutex_init(&rs->lock, NULL);
+
+    nes->ramsearch = rs;
+    return rs;
+}
+
+void
+ramsearch_free(struct nes *nes)
+{
+    pthread_mutex_destroy(&nes->ramsearch->lock);
+    free(nes->ramsearch);
+    nes->ramsearch = NULL;
+}
+
+void
+ramsearch_snap(struct ramsearch *rs, struct nes *nes)
+{
+    // the console is searching, it can't have the ring change under it
+    if (pthread_mutex_trylock(&rs->lock) != 0)
+    {
+        __atomic_add_fetch(&rs->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    u8 *s   = rs->snaps[rs->taken % RAMSEARCH_FRAMES];
+    u8 *prg = MAP_CALL(nes, nes->cartridge.mapper, 0x6000, nes->cpu->mem,
+                       MAP_MODE_CPU);
+
+    memcpy(s, nes->core->ram, RAMSEARCH_RAM);
+    memcpy(s + RAMSEARCH_RAM, prg, RAMSEARCH_SIZE - RAMSEARCH_RAM);
+    rs->taken += 1;
+
+    pthread_mutex_unlock(&rs->lock);
+}
+
+/*
+ * Snapshot back frames before the newest
+ */
+static const u8 *
+ramsearch_at(const struct ramsearch *rs, u64 back)
+{
+    return rs->snaps[(rs->taken - 1 - back) % RAMSEARCH_FRAMES];
+}
+
+static u16
+ramsearch_addr(u32 i)
+{
+    return i < RAMSEARCH_RAM ? i : 0x6000 + (i - RAMSEARCH_RAM);
+}
+
+int
+ramsearch_start(struct ramsearch *rs)
+{
+    pthread_mutex_lock(&rs->lock);
+    if (rs->taken == 0)
+    {
+        pthread_mutex_unlock(&rs->lock);
+        return 0;
+    }
+
+    memset(rs->alive, 0xFF, sizeof(rs->alive));
+    memcpy(rs->base, ramsearch_at(rs, 0), sizeof(rs->base));
+    rs->left    = RAMSEARCH_SIZE;
+    rs->started = 1;
+
+    pthread_mutex_unlock(&rs->lock);
+    return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * a > b for unsigned bytes, SSE2 only compares signed ones
+ */
+static inline __m128i
+ramsearch_gt(__m128i a, __m128i b)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+
+    return _mm_cmpgt_epi8(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+}
+
+/*
+ * 0xFF in every byte op holds for, going from old to cur
+ */
+static inline __m128i
+ramsearch_test(char op, __m128i old, __m128i cur, __m128i value)
+{
+    switch (op)
+    {
+        case '+':
+            return ramsearch_gt(cur, old);
+        case '-':
+            return ramsearch_gt(old, cur);
+        case '!':
+            return _mm_andnot_si128(_mm_cmpeq_epi8(cur, old),
+                                    _mm_set1_epi8((char)0xFF));
+        case '.':
+            return _mm_cmpeq_epi8(cur, old);
+        case '=':
+            return _mm_cmpeq_epi8(cur, value);
+        case '<':
+            return ramsearch_gt(value, cur);
+        case '>':
+            return ramsearch_gt(cur, value);
+    }
+
+    return _mm_setzero_si128();
+}
+
+/*
+ * Filters the candidates 16 at a time
+ */
+static u32
+ramsearch_pass(struct ramsearch *rs, char op, u8 value, const u8 **olds,
+               const u8 **curs, u32 n)
+{
+    __m128i v    = _mm_set1_epi8((char)value);
+    u32     left = 0;
+
+    for (u32 i = 0; i < RAMSEARCH_SIZE; i += 16)
+    {
+        __m128i m = _mm_load_si128((const __m128i *)(rs->alive + i));
+
+        for (u32 k = 0; k < n && _mm_movemask_epi8(m); k++)
+        {
+            __m128i cur = _mm_load_si128((const __m128i *)(curs[k] + i));
+            __m128i old = _mm_load_si128((const __m128i *)(olds[k] + i));
+
+            m = _mm_and_si128(m, ramsearch_test(op, old, cur, v));
+        }
+
+        _mm_store_si128((__m128i *)(rs->alive + i), m);
+        left += __builtin_popcount(_mm_movemask_epi8(m));
+    }
+
+    return left;
+}
+#else
+/*
+ * Whether op holds for a byte, going from old to cur
+ */
+static inline int
+ramsearch_test(char op, u8 old, u8 cur, u8 value)
+{
+    switch (op)
+    {
+        case '+':
+            return cur > old;
+        case '-':
+            return cur < old;
+        case '!':
+            return cur != old;
+        case '.':
+            return cur == old;
+        case '=':
+            return cur == value;
+        case '<':
+            return cur < value;
+        case '>':
+            return cur > value;
+    }
+
+    return 0;
+}
+
+/*
+ * Filters the candidates one byte at a time
+ */
+static u32
+ramsearch_pass(struct ramsearch *rs, char op, u8 value, const u8 **olds,
+               const u8 **curs, u32 n)
+{
+    u32 left = 0;
+
+    for (u32 i = 0; i < RAMSEARCH_SIZE; i++)
+    {
+        u8 m = rs->alive[i];
+
+        for (u32 k = 0; k < n && m; k++)
+        {
+            if (!ramsearch_test(op, olds[k][i], curs[k][i], value)) m = 0x00;
+        }
+
+        rs->alive[i] = m;
+        left += m != 0;
+    }
+
+    return left;
+}
+#endif
+
+int
+ramsearch_filter(struct ramsearch *rs, char op, u8 value, u32 frames)
+{
+    const u8 *olds[RAMSEARCH_FRAMES];
+    const u8 *curs[RAMSEARCH_FRAMES];
+    u32       n = 1;
+
+    if (op == '\0' || !strchr("+-!.=<>", op))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&rs->lock);
+    if (!rs->started)
+    {
+        pthread_mutex_unlock(&rs->lock);
+        return -1;
+    }
+
+    u32 have  = MIN(rs->taken, RAMSEARCH_FRAMES);
+    u8  about = strchr("=<>", op) != NULL; // a value, not a change
+
+    // each of the last frames, or since the last step
+    olds[0] = rs->base;
+    curs[0] = ramsearch_at(rs, 0);
+    if (frames && (about || have > 1))
+    {
+        n = MIN(frames, have - !about);
+        for (u32 k = 0; k < n; k++)
+        {
+            curs[k] = ramsearch_at(rs, k);
+            olds[k] = about ? curs[k] : ramsearch_at(rs, k + 1);
+        }
+    }
+
+    u32 left = ramsearch_pass(rs, op, value, olds, curs, n);
+
+    memcpy(rs->base, curs[0], sizeof(rs->base));
+    rs->left = left;
+
+    pthread_mutex_unlock(&rs->lock);
+    return left;
+}
+
+void
+ramsearch_list(struct ramsearch *rs)
+{
+    u32 shown = 0;
+
+    pthread_mutex_lock(&rs->lock);
+    if (!rs->started)
+    {
+        pthread_mutex_unlock(&rs->lock);
+        printf("No search, fn starts one\n");
+        return;
+    }
+
+    const u8 *cur = ramsearch_at(rs, 0);
+
+    printf("%u candidates, %llu frames not captured\n", rs->left,
+           (unsigned long long)__atomic_load_n(&rs->dropped,
+                                               __ATOMIC_RELAXED));
+    for (u32 i = 0; i < RAMSEARCH_SIZE && shown < RAMSEARCH_LIST; i++)
+    {
+        if (rs->alive[i])
+        {
+            printf("$%04X: %02X (%02X at the last step)\n", ramsearch_addr(i),
+                   cur[i], rs->base[i]);
+            shown++;
+        }
+    }
+    if (shown < rs->left)
+    {
+        printf("...\n");
+    }
+
+    pthread_mutex_unlock(&rs->lock);
+}
+
+void
+ramsearch_history(struct ramsearch *rs, u16 addr, u32 count)
+{
+    u32 i;
+
+    if (addr < 0x2000)
+    {
+        i = addr & (RAMSEARCH_RAM - 1);
+    }
+    else if (addr >= 0x6000 && addr < 0x8000)
+    {
+        i = RAMSEARCH_RAM + (addr - 0x6000);
+    }
+    else
+    {
+        printf("$%04X is neither RAM nor PRG-RAM\n", addr);
+        return;
+    }
+
+    pthread_mutex_lock(&rs->lock);
+
+    count = MIN(count, MIN(rs->taken, RAMSEARCH_FRAMES));
+    printf("$%04X, last %u frames:", ramsearch_addr(i), count);
+    for (u32 k = count; k > 0; k--)
+    {
+        printf("%s%02X", (count - k) % 16 ? " " : "\n  ",
+               ramsearch_at(rs, k - 1)[i]);
+    }
+    printf("\n");
+
+    pthread_mutex_unlock(&rs->lock);
+}
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_RAMSEARCH_H_
+#define NES_RAMSEARCH_H_
+
+/*! @file ramsearch.h
+ * RAM search and watch
+ *
+ * For finding where a game keeps lives, timers or positions. With -d, the
+ * game loop copies CPU RAM and PRG-RAM ($6000-$7FFF) into a ring of the last
+ * RAMSEARCH_FRAMES frames, at the end of each one. The debugger console (see
+ * debug.h) searches these snapshots, never the live machine, so it can run
+ * while the game does. The game loop only ever tries the lock: a frame that
+ * comes in while the console holds it isn't captured.
+ *
+ * A search starts with every byte as a candidate and narrows them down with
+ * one predicate at a time. Each compares the newest snapshot with the one
+ * the last step of the search saw, or, given a number of frames, has to hold
+ * for every one of the last that many frames: a byte that increased in each
+ * of them, or equaled a value in each. The filter goes over 16 bytes at a
+ * time with SSE2, and over all frames asked for before moving on, so each
+ * candidate mask is loaded and stored once.
+ *
+ * Snapshot byte i is CPU address i below RAMSEARCH_RAM, and $6000 plus the
+ * rest above it. Needs the in-tree core (not -l).
+ */
+
+#include <pthread.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#define RAMSEARCH_RAM    0x800                     //!< Internal RAM
+#define RAMSEARCH_SIZE   (RAMSEARCH_RAM + 0x2000) //!< And PRG-RAM
+#define RAMSEARCH_FRAMES 64
+#define RAMSEARCH_LIST   32 //!< Candidates ramsearch_list() prints at most
+
+/*!
+ * @struct ramsearch
+ * Snapshots, filled by the game loop, and the search the console runs on
+ * them
+ */
+struct ramsearch
+{
+    u8 snaps[RAMSEARCH_FRAMES][RAMSEARCH_SIZE] __attribute__((aligned(16)));
+    u64 taken;    //!< Snapshots taken, the newest is (taken - 1) % FRAMES
+    u64 dropped;  //!< Frames the console held the lock through
+    u8  complete; //!< Last nes->frame_complete seen
+
+    u8  alive[RAMSEARCH_SIZE] __attribute__((aligned(16))); //!< 0xFF, 0x00
+    u8  base[RAMSEARCH_SIZE] __attribute__((aligned(16)));  //!< Last step
+    u32 left;    //!< Candidates alive
+    u8  started; //!< There is a search
+
+    pthread_mutex_t lock; //!< Over everything above
+};
+
+/*!
+ * Sets up an empty ring and stores it in nes->ramsearch
+ *
+ * @returns NULL with -l
+ */
+struct ramsearch *
+ramsearch_create(struct nes *nes);
+
+void
+ramsearch_free(struct nes *nes);
+
+/*
+ * Copies the machine into the ring, see ramsearch_capture()
+ */
+void
+ramsearch_snap(struct ramsearch *rs, struct nes *nes);
+
+/*!
+ * Called by the game loop between two CPU slices. Takes a snapshot once per
+ * frame, when nes->frame_complete rises
+ */
+static inline void
+ramsearch_capture(struct ramsearch *rs, struct nes *nes)
+{
+    if (nes->frame_complete != rs->complete)
+    {
+        rs->complete = nes->frame_complete;
+        if (rs->complete) ramsearch_snap(rs, nes);
+    }
+}
+
+/*!
+ * Makes every byte a candidate again, as of the newest snapshot
+ *
+ * @returns 0 if there is no snapshot yet
+ */
+int
+ramsearch_start(struct ramsearch *rs);
+
+/*!
+ * Keeps the candidates op holds for
+ *
+ * @param rs
+ * @param op + increased, - decreased, ! changed, . unchanged, or = < > value
+ * @param value Compared with for = < >
+ * @param frames 0 to compare with the last step, else the number of frames
+ *        op has to hold in each of, as far as the ring goes back
+ *
+ * @returns Candidates left, or -1 if there is no search or op is unknown
+ */
+int
+ramsearch_filter(struct ramsearch *rs, char op, u8 value, u32 frames);
+
+/*!
+ * Prints the first RAMSEARCH_LIST candidates to stdout, with their value in
+ * the newest snapshot and at the last step
+ */
+void
+ramsearch_list(struct ramsearch *rs);
+
+/*!
+ * Prints what addr held over the last count frames to stdout, oldest first
+ */
+void
+ramsearch_history(struct ramsearch *rs, u16 addr, u32 count);
+
+#endif // NES_RAMSEARCH_H_
@@ -0,0 +1,324 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "ppu.h"
+#include "rp2a03.h"
+#include "util.h"
+
+/*
+ * Encodes cur XOR prev, or cur alone if prev is NULL
+ *
+ * @returns Bytes written to out, at most sizeof(struct state) + 4
+ */
+static size_t
+rewind_encode(const u8 *cur, const u8 *prev, u8 *out)
+{
+    const size_t n = sizeof(struct state);
+    size_t       i = 0, o = 0;
+
+#define REWIND_X(_i) (prev ? cur[_i] ^ prev[_i] : cur[_i])
+
+    while (i < n)
+    {
+        size_t zeros = i;
+        while (i < n && REWIND_X(i) == 0)
+        {
+            i++;
+        }
+        zeros = i - zeros;
+
+        // literals run until REWIND_MIN_ZEROS zeros in a row, or the end
+        size_t lit = i;
+        while (i < n)
+        {
+            size_t z = i;
+            while (z < n && z - i < REWIND_MIN_ZEROS && REWIND_X(z) == 0)
+            {
+                z++;
+            }
+            if (z - i == REWIND_MIN_ZEROS || z == n)
+            {
+                break;
+            }
+            i = z + 1;
+        }
+
+        u16 hdr[2] = {zeros, i - lit};
+        memcpy(out + o, hdr, sizeof(hdr));
+        o += sizeof(hdr);
+        for (size_t j = lit; j < i; j++)
+        {
+            out[o++] = REWIND_X(j);
+        }
+    }
+
+#undef REWIND_X
+
+    return o;
+}
+
+/*
+ * XORs an encoded entry into state
+ */
+static void
+rewind_apply(u8 *state, const u8 *in, size_t len)
+{
+    size_t i = 0, o = 0;
+
+    while (i < len)
+    {
+        u16 hdr[2];
+        memcpy(hdr, in + i, sizeof(hdr));
+        i += sizeof(hdr);
+        o += hdr[0];
+
+        for (u16 j = 0; j < hdr[1]; j++)
+        {
+            state[o++] ^= in[i++];
+        }
+    }
+}
+
+static struct rewind_entry *
+rewind_entry(struct rewind *rw, u32 i)
+{
+    return &rw->ents[(rw->first + i) % rw->nents];
+}
+
+/*
+ * Appends an encoded entry, dropping the oldest ones until it fits. Called
+ * with the lock held
+ */
+static void
+rewind_append(struct rewind *rw, const u8 *data, u32 len, u32 key)
+{
+    u64 off = rw->head;
+
+    // entries are never split across the end of buf
+    if (off % rw->cap + len > rw->cap)
+    {
+        off += rw->cap - off % rw->cap;
+    }
+
+    while (rw->count &&
+           (rw->count == rw->nents ||
+            off + len - rewind_entry(rw, 0)->off > rw->cap))
+    {
+        rw->first = (rw->first + 1) % rw->nents;
+        rw->count -= 1;
+    }
+
+    struct rewind_entry *e = rewind_entry(rw, rw->count);
+    e->off = off;
+    e->len = len;
+    e->key = key;
+    memcpy(rw->buf + off % rw->cap, data, len);
+
+    rw->count += 1;
+    rw->head = off + len;
+}
+
+static const u8 *
+rewind_data(struct rewind *rw, const struct rewind_entry *e)
+{
+    return rw->buf + e->off % rw->cap;
+}
+
+/*
+ * Compressor thread
+ */
+static void *
+rewind_loop(void *in)
+{
+    struct rewind *rw = in;
+
+    for (;;)
+    {
+        sem_wait(&rw->ready);
+        if (!__atomic_load_n(&rw->enable, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        u32           tail = rw->in_tail;
+        struct state *s    = &rw->inbox[tail % REWIND_INBOX];
+        u32           key  = rw->count == 0 || rw->since_key >= REWIND_KEYFRAME;
+
+        pthread_mutex_lock(&rw->lock);
+        size_t len = rewind_encode((const u8 *)s,
+                                   key ? NULL : (const u8 *)&rw->prev,
+                                   rw->scratch);
+        rewind_append(rw, rw->scratch, len, key);
+        rw->since_key = key ? 1 : rw->since_key + 1;
+        memcpy(&rw->prev, s, sizeof(struct state));
+        pthread_mutex_unlock(&rw->lock);
+
+        __atomic_store_n(&rw->in_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+struct rewind *
+rewind_create(struct nes *nes, u64 budget)
+{
+    if (nes->mode_libcpu || nes->mode_pipeline)
+    {
+        return NULL;
+    }
+
+    struct rewind *rw = calloc(1, sizeof(struct rewind));
+
+    // the fixed part and the entry table come off the budget first
+    u64 fixed = sizeof(struct rewind);
+    rw->nents = MIN(MAX(budget / REWIND_ENTRY_BYTES, 1), REWIND_ENTRIES);
+    fixed += (u64)rw->nents * sizeof(struct rewind_entry);
+
+    rw->cap  = MAX(budget - MIN(budget, fixed), sizeof(rw->scratch));
+    rw->buf  = malloc(rw->cap);
+    rw->ents = malloc(rw->nents * sizeof(struct rewind_entry));
+
+    sem_init(&rw->ready, 0, 0);
+    pthread_mutex_init(&rw->lock, NULL);
+    rw->enable = 1;
+    pthread_create(&rw->thread, NULL, rewind_loop, rw);
+
+    nes->rewind = rw;
+    return rw;
+}
+
+void
+rewind_free(struct rewind *rw)
+{
+    __atomic_store_n(&rw->enable, 0, __ATOMIC_RELEASE);
+    sem_post(&rw->ready);
+    pthread_join(rw->thread, NULL);
+
+    sem_destroy(&rw->ready);
+    pthread_mutex_destroy(&rw->lock);
+    free(rw->ents);
+    free(rw->buf);
+    free(rw);
+}
+
+void
+rewind_push(struct rewind *rw, struct nes *nes)
+{
+    u32 head = rw->in_head;
+
+    if (head - __atomic_load_n(&rw->in_tail, __ATOMIC_ACQUIRE) >= REWIND_INBOX)
+    {
+        rw->dropped += 1;
+        return;
+    }
+
+    state_save(nes, &rw->inbox[head % REWIND_INBOX]);
+    __atomic_store_n(&rw->in_head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&rw->ready);
+}
+
+/*
+ * Rebuilds the state before entry pos into cur. Called with the lock held
+ */
+static int
+rewind_back(struct rewind *rw)
+{
+    struct rewind_entry *e = rewind_entry(rw, rw->pos);
+
+    if (rw->pos == 0)
+    {
+        return 0;
+    }
+
+    if (!e->key)
+    {
+        rewind_apply((u8 *)&rw->cur, rewind_data(rw, e), e->len);
+        rw->pos -= 1;
+        return 1;
+    }
+
+    // the keyframe before this one, then forward through its deltas
+    u32 k = rw->pos - 1;
+    while (k > 0 && !rewind_entry(rw, k)->key)
+    {
+        k--;
+    }
+    if (!rewind_entry(rw, k)->key)
+    {
+        return 0;
+    }
+
+    memset(&rw->cur, 0, sizeof(struct state));
+    for (u32 i = k; i < rw->pos; i++)
+    {
+        e = rewind_entry(rw, i);
+        rewind_apply((u8 *)&rw->cur, rewind_data(rw, e), e->len);
+    }
+    rw->pos -= 1;
+    return 1;
+}
+
+int
+rewind_step(struct rewind *rw, struct nes *nes)
+{
+    struct rp2a03 *c = nes->core;
+
+    // everything the game loop pushed goes into the ring first
+    while (__atomic_load_n(&rw->in_tail, __ATOMIC_ACQUIRE) != rw->in_head)
+    {
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&rw->lock);
+    if (!rw->back)
+    {
+        if (rw->count == 0)
+        {
+            pthread_mutex_unlock(&rw->lock);
+            return 0;
+        }
+        memcpy(&rw->cur, &rw->prev, sizeof(struct state));
+        rw->pos  = rw->count - 1;
+        rw->back = 1;
+    }
+
+    int moved = rewind_back(rw);
+    pthread_mutex_unlock(&rw->lock);
+
+    // the frame buffer isn't part of a state, run a frame to redraw it. Even
+    // if run-ahead normally hides the real frames
+    u8 hidden = nes->ppu->hidden;
+
+    state_load(nes, &rw->cur);
+    ppu_set_hidden(nes->ppu, 0);
+    rp2a03_run(c, c->cycles + NES_FRAME_CYCLES);
+    ppu_set_hidden(nes->ppu, hidden);
+
+    return moved;
+}
+
+void
+rewind_end(struct rewind *rw, struct nes *nes)
+{
+    if (!rw->back)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&rw->lock);
+    struct rewind_entry *e = rewind_entry(rw, rw->pos);
+
+    rw->count     = rw->pos + 1;
+    rw->head      = e->off + e->len;
+    rw->since_key = REWIND_KEYFRAME; // cheaper than finding the last one
+    rw->back      = 0;
+    memcpy(&rw->prev, &rw->cur, sizeof(struct state));
+    pthread_mutex_unlock(&rw->lock);
+
+    state_load(nes, &rw->cur);
+    rw->complete = nes->frame_complete;
+}
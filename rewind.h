@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_REWIND_H_
+#define NES_REWIND_H_
+
+/*! @file rewind.h
+ * Rewind
+ *
+ * With -R megabytes, the game loop takes a save state (see state.h) at the
+ * end of every frame and drops it in a small inbox. A compressor thread XORs
+ * it with the state before it, run-length encodes the result and appends it
+ * to a ring of at most that many megabytes. Every REWIND_KEYFRAME-th entry is
+ * a keyframe, the encoded state itself instead of a delta. The oldest entries
+ * are dropped to make room. If the compressor falls a whole inbox behind,
+ * the newest states are dropped instead, and the next delta is simply taken
+ * against the last state that made it.
+ *
+ * Holding r steps backwards a frame at a time. As XOR is its own inverse, the
+ * state before a delta entry is the state after it XORed with the delta
+ * again, so most steps only touch the bytes that changed. Stepping over a
+ * keyframe rebuilds the state before it from the previous keyframe and the
+ * deltas after that. Each step loads the state and runs one frame to redraw
+ * the screen. Letting go resumes from the state shown and forgets
+ * everything after it.
+ *
+ * The megabytes cover everything rewind allocates: the states it keeps at
+ * hand (inbox, the newest state, the one shown and the encoder output, about
+ * 360KB) and the entry table come off the top, the ring gets the rest. The
+ * table has one entry per REWIND_ENTRY_BYTES of budget, up to REWIND_ENTRIES.
+ * A budget too small for the ring to hold a keyframe is rounded up.
+ *
+ * Encoding: a sequence of (u16 zeros, u16 count, count bytes) runs. zeros
+ * bytes are skipped, count bytes are XORed into the state. Zero runs shorter
+ * than REWIND_MIN_ZEROS stay inside the literal bytes.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#include "state.h"
+
+#define REWIND_INBOX       4     //!< States between game loop and compressor
+#define REWIND_ENTRIES     65536 //!< About 18 minutes at 60 per second
+#define REWIND_ENTRY_BYTES 256   //!< Budget per entry, see rewind_create()
+#define REWIND_KEYFRAME    60    //!< One keyframe per second
+#define REWIND_MIN_ZEROS   8
+
+// counts in the encoding are 16 bits
+_Static_assert(sizeof(struct state) < 0x10000, "state too large to encode");
+
+struct rewind_entry
+{
+    u64 off; //!< Offset in bytes appended since creation, see rewind.buf
+    u32 len;
+    u32 key; //!< Keyframe, encoded against zeros
+};
+
+/*!
+ * @struct rewind
+ * Ring of encoded states and the compressor feeding it
+ */
+struct rewind
+{
+    u8 *buf;  //!< Encoded entries, byte off is at buf[off % cap]
+    u64 cap;  //!< Size of buf, what is left of the budget
+    u64 head; //!< Bytes appended since creation
+
+    struct rewind_entry *ents;
+    u32                  nents; //!< Size of ents
+    u32                  first; //!< Oldest entry
+    u32                 count;
+    u32                 since_key; //!< Entries since the last keyframe
+
+    struct state prev; //!< State of the newest entry
+    struct state cur;  //!< State being shown while rewinding
+    u32          pos;  //!< Entry cur belongs to, counted from the oldest
+    u8           back; //!< Rewinding, cur and pos are valid
+
+    u8 scratch[sizeof(struct state) + 16]; //!< Encoder output
+
+    struct state inbox[REWIND_INBOX];
+    u32          in_head; //!< Owned by the game loop
+    u32          in_tail; //!< Owned by the compressor
+    u8           complete; //!< Last nes->frame_complete seen
+
+    sem_t           ready;
+    pthread_mutex_t lock; //!< Held by the compressor or a rewind step
+    pthread_t       thread;
+    u8              enable;
+
+    u64 dropped; //!< States the compressor had no room for
+};
+
+/*!
+ * Starts the compressor with budget bytes in all and stores it in
+ * nes->rewind
+ *
+ * @returns NULL if states can't be saved and loaded in this configuration
+ */
+struct rewind *
+rewind_create(struct nes *nes, u64 budget);
+
+/*!
+ * Stops the compressor and frees the ring
+ */
+void
+rewind_free(struct rewind *rw);
+
+/*
+ * Game loop side of a capture, see rewind_capture()
+ */
+void
+rewind_push(struct rewind *rw, struct nes *nes);
+
+/*!
+ * Called by the game loop between two CPU slices. Takes a state once per
+ * frame, right after the frame is complete
+ */
+static inline void
+rewind_capture(struct rewind *rw, struct nes *nes)
+{
+    if (nes->frame_complete != rw->complete)
+    {
+        rw->complete = nes->frame_complete;
+        if (rw->complete) rewind_push(rw, nes);
+    }
+}
+
+/*!
+ * Steps one frame back and redraws it
+ *
+ * @returns 0 at the oldest state that can be rebuilt
+ */
+int
+rewind_step(struct rewind *rw, struct nes *nes);
+
+/*!
+ * Resumes from the state rewound to. Called once the rewind key is let go
+ */
+void
+rewind_end(struct rewind *rw, struct nes *nes);
+
+#endif // NES_REWIND_H_
@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rom.h"
+#include "clone.h"
+#include "mapper.h"
+#include "nescpu.h"
+#include "ppu.h"
+#include "rp2a03.h"
+#include "rp2a03aot.h"
+
+struct nes *
+rom_create(void)
+{
+    struct nes *nes = calloc(1, sizeof(struct nes));
+
+    nes->cpu           = calloc(1, sizeof(struct cpu));
+    nes->ppu           = calloc(1, sizeof(struct ppu));
+    nes->cpu->mem      = calloc(1, MEM_SIZE);
+    nes->core          = calloc(1, sizeof(struct rp2a03));
+    nes->mappers       = calloc(0x100, sizeof(void *));
+    nes->mapper_writes = calloc(0x100, sizeof(void *));
+    nes->enable        = 1;
+
+    nes->cpu->cpu_read  = nes_cpu_read;
+    nes->cpu->cpu_write = nes_cpu_write;
+
+    nes->cpu->fw = nes;
+    nes->ppu->fw = nes;
+
+    mappers_init(nes);
+    ppu_init(nes->ppu);
+
+    return nes;
+}
+
+int
+rom_load(struct nes *nes, const char *path)
+{
+    struct
+    {
+        u8 name[4]; // "NES\x1A"
+        u8 s_prg_rom_16;
+        u8 s_chr_rom_8;
+        u8 flags6;
+        u8 flags7;
+        u8 padding[8];
+    } header;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return 0;
+    }
+
+    if (fread(&header, 16, 1, file) != 1 ||
+        memcmp(header.name, "NES\x1A", 4) != 0)
+    {
+        fprintf(stderr, "%s: not an iNES file\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    if (header.flags6 & 0x04)
+    {
+        fseek(file, 512, SEEK_CUR); // skip trainer
+    }
+
+    nes->cartridge.mapper = (header.flags7 & 0xF0) | (header.flags6 >> 4);
+    nes->mirror =
+      (header.flags6 & 0x01) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+
+    nes->cartridge.s_prg_rom_16 = header.s_prg_rom_16;
+    nes->cartridge.s_chr_rom_8  = header.s_chr_rom_8;
+
+    int sprg = nes->cartridge.s_prg_rom_16 * 0x4000;
+    int schr = nes->cartridge.s_chr_rom_8 * 0x2000;
+
+    // ROM on pages of its own, so clones never copy it, see clone.h
+    nes->cartridge.chr = clone_alloc(schr ? schr : 0x2000); // CHR-RAM if none
+    nes->cartridge.prg = clone_alloc(sprg);
+    if (!schr)
+    {
+        memset(nes->cartridge.chr, 0, 0x2000);
+    }
+
+    if (fread(nes->cartridge.prg, sprg, 1, file) != 1 ||
+        (schr && fread(nes->cartridge.chr, schr, 1, file) != 1))
+    {
+        fprintf(stderr, "%s: truncated\n", path);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    nes->cartridge.hash = rp2a03_aot_hash(nes->cartridge.prg, sprg,
+                                          nes->cartridge.chr, schr);
+
+    mapper_init(nes);
+    rp2a03_init(nes->core, nes);
+
+    return 1;
+}
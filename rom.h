@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_ROM_H_
+#define NES_ROM_H_
+
+/*! @file rom.h
+ * Machine setup and iNES loading
+ *
+ * Shared by nes.c and the tools that run the core without nes.c, SDL or a
+ * window (tools/nessearch.c, tools/nesnet.c), so every machine is set up the
+ * same way. Any number of them can run in one process, on as many threads.
+ */
+
+#include <cpu.h>
+#include <nes.h>
+
+/*!
+ * Allocates a machine with no cartridge in it. The CPU, PPU and core are
+ * zeroed, the mapper tables filled in
+ */
+struct nes *
+rom_create(void);
+
+/*!
+ * Loads the iNES file at path into nes, then sets up its mapper and the core.
+ * PRG and CHR get pages of their own, see clone_alloc(). Doesn't reset, the
+ * caller does that once whatever reads the reset vector is in place
+ *
+ * @returns 0 if path can't be read or isn't an iNES file, with a message on
+ *          stderr
+ */
+int
+rom_load(struct nes *nes, const char *path);
+
+#endif // NES_ROM_H_
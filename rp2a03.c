@@ -0,0 +1,1491 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp2a03.h"
+#include "rp2a03op.h"
+#include "rp2a03jit.h"
+#include "rp2a03aot.h"
+#include "trace.h"
+#include "cdl.h"
+#include "cheat.h"
+#include "clone.h"
+#include "debug.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "nescpu.h"
+#include "prof.h"
+
+#define C_ RP2A03_C
+#define Z_ RP2A03_Z
+#define I_ RP2A03_I
+#define B_ RP2A03_B
+#define U_ RP2A03_U
+#define V_ RP2A03_V
+#define N_ RP2A03_N
+
+#define PAGE(_a)        ((_a) >> 11)
+#define CROSSED(_a, _b) (((_a) ^ (_b)) & 0xFF00)
+
+/*
+ * Runs the PPU up to (and including) the given CPU cycle, 3 dots per cycle
+ */
+static inline void
+rp2a03_sync(struct rp2a03 *c, u64 to)
+{
+    struct ppu *ppu = c->nes->ppu;
+
+    if (c->synced < to)
+    {
+        PROF_ENTER(PROF_PPU);
+        while (c->synced < to)
+        {
+            ppu_clock(ppu);
+            ppu_clock(ppu);
+            ppu_clock(ppu);
+            c->synced += 1;
+        }
+        PROF_LEAVE(PROF_PPU);
+    }
+    c->nes->cycle = c->synced;
+}
+
+/*
+ * Drops every block decoded from writable memory
+ */
+static void
+rp2a03_flush(struct rp2a03 *c)
+{
+    for (int i = 0; i < RP2A03_PAGES; i++)
+    {
+        if (c->codemap[i])
+        {
+            memset(c->codemap[i], 0, 0x800);
+            c->codemap[i] = NULL;
+        }
+    }
+
+    c->gen += 1;
+    c->flush = 1;
+    c->stats_cache.flushes += 1;
+}
+
+/*
+ * Called for writes to a page that holds cached code
+ */
+static void
+rp2a03_code_write(struct rp2a03 *c, u16 addr)
+{
+    if (c->codemap[PAGE(addr)][addr & 0x07FF])
+    {
+        rp2a03_flush(c);
+    }
+}
+
+/*
+ * Checks an access to a watched page against the debugger's points. The
+ * instruction is already halfway through, so a hit is kept for rp2a03_debug()
+ * to report before the next one
+ */
+static void
+rp2a03_watch(struct rp2a03 *c, u16 addr, u8 kind)
+{
+    struct debug     *dbg  = c->nes->debug;
+    struct ppu       *ppu  = c->nes->ppu;
+    struct debug_stop stop = {-1, DEBUG_CPU, kind, debug_canon(addr)};
+
+    if (!dbg || dbg->watched)
+    {
+        return;
+    }
+
+    if (dbg->pages[PAGE(stop.addr)] & kind)
+    {
+        stop.id = debug_find(dbg, DEBUG_CPU, kind, stop.addr, stop.addr);
+        if (stop.id >= 0) goto hit;
+    }
+
+    // PPU space and OAM are reached through their registers
+    if (stop.addr == 0x2007 && (dbg->ppu & kind))
+    {
+        stop.space = DEBUG_PPU;
+        stop.addr  = ppu->vaddr & 0x3FFF;
+        stop.id    = debug_find(dbg, DEBUG_PPU, kind, stop.addr, stop.addr);
+    }
+    else if (stop.addr == 0x2004 && (dbg->oam & kind))
+    {
+        stop.space = DEBUG_OAM;
+        stop.addr  = ppu->registers.oamaddr;
+        stop.id    = debug_find(dbg, DEBUG_OAM, kind, stop.addr, stop.addr);
+    }
+    else if (stop.addr == 0x4014 && (kind & dbg->oam & DEBUG_WRITE))
+    {
+        stop.space = DEBUG_OAM;
+        stop.id    = debug_find(dbg, DEBUG_OAM, DEBUG_WRITE, 0x00, 0xFF);
+        stop.addr  = stop.id >= 0 ? dbg->points[stop.id].lo : 0;
+    }
+
+    if (stop.id < 0)
+    {
+        return;
+    }
+
+hit:
+    dbg->watch   = stop;
+    dbg->watched = 1;
+    __atomic_store_n(&dbg->step, 1, __ATOMIC_RELEASE);
+    c->flush = 1;
+}
+
+/*
+ * wrmap entry of page i: none while the debugger watches it or a clone mark
+ * still has to copy some of it
+ */
+static inline u8 *
+rp2a03_wrpage(struct rp2a03 *c, int i)
+{
+    struct clone_mark *m  = c->nes->mark;
+    u8                *wr = c->wrmem[i];
+
+    if (c->watch[i] & DEBUG_WRITE) return NULL;
+    if (m && wr && clone_pending(m, wr, 0x800)) return NULL;
+    return wr;
+}
+
+/*
+ * Reads and writes of pages rp2a03_remap() left out of rdmap and wrmap:
+ * pages the debugger watches, and memory a clone mark has yet to copy. Kept
+ * out of line, nothing else comes here
+ */
+static __attribute__((noinline)) u8
+rp2a03_read_watched(struct rp2a03 *c, u16 addr, u64 at)
+{
+    u8 *p = c->rdmem[PAGE(addr)];
+
+    if (p)
+    {
+        rp2a03_watch(c, addr, DEBUG_READ);
+        return p[addr & 0x07FF];
+    }
+
+    // the PPU points look at VRAM and OAM addresses as of the access
+    rp2a03_sync(c, at);
+    rp2a03_watch(c, addr, DEBUG_READ);
+    return nes_bus_read(c->nes, addr);
+}
+
+static __attribute__((noinline)) void
+rp2a03_write_watched(struct rp2a03 *c, u16 addr, u8 val, u64 at)
+{
+    u8 *p = c->wrmem[PAGE(addr)];
+
+    if (p)
+    {
+        if (c->watch[PAGE(addr)] & DEBUG_WRITE)
+        {
+            rp2a03_watch(c, addr, DEBUG_WRITE);
+        }
+        if (c->nes->mark)
+        {
+            clone_touch(c->nes->mark, p + (addr & 0x07FF));
+            c->wrmap[PAGE(addr)] = rp2a03_wrpage(c, PAGE(addr));
+        }
+        p[addr & 0x07FF] = val;
+        if (c->codemap[PAGE(addr)]) rp2a03_code_write(c, addr);
+        return;
+    }
+
+    rp2a03_sync(c, at);
+    rp2a03_watch(c, addr, DEBUG_WRITE);
+    nes_bus_write(c->nes, addr, val);
+}
+
+/*
+ * The page table covers RAM (which includes the zero page and the stack),
+ * PRG-RAM and PRG-ROM. Only I/O, mapper registers and watched pages leave
+ * this function
+ */
+static inline u8
+rp2a03_read(struct rp2a03 *c, u16 addr, u64 at)
+{
+    u8 *p = c->rdmap[PAGE(addr)];
+    if (p)
+    {
+        return p[addr & 0x07FF];
+    }
+
+    if (c->watch[PAGE(addr)] & DEBUG_READ)
+    {
+        return rp2a03_read_watched(c, addr, at);
+    }
+
+    rp2a03_sync(c, at);
+    return nes_bus_read(c->nes, addr);
+}
+
+static inline void
+rp2a03_write(struct rp2a03 *c, u16 addr, u8 val, u64 at)
+{
+    u8 *p = c->wrmap[PAGE(addr)];
+    if (p)
+    {
+        p[addr & 0x07FF] = val;
+        if (c->codemap[PAGE(addr)]) rp2a03_code_write(c, addr);
+        return;
+    }
+
+    if (c->wrmem[PAGE(addr)] || c->watch[PAGE(addr)] & DEBUG_WRITE)
+    {
+        rp2a03_write_watched(c, addr, val, at);
+        return;
+    }
+
+    rp2a03_sync(c, at);
+    nes_bus_write(c->nes, addr, val);
+}
+
+/*
+ * Instruction and vector fetches, which watchpoints don't see
+ */
+static inline u8
+rp2a03_fetch(struct rp2a03 *c, u16 addr, u64 at)
+{
+    const u8 *p = c->rdmem[PAGE(addr)];
+    if (p)
+    {
+        return p[addr & 0x07FF];
+    }
+
+    rp2a03_sync(c, at);
+    return nes_bus_read(c->nes, addr);
+}
+
+/*
+ * Stack accesses skip the page tables, the stack is always RAM. Code can
+ * still run from it (see jit_stack_check()), and it can be watched
+ */
+static inline void
+rp2a03_push(struct rp2a03 *c, u8 val)
+{
+    if (c->watch[0] & DEBUG_WRITE) rp2a03_watch(c, 0x100 | c->SP, DEBUG_WRITE);
+
+    c->ram[0x100 | c->SP] = val;
+    if (c->codemap[0]) rp2a03_code_write(c, 0x100 | c->SP);
+    c->SP -= 1;
+}
+
+static inline u8
+rp2a03_pull(struct rp2a03 *c)
+{
+    c->SP += 1;
+    if (c->watch[0] & DEBUG_READ) rp2a03_watch(c, 0x100 | c->SP, DEBUG_READ);
+
+    return c->ram[0x100 | c->SP];
+}
+
+/*
+ * Pointer of (zp,X) and (zp),Y, which wraps within the zero page
+ */
+static inline u16
+rp2a03_pointer(struct rp2a03 *c, u8 zp)
+{
+    if (c->watch[0] & DEBUG_READ)
+    {
+        rp2a03_watch(c, zp, DEBUG_READ);
+        rp2a03_watch(c, (u8)(zp + 1), DEBUG_READ);
+    }
+
+    return c->ram[zp] | (c->ram[(u8)(zp + 1)] << 8);
+}
+
+static inline void
+rp2a03_interrupt(struct rp2a03 *c, u16 vector, u8 b)
+{
+    rp2a03_push(c, c->PC >> 8);
+    rp2a03_push(c, c->PC & 0xFF);
+    rp2a03_push(c, (c->P & ~B_) | U_ | b);
+    c->P |= I_;
+
+    u16 lo = rp2a03_fetch(c, vector, c->synced);
+    c->PC  = lo | (rp2a03_fetch(c, vector + 1, c->synced) << 8);
+}
+
+static inline u32
+rp2a03_hash(const u8 *src, u16 pc)
+{
+    u64 key = (uintptr_t)src + ((u64)pc << 48);
+    return (key * 0x9E3779B97F4A7C15ull) >> (64 - RP2A03_CACHE_BITS);
+}
+
+/*
+ * Looks for generated code for a block decoded from PRG-ROM
+ */
+static void
+rp2a03_decode_aot(struct rp2a03 *c, struct rp2a03_block *b)
+{
+    const u8 *prg  = c->nes->cartridge.prg;
+    size_t    sprg = c->nes->cartridge.s_prg_rom_16 * 0x4000;
+
+    if (b->src < prg || b->src >= prg + sprg)
+    {
+        return;
+    }
+
+    const struct rp2a03_aot_block *a =
+      rp2a03_aot_find(c, b->src - prg, b->pc);
+    if (a)
+    {
+        b->jit        = a->fn;
+        b->jit_cycles = a->cycles;
+        c->stats_jit.aot += 1;
+    }
+}
+
+/*
+ * Decodes the basic block starting at pc into b. Blocks never leave the 2KB
+ * page they start in, so the host address of their first byte is enough to
+ * tell which bank they came from
+ *
+ * Returns 0 if not even the first instruction fits in the page
+ */
+static int
+rp2a03_decode(struct rp2a03 *c, struct rp2a03_block *b, u8 *page, u16 pc)
+{
+    u16 off    = pc & 0x07FF;
+    u16 at     = off;
+    int n      = 0;
+    u8  direct = 0;
+
+    while (n < RP2A03_BLOCK_MAX)
+    {
+        u8 op  = page[at];
+        u8 len = rp2a03_lengths[op];
+
+        if (at + len > 0x800)
+        {
+            break;
+        }
+
+        struct rp2a03_insn *d = &b->insns[n++];
+
+        d->pc     = pc + (at - off);
+        d->op     = op;
+        d->len    = len;
+        d->cycles = rp2a03_cycles[op];
+        d->arg    = len > 1 ? page[at + 1] : 0;
+        if (len > 2) d->arg |= page[at + 2] << 8;
+
+        direct |= rp2a03_ram_operand(op, d->arg) || rp2a03_ram_implied(op);
+        at += len;
+
+        if (rp2a03_ends_block(op))
+        {
+            break;
+        }
+    }
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    b->src    = page + off;
+    b->pc     = pc;
+    b->count  = n;
+    b->ram    = c->wrmem[PAGE(pc)] != NULL;
+    b->direct = direct;
+    b->gen    = c->gen;
+    b->heat   = 0;
+    b->jit    = NULL;
+
+    if (c->aot && !b->ram)
+    {
+        rp2a03_decode_aot(c, b);
+    }
+
+    if (b->ram)
+    {
+        // watch the bytes of the block for writes. All 4 RAM mirrors share
+        // their flags
+        int first = PAGE(pc) < 4 ? 0 : PAGE(pc);
+        int last  = PAGE(pc) < 4 ? 3 : PAGE(pc);
+        u8 *flags = c->codeflags[first];
+
+        memset(flags + off, 1, at - off);
+        for (int i = first; i <= last; i++)
+        {
+            c->codemap[i] = flags;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Decodes the instruction at PC on its own, into c->scratch
+ */
+static struct rp2a03_block *
+rp2a03_single(struct rp2a03 *c)
+{
+    struct rp2a03_block *b  = &c->scratch;
+    struct rp2a03_insn  *d  = &b->insns[0];
+    u16                  pc = c->PC;
+
+    d->pc     = pc;
+    d->op     = rp2a03_fetch(c, pc, c->cycles + 1);
+    d->len    = rp2a03_lengths[d->op];
+    d->cycles = rp2a03_cycles[d->op];
+    d->arg    = 0;
+    if (d->len > 1) d->arg = rp2a03_fetch(c, pc + 1, c->cycles + 2);
+    if (d->len > 2) d->arg |= rp2a03_fetch(c, pc + 2, c->cycles + 3) << 8;
+    b->count = 1;
+
+    c->stats_cache.uncached += 1;
+    return b;
+}
+
+/*
+ * Finds the block at PC, decoding it on a miss. Code that can't be cached
+ * (running from I/O space, or an instruction split across two pages) gets a
+ * one instruction block read through the bus
+ */
+static struct rp2a03_block *
+rp2a03_lookup(struct rp2a03 *c)
+{
+    u16 pc   = c->PC;
+    u8 *page = c->rdmem[PAGE(pc)];
+
+    if (page)
+    {
+        const u8            *src = page + (pc & 0x07FF);
+        struct rp2a03_block *b   = &c->cache[rp2a03_hash(src, pc)];
+
+        if (b->src == src && b->pc == pc && (!b->ram || b->gen == c->gen))
+        {
+            c->stats_cache.hits += 1;
+            return b;
+        }
+
+        if (rp2a03_decode(c, b, page, pc))
+        {
+            c->stats_cache.misses += 1;
+            return b;
+        }
+    }
+
+    return rp2a03_single(c);
+}
+
+/*
+ * Addressing modes. Each one leaves the effective address in addr and adds
+ * the page crossing penalty to cyc where the instruction has one (the P
+ * variants). Operands come from the decoded instruction, and IMM leaves the
+ * operand itself in v, it was fetched along with the opcode
+ */
+#define ARG8  ((u8)d->arg)
+#define ARG16 (d->arg)
+
+#define IMM  v = ARG8
+#define ZP   addr = ARG8
+#define ZPX  addr = (u8)(ARG8 + c->X)
+#define ZPY  addr = (u8)(ARG8 + c->Y)
+#define ABS  addr = ARG16
+#define ABX  base = ARG16, addr = base + c->X
+#define ABY  base = ARG16, addr = base + c->Y
+#define ABXP ABX, cyc += CROSSED(base, addr) ? 1 : 0
+#define ABYP ABY, cyc += CROSSED(base, addr) ? 1 : 0
+#define IZX  zp = ARG8 + c->X, addr = rp2a03_pointer(c, zp)
+#define IZY  zp = ARG8, base = rp2a03_pointer(c, zp), addr = base + c->Y
+#define IZYP IZY, cyc += CROSSED(base, addr) ? 1 : 0
+
+/*
+ * Memory accesses inside an instruction. The PPU is synced to the last cycle
+ * of the instruction before any I/O access, which is where the 6502 does its
+ * data read or write in almost all cases
+ */
+#define RDAT(_a) rp2a03_read(c, (_a), start + cyc)
+#define RD       RDAT(addr)
+#define WR(_v)   rp2a03_write(c, addr, (_v), start + cyc)
+#define LD(_r)   (_r) = RD, rp2a03_setnz(c, (_r))
+#define LDV(_r)  (_r) = v, rp2a03_setnz(c, (_r))
+#define RMW(_f)  v = RD, v = _f(c, v), WR(v)
+
+#define BIT                                                                    \
+    v    = RD,                                                                 \
+    c->P = (c->P & ~(N_ | V_ | Z_)) | (v & (N_ | V_)) | ((c->A & v) ? 0 : Z_)
+
+#define BRANCH(_cond)                                                          \
+    do                                                                         \
+    {                                                                          \
+        int8_t off = (int8_t)ARG8;                                             \
+        if (_cond)                                                             \
+        {                                                                      \
+            u16 to = c->PC + off;                                              \
+            cyc += CROSSED(c->PC, to) ? 2 : 1;                                 \
+            c->PC = to;                                                        \
+        }                                                                      \
+    } while (0)
+
+/*
+ * SHX, SHY, SHA and TAS store a register ANDed with the high byte of the base
+ * address plus one. When the index crosses a page, that value also replaces
+ * the high byte of the address
+ */
+#define SH(_v)                                                                 \
+    do                                                                         \
+    {                                                                          \
+        u8 sv = (_v) & ((base >> 8) + 1);                                      \
+        if (CROSSED(base, addr)) addr = (addr & 0x00FF) | (sv << 8);           \
+        WR(sv);                                                                \
+    } while (0)
+
+/*
+ * Threaded dispatch: every handler ends the instruction itself and jumps
+ * straight to the handler of the next decoded one, so there is no central
+ * switch for the branch predictor to choke on. The table is picked per
+ * block, which is how the code/data logger and the debugger cost nothing
+ * when off, and breakpoints nothing outside of their page
+ */
+#define OP(_x) op_##_x:
+#define OPS16(_h)                                                              \
+    &&op_##_h##0, &&op_##_h##1, &&op_##_h##2, &&op_##_h##3, &&op_##_h##4,      \
+      &&op_##_h##5, &&op_##_h##6, &&op_##_h##7, &&op_##_h##8, &&op_##_h##9,    \
+      &&op_##_h##A, &&op_##_h##B, &&op_##_h##C, &&op_##_h##D, &&op_##_h##E,    \
+      &&op_##_h##F
+
+#define DISPATCH                                                               \
+    start = c->cycles;                                                         \
+    cyc   = d->cycles;                                                         \
+    if (c->trace) rp2a03_trace(c, d);                                          \
+    c->PC = d->pc + d->len;                                                    \
+    goto *dispatch[d->op]
+
+#define NEXT                                                                   \
+    do                                                                         \
+    {                                                                          \
+        c->cycles = start + cyc;                                               \
+        if (c->nes->dma_stall)                                                 \
+        {                                                                      \
+            c->cycles += c->nes->dma_stall;                                    \
+            c->nes->dma_stall = 0;                                             \
+        }                                                                      \
+        rp2a03_sync(c, c->cycles);                                             \
+                                                                               \
+        d += 1;                                                                \
+        if (d == end || ppu->nmi || c->flush || c->cycles >= until)            \
+        {                                                                      \
+            goto block;                                                        \
+        }                                                                      \
+        DISPATCH;                                                              \
+    } while (0)
+
+/*
+ * Records the instruction about to run. Kept out of line, the dispatch only
+ * pays for the test of c->trace
+ */
+static __attribute__((noinline)) void
+rp2a03_trace(struct rp2a03 *c, const struct rp2a03_insn *d)
+{
+    struct ppu *ppu = c->nes->ppu;
+
+    struct trace_rec r = {
+        .cycle    = c->cycles,
+        .pc       = d->pc,
+        .op       = d->op,
+        .arg      = {d->arg, d->arg >> 8},
+        .A        = c->A,
+        .X        = c->X,
+        .Y        = c->Y,
+        .P        = c->P,
+        .SP       = c->SP,
+        .scanline = ppu->scanline,
+        .dot      = ppu->cycle,
+    };
+
+    trace_push(c->trace, &r);
+}
+
+/*
+ * Works out the memory operand of the instruction about to run, the same way
+ * its handler will, from registers the instruction hasn't changed yet. Stack
+ * accesses and the pointer reads of (zp,X) and (zp),Y aren't included
+ *
+ * Returns DEBUG_READ and/or DEBUG_WRITE, or 0 if there is no operand
+ */
+static u8
+rp2a03_operand(struct rp2a03 *c, const struct rp2a03_insn *d, u16 *addr)
+{
+    u8 op  = d->op;
+    u8 row = op >> 5;
+    u8 cc  = op & 0x03;
+    u8 zp;
+
+    // JMP and JSR don't read their operand. The pointer of JMP (ind) only
+    // matters to the code/data logger, which reads it itself
+    if (op == 0x4C || op == 0x20 || op == 0x6C)
+    {
+        return 0;
+    }
+
+    // STX, LDX, SAX and LAX index with Y instead of X
+    u8 index = row == 4 || row == 5 ? c->Y : c->X;
+
+    switch (op & 0x1F)
+    {
+        case 0x01:
+        case 0x03:
+            zp    = ARG8 + c->X;
+            *addr = c->ram[zp] | (c->ram[(u8)(zp + 1)] << 8);
+            break;
+        case 0x11:
+        case 0x13:
+            zp    = ARG8;
+            *addr = (c->ram[zp] | (c->ram[(u8)(zp + 1)] << 8)) + c->Y;
+            break;
+        case 0x04:
+        case 0x05:
+        case 0x06:
+        case 0x07:
+            *addr = ARG8;
+            break;
+        case 0x14:
+        case 0x15:
+            *addr = (u8)(ARG8 + c->X);
+            break;
+        case 0x16:
+        case 0x17:
+            *addr = (u8)(ARG8 + index);
+            break;
+        case 0x0C:
+        case 0x0D:
+        case 0x0E:
+        case 0x0F:
+            *addr = ARG16;
+            break;
+        case 0x19:
+        case 0x1B:
+            *addr = ARG16 + c->Y;
+            break;
+        case 0x1C:
+        case 0x1D:
+            *addr = ARG16 + c->X;
+            break;
+        case 0x1E:
+        case 0x1F:
+            *addr = ARG16 + index;
+            break;
+        default:
+            return 0;
+    }
+
+    // $80-$9F store, the shifts, INC, DEC and their unofficial combinations
+    // (cc 2 and 3) modify, and LDX/LAX/LAS and everything else just read
+    if (row == 4) return DEBUG_WRITE;
+    if (cc >= 2 && row != 5) return DEBUG_READ | DEBUG_WRITE;
+    return DEBUG_READ;
+}
+
+/*
+ * Sets flag, and the bank bits, on addr if it is in a logged PRG-ROM page.
+ * Bytes that already have them aren't written again
+ */
+static inline void
+rp2a03_cdl_mark(struct rp2a03 *c, u16 addr, u8 flag)
+{
+    u8 *log = c->cdlmap[PAGE(addr)];
+
+    flag |= CDL_BANK(addr);
+    if (log && (log[addr & 0x07FF] & flag) != flag)
+    {
+        log[addr & 0x07FF] |= flag;
+    }
+}
+
+/*
+ * Logs the instruction about to run, and the data it is about to read. Zero
+ * page and stack accesses are never PRG-ROM and come out as no-ops
+ */
+static void
+rp2a03_cdl(struct rp2a03 *c, const struct rp2a03_insn *d)
+{
+    u16 addr;
+
+    for (int i = 0; i < d->len; i++)
+    {
+        rp2a03_cdl_mark(c, d->pc + i, CDL_CODE);
+    }
+
+    if (d->op == 0x6C)
+    {
+        // JMP (ind), with the pointer's high byte not carrying
+        addr = ARG16;
+        rp2a03_cdl_mark(c, addr, CDL_DATA);
+        rp2a03_cdl_mark(c, (addr & 0xFF00) | ((addr + 1) & 0x00FF), CDL_DATA);
+        return;
+    }
+
+    if (rp2a03_operand(c, d, &addr) & DEBUG_READ)
+    {
+        rp2a03_cdl_mark(c, addr, CDL_DATA);
+    }
+}
+
+/*
+ * Drops every cached block, after rp2a03_poke() patched PRG-ROM. Nothing
+ * refers to the compiled code anymore, so the JIT arena starts over too
+ */
+static void
+rp2a03_purge(struct rp2a03 *c)
+{
+    memset(c->cache, 0, RP2A03_CACHE_SIZE * sizeof(struct rp2a03_block));
+    c->jit_used = 0;
+    c->purge    = 0;
+    c->flush    = 1;
+}
+
+/*
+ * Stops before the instruction about to run on a breakpoint, a watchpoint hit
+ * by the one before it, or a pending step. The page flags keep the point
+ * table out of it for everything else
+ *
+ * Returns 1 if the debugger moved PC while stopped, the instruction must not
+ * run then. Returns 2 if the debugger wrote to code while stopped: d may be
+ * stale or gone along with the block cache, and the instruction has been
+ * decoded again into c->scratch
+ */
+static int
+rp2a03_debug(struct rp2a03 *c, const struct rp2a03_insn *d)
+{
+    struct debug     *dbg  = c->nes->debug;
+    struct debug_stop stop = {-1, DEBUG_CPU, DEBUG_EXEC, debug_canon(d->pc)};
+    u32               gen  = c->gen;
+
+    if (dbg->watched)
+    {
+        dbg->watched = 0;
+        stop         = dbg->watch;
+        goto hit;
+    }
+
+    if (dbg->pages[PAGE(stop.addr)] & DEBUG_EXEC)
+    {
+        stop.id = debug_find(dbg, DEBUG_CPU, DEBUG_EXEC, stop.addr, stop.addr);
+        if (stop.id >= 0) goto hit;
+    }
+
+    if (!__atomic_load_n(&dbg->step, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    stop = (struct debug_stop){-1, DEBUG_CPU, DEBUG_EXEC, d->pc};
+
+hit:
+    // the debugger sees PC at the instruction, not past it
+    c->PC = d->pc;
+    debug_wait(dbg, &stop);
+
+    // points set while stopped
+    if (__atomic_load_n(&dbg->dirty, __ATOMIC_ACQUIRE))
+    {
+        rp2a03_remap(c);
+    }
+
+    if (c->PC != d->pc)
+    {
+        return 1;
+    }
+
+    // the cache is only dropped now, nothing runs from it while stopped
+    if (c->purge || c->gen != gen)
+    {
+        if (c->purge) rp2a03_purge(c);
+
+        d     = rp2a03_single(c)->insns;
+        c->PC = d->pc + d->len;
+        return 2;
+    }
+
+    c->PC = d->pc + d->len;
+    return 0;
+}
+
+/*
+ * Runs before every instruction of a block rp2a03_hooked() picked. Kept out
+ * of line like rp2a03_trace(), the plain dispatch table never comes here.
+ * Returns what rp2a03_debug() does
+ */
+static __attribute__((noinline)) int
+rp2a03_hook(struct rp2a03 *c, const struct rp2a03_insn *d)
+{
+    int moved;
+
+    if (c->nes->debug && (moved = rp2a03_debug(c, d)))
+    {
+        return moved;
+    }
+
+    if (c->nes->cdl)
+    {
+        rp2a03_cdl(c, d);
+    }
+    return 0;
+}
+
+/*
+ * Whether the block at PC has to go through rp2a03_hook(): the code/data
+ * logger is on, a stop is pending, or there is a breakpoint in the block's
+ * page. Blocks never leave their page, so every other block gets the plain
+ * dispatch table and native code. Watchpoints don't need the hook at all,
+ * see rp2a03_watch()
+ */
+static inline int
+rp2a03_hooked(struct rp2a03 *c, const struct debug *dbg)
+{
+    if (c->nes->cdl)
+    {
+        return 1;
+    }
+
+    return dbg && (__atomic_load_n(&dbg->step, __ATOMIC_RELAXED) ||
+                   (dbg->pages[PAGE(c->PC)] & DEBUG_EXEC));
+}
+
+/*
+ * Last cycle a native block (JIT or AOT) may end on: the PPU isn't run inside
+ * native code, so it must not get to the NMI dot (scanline 241, dot 1) before
+ * the block ends. Keeps a couple of cycles in hand for the odd frame skip
+ */
+static u64
+rp2a03_deadline(struct rp2a03 *c, u64 until)
+{
+    struct ppu *ppu = c->nes->ppu;
+
+    int pos  = (ppu->scanline + 1) * 341 + ppu->cycle;
+    int dots = 242 * 341 + 1 - pos;
+
+    if (dots <= 0)
+    {
+        dots += 262 * 341;
+    }
+
+    int cycles = dots / 3 - 2;
+    if (cycles <= 0)
+    {
+        return c->synced;
+    }
+
+    u64 deadline = c->synced + cycles;
+    return deadline < until ? deadline : until;
+}
+
+void
+rp2a03_run(struct rp2a03 *c, u64 until)
+{
+    static const void *const ops[256] = {
+        OPS16(0), OPS16(1), OPS16(2), OPS16(3), OPS16(4), OPS16(5),
+        OPS16(6), OPS16(7), OPS16(8), OPS16(9), OPS16(A), OPS16(B),
+        OPS16(C), OPS16(D), OPS16(E), OPS16(F),
+    };
+
+    // while hooked, every opcode goes through hook: first
+    static const void *const ops_hook[256] = {[0 ... 255] = &&hook};
+
+    const void *const *dispatch;
+
+    struct ppu   *ppu = c->nes->ppu;
+    struct debug *dbg = c->nes->debug;
+
+    struct rp2a03_block      *b;
+    const struct rp2a03_insn *d, *end;
+
+    u64 start;
+    u8  cyc;
+    u16 addr, base;
+    u8  zp, v;
+    int hooked;
+
+    if (dbg && __atomic_load_n(&dbg->dirty, __ATOMIC_ACQUIRE))
+    {
+        rp2a03_remap(c);
+    }
+
+    if (c->purge)
+    {
+        rp2a03_purge(c);
+    }
+
+block:
+    if (c->cycles >= until)
+    {
+        return;
+    }
+    c->flush = 0;
+
+    if (ppu->nmi)
+    {
+        ppu->nmi = 0;
+        rp2a03_interrupt(c, 0xFFFA, 0);
+        c->cycles += 7;
+        rp2a03_sync(c, c->cycles);
+        goto block;
+    }
+
+    if (c->jammed)
+    {
+        c->cycles += 1;
+        rp2a03_sync(c, c->cycles);
+        goto block;
+    }
+
+    b = rp2a03_lookup(c);
+
+#ifdef RP2A03_JIT
+    if (c->jit && !b->jit && !b->ram && b != &c->scratch &&
+        ++b->heat == RP2A03_JIT_HEAT)
+    {
+        rp2a03_jit_compile(c, b);
+    }
+#endif
+
+    hooked = rp2a03_hooked(c, dbg);
+
+    // native code would skip the trace and the hooks, and doesn't go through
+    // the page tables for RAM
+    if (b->jit && !c->trace && !hooked && !(b->direct && c->watch[0]) &&
+        c->cycles + b->jit_cycles < rp2a03_deadline(c, until))
+    {
+        start = c->cycles;
+        b->jit(c);
+
+        // nothing was run if the first instruction has to be interpreted
+        if (c->cycles != start)
+        {
+            rp2a03_sync(c, c->cycles);
+            c->stats_jit.runs += 1;
+            goto block;
+        }
+    }
+
+    d        = b->insns;
+    end      = d + b->count;
+    dispatch = hooked ? ops_hook : ops;
+    DISPATCH;
+
+hook:
+    switch (rp2a03_hook(c, d))
+    {
+        case 1:
+            goto block;
+        case 2:
+            d   = c->scratch.insns;
+            end = d + 1;
+            cyc = d->cycles;
+            break;
+    }
+    goto *ops[d->op];
+
+    // clang-format off
+    /* loads and stores */
+    OP(A9) IMM; LDV(c->A); NEXT;
+    OP(A5) ZP; LD(c->A); NEXT;
+    OP(B5) ZPX; LD(c->A); NEXT;
+    OP(AD) ABS; LD(c->A); NEXT;
+    OP(BD) ABXP; LD(c->A); NEXT;
+    OP(B9) ABYP; LD(c->A); NEXT;
+    OP(A1) IZX; LD(c->A); NEXT;
+    OP(B1) IZYP; LD(c->A); NEXT;
+
+    OP(A2) IMM; LDV(c->X); NEXT;
+    OP(A6) ZP; LD(c->X); NEXT;
+    OP(B6) ZPY; LD(c->X); NEXT;
+    OP(AE) ABS; LD(c->X); NEXT;
+    OP(BE) ABYP; LD(c->X); NEXT;
+
+    OP(A0) IMM; LDV(c->Y); NEXT;
+    OP(A4) ZP; LD(c->Y); NEXT;
+    OP(B4) ZPX; LD(c->Y); NEXT;
+    OP(AC) ABS; LD(c->Y); NEXT;
+    OP(BC) ABXP; LD(c->Y); NEXT;
+
+    OP(85) ZP; WR(c->A); NEXT;
+    OP(95) ZPX; WR(c->A); NEXT;
+    OP(8D) ABS; WR(c->A); NEXT;
+    OP(9D) ABX; WR(c->A); NEXT;
+    OP(99) ABY; WR(c->A); NEXT;
+    OP(81) IZX; WR(c->A); NEXT;
+    OP(91) IZY; WR(c->A); NEXT;
+
+    OP(86) ZP; WR(c->X); NEXT;
+    OP(96) ZPY; WR(c->X); NEXT;
+    OP(8E) ABS; WR(c->X); NEXT;
+
+    OP(84) ZP; WR(c->Y); NEXT;
+    OP(94) ZPX; WR(c->Y); NEXT;
+    OP(8C) ABS; WR(c->Y); NEXT;
+
+    /* transfers */
+    OP(AA) c->X = c->A; rp2a03_setnz(c, c->X); NEXT;
+    OP(A8) c->Y = c->A; rp2a03_setnz(c, c->Y); NEXT;
+    OP(8A) c->A = c->X; rp2a03_setnz(c, c->A); NEXT;
+    OP(98) c->A = c->Y; rp2a03_setnz(c, c->A); NEXT;
+    OP(BA) c->X = c->SP; rp2a03_setnz(c, c->X); NEXT;
+    OP(9A) c->SP = c->X; NEXT;
+
+    /* logic and arithmetic */
+    OP(29) IMM; c->A &= v; rp2a03_setnz(c, c->A); NEXT;
+    OP(25) ZP; c->A &= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(35) ZPX; c->A &= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(2D) ABS; c->A &= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(3D) ABXP; c->A &= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(39) ABYP; c->A &= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(21) IZX; c->A &= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(31) IZYP; c->A &= RD; rp2a03_setnz(c, c->A); NEXT;
+
+    OP(09) IMM; c->A |= v; rp2a03_setnz(c, c->A); NEXT;
+    OP(05) ZP; c->A |= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(15) ZPX; c->A |= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(0D) ABS; c->A |= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(1D) ABXP; c->A |= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(19) ABYP; c->A |= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(01) IZX; c->A |= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(11) IZYP; c->A |= RD; rp2a03_setnz(c, c->A); NEXT;
+
+    OP(49) IMM; c->A ^= v; rp2a03_setnz(c, c->A); NEXT;
+    OP(45) ZP; c->A ^= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(55) ZPX; c->A ^= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(4D) ABS; c->A ^= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(5D) ABXP; c->A ^= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(59) ABYP; c->A ^= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(41) IZX; c->A ^= RD; rp2a03_setnz(c, c->A); NEXT;
+    OP(51) IZYP; c->A ^= RD; rp2a03_setnz(c, c->A); NEXT;
+
+    OP(69) IMM; rp2a03_adc(c, v); NEXT;
+    OP(65) ZP; rp2a03_adc(c, RD); NEXT;
+    OP(75) ZPX; rp2a03_adc(c, RD); NEXT;
+    OP(6D) ABS; rp2a03_adc(c, RD); NEXT;
+    OP(7D) ABXP; rp2a03_adc(c, RD); NEXT;
+    OP(79) ABYP; rp2a03_adc(c, RD); NEXT;
+    OP(61) IZX; rp2a03_adc(c, RD); NEXT;
+    OP(71) IZYP; rp2a03_adc(c, RD); NEXT;
+
+    OP(E9)
+    OP(EB) IMM; rp2a03_adc(c, ~v); NEXT;
+    OP(E5) ZP; rp2a03_adc(c, ~RD); NEXT;
+    OP(F5) ZPX; rp2a03_adc(c, ~RD); NEXT;
+    OP(ED) ABS; rp2a03_adc(c, ~RD); NEXT;
+    OP(FD) ABXP; rp2a03_adc(c, ~RD); NEXT;
+    OP(F9) ABYP; rp2a03_adc(c, ~RD); NEXT;
+    OP(E1) IZX; rp2a03_adc(c, ~RD); NEXT;
+    OP(F1) IZYP; rp2a03_adc(c, ~RD); NEXT;
+
+    OP(C9) IMM; rp2a03_cmp(c, c->A, v); NEXT;
+    OP(C5) ZP; rp2a03_cmp(c, c->A, RD); NEXT;
+    OP(D5) ZPX; rp2a03_cmp(c, c->A, RD); NEXT;
+    OP(CD) ABS; rp2a03_cmp(c, c->A, RD); NEXT;
+    OP(DD) ABXP; rp2a03_cmp(c, c->A, RD); NEXT;
+    OP(D9) ABYP; rp2a03_cmp(c, c->A, RD); NEXT;
+    OP(C1) IZX; rp2a03_cmp(c, c->A, RD); NEXT;
+    OP(D1) IZYP; rp2a03_cmp(c, c->A, RD); NEXT;
+
+    OP(E0) IMM; rp2a03_cmp(c, c->X, v); NEXT;
+    OP(E4) ZP; rp2a03_cmp(c, c->X, RD); NEXT;
+    OP(EC) ABS; rp2a03_cmp(c, c->X, RD); NEXT;
+    OP(C0) IMM; rp2a03_cmp(c, c->Y, v); NEXT;
+    OP(C4) ZP; rp2a03_cmp(c, c->Y, RD); NEXT;
+    OP(CC) ABS; rp2a03_cmp(c, c->Y, RD); NEXT;
+
+    OP(24) ZP; BIT; NEXT;
+    OP(2C) ABS; BIT; NEXT;
+
+    /* increments, decrements and shifts */
+    OP(E6) ZP; RMW(rp2a03_inc); NEXT;
+    OP(F6) ZPX; RMW(rp2a03_inc); NEXT;
+    OP(EE) ABS; RMW(rp2a03_inc); NEXT;
+    OP(FE) ABX; RMW(rp2a03_inc); NEXT;
+    OP(C6) ZP; RMW(rp2a03_dec); NEXT;
+    OP(D6) ZPX; RMW(rp2a03_dec); NEXT;
+    OP(CE) ABS; RMW(rp2a03_dec); NEXT;
+    OP(DE) ABX; RMW(rp2a03_dec); NEXT;
+
+    OP(E8) c->X += 1; rp2a03_setnz(c, c->X); NEXT;
+    OP(C8) c->Y += 1; rp2a03_setnz(c, c->Y); NEXT;
+    OP(CA) c->X -= 1; rp2a03_setnz(c, c->X); NEXT;
+    OP(88) c->Y -= 1; rp2a03_setnz(c, c->Y); NEXT;
+
+    OP(0A) c->A = rp2a03_asl(c, c->A); NEXT;
+    OP(06) ZP; RMW(rp2a03_asl); NEXT;
+    OP(16) ZPX; RMW(rp2a03_asl); NEXT;
+    OP(0E) ABS; RMW(rp2a03_asl); NEXT;
+    OP(1E) ABX; RMW(rp2a03_asl); NEXT;
+
+    OP(4A) c->A = rp2a03_lsr(c, c->A); NEXT;
+    OP(46) ZP; RMW(rp2a03_lsr); NEXT;
+    OP(56) ZPX; RMW(rp2a03_lsr); NEXT;
+    OP(4E) ABS; RMW(rp2a03_lsr); NEXT;
+    OP(5E) ABX; RMW(rp2a03_lsr); NEXT;
+
+    OP(2A) c->A = rp2a03_rol(c, c->A); NEXT;
+    OP(26) ZP; RMW(rp2a03_rol); NEXT;
+    OP(36) ZPX; RMW(rp2a03_rol); NEXT;
+    OP(2E) ABS; RMW(rp2a03_rol); NEXT;
+    OP(3E) ABX; RMW(rp2a03_rol); NEXT;
+
+    OP(6A) c->A = rp2a03_ror(c, c->A); NEXT;
+    OP(66) ZP; RMW(rp2a03_ror); NEXT;
+    OP(76) ZPX; RMW(rp2a03_ror); NEXT;
+    OP(6E) ABS; RMW(rp2a03_ror); NEXT;
+    OP(7E) ABX; RMW(rp2a03_ror); NEXT;
+
+    /* jumps, calls and interrupts */
+    OP(4C) c->PC = ARG16; NEXT;
+    OP(6C)
+        // the high byte doesn't carry into the next page
+        base  = ARG16;
+        addr  = RDAT(base);
+        c->PC = addr | (RDAT((base & 0xFF00) | ((base + 1) & 0x00FF)) << 8);
+        NEXT;
+    OP(20)
+        addr = ARG16;
+        c->PC -= 1;
+        rp2a03_push(c, c->PC >> 8);
+        rp2a03_push(c, c->PC & 0xFF);
+        c->PC = addr;
+        NEXT;
+    OP(60)
+        c->PC = rp2a03_pull(c);
+        c->PC |= rp2a03_pull(c) << 8;
+        c->PC += 1;
+        NEXT;
+    OP(40)
+        c->P  = (rp2a03_pull(c) & ~B_) | U_;
+        c->PC = rp2a03_pull(c);
+        c->PC |= rp2a03_pull(c) << 8;
+        NEXT;
+    OP(00)
+        c->PC += 1;
+        rp2a03_interrupt(c, 0xFFFE, B_);
+        NEXT;
+
+    /* branches */
+    OP(10) BRANCH(!(c->P & N_)); NEXT;
+    OP(30) BRANCH(c->P & N_); NEXT;
+    OP(50) BRANCH(!(c->P & V_)); NEXT;
+    OP(70) BRANCH(c->P & V_); NEXT;
+    OP(90) BRANCH(!(c->P & C_)); NEXT;
+    OP(B0) BRANCH(c->P & C_); NEXT;
+    OP(D0) BRANCH(!(c->P & Z_)); NEXT;
+    OP(F0) BRANCH(c->P & Z_); NEXT;
+
+    /* stack */
+    OP(48) rp2a03_push(c, c->A); NEXT;
+    OP(08) rp2a03_push(c, c->P | B_ | U_); NEXT;
+    OP(68) c->A = rp2a03_pull(c); rp2a03_setnz(c, c->A); NEXT;
+    OP(28) c->P = (rp2a03_pull(c) & ~B_) | U_; NEXT;
+
+    /* flags */
+    OP(18) c->P &= ~C_; NEXT;
+    OP(38) c->P |= C_; NEXT;
+    OP(58) c->P &= ~I_; NEXT;
+    OP(78) c->P |= I_; NEXT;
+    OP(B8) c->P &= ~V_; NEXT;
+    OP(D8) c->P &= ~RP2A03_D; NEXT;
+    OP(F8) c->P |= RP2A03_D; NEXT;
+
+    /* NOPs, official and not */
+    OP(EA)
+    OP(1A)
+    OP(3A)
+    OP(5A)
+    OP(7A)
+    OP(DA)
+    OP(FA) NEXT;
+    OP(80)
+    OP(82)
+    OP(89)
+    OP(C2)
+    OP(E2) IMM; NEXT;
+    OP(04)
+    OP(44)
+    OP(64) ZP; RD; NEXT;
+    OP(14)
+    OP(34)
+    OP(54)
+    OP(74)
+    OP(D4)
+    OP(F4) ZPX; RD; NEXT;
+    OP(0C) ABS; RD; NEXT;
+    OP(1C)
+    OP(3C)
+    OP(5C)
+    OP(7C)
+    OP(DC)
+    OP(FC) ABXP; RD; NEXT;
+
+    /* unofficial combined opcodes */
+    OP(A7) ZP; LD(c->A); c->X = c->A; NEXT; // LAX
+    OP(B7) ZPY; LD(c->A); c->X = c->A; NEXT;
+    OP(AF) ABS; LD(c->A); c->X = c->A; NEXT;
+    OP(BF) ABYP; LD(c->A); c->X = c->A; NEXT;
+    OP(A3) IZX; LD(c->A); c->X = c->A; NEXT;
+    OP(B3) IZYP; LD(c->A); c->X = c->A; NEXT;
+    OP(AB) IMM; LDV(c->A); c->X = c->A; NEXT; // LXA
+
+    OP(87) ZP; WR(c->A & c->X); NEXT; // SAX
+    OP(97) ZPY; WR(c->A & c->X); NEXT;
+    OP(8F) ABS; WR(c->A & c->X); NEXT;
+    OP(83) IZX; WR(c->A & c->X); NEXT;
+
+#define UNOFFICIAL_RMW(_e, _o, _rmw)                                           \
+OP(_e##7) ZP; _rmw; NEXT;                                                  \
+OP(_o##7) ZPX; _rmw; NEXT;                                                 \
+OP(_e##F) ABS; _rmw; NEXT;                                                 \
+OP(_o##F) ABX; _rmw; NEXT;                                                 \
+OP(_o##B) ABY; _rmw; NEXT;                                                 \
+OP(_e##3) IZX; _rmw; NEXT;                                                 \
+OP(_o##3) IZY; _rmw; NEXT;
+
+    // SLO, RLA, SRE, RRA, DCP, ISC
+    UNOFFICIAL_RMW(0, 1, (RMW(rp2a03_asl), c->A |= v,
+                          rp2a03_setnz(c, c->A)))
+    UNOFFICIAL_RMW(2, 3, (RMW(rp2a03_rol), c->A &= v,
+                          rp2a03_setnz(c, c->A)))
+    UNOFFICIAL_RMW(4, 5, (RMW(rp2a03_lsr), c->A ^= v,
+                          rp2a03_setnz(c, c->A)))
+    UNOFFICIAL_RMW(6, 7, (RMW(rp2a03_ror), rp2a03_adc(c, v)))
+    UNOFFICIAL_RMW(C, D, (v = RD - 1, WR(v), rp2a03_cmp(c, c->A, v)))
+    UNOFFICIAL_RMW(E, F, (v = RD + 1, WR(v), rp2a03_adc(c, ~v)))
+
+    OP(0B)
+    OP(2B) // ANC
+        IMM;
+        c->A &= v;
+        rp2a03_setnz(c, c->A);
+        c->P = (c->P & ~C_) | (c->A >> 7);
+        NEXT;
+    OP(4B) // ALR
+        IMM;
+        c->A = rp2a03_lsr(c, c->A & v);
+        NEXT;
+    OP(6B) // ARR
+        IMM;
+        c->A &= v;
+        c->A = (c->A >> 1) | ((c->P & C_) << 7);
+        rp2a03_setnz(c, c->A);
+        c->P &= ~(C_ | V_);
+        c->P |= (c->A >> 6) & C_;
+        c->P |= ((c->A >> 6) ^ (c->A >> 5)) & 0x01 ? V_ : 0;
+        NEXT;
+    OP(CB) // AXS
+        IMM;
+        c->P = (c->P & ~C_) | ((c->A & c->X) >= v ? C_ : 0);
+        c->X = (c->A & c->X) - v;
+        rp2a03_setnz(c, c->X);
+        NEXT;
+    OP(8B) // XAA, unstable, uses the common magic constant
+        IMM;
+        c->A = (c->A | 0xEE) & c->X & v;
+        rp2a03_setnz(c, c->A);
+        NEXT;
+    OP(BB) // LAS
+        ABYP;
+        c->A = c->X = c->SP = RD & c->SP;
+        rp2a03_setnz(c, c->A);
+        NEXT;
+
+    OP(9C) ABX; SH(c->Y); NEXT; // SHY
+    OP(9E) ABY; SH(c->X); NEXT; // SHX
+    OP(9F) ABY; SH(c->A & c->X); NEXT; // SHA
+    OP(93) IZY; SH(c->A & c->X); NEXT;
+    OP(9B) // TAS
+        ABY;
+        c->SP = c->A & c->X;
+        SH(c->SP);
+        NEXT;
+
+    /* KIL */
+    OP(02) OP(12) OP(22) OP(32) OP(42) OP(52)
+    OP(62) OP(72) OP(92) OP(B2) OP(D2) OP(F2)
+        c->jammed = 1;
+        c->PC -= 1;
+        NEXT;
+    // clang-format on
+}
+
+/*
+ * Flags for the pages an access can hit a watchpoint in. PPU and OAM points
+ * are reached through the PPU registers and $4014
+ */
+static void
+rp2a03_rewatch(struct rp2a03 *c)
+{
+    struct debug *dbg = c->nes->debug;
+
+    memset(c->watch, 0, sizeof(c->watch));
+    if (!dbg)
+    {
+        return;
+    }
+
+    __atomic_store_n(&dbg->dirty, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < RP2A03_PAGES; i++)
+    {
+        c->watch[i] = dbg->pages[i] & (DEBUG_READ | DEBUG_WRITE);
+    }
+
+    for (int i = PAGE(0x2000); i < PAGE(0x4000); i++)
+    {
+        c->watch[i] |= (dbg->ppu | dbg->oam) & (DEBUG_READ | DEBUG_WRITE);
+    }
+    c->watch[PAGE(0x4014)] |= dbg->oam & DEBUG_WRITE;
+}
+
+void
+rp2a03_remap(struct rp2a03 *c)
+{
+    struct nes *nes   = c->nes;
+    u8          moved = 0;
+
+    rp2a03_rewatch(c);
+
+    for (int i = 0; i < RP2A03_PAGES; i++)
+    {
+        u16 addr = i << 11;
+        u8 *wr   = c->wrmem[i];
+
+        c->rdmem[i] = NULL;
+        c->wrmem[i] = NULL;
+
+        if (addr < 0x2000)
+        {
+            c->rdmem[i] = c->ram;
+            c->wrmem[i] = c->ram;
+        }
+        else if (addr >= 0x6000)
+        {
+            // PRG-RAM and PRG-ROM: whatever the mapper currently points at.
+            // Writes at $8000 and up are left to the mapper
+            u8 *p = MAP_CALL(nes, nes->cartridge.mapper, addr, nes->cpu->mem,
+                             MAP_MODE_CPU);
+
+            c->rdmem[i] = p;
+            if (addr < 0x8000) c->wrmem[i] = p;
+        }
+
+        // PRG-ROM pages get their slice of the code/data log
+        const u8 *prg  = nes->cartridge.prg;
+        size_t    sprg = nes->cartridge.s_prg_rom_16 * 0x4000;
+        u8       *p    = c->rdmem[i];
+
+        c->cdlmap[i] = NULL;
+        if (nes->cdl && addr >= 0x8000 && p >= prg && p < prg + sprg)
+        {
+            c->cdlmap[i] = nes->cdl + (p - prg);
+        }
+
+        // pages with cheats read from a patched copy of the bank, see cheat.h
+        if (nes->cheats && addr >= 0x8000 && (nes->cheats->pages >> i & 1))
+        {
+            c->rdmem[i] = cheat_page(nes->cheats, i, p);
+        }
+
+        // watched pages take the slow way, see rp2a03_watch()
+        c->rdmap[i] = c->watch[i] & DEBUG_READ ? NULL : c->rdmem[i];
+        c->wrmap[i] = rp2a03_wrpage(c, i);
+
+        if (c->codemap[i] && c->wrmem[i] != wr)
+        {
+            moved = 1;
+        }
+    }
+
+    // blocks from PRG-ROM are keyed by their bank, so they can stay. Only
+    // the block being run has to be left, it may have just been switched out
+    if (moved)
+    {
+        rp2a03_flush(c);
+    }
+    c->flush = 1;
+}
+
+void
+rp2a03_invalidate(struct rp2a03 *c)
+{
+    rp2a03_flush(c);
+    rp2a03_remap(c);
+}
+
+void
+rp2a03_invalidate_all(struct rp2a03 *c)
+{
+    rp2a03_purge(c);
+    rp2a03_invalidate(c);
+}
+
+u8
+rp2a03_peek(struct rp2a03 *c, u16 addr)
+{
+    const u8 *p = c->rdmem[PAGE(addr)];
+
+    return p ? p[addr & 0x07FF] : 0;
+}
+
+void
+rp2a03_poke(struct rp2a03 *c, u16 addr, u8 val)
+{
+    u8 *wr = c->wrmem[PAGE(addr)];
+    u8 *rd = c->rdmem[PAGE(addr)];
+
+    if (wr)
+    {
+        if (c->nes->mark) clone_touch(c->nes->mark, wr + (addr & 0x07FF));
+        wr[addr & 0x07FF] = val;
+        if (c->codemap[PAGE(addr)]) rp2a03_code_write(c, addr);
+    }
+    else if (rd)
+    {
+        // blocks from PRG-ROM are never checked for writes. The core may be
+        // stopped in the middle of one, so it drops them itself
+        rd[addr & 0x07FF] = val;
+        c->purge = 1;
+    }
+}
+
+void
+rp2a03_init(struct rp2a03 *c, struct nes *nes)
+{
+    memset(c, 0, sizeof(struct rp2a03));
+
+    c->nes   = nes;
+    c->ram   = nes->cpu->mem;
+    c->cache = calloc(RP2A03_CACHE_SIZE, sizeof(struct rp2a03_block));
+
+    rp2a03_remap(c);
+}
+
+void
+rp2a03_free(struct rp2a03 *c)
+{
+    rp2a03_jit_free(c);
+    rp2a03_aot_free(c);
+    free(c->cache);
+    free(c);
+}
+
+void
+rp2a03_reset(struct rp2a03 *c)
+{
+    c->A      = 0;
+    c->X      = 0;
+    c->Y      = 0;
+    c->SP     = 0xFD;
+    c->P      = I_ | U_;
+    c->jammed = 0;
+
+    u16 lo = rp2a03_fetch(c, 0xFFFC, c->synced);
+    c->PC  = lo | (rp2a03_fetch(c, 0xFFFD, c->synced) << 8);
+
+    c->cycles += 7;
+    rp2a03_sync(c, c->cycles);
+}
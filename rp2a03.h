@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_RP2A03_H_
+#define NES_RP2A03_H_
+
+/*! @file rp2a03.h
+ * NES-specific 6502 (RP2A03) core
+ *
+ * Unlike the generic 6502 library, this core knows the NES memory map, so
+ * RAM, zero page, stack and PRG accesses never leave the instruction code.
+ * Only I/O ($2000-$401F) and mapper registers go through nes_bus_read() and
+ * nes_bus_write(). The PPU is caught up right before those accesses and at
+ * the end of every instruction, so it always sees CPU accesses at the dot
+ * they happen on.
+ *
+ * Code is run from a cache of pre-decoded basic blocks. A block ends at the
+ * first jump, branch, call or return, or at the end of its 2KB page, and is
+ * keyed by the host address of its first byte, so every PRG bank gets its own
+ * blocks and a bank switch needs no flush. Blocks decoded from RAM or PRG-RAM
+ * are dropped as soon as one of their bytes is written to.
+ */
+
+#include <stddef.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#define RP2A03_C 0x01 //!< Carry
+#define RP2A03_Z 0x02 //!< Zero
+#define RP2A03_I 0x04 //!< Interrupt disable
+#define RP2A03_D 0x08 //!< Decimal (stored, but ignored by the 2A03)
+#define RP2A03_B 0x10 //!< Break, only exists on the stack
+#define RP2A03_U 0x20 //!< Unused, always set
+#define RP2A03_V 0x40 //!< Overflow
+#define RP2A03_N 0x80 //!< Negative
+
+#define RP2A03_PAGES 32 //!< 2KB pages in the CPU address space
+
+#define RP2A03_BLOCK_MAX  16 //!< Instructions per decoded block
+#define RP2A03_CACHE_BITS 12
+#define RP2A03_CACHE_SIZE (1 << RP2A03_CACHE_BITS) //!< Blocks in the cache
+
+struct rp2a03;
+struct rp2a03_aot_block;
+struct trace;
+
+/*!
+ * Native code for a block, compiled by rp2a03jit.c or loaded from an
+ * rp2a03aot.h module. Runs a prefix of the block and sets PC to the first
+ * instruction it didn't run
+ */
+typedef void (*rp2a03_jitfn)(struct rp2a03 *c);
+
+/*!
+ * A pre-decoded instruction
+ */
+struct rp2a03_insn
+{
+    u16 pc;
+    u16 arg; //!< Operand bytes
+    u8  op;
+    u8  len;
+    u8  cycles; //!< Base cycle count, without page crossing penalties
+};
+
+/*!
+ * A pre-decoded basic block
+ */
+struct rp2a03_block
+{
+    const u8 *src; //!< Host address of the first byte, identifies the bank
+    u16       pc;
+    u8        count;
+    u8        ram;    //!< Decoded from writable memory, only valid for gen
+    u8        direct; //!< Has operands native code reads from RAM directly
+    u32       gen;
+
+    u16          heat;       //!< Times run, until it gets compiled
+    u8           jit_cycles; //!< Most cycles the native code can take
+    rp2a03_jitfn jit;        //!< Native code, or NULL
+
+    struct rp2a03_insn insns[RP2A03_BLOCK_MAX];
+};
+
+/*!
+ * @struct rp2a03
+ * CPU registers and the page tables used for fast memory access
+ */
+struct rp2a03
+{
+    u16 PC;
+    u8  A;
+    u8  X;
+    u8  Y;
+    u8  SP;
+    u8  P;
+
+    u64 cycles; //!< CPU cycles since power on
+    u64 synced; //!< CPU cycles the PPU has been run for
+
+    u8 jammed; //!< Hit a KIL opcode, only a reset gets out of it
+
+    /*
+     * Readable/writable memory for each 2KB page, or NULL when the page has
+     * to go through nes_bus_read()/nes_bus_write(), is watched, or (wrmap
+     * only) still has to be copied for a clone mark, see clone.h
+     */
+    u8 *rdmap[RP2A03_PAGES];
+    u8 *wrmap[RP2A03_PAGES];
+
+    /*
+     * The memory behind each page, watched or not. Instruction fetches and
+     * the debugger go through these
+     */
+    u8 *rdmem[RP2A03_PAGES];
+    u8 *wrmem[RP2A03_PAGES];
+
+    u8 watch[RP2A03_PAGES]; //!< DEBUG_READ/DEBUG_WRITE points, see debug.h
+
+    u8         *ram; //!< 2KB internal RAM
+    struct nes *nes;
+
+    struct rp2a03_block *cache;   //!< Direct-mapped block cache
+    struct rp2a03_block  scratch; //!< Single instruction that can't be cached
+
+    u32 gen;   //!< Bumped whenever blocks from writable memory are dropped
+    u8  flush; //!< Leave the current block after this instruction
+    u8  purge; //!< Drop every block before running again, see rp2a03_poke()
+
+    /*
+     * Per-byte "holds cached code" flags for writable pages, or NULL for pages
+     * with no cached code in them
+     */
+    u8 *codemap[RP2A03_PAGES];
+    u8  codeflags[RP2A03_PAGES][0x800];
+
+    /*
+     * Code/data log bytes for each PRG-ROM page, or NULL for pages that
+     * aren't logged. Only built while nes->cdl is set, see cdl.h
+     */
+    u8 *cdlmap[RP2A03_PAGES];
+
+    struct
+    {
+        u64 hits;     //!< Blocks found in the cache
+        u64 misses;   //!< Blocks decoded
+        u64 uncached; //!< Instructions run outside of the cache
+        u64 flushes;  //!< Writes that dropped blocks from writable memory
+    } stats_cache;
+
+    struct trace *trace; //!< Instruction trace, see trace.h. NULL when off
+
+    u8     jit;       //!< Compile hot blocks, see rp2a03jit.h
+    u8    *jit_arena; //!< Executable memory for compiled blocks
+    size_t jit_used;
+
+    void                          *aot_handle; //!< See rp2a03aot.h
+    const struct rp2a03_aot_block *aot;        //!< Sorted by prg and pc
+    u32                            aot_count;
+
+    struct
+    {
+        u64 compiled; //!< Blocks compiled
+        u64 aot;      //!< Blocks given code from the AOT module
+        u64 runs;     //!< Blocks run as native code
+        u64 resets;   //!< Times the arena filled up and was thrown away
+    } stats_jit;
+};
+
+/*!
+ * Initializes the core for nes and builds its page tables
+ *
+ * @param c
+ * @param nes
+ */
+void
+rp2a03_init(struct rp2a03 *c, struct nes *nes);
+
+/*!
+ * Frees the block cache and the core itself
+ */
+void
+rp2a03_free(struct rp2a03 *c);
+
+/*!
+ * Jumps through the reset vector
+ */
+void
+rp2a03_reset(struct rp2a03 *c);
+
+/*!
+ * Rebuilds the page tables. Mappers call this after every bank switch, the
+ * core after the debugger changed its points. The block being run is left
+ * after the current instruction
+ */
+void
+rp2a03_remap(struct rp2a03 *c);
+
+/*!
+ * Drops every block decoded from writable memory and rebuilds the page
+ * tables, after RAM and mapper state were replaced as a whole (see state.h)
+ */
+void
+rp2a03_invalidate(struct rp2a03 *c);
+
+/*!
+ * Same, but drops every block, those decoded from ROM included, and the
+ * compiled code. For when the bytes behind ROM pages change (see cheat.h).
+ * Must be called between two rp2a03_run()
+ */
+void
+rp2a03_invalidate_all(struct rp2a03 *c);
+
+/*!
+ * Reads CPU memory for a debugger, without side effects: I/O and mapper
+ * registers read as 0
+ */
+u8
+rp2a03_peek(struct rp2a03 *c, u16 addr);
+
+/*!
+ * Writes CPU memory for a debugger. RAM and PRG-RAM drop whatever blocks
+ * they hold as usual. PRG-ROM can be patched too, which throws away the whole
+ * block cache (but not code loaded from an AOT module) once the core runs
+ * again. I/O and mapper registers are left alone. Only call while the core
+ * isn't running, or is stopped in the debugger
+ */
+void
+rp2a03_poke(struct rp2a03 *c, u16 addr, u8 val);
+
+/*!
+ * Runs whole instructions, along with the PPU, until at least the given
+ * cycle has been reached. NMIs raised by the PPU are taken between
+ * instructions
+ *
+ * @param c
+ * @param until CPU cycle to run to
+ */
+void
+rp2a03_run(struct rp2a03 *c, u64 until);
+
+#endif // NES_RP2A03_H_
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <dlfcn.h>
+#include <stdio.h>
+
+#include "rp2a03.h"
+#include "rp2a03aot.h"
+
+int
+rp2a03_aot_load(struct rp2a03 *c, const char *dir)
+{
+    struct nes *nes = c->nes;
+
+    size_t sprg = nes->cartridge.s_prg_rom_16 * 0x4000;
+    size_t schr = nes->cartridge.s_chr_rom_8 * 0x2000;
+    u64    hash = rp2a03_aot_hash(nes->cartridge.prg, sprg,
+                                  nes->cartridge.chr, schr);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%016llx.so", dir,
+             (unsigned long long)hash);
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+    {
+        return 0;
+    }
+
+    const u32 *abi    = dlsym(handle, "rp2a03_aot_abi");
+    const u32 *size   = dlsym(handle, "rp2a03_aot_size");
+    const u32 *count  = dlsym(handle, "rp2a03_aot_count");
+    const void *table = dlsym(handle, "rp2a03_aot_blocks");
+
+    // generated code reaches into struct rp2a03, so it has to come from this
+    // very build of the headers
+    if (!abi || !size || !count || !table || *abi != RP2A03_AOT_ABI ||
+        *size != sizeof(struct rp2a03))
+    {
+        dlclose(handle);
+        return 0;
+    }
+
+    c->aot_handle = handle;
+    c->aot        = table;
+    c->aot_count  = *count;
+    return 1;
+}
+
+void
+rp2a03_aot_free(struct rp2a03 *c)
+{
+    if (c->aot_handle)
+    {
+        dlclose(c->aot_handle);
+    }
+    c->aot_handle = NULL;
+    c->aot        = NULL;
+    c->aot_count  = 0;
+}
+
+const struct rp2a03_aot_block *
+rp2a03_aot_find(struct rp2a03 *c, u32 prg, u16 pc)
+{
+    u32 lo = 0;
+    u32 hi = c->aot_count;
+
+    while (lo < hi)
+    {
+        u32 mid = (lo + hi) / 2;
+
+        const struct rp2a03_aot_block *a = &c->aot[mid];
+        if (a->prg == prg && a->pc == pc)
+        {
+            return a;
+        }
+
+        if (a->prg < prg || (a->prg == prg && a->pc < pc)) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_RP2A03AOT_H_
+#define NES_RP2A03AOT_H_
+
+/*! @file rp2a03aot.h
+ * Ahead-of-time compiled PRG code
+ *
+ * tools/nesaot.c follows the code of a ROM from its vectors (and from a code
+ * data log, if there is one) and writes a C file with one function per basic
+ * block. That file is built into a shared object named after the ROM's hash,
+ * which rp2a03_aot_load() picks up. Blocks decoded from PRG-ROM then get their
+ * native code from the module instead of the JIT.
+ *
+ * Generated blocks follow the rules of rp2a03jit.h: they only touch RAM,
+ * PRG-RAM and PRG-ROM through the live page tables, and hand anything else
+ * back to the interpreter. Blocks the tool didn't find are interpreted.
+ */
+
+#include <stddef.h>
+
+#include <cpu.h>
+
+#include "rp2a03.h"
+
+/*!
+ * Bumped whenever generated code has to be rebuilt: any change to the layout
+ * of struct rp2a03 (rp2a03_aot_load() only catches changes of its size) or to
+ * the rules above. 2: code/data log map, cheat pages, and watched pages that
+ * are NULL in rdmap and wrmap
+ */
+#define RP2A03_AOT_ABI 2
+
+/*!
+ * A generated block, the module's table is sorted by prg then pc
+ */
+struct rp2a03_aot_block
+{
+    u32          prg;    //!< Offset of the first byte in PRG-ROM
+    u16          pc;     //!< CPU address of the first byte
+    u8           cycles; //!< Most cycles the block can take
+    rp2a03_jitfn fn;
+};
+
+/*!
+ * Hash of the PRG and CHR data that names a ROM's module (FNV-1a)
+ */
+static inline u64
+rp2a03_aot_hash(const u8 *prg, size_t sprg, const u8 *chr, size_t schr)
+{
+    u64 h = 0xCBF29CE484222325ull;
+
+    for (size_t i = 0; i < sprg; i++)
+    {
+        h = (h ^ prg[i]) * 0x100000001B3ull;
+    }
+    for (size_t i = 0; i < schr; i++)
+    {
+        h = (h ^ chr[i]) * 0x100000001B3ull;
+    }
+
+    return h;
+}
+
+/*!
+ * Loads dir/<hash>.so for the ROM in c->nes
+ *
+ * @returns 1 if a module was loaded, 0 if there is none or it doesn't match
+ *          this build
+ */
+int
+rp2a03_aot_load(struct rp2a03 *c, const char *dir);
+
+/*!
+ * Unloads the module
+ */
+void
+rp2a03_aot_free(struct rp2a03 *c);
+
+/*!
+ * Finds the generated block for the given PRG-ROM offset and CPU address
+ *
+ * @returns the block, or NULL if the tool didn't find one there
+ */
+const struct rp2a03_aot_block *
+rp2a03_aot_find(struct rp2a03 *c, u32 prg, u16 pc);
+
+/*
+ * Helpers for generated code. Every block keeps the cycle count in cyc and
+ * leaves through AOT_EXIT(), either at the end or right before an instruction
+ * that has to be interpreted
+ */
+#define AOT_EXIT(_pc)                                                          \
+    do                                                                         \
+    {                                                                          \
+        c->PC     = (_pc);                                                     \
+        c->cycles = cyc;                                                       \
+        return;                                                                \
+    } while (0)
+
+#define AOT_RD(_pc)                                                            \
+    do                                                                         \
+    {                                                                          \
+        p = c->rdmap[addr >> 11];                                              \
+        if (!p) AOT_EXIT(_pc);                                                 \
+        v = p[addr & 0x07FF];                                                  \
+    } while (0)
+
+// Points p at the page addr is written to
+#define AOT_WR(_pc)                                                            \
+    do                                                                         \
+    {                                                                          \
+        p = c->wrmap[addr >> 11];                                              \
+        if (!p || c->codemap[addr >> 11]) AOT_EXIT(_pc);                       \
+    } while (0)
+
+// RAM and the stack, which can't hold cached code when codemap[0] is NULL
+#define AOT_RAMWR(_pc)                                                         \
+    do                                                                         \
+    {                                                                          \
+        if (c->codemap[0]) AOT_EXIT(_pc);                                      \
+    } while (0)
+
+#define AOT_PUSH(_v)                                                           \
+    do                                                                         \
+    {                                                                          \
+        c->ram[0x100 | c->SP] = (_v);                                          \
+        c->SP -= 1;                                                            \
+    } while (0)
+
+#define AOT_PULL() (c->SP += 1, c->ram[0x100 | c->SP])
+
+#define AOT_CROSSED(_a, _b) ((((_a) ^ (_b)) & 0xFF00) != 0)
+
+#endif // NES_RP2A03AOT_H_
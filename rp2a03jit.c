@@ -0,0 +1,999 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "rp2a03.h"
+#include "rp2a03jit.h"
+
+#ifdef RP2A03_JIT
+
+#define JIT_BLOCK_MAX 4096 //!< Worst case bytes of code for one block
+#define JIT_EXITS_MAX 64
+
+// clang-format off
+enum jit_kind
+{
+    J_NONE,
+    J_ADC, J_AND, J_ASL, J_BIT, J_BRANCH, J_CLC, J_CLD, J_CLI, J_CLV, J_CMP,
+    J_CPX, J_CPY, J_DEC, J_DEX, J_DEY, J_EOR, J_INC, J_INX, J_INY, J_JMP,
+    J_JSR, J_LDA, J_LDX, J_LDY, J_LSR, J_NOP, J_ORA, J_PHA, J_PHP, J_PLA,
+    J_PLP, J_ROL, J_ROR, J_RTS, J_SBC, J_SEC, J_SED, J_SEI, J_STA, J_STX,
+    J_STY, J_TAX, J_TAY, J_TSX, J_TXA, J_TXS, J_TYA
+};
+
+enum jit_mode
+{
+    M_IMP, M_ACC, M_IMM, M_REL, M_ZP, M_ZPX, M_ZPY, M_ABS, M_ABX, M_ABXP,
+    M_ABY, M_ABYP, M_IZX, M_IZY, M_IZYP
+};
+
+/*
+ * Official opcodes only. BRK, RTI and JMP () are left to the interpreter
+ */
+static const struct
+{
+    u8 kind;
+    u8 mode;
+} jit_ops[256] = {
+    [0x01] = {J_ORA, M_IZX},
+    [0x05] = {J_ORA, M_ZP},
+    [0x06] = {J_ASL, M_ZP},
+    [0x08] = {J_PHP, M_IMP},
+    [0x09] = {J_ORA, M_IMM},
+    [0x0A] = {J_ASL, M_ACC},
+    [0x0D] = {J_ORA, M_ABS},
+    [0x0E] = {J_ASL, M_ABS},
+    [0x10] = {J_BRANCH, M_REL},
+    [0x11] = {J_ORA, M_IZYP},
+    [0x15] = {J_ORA, M_ZPX},
+    [0x16] = {J_ASL, M_ZPX},
+    [0x18] = {J_CLC, M_IMP},
+    [0x19] = {J_ORA, M_ABYP},
+    [0x1D] = {J_ORA, M_ABXP},
+    [0x1E] = {J_ASL, M_ABX},
+    [0x20] = {J_JSR, M_ABS},
+    [0x21] = {J_AND, M_IZX},
+    [0x24] = {J_BIT, M_ZP},
+    [0x25] = {J_AND, M_ZP},
+    [0x26] = {J_ROL, M_ZP},
+    [0x28] = {J_PLP, M_IMP},
+    [0x29] = {J_AND, M_IMM},
+    [0x2A] = {J_ROL, M_ACC},
+    [0x2C] = {J_BIT, M_ABS},
+    [0x2D] = {J_AND, M_ABS},
+    [0x2E] = {J_ROL, M_ABS},
+    [0x30] = {J_BRANCH, M_REL},
+    [0x31] = {J_AND, M_IZYP},
+    [0x35] = {J_AND, M_ZPX},
+    [0x36] = {J_ROL, M_ZPX},
+    [0x38] = {J_SEC, M_IMP},
+    [0x39] = {J_AND, M_ABYP},
+    [0x3D] = {J_AND, M_ABXP},
+    [0x3E] = {J_ROL, M_ABX},
+    [0x41] = {J_EOR, M_IZX},
+    [0x45] = {J_EOR, M_ZP},
+    [0x46] = {J_LSR, M_ZP},
+    [0x48] = {J_PHA, M_IMP},
+    [0x49] = {J_EOR, M_IMM},
+    [0x4A] = {J_LSR, M_ACC},
+    [0x4C] = {J_JMP, M_ABS},
+    [0x4D] = {J_EOR, M_ABS},
+    [0x4E] = {J_LSR, M_ABS},
+    [0x50] = {J_BRANCH, M_REL},
+    [0x51] = {J_EOR, M_IZYP},
+    [0x55] = {J_EOR, M_ZPX},
+    [0x56] = {J_LSR, M_ZPX},
+    [0x58] = {J_CLI, M_IMP},
+    [0x59] = {J_EOR, M_ABYP},
+    [0x5D] = {J_EOR, M_ABXP},
+    [0x5E] = {J_LSR, M_ABX},
+    [0x60] = {J_RTS, M_IMP},
+    [0x61] = {J_ADC, M_IZX},
+    [0x65] = {J_ADC, M_ZP},
+    [0x66] = {J_ROR, M_ZP},
+    [0x68] = {J_PLA, M_IMP},
+    [0x69] = {J_ADC, M_IMM},
+    [0x6A] = {J_ROR, M_ACC},
+    [0x6D] = {J_ADC, M_ABS},
+    [0x6E] = {J_ROR, M_ABS},
+    [0x70] = {J_BRANCH, M_REL},
+    [0x71] = {J_ADC, M_IZYP},
+    [0x75] = {J_ADC, M_ZPX},
+    [0x76] = {J_ROR, M_ZPX},
+    [0x78] = {J_SEI, M_IMP},
+    [0x79] = {J_ADC, M_ABYP},
+    [0x7D] = {J_ADC, M_ABXP},
+    [0x7E] = {J_ROR, M_ABX},
+    [0x81] = {J_STA, M_IZX},
+    [0x84] = {J_STY, M_ZP},
+    [0x85] = {J_STA, M_ZP},
+    [0x86] = {J_STX, M_ZP},
+    [0x88] = {J_DEY, M_IMP},
+    [0x8A] = {J_TXA, M_IMP},
+    [0x8C] = {J_STY, M_ABS},
+    [0x8D] = {J_STA, M_ABS},
+    [0x8E] = {J_STX, M_ABS},
+    [0x90] = {J_BRANCH, M_REL},
+    [0x91] = {J_STA, M_IZY},
+    [0x94] = {J_STY, M_ZPX},
+    [0x95] = {J_STA, M_ZPX},
+    [0x96] = {J_STX, M_ZPY},
+    [0x98] = {J_TYA, M_IMP},
+    [0x99] = {J_STA, M_ABY},
+    [0x9A] = {J_TXS, M_IMP},
+    [0x9D] = {J_STA, M_ABX},
+    [0xA0] = {J_LDY, M_IMM},
+    [0xA1] = {J_LDA, M_IZX},
+    [0xA2] = {J_LDX, M_IMM},
+    [0xA4] = {J_LDY, M_ZP},
+    [0xA5] = {J_LDA, M_ZP},
+    [0xA6] = {J_LDX, M_ZP},
+    [0xA8] = {J_TAY, M_IMP},
+    [0xA9] = {J_LDA, M_IMM},
+    [0xAA] = {J_TAX, M_IMP},
+    [0xAC] = {J_LDY, M_ABS},
+    [0xAD] = {J_LDA, M_ABS},
+    [0xAE] = {J_LDX, M_ABS},
+    [0xB0] = {J_BRANCH, M_REL},
+    [0xB1] = {J_LDA, M_IZYP},
+    [0xB4] = {J_LDY, M_ZPX},
+    [0xB5] = {J_LDA, M_ZPX},
+    [0xB6] = {J_LDX, M_ZPY},
+    [0xB8] = {J_CLV, M_IMP},
+    [0xB9] = {J_LDA, M_ABYP},
+    [0xBA] = {J_TSX, M_IMP},
+    [0xBC] = {J_LDY, M_ABXP},
+    [0xBD] = {J_LDA, M_ABXP},
+    [0xBE] = {J_LDX, M_ABYP},
+    [0xC0] = {J_CPY, M_IMM},
+    [0xC1] = {J_CMP, M_IZX},
+    [0xC4] = {J_CPY, M_ZP},
+    [0xC5] = {J_CMP, M_ZP},
+    [0xC6] = {J_DEC, M_ZP},
+    [0xC8] = {J_INY, M_IMP},
+    [0xC9] = {J_CMP, M_IMM},
+    [0xCA] = {J_DEX, M_IMP},
+    [0xCC] = {J_CPY, M_ABS},
+    [0xCD] = {J_CMP, M_ABS},
+    [0xCE] = {J_DEC, M_ABS},
+    [0xD0] = {J_BRANCH, M_REL},
+    [0xD1] = {J_CMP, M_IZYP},
+    [0xD5] = {J_CMP, M_ZPX},
+    [0xD6] = {J_DEC, M_ZPX},
+    [0xD8] = {J_CLD, M_IMP},
+    [0xD9] = {J_CMP, M_ABYP},
+    [0xDD] = {J_CMP, M_ABXP},
+    [0xDE] = {J_DEC, M_ABX},
+    [0xE0] = {J_CPX, M_IMM},
+    [0xE1] = {J_SBC, M_IZX},
+    [0xE4] = {J_CPX, M_ZP},
+    [0xE5] = {J_SBC, M_ZP},
+    [0xE6] = {J_INC, M_ZP},
+    [0xE8] = {J_INX, M_IMP},
+    [0xE9] = {J_SBC, M_IMM},
+    [0xEA] = {J_NOP, M_IMP},
+    [0xEC] = {J_CPX, M_ABS},
+    [0xED] = {J_SBC, M_ABS},
+    [0xEE] = {J_INC, M_ABS},
+    [0xF0] = {J_BRANCH, M_REL},
+    [0xF1] = {J_SBC, M_IZYP},
+    [0xF5] = {J_SBC, M_ZPX},
+    [0xF6] = {J_INC, M_ZPX},
+    [0xF8] = {J_SED, M_IMP},
+    [0xF9] = {J_SBC, M_ABYP},
+    [0xFD] = {J_SBC, M_ABXP},
+    [0xFE] = {J_INC, M_ABX},
+};
+// clang-format on
+
+/* x86-64 registers, by their encoding */
+#define AL  0
+#define CL  1
+#define DL  2
+#define DH  6
+#define EAX 0
+#define ECX 1
+#define EDX 2
+
+#define OFF(_f) ((u32)offsetof(struct rp2a03, _f))
+
+/*
+ * Code generation state. Register use in compiled code:
+ *  rbx  struct rp2a03 *
+ *  r12  c->ram
+ *  r13  c->cycles
+ *  ecx  effective address, then rdx + rdi is the host address of the operand
+ *  esi  page crossing penalty
+ *  eax, edx scratch
+ */
+struct jit
+{
+    u8 *p;
+    u8 *end;
+    u8  overflow;
+
+    struct
+    {
+        u8 *at; //!< rel32 to patch
+        u16 pc; //!< Instruction to hand back to the interpreter
+    } exits[JIT_EXITS_MAX];
+    int nexits;
+
+    u8 *epilogue[2]; //!< rel32s to patch with the epilogue address
+    int nepilogue;
+};
+
+static void
+jit_emit(struct jit *j, const u8 *b, int n)
+{
+    if (j->p + n > j->end)
+    {
+        j->overflow = 1;
+        return;
+    }
+    memcpy(j->p, b, n);
+    j->p += n;
+}
+
+#define EMIT(_j, ...)                                                          \
+    jit_emit((_j), (const u8[]){__VA_ARGS__}, sizeof((const u8[]){__VA_ARGS__}))
+
+static void
+jit_u32(struct jit *j, u32 v)
+{
+    EMIT(j, v, v >> 8, v >> 16, v >> 24);
+}
+
+static void
+jit_patch(u8 *at, u8 *to)
+{
+    int32_t rel = to - (at + 4);
+    memcpy(at, &rel, 4);
+}
+
+/*
+ * ModRM for [rbx + disp32], with reg in the reg field
+ */
+static void
+jit_rbx(struct jit *j, u8 reg, u32 off)
+{
+    EMIT(j, 0x80 | reg << 3 | 3);
+    jit_u32(j, off);
+}
+
+static void
+jit_ld8(struct jit *j, u8 reg, u32 off) // mov r8, [rbx + off]
+{
+    EMIT(j, 0x8A);
+    jit_rbx(j, reg, off);
+}
+
+static void
+jit_st8(struct jit *j, u8 reg, u32 off) // mov [rbx + off], r8
+{
+    EMIT(j, 0x88);
+    jit_rbx(j, reg, off);
+}
+
+static void
+jit_ldz(struct jit *j, u8 reg, u32 off) // movzx r32, byte [rbx + off]
+{
+    EMIT(j, 0x0F, 0xB6);
+    jit_rbx(j, reg, off);
+}
+
+static void
+jit_and8(struct jit *j, u32 off, u8 imm) // and byte [rbx + off], imm
+{
+    EMIT(j, 0x80);
+    jit_rbx(j, 4, off);
+    EMIT(j, imm);
+}
+
+static void
+jit_or8(struct jit *j, u32 off, u8 imm) // or byte [rbx + off], imm
+{
+    EMIT(j, 0x80);
+    jit_rbx(j, 1, off);
+    EMIT(j, imm);
+}
+
+static void
+jit_orr8(struct jit *j, u32 off, u8 reg) // or [rbx + off], r8
+{
+    EMIT(j, 0x08);
+    jit_rbx(j, reg, off);
+}
+
+static void
+jit_exit_jcc(struct jit *j, u8 cc, u16 pc) // jcc rel32, 0 for jmp
+{
+    if (j->nexits == JIT_EXITS_MAX)
+    {
+        j->overflow = 1;
+        return;
+    }
+
+    if (cc) EMIT(j, 0x0F, cc);
+    else EMIT(j, 0xE9);
+
+    j->exits[j->nexits].at = j->p;
+    j->exits[j->nexits].pc = pc;
+    j->nexits += 1;
+    jit_u32(j, 0);
+}
+
+static void
+jit_setpc(struct jit *j, u16 pc) // mov word [rbx + PC], imm16
+{
+    EMIT(j, 0x66, 0xC7);
+    jit_rbx(j, 0, OFF(PC));
+    EMIT(j, pc, pc >> 8);
+}
+
+static void
+jit_cycles(struct jit *j, u32 n) // add r13, imm32
+{
+    EMIT(j, 0x49, 0x81, 0xC5);
+    jit_u32(j, n);
+}
+
+/*
+ * Sets N and Z from an 8-bit register, clobbers dl
+ */
+static void
+jit_nz(struct jit *j, u8 reg)
+{
+    jit_and8(j, OFF(P), (u8) ~(RP2A03_N | RP2A03_Z));
+    EMIT(j, 0x84, 0xC0 | reg << 3 | reg); // test reg, reg
+    EMIT(j, 0x0F, 0x94, 0xC2);            // setz dl
+    EMIT(j, 0xD0, 0xE2);                  // shl dl, 1
+    jit_orr8(j, OFF(P), DL);
+    EMIT(j, 0x88, 0xC0 | reg << 3 | DL);  // mov dl, reg
+    EMIT(j, 0x80, 0xE2, 0x80);            // and dl, 0x80
+    jit_orr8(j, OFF(P), DL);
+}
+
+/*
+ * Sets C from cl, which holds 0 or 1
+ */
+static void
+jit_carry(struct jit *j)
+{
+    jit_and8(j, OFF(P), ~RP2A03_C);
+    jit_orr8(j, OFF(P), CL);
+}
+
+/* classes of effective address */
+#define A_RAM 0 //!< ecx is an offset into internal RAM
+#define A_DYN 1 //!< ecx has to go through the page tables
+#define A_IO  2 //!< Constant address in I/O space, can't be compiled
+
+/*
+ * Computes the effective address into ecx, and the page crossing penalty into
+ * esi for the P modes
+ */
+static int
+jit_addr(struct jit *j, const struct rp2a03_insn *d, u8 mode)
+{
+    u8 zp = d->arg;
+
+    switch (mode)
+    {
+        case M_ZP:
+            EMIT(j, 0xB9); // mov ecx, imm32
+            jit_u32(j, zp);
+            return A_RAM;
+
+        case M_ZPX:
+        case M_ZPY:
+            jit_ldz(j, ECX, mode == M_ZPX ? OFF(X) : OFF(Y));
+            EMIT(j, 0x81, 0xC1); // add ecx, imm32
+            jit_u32(j, zp);
+            EMIT(j, 0x0F, 0xB6, 0xC9); // movzx ecx, cl
+            return A_RAM;
+
+        case M_ABS:
+            if (d->arg < 0x2000)
+            {
+                EMIT(j, 0xB9);
+                jit_u32(j, d->arg & 0x07FF);
+                return A_RAM;
+            }
+            if (d->arg < 0x6000)
+            {
+                return A_IO;
+            }
+            EMIT(j, 0xB9);
+            jit_u32(j, d->arg);
+            return A_DYN;
+
+        case M_ABX:
+        case M_ABXP:
+        case M_ABY:
+        case M_ABYP:
+            jit_ldz(j, ECX, mode <= M_ABXP ? OFF(X) : OFF(Y));
+            EMIT(j, 0x81, 0xC1);
+            jit_u32(j, d->arg);
+            if (mode == M_ABXP || mode == M_ABYP)
+            {
+                EMIT(j, 0x81, 0xF9); // cmp ecx, imm32
+                jit_u32(j, d->arg | 0xFF);
+                EMIT(j, 0x0F, 0x97, 0xC0); // seta al
+                EMIT(j, 0x0F, 0xB6, 0xF0); // movzx esi, al
+            }
+            EMIT(j, 0x0F, 0xB7, 0xC9); // movzx ecx, cx
+            return A_DYN;
+
+        case M_IZX:
+            jit_ldz(j, EDX, OFF(X));
+            EMIT(j, 0x81, 0xC2); // add edx, imm32
+            jit_u32(j, zp);
+            EMIT(j, 0x0F, 0xB6, 0xD2);             // movzx edx, dl
+            EMIT(j, 0x41, 0x0F, 0xB6, 0x0C, 0x14); // movzx ecx, [r12 + rdx]
+            EMIT(j, 0x83, 0xC2, 0x01);             // add edx, 1
+            EMIT(j, 0x0F, 0xB6, 0xD2);
+            EMIT(j, 0x41, 0x0F, 0xB6, 0x14, 0x14); // movzx edx, [r12 + rdx]
+            EMIT(j, 0xC1, 0xE2, 0x08);             // shl edx, 8
+            EMIT(j, 0x09, 0xD1);                   // or ecx, edx
+            return A_DYN;
+
+        case M_IZY:
+        case M_IZYP:
+            EMIT(j, 0xBA); // mov edx, imm32
+            jit_u32(j, zp);
+            EMIT(j, 0x41, 0x0F, 0xB6, 0x0C, 0x14);
+            EMIT(j, 0xBA);
+            jit_u32(j, (u8)(zp + 1));
+            EMIT(j, 0x41, 0x0F, 0xB6, 0x14, 0x14);
+            EMIT(j, 0xC1, 0xE2, 0x08);
+            EMIT(j, 0x09, 0xD1);
+            jit_ldz(j, EDX, OFF(Y));
+            EMIT(j, 0x01, 0xCA); // add edx, ecx
+            if (mode == M_IZYP)
+            {
+                EMIT(j, 0x89, 0xD0);                   // mov eax, edx
+                EMIT(j, 0x31, 0xC8);                   // xor eax, ecx
+                EMIT(j, 0xA9, 0x00, 0xFF, 0x00, 0x00); // test eax, 0xFF00
+                EMIT(j, 0x0F, 0x95, 0xC0);             // setnz al
+                EMIT(j, 0x0F, 0xB6, 0xF0);             // movzx esi, al
+            }
+            EMIT(j, 0x0F, 0xB7, 0xCA); // movzx ecx, dx
+            return A_DYN;
+    }
+
+    return A_IO;
+}
+
+/*
+ * Points rdx + rdi at the operand, or leaves for the interpreter if the page
+ * isn't plain memory. Writes also leave if the page holds cached code
+ */
+static void
+jit_resolve(struct jit *j, int cls, u8 write, u16 pc)
+{
+    if (cls == A_RAM)
+    {
+        if (write)
+        {
+            EMIT(j, 0x48, 0x83, 0xBB); // cmp qword [rbx + codemap], 0
+            jit_u32(j, OFF(codemap));
+            EMIT(j, 0x00);
+            jit_exit_jcc(j, 0x85, pc);
+        }
+        EMIT(j, 0x4C, 0x89, 0xE2); // mov rdx, r12
+        EMIT(j, 0x89, 0xCF);       // mov edi, ecx
+        return;
+    }
+
+    EMIT(j, 0x89, 0xCF);             // mov edi, ecx
+    EMIT(j, 0x81, 0xE7);             // and edi, 0x7FF
+    jit_u32(j, 0x07FF);
+    EMIT(j, 0x89, 0xCA);             // mov edx, ecx
+    EMIT(j, 0xC1, 0xEA, 0x0B);       // shr edx, 11
+    if (write)
+    {
+        EMIT(j, 0x48, 0x83, 0xBC, 0xD3); // cmp qword [rbx + rdx*8 + codemap], 0
+        jit_u32(j, OFF(codemap));
+        EMIT(j, 0x00);
+        jit_exit_jcc(j, 0x85, pc);
+    }
+    EMIT(j, 0x48, 0x8B, 0x94, 0xD3); // mov rdx, [rbx + rdx*8 + map]
+    jit_u32(j, write ? OFF(wrmap) : OFF(rdmap));
+    EMIT(j, 0x48, 0x85, 0xD2);       // test rdx, rdx
+    jit_exit_jcc(j, 0x84, pc);
+}
+
+#define JIT_STOP 0 //!< Can't compile this instruction
+#define JIT_NEXT 1
+#define JIT_END  2 //!< Compiled, and it ended the block
+
+/*
+ * Loads the operand of a read instruction into al
+ */
+static int
+jit_read(struct jit *j, const struct rp2a03_insn *d, u8 mode)
+{
+    if (mode == M_IMM)
+    {
+        EMIT(j, 0xB8); // mov eax, imm32
+        jit_u32(j, (u8)d->arg);
+        return JIT_NEXT;
+    }
+
+    int cls = jit_addr(j, d, mode);
+    if (cls == A_IO)
+    {
+        return JIT_STOP;
+    }
+
+    jit_resolve(j, cls, 0, d->pc);
+    EMIT(j, 0x0F, 0xB6, 0x04, 0x3A); // movzx eax, byte [rdx + rdi]
+    return JIT_NEXT;
+}
+
+/*
+ * Points rdx + rdi at the operand of a write or read-modify-write
+ */
+static int
+jit_write(struct jit *j, const struct rp2a03_insn *d, u8 mode)
+{
+    int cls = jit_addr(j, d, mode);
+    if (cls == A_IO)
+    {
+        return JIT_STOP;
+    }
+
+    jit_resolve(j, cls, 1, d->pc);
+    return JIT_NEXT;
+}
+
+static void
+jit_stack_check(struct jit *j, u16 pc)
+{
+    EMIT(j, 0x48, 0x83, 0xBB); // cmp qword [rbx + codemap], 0
+    jit_u32(j, OFF(codemap));
+    EMIT(j, 0x00);
+    jit_exit_jcc(j, 0x85, pc);
+}
+
+static void
+jit_push(struct jit *j, u8 reg) // reg has to be al
+{
+    jit_ldz(j, ECX, OFF(SP));
+    EMIT(j, 0x41, 0x88, 0x84 | reg << 3, 0x0C, 0x00, 0x01, 0x00, 0x00);
+    EMIT(j, 0xFE); // dec byte [rbx + SP]
+    jit_rbx(j, 1, OFF(SP));
+}
+
+static void
+jit_pull(struct jit *j, u8 reg) // movzx reg, byte [r12 + 0x100 + ++SP]
+{
+    EMIT(j, 0xFE); // inc byte [rbx + SP]
+    jit_rbx(j, 0, OFF(SP));
+    jit_ldz(j, ECX, OFF(SP));
+    EMIT(j, 0x41, 0x0F, 0xB6, 0x84 | reg << 3, 0x0C, 0x00, 0x01, 0x00, 0x00);
+}
+
+static u32
+jit_reg(u8 kind)
+{
+    switch (kind)
+    {
+        case J_LDX:
+        case J_STX:
+        case J_CPX:
+        case J_INX:
+        case J_DEX:
+            return OFF(X);
+        case J_LDY:
+        case J_STY:
+        case J_CPY:
+        case J_INY:
+        case J_DEY:
+            return OFF(Y);
+    }
+    return OFF(A);
+}
+
+/*
+ * Compiles a single instruction. Nothing may be changed before the last
+ * possible exit, so the interpreter can redo the instruction from scratch
+ */
+static int
+jit_insn(struct jit *j, const struct rp2a03_insn *d)
+{
+    u8  kind = jit_ops[d->op].kind;
+    u8  mode = jit_ops[d->op].mode;
+    u32 reg  = jit_reg(kind);
+    u16 next = d->pc + d->len;
+
+    switch (kind)
+    {
+        case J_NONE:
+            return JIT_STOP;
+
+        case J_LDA:
+        case J_LDX:
+        case J_LDY:
+            if (!jit_read(j, d, mode)) return JIT_STOP;
+            jit_st8(j, AL, reg);
+            jit_nz(j, AL);
+            break;
+
+        case J_STA:
+        case J_STX:
+        case J_STY:
+            if (!jit_write(j, d, mode)) return JIT_STOP;
+            jit_ld8(j, AL, reg);
+            EMIT(j, 0x88, 0x04, 0x3A); // mov [rdx + rdi], al
+            break;
+
+        case J_ORA:
+        case J_AND:
+        case J_EOR:
+            if (!jit_read(j, d, mode)) return JIT_STOP;
+            EMIT(j, kind == J_ORA ? 0x0A : kind == J_AND ? 0x22 : 0x32);
+            jit_rbx(j, AL, OFF(A)); // op al, [rbx + A]
+            jit_st8(j, AL, OFF(A));
+            jit_nz(j, AL);
+            break;
+
+        case J_ADC:
+        case J_SBC:
+            if (!jit_read(j, d, mode)) return JIT_STOP;
+            if (kind == J_SBC) EMIT(j, 0xF6, 0xD0); // not al
+            EMIT(j, 0x88, 0xC1);                    // mov cl, al
+            jit_ld8(j, AL, OFF(A));
+            jit_ld8(j, DL, OFF(P));
+            EMIT(j, 0xD0, 0xEA);       // shr dl, 1
+            EMIT(j, 0x10, 0xC8);       // adc al, cl
+            EMIT(j, 0x0F, 0x92, 0xC2); // setc dl
+            EMIT(j, 0x0F, 0x90, 0xC6); // seto dh
+            jit_st8(j, AL, OFF(A));
+            jit_and8(j, OFF(P), ~(RP2A03_C | RP2A03_V));
+            jit_orr8(j, OFF(P), DL);
+            EMIT(j, 0xC0, 0xE6, 0x06); // shl dh, 6
+            jit_orr8(j, OFF(P), DH);
+            jit_nz(j, AL);
+            break;
+
+        case J_CMP:
+        case J_CPX:
+        case J_CPY:
+            if (!jit_read(j, d, mode)) return JIT_STOP;
+            jit_ld8(j, CL, reg);
+            EMIT(j, 0x38, 0xC1);       // cmp cl, al
+            EMIT(j, 0x0F, 0x93, 0xC2); // setae dl
+            EMIT(j, 0x28, 0xC1);       // sub cl, al
+            jit_and8(j, OFF(P), ~RP2A03_C);
+            jit_orr8(j, OFF(P), DL);
+            jit_nz(j, CL);
+            break;
+
+        case J_BIT:
+            if (!jit_read(j, d, mode)) return JIT_STOP;
+            jit_ld8(j, CL, OFF(A));
+            EMIT(j, 0x20, 0xC1);       // and cl, al
+            EMIT(j, 0x0F, 0x94, 0xC2); // setz dl
+            EMIT(j, 0xD0, 0xE2);       // shl dl, 1
+            jit_and8(j, OFF(P), (u8) ~(RP2A03_N | RP2A03_V | RP2A03_Z));
+            jit_orr8(j, OFF(P), DL);
+            EMIT(j, 0x24, 0xC0); // and al, 0xC0
+            jit_orr8(j, OFF(P), AL);
+            break;
+
+        case J_ASL:
+        case J_LSR:
+        case J_ROL:
+        case J_ROR:
+            if (mode == M_ACC)
+            {
+                jit_ld8(j, AL, OFF(A));
+            }
+            else
+            {
+                if (!jit_write(j, d, mode)) return JIT_STOP;
+                EMIT(j, 0x0F, 0xB6, 0x04, 0x3A);
+            }
+            jit_ld8(j, CL, OFF(P));
+            EMIT(j, 0xD0, 0xE9); // shr cl, 1 (carry in)
+            EMIT(j, 0xD0, kind == J_ASL   ? 0xE0  // shl al, 1
+                          : kind == J_LSR ? 0xE8  // shr al, 1
+                          : kind == J_ROL ? 0xD0  // rcl al, 1
+                                          : 0xD8); // rcr al, 1
+            EMIT(j, 0x0F, 0x92, 0xC1); // setc cl
+            if (mode == M_ACC) jit_st8(j, AL, OFF(A));
+            else EMIT(j, 0x88, 0x04, 0x3A);
+            jit_carry(j);
+            jit_nz(j, AL);
+            break;
+
+        case J_INC:
+        case J_DEC:
+            if (!jit_write(j, d, mode)) return JIT_STOP;
+            EMIT(j, 0x0F, 0xB6, 0x04, 0x3A);
+            EMIT(j, 0xFE, kind == J_INC ? 0xC0 : 0xC8); // inc/dec al
+            EMIT(j, 0x88, 0x04, 0x3A);
+            jit_nz(j, AL);
+            break;
+
+        case J_INX:
+        case J_INY:
+        case J_DEX:
+        case J_DEY:
+            jit_ld8(j, AL, reg);
+            EMIT(j, 0xFE, (kind == J_INX || kind == J_INY) ? 0xC0 : 0xC8);
+            jit_st8(j, AL, reg);
+            jit_nz(j, AL);
+            break;
+
+        case J_TAX:
+        case J_TAY:
+        case J_TXA:
+        case J_TYA:
+        case J_TSX:
+        case J_TXS:
+        {
+            u32 from = kind == J_TAX || kind == J_TAY ? OFF(A)
+                       : kind == J_TXA || kind == J_TXS ? OFF(X)
+                       : kind == J_TYA                  ? OFF(Y)
+                                                        : OFF(SP);
+            u32 to   = kind == J_TXA || kind == J_TYA ? OFF(A)
+                       : kind == J_TAX || kind == J_TSX ? OFF(X)
+                       : kind == J_TAY                  ? OFF(Y)
+                                                        : OFF(SP);
+            jit_ld8(j, AL, from);
+            jit_st8(j, AL, to);
+            if (kind != J_TXS) jit_nz(j, AL);
+            break;
+        }
+
+        case J_CLC: jit_and8(j, OFF(P), ~RP2A03_C); break;
+        case J_SEC: jit_or8(j, OFF(P), RP2A03_C); break;
+        case J_CLI: jit_and8(j, OFF(P), ~RP2A03_I); break;
+        case J_SEI: jit_or8(j, OFF(P), RP2A03_I); break;
+        case J_CLV: jit_and8(j, OFF(P), ~RP2A03_V); break;
+        case J_CLD: jit_and8(j, OFF(P), ~RP2A03_D); break;
+        case J_SED: jit_or8(j, OFF(P), RP2A03_D); break;
+        case J_NOP: break;
+
+        case J_PHA:
+        case J_PHP:
+            jit_stack_check(j, d->pc);
+            jit_ld8(j, AL, kind == J_PHA ? OFF(A) : OFF(P));
+            if (kind == J_PHP) EMIT(j, 0x0C, RP2A03_B | RP2A03_U); // or al
+            jit_push(j, AL);
+            break;
+
+        case J_PLA:
+            jit_pull(j, EAX);
+            jit_st8(j, AL, OFF(A));
+            jit_nz(j, AL);
+            break;
+
+        case J_PLP:
+            jit_pull(j, EAX);
+            EMIT(j, 0x24, (u8)~RP2A03_B); // and al
+            EMIT(j, 0x0C, RP2A03_U);      // or al
+            jit_st8(j, AL, OFF(P));
+            break;
+
+        case J_JSR:
+            jit_stack_check(j, d->pc);
+            EMIT(j, 0xB8); // mov eax, return address - 1
+            jit_u32(j, (u16)(d->pc + 2) >> 8);
+            jit_push(j, AL);
+            EMIT(j, 0xB8);
+            jit_u32(j, (u8)(d->pc + 2));
+            jit_push(j, AL);
+            jit_cycles(j, d->cycles);
+            jit_setpc(j, d->arg);
+            return JIT_END;
+
+        case J_RTS:
+            jit_pull(j, EAX);
+            jit_pull(j, EDX);
+            EMIT(j, 0xC1, 0xE2, 0x08); // shl edx, 8
+            EMIT(j, 0x09, 0xD0);       // or eax, edx
+            EMIT(j, 0xFF, 0xC0);       // inc eax
+            EMIT(j, 0x66, 0x89);       // mov [rbx + PC], ax
+            jit_rbx(j, AL, OFF(PC));
+            jit_cycles(j, d->cycles);
+            return JIT_END;
+
+        case J_JMP:
+            jit_cycles(j, d->cycles);
+            jit_setpc(j, d->arg);
+            return JIT_END;
+
+        case J_BRANCH:
+        {
+            static const u8 flags[4] = {RP2A03_N, RP2A03_V, RP2A03_C,
+                                        RP2A03_Z};
+
+            u16 to    = next + (int8_t)d->arg;
+            u8  extra = ((next ^ to) & 0xFF00) ? 2 : 1;
+
+            EMIT(j, 0xF6); // test byte [rbx + P], flag
+            jit_rbx(j, 0, OFF(P));
+            EMIT(j, flags[d->op >> 6]);
+
+            // jnz/jz over the not taken path
+            EMIT(j, 0x0F, (d->op & 0x20) ? 0x85 : 0x84);
+            u8 *taken = j->p;
+            jit_u32(j, 0);
+
+            jit_cycles(j, d->cycles);
+            jit_setpc(j, next);
+            EMIT(j, 0xE9);
+            j->epilogue[j->nepilogue++] = j->p;
+            jit_u32(j, 0);
+
+            if (!j->overflow) jit_patch(taken, j->p);
+            jit_cycles(j, d->cycles + extra);
+            jit_setpc(j, to);
+            return JIT_END;
+        }
+    }
+
+    jit_cycles(j, d->cycles);
+    if (mode == M_ABXP || mode == M_ABYP || mode == M_IZYP)
+    {
+        EMIT(j, 0x49, 0x01, 0xF5); // add r13, rsi
+    }
+
+    return JIT_NEXT;
+}
+
+static void
+jit_reset(struct rp2a03 *c)
+{
+    u8 *arena = c->jit_arena;
+
+    // leave code from AOT modules alone
+    for (int i = 0; i < RP2A03_CACHE_SIZE; i++)
+    {
+        u8 *fn = (u8 *)c->cache[i].jit;
+        if (fn >= arena && fn < arena + RP2A03_JIT_ARENA)
+        {
+            c->cache[i].jit = NULL;
+        }
+    }
+    c->jit_used = 0;
+    c->stats_jit.resets += 1;
+}
+
+void
+rp2a03_jit_compile(struct rp2a03 *c, struct rp2a03_block *b)
+{
+    if (c->jit_used + JIT_BLOCK_MAX > RP2A03_JIT_ARENA)
+    {
+        jit_reset(c);
+    }
+
+    u8 *start = c->jit_arena + c->jit_used;
+
+    struct jit j = {.p = start, .end = start + JIT_BLOCK_MAX};
+
+    // push rbx, r12, r13; rbx = c; r12 = c->ram; r13 = c->cycles
+    EMIT(&j, 0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB);
+    EMIT(&j, 0x4C, 0x8B, 0xA3);
+    jit_u32(&j, OFF(ram));
+    EMIT(&j, 0x4C, 0x8B, 0xAB);
+    jit_u32(&j, OFF(cycles));
+
+    int n      = 0;
+    int cycles = 0;
+    int end    = JIT_NEXT;
+
+    while (n < b->count && end == JIT_NEXT)
+    {
+        const struct rp2a03_insn *d    = &b->insns[n];
+        u8                       *undo = j.p;
+        int                       exits = j.nexits;
+
+        end = jit_insn(&j, d);
+        if (end == JIT_STOP)
+        {
+            // give the rest of the block to the interpreter
+            j.p      = undo;
+            j.nexits = exits;
+            jit_setpc(&j, d->pc);
+            break;
+        }
+
+        u8 mode = jit_ops[d->op].mode;
+        cycles += d->cycles;
+        cycles += mode == M_ABXP || mode == M_ABYP || mode == M_IZYP;
+        cycles += jit_ops[d->op].kind == J_BRANCH ? 2 : 0;
+        n += 1;
+    }
+
+    if (end == JIT_NEXT)
+    {
+        jit_setpc(&j, b->insns[n - 1].pc + b->insns[n - 1].len);
+    }
+
+    // epilogue: c->cycles = r13; pop r13, r12, rbx; ret
+    u8 *epilogue = j.p;
+    EMIT(&j, 0x4C, 0x89, 0xAB);
+    jit_u32(&j, OFF(cycles));
+    EMIT(&j, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+
+    for (int i = 0; i < j.nepilogue && !j.overflow; i++)
+    {
+        jit_patch(j.epilogue[i], epilogue);
+    }
+
+    for (int i = 0; i < j.nexits; i++)
+    {
+        u8 *stub = j.p;
+        jit_setpc(&j, j.exits[i].pc);
+        EMIT(&j, 0xE9);
+        jit_u32(&j, 0);
+        if (j.overflow) break;
+        jit_patch(j.exits[i].at, stub);
+        jit_patch(j.p - 4, epilogue);
+    }
+
+    if (n == 0 || j.overflow)
+    {
+        return;
+    }
+
+    b->jit        = (rp2a03_jitfn)start;
+    b->jit_cycles = cycles;
+    c->jit_used += (j.p - start + 15) & ~15;
+    c->stats_jit.compiled += 1;
+}
+
+int
+rp2a03_jit_init(struct rp2a03 *c)
+{
+    c->jit_arena = mmap(NULL, RP2A03_JIT_ARENA,
+                        PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c->jit_arena == MAP_FAILED)
+    {
+        c->jit_arena = NULL;
+        return 0;
+    }
+
+    c->jit_used = 0;
+    c->jit      = 1;
+    return 1;
+}
+
+void
+rp2a03_jit_free(struct rp2a03 *c)
+{
+    if (c->jit_arena)
+    {
+        munmap(c->jit_arena, RP2A03_JIT_ARENA);
+    }
+    c->jit_arena = NULL;
+    c->jit       = 0;
+}
+
+#else // no JIT for this platform
+
+int
+rp2a03_jit_init(struct rp2a03 *c)
+{
+    return 0;
+}
+
+void
+rp2a03_jit_free(struct rp2a03 *c)
+{
+}
+
+void
+rp2a03_jit_compile(struct rp2a03 *c, struct rp2a03_block *b)
+{
+}
+
+#endif // RP2A03_JIT
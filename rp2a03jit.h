@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_RP2A03JIT_H_
+#define NES_RP2A03JIT_H_
+
+/*! @file rp2a03jit.h
+ * x86-64 recompiler for hot PRG-ROM blocks
+ *
+ * Blocks from the rp2a03.c cache that have run RP2A03_JIT_HEAT times are
+ * compiled to native code with their cycle counts folded in. Compiled code
+ * only touches RAM, PRG-RAM and PRG-ROM, and reads them through the live page
+ * tables. Any instruction that would reach I/O or a mapper register, or write
+ * to memory holding cached code, leaves the compiled code right before it and
+ * is run by the interpreter instead.
+ *
+ * The PPU is not clocked inside compiled code. rp2a03_run() only enters a
+ * compiled block when it can't end past the next possible NMI or the end of
+ * the run, so the result is the same as interpreting it.
+ *
+ * On anything but x86-64 (or with -DRP2A03_NO_JIT) rp2a03_jit_init() fails
+ * and the interpreter is used.
+ */
+
+#include <cpu.h>
+
+#if defined(__x86_64__) && !defined(RP2A03_NO_JIT)
+#define RP2A03_JIT 1
+#endif
+
+#define RP2A03_JIT_HEAT  32        //!< Runs before a block is compiled
+#define RP2A03_JIT_ARENA (4 << 20) //!< Bytes of executable memory
+
+struct rp2a03;
+struct rp2a03_block;
+
+/*!
+ * Sets up the executable arena and enables compilation for c
+ *
+ * @returns 1 on success, 0 if there is no JIT for this platform
+ */
+int
+rp2a03_jit_init(struct rp2a03 *c);
+
+/*!
+ * Frees the executable arena
+ */
+void
+rp2a03_jit_free(struct rp2a03 *c);
+
+/*!
+ * Compiles b and stores the result in b->jit. Compilation stops at the first
+ * instruction that can't be compiled; if that is the first one, b->jit stays
+ * NULL
+ */
+void
+rp2a03_jit_compile(struct rp2a03 *c, struct rp2a03_block *b);
+
+#endif // NES_RP2A03JIT_H_
@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_RP2A03OP_H_
+#define NES_RP2A03OP_H_
+
+/*! @file rp2a03op.h
+ * Opcode tables and flag helpers shared by the rp2a03.c interpreter and the
+ * C code generated by tools/nesaot.c
+ */
+
+#include <cpu.h>
+
+#include "rp2a03.h"
+
+static const u8 rp2a03_cycles[256] = {
+    /*  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
+    7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6, // 0
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 1
+    6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6, // 2
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 3
+    6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6, // 4
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 5
+    6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6, // 6
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 7
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4, // 8
+    2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5, // 9
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4, // A
+    2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4, // B
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, // C
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // D
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, // E
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // F
+};
+
+static const u8 rp2a03_lengths[256] = {
+    /*  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
+    1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // 0
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // 1
+    3, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // 2
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // 3
+    1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // 4
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // 5
+    1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // 6
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // 7
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // 8
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // 9
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // A
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // B
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // C
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // D
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3, // E
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3, // F
+};
+
+static inline int
+rp2a03_ends_block(u8 op)
+{
+    switch (op)
+    {
+        case 0x00: // BRK
+        case 0x20: // JSR
+        case 0x40: // RTI
+        case 0x4C: // JMP
+        case 0x60: // RTS
+        case 0x6C: // JMP ()
+            return 1;
+    }
+
+    // branches, and KIL (which never advances)
+    return (op & 0x1F) == 0x10 ||
+           ((op & 0x0F) == 0x02 && (op < 0x80 || (op & 0x10)));
+}
+
+/*
+ * Whether the operand of op is in RAM whatever the registers hold: the zero
+ * page modes, and absolute addresses below $2000. Native code reads and writes
+ * those without the page tables
+ */
+static inline int
+rp2a03_ram_operand(u8 op, u16 arg)
+{
+    switch (op & 0x1F)
+    {
+        case 0x04:
+        case 0x05:
+        case 0x06:
+        case 0x07:
+        case 0x14:
+        case 0x15:
+        case 0x16:
+        case 0x17:
+            return 1;
+        case 0x0C:
+        case 0x0D:
+        case 0x0E:
+        case 0x0F:
+            return arg < 0x2000;
+    }
+
+    return 0;
+}
+
+/*
+ * Whether op touches RAM that no operand names: the stack, or the pointer of
+ * (zp,X) and (zp),Y. Native code reaches those without the page tables too
+ */
+static inline int
+rp2a03_ram_implied(u8 op)
+{
+    switch (op)
+    {
+        case 0x00: // BRK
+        case 0x08: // PHP
+        case 0x20: // JSR
+        case 0x28: // PLP
+        case 0x40: // RTI
+        case 0x48: // PHA
+        case 0x60: // RTS
+        case 0x68: // PLA
+            return 1;
+    }
+
+    switch (op & 0x1F)
+    {
+        case 0x01:
+        case 0x03:
+        case 0x11:
+        case 0x13:
+            return 1;
+    }
+
+    return 0;
+}
+
+static inline void
+rp2a03_setnz(struct rp2a03 *c, u8 v)
+{
+    c->P = (c->P & ~(RP2A03_N | RP2A03_Z)) | (v & RP2A03_N) |
+           (v ? 0 : RP2A03_Z);
+}
+
+static inline void
+rp2a03_adc(struct rp2a03 *c, u8 v)
+{
+    u16 s = c->A + v + (c->P & RP2A03_C);
+    u8  r = s;
+
+    c->P &= ~(RP2A03_C | RP2A03_V);
+    if (s > 0xFF) c->P |= RP2A03_C;
+    if (~(c->A ^ v) & (c->A ^ r) & 0x80) c->P |= RP2A03_V;
+
+    c->A = r;
+    rp2a03_setnz(c, r);
+}
+
+static inline void
+rp2a03_cmp(struct rp2a03 *c, u8 reg, u8 v)
+{
+    c->P = (c->P & ~RP2A03_C) | (reg >= v ? RP2A03_C : 0);
+    rp2a03_setnz(c, reg - v);
+}
+
+static inline u8
+rp2a03_asl(struct rp2a03 *c, u8 v)
+{
+    c->P = (c->P & ~RP2A03_C) | (v >> 7);
+    v <<= 1;
+    rp2a03_setnz(c, v);
+    return v;
+}
+
+static inline u8
+rp2a03_lsr(struct rp2a03 *c, u8 v)
+{
+    c->P = (c->P & ~RP2A03_C) | (v & 0x01);
+    v >>= 1;
+    rp2a03_setnz(c, v);
+    return v;
+}
+
+static inline u8
+rp2a03_rol(struct rp2a03 *c, u8 v)
+{
+    u8 r = (v << 1) | (c->P & RP2A03_C);
+    c->P = (c->P & ~RP2A03_C) | (v >> 7);
+    rp2a03_setnz(c, r);
+    return r;
+}
+
+static inline u8
+rp2a03_ror(struct rp2a03 *c, u8 v)
+{
+    u8 r = (v >> 1) | ((c->P & RP2A03_C) << 7);
+    c->P = (c->P & ~RP2A03_C) | (v & 0x01);
+    rp2a03_setnz(c, r);
+    return r;
+}
+
+static inline u8
+rp2a03_inc(struct rp2a03 *c, u8 v)
+{
+    rp2a03_setnz(c, v + 1);
+    return v + 1;
+}
+
+static inline u8
+rp2a03_dec(struct rp2a03 *c, u8 v)
+{
+    rp2a03_setnz(c, v - 1);
+    return v - 1;
+}
+
+#endif // NES_RP2A03OP_H_
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "runahead.h"
+#include "ppu.h"
+#include "rp2a03.h"
+#include "stats.h"
+#include "util.h"
+
+struct runahead *
+runahead_create(struct nes *nes, u32 frames)
+{
+    if (nes->mode_libcpu || nes->mode_pipeline)
+    {
+        return NULL;
+    }
+
+    struct runahead *ra = calloc(1, sizeof(struct runahead));
+
+    ra->frames = frames;
+    ppu_set_hidden(nes->ppu, 1);
+
+    nes->runahead = ra;
+    return ra;
+}
+
+void
+runahead_close(struct nes *nes)
+{
+    struct runahead *ra = nes->runahead;
+
+    if (ra->count)
+    {
+        fprintf(stderr,
+                "Run-ahead of %u frames over %llu frames: avg %.2f ms, "
+                "max %.2f ms, %llu longer than a frame\n",
+                ra->frames, (unsigned long long)ra->count,
+                ra->sum / 1000.0 / ra->count, ra->max / 1000.0,
+                (unsigned long long)ra->late);
+    }
+
+    free(ra);
+    nes->runahead = NULL;
+}
+
+u64
+runahead_run(struct runahead *ra, struct nes *nes)
+{
+    struct rp2a03 *c   = nes->core;
+    struct ppu    *ppu = nes->ppu;
+    u64            at  = util_now_us();
+    u64            dot = ppu->dot;
+
+    state_save(nes, &ra->save);
+
+    for (u32 i = 0; i < ra->frames; i++)
+    {
+        if (i == ra->frames - 1)
+        {
+            ppu_set_hidden(ppu, 0);
+        }
+        rp2a03_run(c, c->cycles + NES_FRAME_CYCLES);
+    }
+
+    ppu_set_hidden(ppu, 1);
+    state_load(nes, &ra->save);
+
+    // frames run ahead don't count as emulated, see stats.h
+    __atomic_store_n(&ppu->dot, dot, __ATOMIC_RELAXED);
+
+    u64 us = util_now_us() - at;
+
+    ra->count += 1;
+    ra->sum += us;
+    ra->max = MAX(ra->max, us);
+    ra->late += us > NES_FRAME_US;
+    stats_add(&nes->stats_emu.ahead, us);
+
+    return us;
+}
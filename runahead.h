@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_RUNAHEAD_H_
+#define NES_RUNAHEAD_H_
+
+/*! @file runahead.h
+ * Run-ahead
+ *
+ * Games usually read the controller a frame or more before the frame that
+ * shows what they did with it. With -A frames, the real frames are emulated
+ * hidden (see ppu_set_hidden()). At the end of each one, the game loop saves
+ * the machine, runs that many frames further with the buttons held right now,
+ * drawing only the last of them, and loads the machine back. The screen is
+ * always that many frames ahead of the real machine, which takes as many
+ * frames of lag out, for games that react within them.
+ *
+ * Hidden frames skip pixel output, and fetches on lines where sprite 0 can't
+ * hit, so they are cheaper than drawn ones. The time a burst takes comes out
+ * of the next sleeps of the game loop, so the real machine keeps its speed as
+ * long as the burst fits in a frame. It shows as ahead= on the stats line
+ * (see stats.h) and is summed up on exit, to choose frames by.
+ *
+ * Needs the in-tree core and no -p, like save states.
+ */
+
+#include <cpu.h>
+#include <nes.h>
+
+#include "state.h"
+
+/*!
+ * @struct runahead
+ * Machine saved over a burst, and what the bursts took
+ */
+struct runahead
+{
+    struct state save;
+    u32          frames;   //!< How far ahead the screen is
+    u8           complete; //!< Last nes->frame_complete seen
+
+    u64 count; //!< Bursts run
+    u64 sum;   //!< us
+    u64 max;   //!< us
+    u64 late;  //!< Bursts longer than a frame (NES_FRAME_US)
+};
+
+/*!
+ * Hides the real frames from now on and stores the run-ahead in nes->runahead
+ *
+ * @returns NULL if states can't be saved and loaded in this configuration
+ */
+struct runahead *
+runahead_create(struct nes *nes, u32 frames);
+
+/*!
+ * Prints what the bursts took to stderr and frees nes->runahead
+ */
+void
+runahead_close(struct nes *nes);
+
+/*
+ * Runs one burst, see runahead_frame()
+ */
+u64
+runahead_run(struct runahead *ra, struct nes *nes);
+
+/*!
+ * Called by the game loop between two CPU slices. Runs ahead once per frame,
+ * right after the real frame is complete
+ *
+ * @returns us the burst took, 0 if there was none
+ */
+static inline u64
+runahead_frame(struct runahead *ra, struct nes *nes)
+{
+    if (nes->frame_complete != ra->complete)
+    {
+        ra->complete = nes->frame_complete;
+        if (ra->complete) return runahead_run(ra, nes);
+    }
+    return 0;
+}
+
+#endif // NES_RUNAHEAD_H_
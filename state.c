@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+#include "ppu.h"
+#include "rp2a03.h"
+
+// a change here means the file format changed, bump STATE_VERSION with it
+_Static_assert(sizeof(struct state) == 51672, "struct state layout changed");
+
+static void
+state_save_ppu(const struct ppu *ppu, struct state_ppu *s)
+{
+    memcpy(s->oam, ppu->oam, sizeof(s->oam));
+    memcpy(s->soam, ppu->soam, sizeof(s->soam));
+
+    s->cycle        = ppu->cycle;
+    s->scanline     = ppu->scanline;
+    s->vaddr        = ppu->vaddr;
+    s->taddr        = ppu->taddr;
+    s->fxscroll     = ppu->fxscroll;
+    s->reg_shift_1  = ppu->reg_shift_1;
+    s->reg_shift_2  = ppu->reg_shift_2;
+    s->bg_shift_plo = ppu->bg_shift_plo;
+    s->bg_shift_phi = ppu->bg_shift_phi;
+    s->bg_shift_alo = ppu->bg_shift_alo;
+    s->bg_shift_ahi = ppu->bg_shift_ahi;
+
+    memcpy(s->registers, &ppu->registers, sizeof(s->registers));
+    s->nmi           = ppu->nmi;
+    s->address_latch = ppu->address_latch;
+    s->data          = ppu->data;
+    s->fstoggle      = ppu->fstoggle;
+    s->odd_frame     = ppu->odd_frame;
+
+    s->bg_id  = ppu->bg_id;
+    s->bg_at  = ppu->bg_at;
+    s->bg_lsb = ppu->bg_lsb;
+    s->bg_msb = ppu->bg_msb;
+
+    s->n_oam              = ppu->n_oam;
+    s->m_oam              = ppu->m_oam;
+    s->i_soam             = ppu->i_soam;
+    s->soam_true          = ppu->soam_true;
+    s->soam_write_disable = ppu->soam_write_disable;
+    s->soam_latch         = ppu->soam_latch;
+    s->sprite_count       = ppu->sprite_count;
+    memcpy(s->sp_latch, ppu->sp_latch, 8);
+    memcpy(s->sp_counter, ppu->sp_counter, 8);
+    memcpy(s->sp_shift_lo, ppu->sp_shift_lo, 8);
+    memcpy(s->sp_shift_hi, ppu->sp_shift_hi, 8);
+    s->inc_sprite0 = ppu->inc_sprite0;
+    s->ren_sprite0 = ppu->ren_sprite0;
+}
+
+static void
+state_load_ppu(struct ppu *ppu, const struct state_ppu *s)
+{
+    memcpy(ppu->oam, s->oam, sizeof(s->oam));
+    memcpy(ppu->soam, s->soam, sizeof(s->soam));
+
+    ppu->cycle        = s->cycle;
+    ppu->scanline     = s->scanline;
+    ppu->vaddr        = s->vaddr;
+    ppu->taddr        = s->taddr;
+    ppu->fxscroll     = s->fxscroll;
+    ppu->reg_shift_1  = s->reg_shift_1;
+    ppu->reg_shift_2  = s->reg_shift_2;
+    ppu->bg_shift_plo = s->bg_shift_plo;
+    ppu->bg_shift_phi = s->bg_shift_phi;
+    ppu->bg_shift_alo = s->bg_shift_alo;
+    ppu->bg_shift_ahi = s->bg_shift_ahi;
+
+    memcpy(&ppu->registers, s->registers, sizeof(s->registers));
+    ppu->nmi           = s->nmi;
+    ppu->address_latch = s->address_latch;
+    ppu->data          = s->data;
+    ppu->fstoggle      = s->fstoggle;
+    ppu->odd_frame     = s->odd_frame;
+
+    ppu->bg_id  = s->bg_id;
+    ppu->bg_at  = s->bg_at;
+    ppu->bg_lsb = s->bg_lsb;
+    ppu->bg_msb = s->bg_msb;
+
+    ppu->n_oam              = s->n_oam;
+    ppu->m_oam              = s->m_oam;
+    ppu->i_soam             = s->i_soam;
+    ppu->soam_true          = s->soam_true;
+    ppu->soam_write_disable = s->soam_write_disable;
+    ppu->soam_latch         = s->soam_latch;
+    ppu->sprite_count       = s->sprite_count;
+    memcpy(ppu->sp_latch, s->sp_latch, 8);
+    memcpy(ppu->sp_counter, s->sp_counter, 8);
+    memcpy(ppu->sp_shift_lo, s->sp_shift_lo, 8);
+    memcpy(ppu->sp_shift_hi, s->sp_shift_hi, 8);
+    ppu->inc_sprite0 = s->inc_sprite0;
+    ppu->ren_sprite0 = s->ren_sprite0;
+
+    // the clock variant follows PPUMASK/PPUCTRL
+    ppu_select_clock(ppu);
+}
+
+int
+state_save_regs(struct nes *nes, struct state *s)
+{
+    struct rp2a03 *c = nes->core;
+
+    if (nes->mode_libcpu)
+    {
+        return 0;
+    }
+
+    s->magic   = STATE_MAGIC;
+    s->version = STATE_VERSION;
+    s->rom     = nes->cartridge.hash;
+    s->cycle   = nes->cycle;
+
+    s->cpu.cycles = c->cycles;
+    s->cpu.synced = c->synced;
+    s->cpu.pc     = c->PC;
+    s->cpu.a      = c->A;
+    s->cpu.x      = c->X;
+    s->cpu.y      = c->Y;
+    s->cpu.sp     = c->SP;
+    s->cpu.p      = c->P;
+    s->cpu.jammed = c->jammed;
+
+    state_save_ppu(nes->ppu, &s->ppu);
+
+    memcpy(s->ram, c->ram, sizeof(s->ram));
+
+    s->dma_stall = nes->dma_stall;
+    s->mirror    = nes->mirror;
+    memcpy(s->mapreg, nes->mapreg, sizeof(s->mapreg));
+    s->btn_latch      = nes->btn_latch;
+    s->btn_latch2     = nes->btn_latch2;
+    s->frame_complete = nes->frame_complete;
+    memset(s->pad, 0, sizeof(s->pad));
+
+    return 1;
+}
+
+int
+state_save(struct nes *nes, struct state *s)
+{
+    if (!state_save_regs(nes, s))
+    {
+        return 0;
+    }
+
+    memcpy(s->ppu.vram, nes->ppu->vram, sizeof(s->ppu.vram));
+    memcpy(s->mem, nes->cpu->mem + 0x4000, sizeof(s->mem));
+    memcpy(s->prg_ram, nes->cartridge.prg_ram, sizeof(s->prg_ram));
+    if (nes->cartridge.s_chr_rom_8 == 0)
+    {
+        memcpy(s->chr_ram, nes->cartridge.chr, sizeof(s->chr_ram));
+    }
+    else
+    {
+        memset(s->chr_ram, 0, sizeof(s->chr_ram));
+    }
+
+    return 1;
+}
+
+void
+state_load_regs(struct nes *nes, const struct state *s)
+{
+    struct rp2a03 *c = nes->core;
+
+    nes->cycle = s->cycle;
+
+    c->cycles = s->cpu.cycles;
+    c->synced = s->cpu.synced;
+    c->PC     = s->cpu.pc;
+    c->A      = s->cpu.a;
+    c->X      = s->cpu.x;
+    c->Y      = s->cpu.y;
+    c->SP     = s->cpu.sp;
+    c->P      = s->cpu.p;
+    c->jammed = s->cpu.jammed;
+
+    memcpy(c->ram, s->ram, sizeof(s->ram));
+
+    nes->dma_stall = s->dma_stall;
+    nes->mirror    = s->mirror;
+    memcpy(nes->mapreg, s->mapreg, sizeof(s->mapreg));
+    nes->btn_latch      = s->btn_latch;
+    nes->btn_latch2     = s->btn_latch2;
+    nes->frame_complete = s->frame_complete;
+
+    state_load_ppu(nes->ppu, &s->ppu);
+
+    // RAM changed under any blocks decoded from it, banks may have moved
+    rp2a03_invalidate(c);
+}
+
+int
+state_load(struct nes *nes, const struct state *s)
+{
+    if (s->magic != STATE_MAGIC || s->version != STATE_VERSION ||
+        s->rom != nes->cartridge.hash || nes->mode_libcpu || nes->ppu->pipe ||
+        nes->mark)
+    {
+        return 0;
+    }
+
+    memcpy(nes->ppu->vram, s->ppu.vram, sizeof(s->ppu.vram));
+    memcpy(nes->cpu->mem + 0x4000, s->mem, sizeof(s->mem));
+    memcpy(nes->cartridge.prg_ram, s->prg_ram, sizeof(s->prg_ram));
+    if (nes->cartridge.s_chr_rom_8 == 0)
+    {
+        memcpy(nes->cartridge.chr, s->chr_ram, sizeof(s->chr_ram));
+    }
+
+    state_load_regs(nes, s);
+
+    return 1;
+}
+
+int
+state_write(struct nes *nes, const char *path)
+{
+    struct state s;
+
+    if (!state_save(nes, &s))
+    {
+        return 0;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    size_t ok = fwrite(&s, sizeof(s), 1, file);
+    return (fclose(file) == 0) & (ok == 1);
+}
+
+int
+state_read(struct nes *nes, const char *path)
+{
+    struct state s;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    size_t ok = fread(&s, sizeof(s), 1, file);
+    fclose(file);
+
+    return ok == 1 && state_load(nes, &s);
+}
@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_STATE_H_
+#define NES_STATE_H_
+
+/*! @file state.h
+ * Save states
+ *
+ * A state is one flat struct with no pointers in it, so saving and loading
+ * are plain copies (about 50KB each way) and loading allocates nothing. The
+ * same struct is the file format, written in host byte order. The header
+ * names the version of the layout and the ROM it belongs to. Any change to
+ * struct state below has to bump STATE_VERSION.
+ *
+ * Saved: CPU registers and cycle count, RAM, $4000-$7FFF (I/O latches and
+ * NROM's PRG-RAM), PRG-RAM, CHR-RAM, mapper registers and mirroring, the
+ * whole PPU including OAM, VRAM and palette, and the controller shift
+ * register. Not saved: the buttons being held, which are input rather than
+ * state, the frame buffer, which is redrawn by the next frame, and anything
+ * that only counts time since power on, like ppu->dot.
+ *
+ * Only the in-tree core can be saved (not -l), and states can't be loaded
+ * while the PPU pipeline runs, as its replica lives on another thread, or
+ * while a clone mark is set (see clone.h). Both have to be called between two
+ * rp2a03_run() calls.
+ */
+
+#include <stddef.h>
+
+#include <cpu.h>
+#include <nes.h>
+
+#define STATE_MAGIC   0x5453454E //!< "NEST"
+#define STATE_VERSION 2
+
+struct state_cpu
+{
+    u64 cycles;
+    u64 synced;
+    u16 pc;
+    u8  a;
+    u8  x;
+    u8  y;
+    u8  sp;
+    u8  p;
+    u8  jammed;
+};
+
+struct state_ppu
+{
+    u8 vram[0x4000]; //!< Nametables and palette
+    u8 oam[256];
+    u8 soam[64];
+
+    int32_t cycle;
+    int32_t scanline;
+
+    u16 vaddr;
+    u16 taddr;
+    u16 fxscroll;
+    u16 reg_shift_1;
+    u16 reg_shift_2;
+    u16 bg_shift_plo;
+    u16 bg_shift_phi;
+    u16 bg_shift_alo;
+    u16 bg_shift_ahi;
+
+    u8 registers[8]; //!< $2000-$2007
+    u8 nmi;
+    u8 address_latch;
+    u8 data;
+    u8 fstoggle;
+    u8 odd_frame;
+
+    u8 bg_id;
+    u8 bg_at;
+    u8 bg_lsb;
+    u8 bg_msb;
+
+    u8 n_oam;
+    u8 m_oam;
+    u8 i_soam;
+    u8 soam_true;
+    u8 soam_write_disable;
+    u8 soam_latch;
+    u8 sprite_count;
+    u8 sp_latch[8];
+    u8 sp_counter[8];
+    u8 sp_shift_lo[8];
+    u8 sp_shift_hi[8];
+    u8 inc_sprite0;
+    u8 ren_sprite0;
+};
+
+/*!
+ * @struct state
+ * The whole machine, in a fixed layout
+ */
+struct state
+{
+    u32 magic;   //!< STATE_MAGIC
+    u32 version; //!< STATE_VERSION
+    u64 rom;     //!< nes->cartridge.hash of the ROM it was saved from
+    u64 cycle;   //!< nes->cycle
+
+    struct state_cpu cpu;
+    struct state_ppu ppu;
+
+    u8 ram[0x800];      //!< Internal RAM
+    u8 mem[0x4000];     //!< $4000-$7FFF of the CPU memory
+    u8 prg_ram[0x2000]; //!< Mapper PRG-RAM
+    u8 chr_ram[0x2000]; //!< Only used by ROMs without CHR-ROM
+
+    u16 dma_stall;
+    u16 mirror;
+    u8  mapreg[8];
+    u8  btn_latch;
+    u8  btn_latch2;
+    u8  frame_complete;
+    u8  pad[5]; //!< Zero, the layout has no implicit padding
+};
+
+/*!
+ * Copies the machine into s
+ *
+ * @returns 0 if the machine can't be saved, see above
+ */
+int
+state_save(struct nes *nes, struct state *s);
+
+/*!
+ * Replaces the machine with s
+ *
+ * @returns 0 if s is for another ROM or version, or can't be loaded now. The
+ *          machine is left alone then
+ */
+int
+state_load(struct nes *nes, const struct state *s);
+
+/*!
+ * state_save() without the memory a clone mark copies page by page: VRAM,
+ * $4000-$7FFF, PRG-RAM and CHR-RAM. Internal RAM is saved, see clone.h
+ */
+int
+state_save_regs(struct nes *nes, struct state *s);
+
+/*!
+ * Loads what state_save_regs() saved. Nothing is checked, s has to come from
+ * this machine
+ */
+void
+state_load_regs(struct nes *nes, const struct state *s);
+
+/*!
+ * Saves the machine to a file
+ */
+int
+state_write(struct nes *nes, const char *path);
+
+/*!
+ * Loads the machine from a file written by state_write()
+ */
+int
+state_read(struct nes *nes, const char *path);
+
+#endif // NES_STATE_H_
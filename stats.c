@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+#include "ppu.h"
+
+#define STATS_DOT_HZ 5369318.0 //!< NTSC PPU dots per second
+
+/*
+ * Frame number of a dot, 341 x 262 dots minus every other one
+ */
+static u64
+stats_frame(u64 dot)
+{
+    return dot * 2 / 178683;
+}
+
+static u64
+stats_dot(struct nes *nes)
+{
+    return __atomic_load_n(&nes->ppu->dot, __ATOMIC_RELAXED);
+}
+
+/*
+ * Current totals of the game loop
+ */
+static void
+stats_emu(struct stats *s, struct nes *nes)
+{
+    s->busy    = __atomic_load_n(&nes->stats_emu.busy, __ATOMIC_RELAXED);
+    s->sleep   = __atomic_load_n(&nes->stats_emu.sleep, __ATOMIC_RELAXED);
+    s->slept   = __atomic_load_n(&nes->stats_emu.slept, __ATOMIC_RELAXED);
+    s->sleeps  = __atomic_load_n(&nes->stats_emu.sleeps, __ATOMIC_RELAXED);
+    s->stalled = __atomic_load_n(&nes->stats_emu.stalled, __ATOMIC_RELAXED);
+    s->ahead   = __atomic_load_n(&nes->stats_emu.ahead, __ATOMIC_RELAXED);
+    s->resim   = __atomic_load_n(&nes->stats_emu.resim, __ATOMIC_RELAXED);
+
+    // written by the presenter, which is also the thread reporting
+    s->presents = nes->stats_present.frames;
+    s->skipped  = nes->stats_present.skipped;
+    s->rows     = nes->stats_present.rows;
+}
+
+void
+stats_init(struct stats *s, struct nes *nes, u64 now)
+{
+    s->at      = now;
+    s->dot     = stats_dot(nes);
+    s->shown   = stats_frame(s->dot);
+    s->dropped = 0;
+    s->dup     = 0;
+    stats_emu(s, nes);
+
+    snprintf(s->title, sizeof(s->title), "mnem");
+    s->line[0] = '\0';
+}
+
+void
+stats_present(struct stats *s, struct nes *nes)
+{
+    u64 frame = stats_frame(stats_dot(nes));
+
+    if (frame == s->shown)
+    {
+        s->dup += 1;
+    }
+    else
+    {
+        s->dropped += frame - s->shown - 1;
+        s->shown = frame;
+    }
+}
+
+int
+stats_update(struct stats *s, struct nes *nes, u64 now)
+{
+    if (now - s->at < STATS_PERIOD)
+    {
+        return 0;
+    }
+
+    struct stats prev = *s;
+    u64          dot  = stats_dot(nes);
+
+    stats_emu(s, nes);
+
+    double secs   = (now - prev.at) / 1e6;
+    double frames = (double)(stats_frame(dot) - stats_frame(prev.dot));
+    double sleeps = (double)(s->sleeps - prev.sleeps);
+
+    double fps   = frames / secs;
+    double ms    = frames ? (s->busy - prev.busy) / 1e3 / frames : 0.0;
+    double over  = sleeps ? ((double)(s->slept - prev.slept) -
+                            (double)(s->sleep - prev.sleep)) / sleeps
+                          : 0.0;
+    double speed = 100.0 * (dot - prev.dot) / STATS_DOT_HZ / secs;
+    double ahead = frames ? (s->ahead - prev.ahead) / 1e3 / frames : 0.0;
+    double resim = frames ? (s->resim - prev.resim) / 1e3 / frames : 0.0;
+
+    u64 presents = s->presents - prev.presents;
+    u64 skipped  = s->skipped - prev.skipped;
+    u64 rows     = s->rows - prev.rows;
+
+    snprintf(s->title, sizeof(s->title), "mnem - %.1f fps, %.0f%%, %.2f ms",
+             fps, speed, ms);
+    snprintf(s->line, sizeof(s->line),
+             "stats fps=%.2f ms=%.2f over=%.0f speed=%.1f dropped=%llu "
+             "dup=%llu stalled=%llu",
+             fps, ms, over, speed, (unsigned long long)s->dropped,
+             (unsigned long long)s->dup,
+             (unsigned long long)(s->stalled - prev.stalled));
+
+    if (presents)
+    {
+        size_t n = strlen(s->title);
+        snprintf(s->title + n, sizeof(s->title) - n,
+                 ", %.0f rows, %llu skipped", (double)rows / presents,
+                 (unsigned long long)skipped);
+
+        n = strlen(s->line);
+        snprintf(s->line + n, sizeof(s->line) - n, " skipped=%llu rows=%llu",
+                 (unsigned long long)skipped, (unsigned long long)rows);
+    }
+
+    if (nes->runahead)
+    {
+        size_t n = strlen(s->line);
+        snprintf(s->line + n, sizeof(s->line) - n, " ahead=%.2f", ahead);
+    }
+
+    if (nes->netplay)
+    {
+        size_t n = strlen(s->line);
+        snprintf(s->line + n, sizeof(s->line) - n, " resim=%.2f", resim);
+    }
+
+    s->at      = now;
+    s->dot     = dot;
+    s->dropped = 0;
+    s->dup     = 0;
+
+    return 1;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_STATS_H_
+#define NES_STATS_H_
+
+/*! @file stats.h
+ * Live performance statistics
+ *
+ * The game loop adds to nes->stats_emu once per CPU slice and the presenter
+ * counts what it shows. Once a second, the window or headless loop turns the
+ * difference since the last report into rates. Frames are counted from
+ * ppu->dot, so ppu_clock() does no extra work for any of this.
+ *
+ * In the window the report goes to the title. Headless (-H) it goes to
+ * stderr as one line of key=value pairs:
+ *
+ *     stats fps=60.10 ms=2.84 over=61 speed=100.1 dropped=0 dup=0 stalled=514
+ *
+ * - fps: emulated frames per second
+ * - ms: host time spent emulating each frame, without sleeping
+ * - over: average time usleep() overshot its request by, in us
+ * - speed: emulation speed in percent of a real NES
+ * - dropped, dup: frames that were never presented, or presented again
+ * - stalled: CPU cycles skipped over OAM DMA instead of executed
+ * - skipped, rows: in the window, presents that uploaded nothing because the
+ *   frame had not changed, and rows uploaded, see nes_present_dirty(). The
+ *   title shows skipped and the rows uploaded per present
+ * - ahead: with -A, host time spent running ahead each frame, in ms. Part of
+ *   ms, see runahead.h
+ * - resim: with -N, host time spent re-simulating after mispredicted inputs
+ *   each frame, in ms. Part of ms, see netplay.h
+ */
+
+#include <cpu.h>
+#include <nes.h>
+
+#define STATS_PERIOD 1000000 //!< us between two reports
+
+struct stats
+{
+    u64 at;    //!< Time of the last report, us
+    u64 dot;   //!< ppu->dot at the last report
+    u64 shown; //!< Number of the frame presented last
+
+    u64 busy, sleep, slept, sleeps, stalled, ahead, resim; //!< nes->stats_emu
+    u64 presents, skipped, rows; //!< nes->stats_present
+
+    u64 dropped; //!< Since the last report
+    u64 dup;     //!< Since the last report
+
+    char title[64]; //!< Window title with the last report
+    char line[192]; //!< stderr line with the last report
+};
+
+/*
+ * Single writer counters that another thread reads once a second
+ */
+static inline void
+stats_add(u64 *counter, u64 n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+void
+stats_init(struct stats *s, struct nes *nes, u64 now);
+
+/*!
+ * Counts one presentation of the latest frame
+ */
+void
+stats_present(struct stats *s, struct nes *nes);
+
+/*!
+ * Builds title and line once STATS_PERIOD has passed since the last report
+ *
+ * @param s
+ * @param nes
+ * @param now Current time, us
+ *
+ * @returns 1 if there is a new report
+ */
+int
+stats_update(struct stats *s, struct nes *nes, u64 now);
+
+#endif // NES_STATS_H_
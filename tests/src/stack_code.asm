@@ -0,0 +1,95 @@
+; Code run from the stack page has to be decoded again once a push
+; overwrites it, in the block cache and in compiled blocks alike.
+; Standalone NROM, no prefix: reports through $6000 like the instr
+; tests ($6001-$6003 = $DE $B0 $61, text from $6004, $6000 = 0 when
+; passed, 1 when failed).
+
+      .org  $C000
+
+reset:
+      sei
+      cld
+      ldx   #$ff
+      txs
+      lda   #$80
+      sta   $6000
+      lda   #$de
+      sta   $6001
+      lda   #$b0
+      sta   $6002
+      lda   #$61
+      sta   $6003
+
+      ; lda #$11 / rts at $0180
+      lda   #$a9
+      sta   $0180
+      lda   #$11
+      sta   $0181
+      lda   #$60
+      sta   $0182
+
+      ldy   #0
+warm: jsr   $0180
+      dey
+      bne   warm
+      cmp   #$11
+      bne   fail
+
+      ; overwrite the operand with a push, not a store
+      ldx   #$81
+      txs
+      lda   #$22
+      pha
+      ldx   #$ff
+      txs
+      jsr   $0180
+      cmp   #$22
+      bne   fail
+
+      ; again, now that the block is hot enough to be compiled
+      ldy   #0
+warm2:jsr   $0180
+      dey
+      bne   warm2
+      ldx   #$81
+      txs
+      lda   #$33
+      pha
+      ldx   #$ff
+      txs
+      jsr   $0180
+      cmp   #$33
+      bne   fail
+
+      ldx   #0
+pass: lda   msg_pass,x
+      sta   $6004,x
+      beq   passed
+      inx
+      bne   pass
+passed:
+      lda   #0
+      sta   $6000
+done: jmp   done
+
+fail: ldx   #0
+fl:   lda   msg_fail,x
+      sta   $6004,x
+      beq   failed
+      inx
+      bne   fl
+failed:
+      lda   #1
+      sta   $6000
+done2:jmp   done2
+
+nmi:  rti
+
+msg_pass:
+      .byte $0a,"stack_code",$0a,$0a,"Passed",$0a,0
+msg_fail:
+      .byte $0a,"stack_code",$0a,$0a,"Stale code run from the stack page"
+      .byte $0a,$0a,"Failed",$0a,0
+
+      .org  $FFFA
+      .word nmi, reset, nmi
@@ -0,0 +1,830 @@
+/* SPDX-License-Identifier: MIT */
+
+/*! @file nesaot.c
+ * Ahead-of-time compiler for the PRG code of a ROM, see rp2a03aot.h
+ *
+ * Usage: nesaot [-c file.cdl] [-o dir] rom.nes
+ *
+ * Follows the code of the PRG banks mapped at power on from the NMI, reset and
+ * IRQ vectors, plus every run of code in an FCEUX code/data log, and writes
+ * dir/<hash>.c (dir defaults to aot). Build it with make dir/<hash>.so and run
+ * the emulator with -a dir.
+ *
+ * Blocks are cut exactly like rp2a03.c cuts them. Jumps into the switchable
+ * $8000 bank of MMC1 can't be followed without knowing the bank, so that code
+ * is only found through the code/data log.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cpu.h>
+
+#include "rp2a03op.h"
+#include "rp2a03aot.h"
+
+// clang-format off
+enum aot_kind
+{
+    K_NONE,
+    K_ADC, K_AND, K_ASL, K_BCC, K_BCS, K_BEQ, K_BIT, K_BMI, K_BNE, K_BPL,
+    K_BVC, K_BVS, K_CLC, K_CLD, K_CLI, K_CLV, K_CMP, K_CPX, K_CPY, K_DEC,
+    K_DEX, K_DEY, K_EOR, K_INC, K_INX, K_INY, K_JMP, K_JSR, K_LDA, K_LDX,
+    K_LDY, K_LSR, K_NOP, K_ORA, K_PHA, K_PHP, K_PLA, K_PLP, K_ROL, K_ROR,
+    K_RTS, K_SBC, K_SEC, K_SED, K_SEI, K_STA, K_STX, K_STY, K_TAX, K_TAY,
+    K_TSX, K_TXA, K_TXS, K_TYA
+};
+
+static const char *const aot_names[] = {
+    "???",
+    "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL",
+    "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX", "CPY", "DEC",
+    "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA", "LDX",
+    "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL", "ROR",
+    "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "TAX", "TAY",
+    "TSX", "TXA", "TXS", "TYA",
+};
+
+enum aot_mode
+{
+    M_IMP, M_ACC, M_IMM, M_REL, M_ZP, M_ZPX, M_ZPY, M_ABS, M_ABX, M_ABXP,
+    M_ABY, M_ABYP, M_IZX, M_IZY, M_IZYP
+};
+
+/*
+ * Official opcodes only, BRK, RTI and JMP () are left to the interpreter like
+ * in rp2a03jit.c
+ */
+static const struct
+{
+    u8 kind;
+    u8 mode;
+} aot_ops[256] = {
+    [0x69] = {K_ADC, M_IMM}, [0x65] = {K_ADC, M_ZP},   [0x75] = {K_ADC, M_ZPX},
+    [0x6D] = {K_ADC, M_ABS}, [0x7D] = {K_ADC, M_ABXP}, [0x79] = {K_ADC, M_ABYP},
+    [0x61] = {K_ADC, M_IZX}, [0x71] = {K_ADC, M_IZYP},
+    [0x29] = {K_AND, M_IMM}, [0x25] = {K_AND, M_ZP},   [0x35] = {K_AND, M_ZPX},
+    [0x2D] = {K_AND, M_ABS}, [0x3D] = {K_AND, M_ABXP}, [0x39] = {K_AND, M_ABYP},
+    [0x21] = {K_AND, M_IZX}, [0x31] = {K_AND, M_IZYP},
+    [0x0A] = {K_ASL, M_ACC}, [0x06] = {K_ASL, M_ZP},   [0x16] = {K_ASL, M_ZPX},
+    [0x0E] = {K_ASL, M_ABS}, [0x1E] = {K_ASL, M_ABX},
+    [0x90] = {K_BCC, M_REL}, [0xB0] = {K_BCS, M_REL}, [0xF0] = {K_BEQ, M_REL},
+    [0x30] = {K_BMI, M_REL}, [0xD0] = {K_BNE, M_REL}, [0x10] = {K_BPL, M_REL},
+    [0x50] = {K_BVC, M_REL}, [0x70] = {K_BVS, M_REL},
+    [0x24] = {K_BIT, M_ZP},  [0x2C] = {K_BIT, M_ABS},
+    [0x18] = {K_CLC, M_IMP}, [0xD8] = {K_CLD, M_IMP}, [0x58] = {K_CLI, M_IMP},
+    [0xB8] = {K_CLV, M_IMP}, [0x38] = {K_SEC, M_IMP}, [0xF8] = {K_SED, M_IMP},
+    [0x78] = {K_SEI, M_IMP},
+    [0xC9] = {K_CMP, M_IMM}, [0xC5] = {K_CMP, M_ZP},   [0xD5] = {K_CMP, M_ZPX},
+    [0xCD] = {K_CMP, M_ABS}, [0xDD] = {K_CMP, M_ABXP}, [0xD9] = {K_CMP, M_ABYP},
+    [0xC1] = {K_CMP, M_IZX}, [0xD1] = {K_CMP, M_IZYP},
+    [0xE0] = {K_CPX, M_IMM}, [0xE4] = {K_CPX, M_ZP},  [0xEC] = {K_CPX, M_ABS},
+    [0xC0] = {K_CPY, M_IMM}, [0xC4] = {K_CPY, M_ZP},  [0xCC] = {K_CPY, M_ABS},
+    [0xC6] = {K_DEC, M_ZP},  [0xD6] = {K_DEC, M_ZPX}, [0xCE] = {K_DEC, M_ABS},
+    [0xDE] = {K_DEC, M_ABX},
+    [0xCA] = {K_DEX, M_IMP}, [0x88] = {K_DEY, M_IMP},
+    [0x49] = {K_EOR, M_IMM}, [0x45] = {K_EOR, M_ZP},   [0x55] = {K_EOR, M_ZPX},
+    [0x4D] = {K_EOR, M_ABS}, [0x5D] = {K_EOR, M_ABXP}, [0x59] = {K_EOR, M_ABYP},
+    [0x41] = {K_EOR, M_IZX}, [0x51] = {K_EOR, M_IZYP},
+    [0xE6] = {K_INC, M_ZP},  [0xF6] = {K_INC, M_ZPX}, [0xEE] = {K_INC, M_ABS},
+    [0xFE] = {K_INC, M_ABX},
+    [0xE8] = {K_INX, M_IMP}, [0xC8] = {K_INY, M_IMP},
+    [0x4C] = {K_JMP, M_ABS}, [0x20] = {K_JSR, M_ABS},
+    [0xA9] = {K_LDA, M_IMM}, [0xA5] = {K_LDA, M_ZP},   [0xB5] = {K_LDA, M_ZPX},
+    [0xAD] = {K_LDA, M_ABS}, [0xBD] = {K_LDA, M_ABXP}, [0xB9] = {K_LDA, M_ABYP},
+    [0xA1] = {K_LDA, M_IZX}, [0xB1] = {K_LDA, M_IZYP},
+    [0xA2] = {K_LDX, M_IMM}, [0xA6] = {K_LDX, M_ZP},   [0xB6] = {K_LDX, M_ZPY},
+    [0xAE] = {K_LDX, M_ABS}, [0xBE] = {K_LDX, M_ABYP},
+    [0xA0] = {K_LDY, M_IMM}, [0xA4] = {K_LDY, M_ZP},   [0xB4] = {K_LDY, M_ZPX},
+    [0xAC] = {K_LDY, M_ABS}, [0xBC] = {K_LDY, M_ABXP},
+    [0x4A] = {K_LSR, M_ACC}, [0x46] = {K_LSR, M_ZP},  [0x56] = {K_LSR, M_ZPX},
+    [0x4E] = {K_LSR, M_ABS}, [0x5E] = {K_LSR, M_ABX},
+    [0xEA] = {K_NOP, M_IMP},
+    [0x09] = {K_ORA, M_IMM}, [0x05] = {K_ORA, M_ZP},   [0x15] = {K_ORA, M_ZPX},
+    [0x0D] = {K_ORA, M_ABS}, [0x1D] = {K_ORA, M_ABXP}, [0x19] = {K_ORA, M_ABYP},
+    [0x01] = {K_ORA, M_IZX}, [0x11] = {K_ORA, M_IZYP},
+    [0x48] = {K_PHA, M_IMP}, [0x08] = {K_PHP, M_IMP}, [0x68] = {K_PLA, M_IMP},
+    [0x28] = {K_PLP, M_IMP},
+    [0x2A] = {K_ROL, M_ACC}, [0x26] = {K_ROL, M_ZP},  [0x36] = {K_ROL, M_ZPX},
+    [0x2E] = {K_ROL, M_ABS}, [0x3E] = {K_ROL, M_ABX},
+    [0x6A] = {K_ROR, M_ACC}, [0x66] = {K_ROR, M_ZP},  [0x76] = {K_ROR, M_ZPX},
+    [0x6E] = {K_ROR, M_ABS}, [0x7E] = {K_ROR, M_ABX},
+    [0x60] = {K_RTS, M_IMP},
+    [0xE9] = {K_SBC, M_IMM}, [0xE5] = {K_SBC, M_ZP},   [0xF5] = {K_SBC, M_ZPX},
+    [0xED] = {K_SBC, M_ABS}, [0xFD] = {K_SBC, M_ABXP}, [0xF9] = {K_SBC, M_ABYP},
+    [0xE1] = {K_SBC, M_IZX}, [0xF1] = {K_SBC, M_IZYP},
+    [0x85] = {K_STA, M_ZP},  [0x95] = {K_STA, M_ZPX}, [0x8D] = {K_STA, M_ABS},
+    [0x9D] = {K_STA, M_ABX}, [0x99] = {K_STA, M_ABY}, [0x81] = {K_STA, M_IZX},
+    [0x91] = {K_STA, M_IZY},
+    [0x86] = {K_STX, M_ZP},  [0x96] = {K_STX, M_ZPY}, [0x8E] = {K_STX, M_ABS},
+    [0x84] = {K_STY, M_ZP},  [0x94] = {K_STY, M_ZPX}, [0x8C] = {K_STY, M_ABS},
+    [0xAA] = {K_TAX, M_IMP}, [0xA8] = {K_TAY, M_IMP}, [0xBA] = {K_TSX, M_IMP},
+    [0x8A] = {K_TXA, M_IMP}, [0x9A] = {K_TXS, M_IMP}, [0x98] = {K_TYA, M_IMP},
+};
+// clang-format on
+
+#define AOT_WORK_MAX 0x10000 //!< Pending block starts
+
+/*!
+ * @struct aot
+ * The ROM being compiled and what has been found in it so far
+ */
+struct aot
+{
+    u8    *prg;
+    size_t sprg;
+    u8     mapper;
+
+    u8 *seen; //!< Per PRG byte, bit 0/1 for a block at $8000/$C000
+
+    struct
+    {
+        u32 prg;
+        u16 pc;
+    } work[AOT_WORK_MAX];
+    int nwork;
+
+    struct
+    {
+        u32 prg;
+        u16 pc;
+        u8  cycles;
+    } *blocks;
+    int nblocks;
+    int cblocks;
+
+    FILE  *out;
+    FILE  *fn;     //!< The function being written
+    char  *fn_buf;
+    size_t fn_len;
+};
+
+/*
+ * Queues the block at pc, where pc is seen from the block at (prg, from). The
+ * $C000 bank is fixed at power on; which bank is at $8000 is only known for
+ * NROM
+ */
+static void
+aot_follow(struct aot *a, u32 prg, u16 from, u16 pc)
+{
+    long at;
+
+    if (pc < 0x8000)
+    {
+        return; // RAM or PRG-RAM, never compiled
+    }
+
+    if (((pc ^ from) & 0xC000) == 0) at = (long)prg - from + pc;
+    else if (pc >= 0xC000) at = a->sprg - 0x4000 + (pc & 0x3FFF);
+    else if (a->mapper == 0) at = pc & 0x3FFF;
+    else return;
+
+    if (at < 0 || at >= (long)a->sprg || a->nwork == AOT_WORK_MAX)
+    {
+        return;
+    }
+
+    a->work[a->nwork].prg = at;
+    a->work[a->nwork].pc  = pc;
+    a->nwork += 1;
+}
+
+/*
+ * Emits the address calculation for an operand into addr. Returns 0 for RAM,
+ * 1 for memory that goes through the page tables, and -1 for a constant
+ * address in I/O space
+ */
+static int
+aot_addr(struct aot *a, u8 mode, u16 arg)
+{
+    FILE *o = a->fn;
+
+    switch (mode)
+    {
+        case M_ZP:
+            fprintf(o, "    addr = 0x%02X;\n", arg);
+            return 0;
+        case M_ZPX:
+            fprintf(o, "    addr = (u8)(0x%02X + c->X);\n", arg);
+            return 0;
+        case M_ZPY:
+            fprintf(o, "    addr = (u8)(0x%02X + c->Y);\n", arg);
+            return 0;
+        case M_ABS:
+            if (arg >= 0x2000 && arg < 0x6000)
+            {
+                return -1;
+            }
+            if (arg < 0x2000)
+            {
+                fprintf(o, "    addr = 0x%04X;\n", arg & 0x07FF);
+                return 0;
+            }
+            fprintf(o, "    addr = 0x%04X;\n", arg);
+            return 1;
+        case M_ABX:
+        case M_ABXP:
+            fprintf(o, "    addr = 0x%04X + c->X;\n", arg);
+            return 1;
+        case M_ABY:
+        case M_ABYP:
+            fprintf(o, "    addr = 0x%04X + c->Y;\n", arg);
+            return 1;
+        case M_IZX:
+            fprintf(o, "    v    = 0x%02X + c->X;\n", arg);
+            fprintf(o, "    addr = c->ram[v] | c->ram[(u8)(v + 1)] << 8;\n");
+            return 1;
+        case M_IZY:
+        case M_IZYP:
+            fprintf(o, "    base = c->ram[0x%02X] | c->ram[0x%02X] << 8;\n",
+                    arg, (u8)(arg + 1));
+            fprintf(o, "    addr = base + c->Y;\n");
+            return 1;
+    }
+
+    return -1;
+}
+
+/*
+ * Emits one instruction. Returns 0 if it has to be left to the interpreter,
+ * in which case nothing has been written
+ */
+static int
+aot_insn(struct aot *a, const struct rp2a03_insn *d, u8 *cycles)
+{
+    FILE *o    = a->fn;
+    u8    kind = aot_ops[d->op].kind;
+    u8    mode = aot_ops[d->op].mode;
+    u16   next = d->pc + d->len;
+    int   cls  = 0;
+
+    static const char *const regs[] = {
+        [K_LDA] = "A", [K_LDX] = "X", [K_LDY] = "Y", [K_STA] = "A",
+        [K_STX] = "X", [K_STY] = "Y", [K_CMP] = "A", [K_CPX] = "X",
+        [K_CPY] = "Y", [K_INX] = "X", [K_INY] = "Y", [K_DEX] = "X",
+        [K_DEY] = "Y",
+    };
+
+    static const char *const alu[] = {
+        [K_ASL] = "rp2a03_asl", [K_LSR] = "rp2a03_lsr", [K_ROL] = "rp2a03_rol",
+        [K_ROR] = "rp2a03_ror", [K_INC] = "rp2a03_inc", [K_DEC] = "rp2a03_dec",
+    };
+
+    if (kind == K_NONE)
+    {
+        return 0;
+    }
+
+    // constant I/O addresses can't be compiled, check before writing anything
+    if (mode == M_ABS && kind != K_JMP && kind != K_JSR && d->arg >= 0x2000 &&
+        d->arg < 0x6000)
+    {
+        return 0;
+    }
+
+    const char *mem = "c->ram[addr]";
+    if (mode >= M_ZP && kind != K_JMP && kind != K_JSR)
+    {
+        cls = aot_addr(a, mode, d->arg);
+        if (cls) mem = "p[addr & 0x07FF]";
+    }
+
+    u8 rd = 0, wr = 0;
+    switch (kind)
+    {
+        case K_STA:
+        case K_STX:
+        case K_STY:
+            wr = 1;
+            break;
+        case K_ASL:
+        case K_LSR:
+        case K_ROL:
+        case K_ROR:
+        case K_INC:
+        case K_DEC:
+            rd = mode != M_ACC;
+            wr = mode != M_ACC;
+            break;
+        case K_ADC:
+        case K_AND:
+        case K_BIT:
+        case K_CMP:
+        case K_CPX:
+        case K_CPY:
+        case K_EOR:
+        case K_LDA:
+        case K_LDX:
+        case K_LDY:
+        case K_ORA:
+        case K_SBC:
+            rd = 1;
+            break;
+    }
+
+    if (rd && mode == M_IMM) fprintf(o, "    v = 0x%02X;\n", d->arg);
+    else if (rd && cls) fprintf(o, "    AOT_RD(0x%04X);\n", d->pc);
+    else if (rd) fprintf(o, "    v = c->ram[addr];\n");
+
+    if (wr && cls) fprintf(o, "    AOT_WR(0x%04X);\n", d->pc);
+    else if (wr) fprintf(o, "    AOT_RAMWR(0x%04X);\n", d->pc);
+
+    switch (kind)
+    {
+        case K_LDA:
+        case K_LDX:
+        case K_LDY:
+            fprintf(o, "    c->%s = v;\n", regs[kind]);
+            fprintf(o, "    rp2a03_setnz(c, v);\n");
+            break;
+        case K_STA:
+        case K_STX:
+        case K_STY:
+            fprintf(o, "    %s = c->%s;\n", mem, regs[kind]);
+            break;
+        case K_ORA:
+            fprintf(o, "    c->A |= v;\n    rp2a03_setnz(c, c->A);\n");
+            break;
+        case K_AND:
+            fprintf(o, "    c->A &= v;\n    rp2a03_setnz(c, c->A);\n");
+            break;
+        case K_EOR:
+            fprintf(o, "    c->A ^= v;\n    rp2a03_setnz(c, c->A);\n");
+            break;
+        case K_ADC:
+            fprintf(o, "    rp2a03_adc(c, v);\n");
+            break;
+        case K_SBC:
+            fprintf(o, "    rp2a03_adc(c, ~v);\n");
+            break;
+        case K_CMP:
+        case K_CPX:
+        case K_CPY:
+            fprintf(o, "    rp2a03_cmp(c, c->%s, v);\n", regs[kind]);
+            break;
+        case K_BIT:
+            fprintf(o, "    c->P = (c->P & 0x3D) | (v & 0xC0) | "
+                       "((c->A & v) ? 0 : RP2A03_Z);\n");
+            break;
+        case K_ASL:
+        case K_LSR:
+        case K_ROL:
+        case K_ROR:
+        case K_INC:
+        case K_DEC:
+            if (mode == M_ACC)
+            {
+                fprintf(o, "    c->A = %s(c, c->A);\n", alu[kind]);
+            }
+            else
+            {
+                fprintf(o, "    %s = %s(c, v);\n", mem, alu[kind]);
+            }
+            break;
+        case K_INX:
+        case K_INY:
+            fprintf(o, "    c->%s = rp2a03_inc(c, c->%s);\n", regs[kind],
+                    regs[kind]);
+            break;
+        case K_DEX:
+        case K_DEY:
+            fprintf(o, "    c->%s = rp2a03_dec(c, c->%s);\n", regs[kind],
+                    regs[kind]);
+            break;
+        case K_TAX: fprintf(o, "    c->X = c->A;\n"); break;
+        case K_TAY: fprintf(o, "    c->Y = c->A;\n"); break;
+        case K_TSX: fprintf(o, "    c->X = c->SP;\n"); break;
+        case K_TXA: fprintf(o, "    c->A = c->X;\n"); break;
+        case K_TYA: fprintf(o, "    c->A = c->Y;\n"); break;
+        case K_TXS: fprintf(o, "    c->SP = c->X;\n"); break;
+        case K_CLC: fprintf(o, "    c->P &= ~RP2A03_C;\n"); break;
+        case K_CLD: fprintf(o, "    c->P &= ~RP2A03_D;\n"); break;
+        case K_CLI: fprintf(o, "    c->P &= ~RP2A03_I;\n"); break;
+        case K_CLV: fprintf(o, "    c->P &= ~RP2A03_V;\n"); break;
+        case K_SEC: fprintf(o, "    c->P |= RP2A03_C;\n"); break;
+        case K_SED: fprintf(o, "    c->P |= RP2A03_D;\n"); break;
+        case K_SEI: fprintf(o, "    c->P |= RP2A03_I;\n"); break;
+        case K_NOP: break;
+        case K_PHA:
+            fprintf(o, "    AOT_RAMWR(0x%04X);\n", d->pc);
+            fprintf(o, "    AOT_PUSH(c->A);\n");
+            break;
+        case K_PHP:
+            fprintf(o, "    AOT_RAMWR(0x%04X);\n", d->pc);
+            fprintf(o, "    AOT_PUSH(c->P | RP2A03_B | RP2A03_U);\n");
+            break;
+        case K_PLA:
+            fprintf(o, "    c->A = AOT_PULL();\n");
+            fprintf(o, "    rp2a03_setnz(c, c->A);\n");
+            break;
+        case K_PLP:
+            fprintf(o, "    c->P = (AOT_PULL() & ~RP2A03_B) | RP2A03_U;\n");
+            break;
+        case K_JSR:
+            fprintf(o, "    AOT_RAMWR(0x%04X);\n", d->pc);
+            fprintf(o, "    AOT_PUSH(0x%02X);\n", (u16)(d->pc + 2) >> 8);
+            fprintf(o, "    AOT_PUSH(0x%02X);\n", (u8)(d->pc + 2));
+            fprintf(o, "    cyc += %d;\n", d->cycles);
+            fprintf(o, "    AOT_EXIT(0x%04X);\n", d->arg);
+            break;
+        case K_RTS:
+            fprintf(o, "    addr = AOT_PULL();\n");
+            fprintf(o, "    addr |= AOT_PULL() << 8;\n");
+            fprintf(o, "    cyc += %d;\n", d->cycles);
+            fprintf(o, "    AOT_EXIT(addr + 1);\n");
+            break;
+        case K_JMP:
+            fprintf(o, "    cyc += %d;\n", d->cycles);
+            fprintf(o, "    AOT_EXIT(0x%04X);\n", d->arg);
+            break;
+        default: // branches
+        {
+            static const char *const cond[] = {
+                [K_BPL] = "!(c->P & RP2A03_N)", [K_BMI] = "c->P & RP2A03_N",
+                [K_BVC] = "!(c->P & RP2A03_V)", [K_BVS] = "c->P & RP2A03_V",
+                [K_BCC] = "!(c->P & RP2A03_C)", [K_BCS] = "c->P & RP2A03_C",
+                [K_BNE] = "!(c->P & RP2A03_Z)", [K_BEQ] = "c->P & RP2A03_Z",
+            };
+
+            u16 to = next + (int8_t)d->arg;
+
+            fprintf(o, "    if (%s)\n    {\n", cond[kind]);
+            fprintf(o, "        cyc += %d;\n",
+                    d->cycles + (((next ^ to) & 0xFF00) ? 2 : 1));
+            fprintf(o, "        AOT_EXIT(0x%04X);\n    }\n", to);
+            fprintf(o, "    cyc += %d;\n", d->cycles);
+            fprintf(o, "    AOT_EXIT(0x%04X);\n", next);
+            *cycles += d->cycles + 2;
+            return 1;
+        }
+    }
+
+    switch (kind)
+    {
+        case K_LDA:
+        case K_LDX:
+        case K_LDY:
+        case K_INX:
+        case K_INY:
+        case K_DEX:
+        case K_DEY:
+        case K_JSR:
+        case K_RTS:
+        case K_JMP:
+            break;
+        case K_TAX:
+        case K_TSX:
+            fprintf(o, "    rp2a03_setnz(c, c->X);\n");
+            break;
+        case K_TAY:
+            fprintf(o, "    rp2a03_setnz(c, c->Y);\n");
+            break;
+        case K_TXA:
+        case K_TYA:
+            fprintf(o, "    rp2a03_setnz(c, c->A);\n");
+            break;
+    }
+
+    *cycles += d->cycles;
+    if (kind == K_JSR || kind == K_RTS || kind == K_JMP)
+    {
+        return 1;
+    }
+
+    if (mode == M_ABXP || mode == M_ABYP)
+    {
+        fprintf(o, "    cyc += %d + AOT_CROSSED(0x%04X, addr);\n", d->cycles,
+                d->arg);
+        *cycles += 1;
+    }
+    else if (mode == M_IZYP)
+    {
+        fprintf(o, "    cyc += %d + AOT_CROSSED(base, addr);\n", d->cycles);
+        *cycles += 1;
+    }
+    else
+    {
+        fprintf(o, "    cyc += %d;\n", d->cycles);
+    }
+
+    return 1;
+}
+
+/*
+ * Decodes the block at (prg, pc) the way rp2a03_decode() does, emits it and
+ * queues the blocks it can continue to
+ */
+static void
+aot_block(struct aot *a, u32 prg, u16 pc)
+{
+    struct rp2a03_insn insns[RP2A03_BLOCK_MAX];
+
+    u16 off = pc & 0x07FF;
+    u16 at  = off;
+    int n   = 0;
+
+    while (n < RP2A03_BLOCK_MAX)
+    {
+        u32 src = prg + (at - off);
+        u8  op  = a->prg[src];
+        u8  len = rp2a03_lengths[op];
+
+        if (at + len > 0x800 || src + len > a->sprg)
+        {
+            break;
+        }
+
+        struct rp2a03_insn *d = &insns[n++];
+
+        d->pc     = pc + (at - off);
+        d->op     = op;
+        d->len    = len;
+        d->cycles = rp2a03_cycles[op];
+        d->arg    = len > 1 ? a->prg[src + 1] : 0;
+        if (len > 2) d->arg |= a->prg[src + 2] << 8;
+
+        at += len;
+
+        if (rp2a03_ends_block(op))
+        {
+            break;
+        }
+    }
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    // where the block can go next
+    const struct rp2a03_insn *e = &insns[n - 1];
+
+    u16 next = e->pc + e->len;
+    u8  kind = aot_ops[e->op].kind;
+
+    if (kind == K_JMP)
+    {
+        aot_follow(a, prg, pc, e->arg);
+    }
+    else if (kind == K_JSR)
+    {
+        aot_follow(a, prg, pc, e->arg);
+        aot_follow(a, prg, pc, next);
+    }
+    else if (aot_ops[e->op].mode == M_REL)
+    {
+        aot_follow(a, prg, pc, next + (int8_t)e->arg);
+        aot_follow(a, prg, pc, next);
+    }
+    else if (!rp2a03_ends_block(e->op))
+    {
+        aot_follow(a, prg, pc, next); // ran into the page end or the limit
+    }
+
+    // the code itself, up to the first instruction the interpreter has to run
+    FILE *o      = open_memstream(&a->fn_buf, &a->fn_len);
+    u8    cycles = 0;
+
+    a->fn = o;
+
+    fprintf(o, "static void\nb_%05X_%04X(struct rp2a03 *c)\n{\n", prg, pc);
+    fprintf(o, "    u64 cyc = c->cycles;\n");
+    fprintf(o, "    u16 addr, base;\n");
+    fprintf(o, "    u8 *p, v;\n");
+
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        const struct rp2a03_insn *d = &insns[i];
+
+        fprintf(o, "\n    // %04X: %s\n", d->pc,
+                aot_names[aot_ops[d->op].kind]);
+        if (!aot_insn(a, d, &cycles))
+        {
+            break;
+        }
+    }
+
+    if (i == 0)
+    {
+        // nothing to compile, throw the function away
+        fclose(o);
+        free(a->fn_buf);
+        return;
+    }
+
+    if (i < n)
+    {
+        fprintf(o, "    AOT_EXIT(0x%04X);\n}\n\n", insns[i].pc);
+    }
+    else if (!rp2a03_ends_block(e->op))
+    {
+        fprintf(o, "\n    AOT_EXIT(0x%04X);\n}\n\n", next);
+    }
+    else
+    {
+        fprintf(o, "}\n\n");
+    }
+
+    fclose(o);
+    fwrite(a->fn_buf, 1, a->fn_len, a->out);
+    free(a->fn_buf);
+
+    if (a->nblocks == a->cblocks)
+    {
+        a->cblocks = a->cblocks ? a->cblocks * 2 : 256;
+        a->blocks  = realloc(a->blocks, a->cblocks * sizeof(*a->blocks));
+    }
+
+    a->blocks[a->nblocks].prg    = prg;
+    a->blocks[a->nblocks].pc     = pc;
+    a->blocks[a->nblocks].cycles = cycles;
+    a->nblocks += 1;
+}
+
+static int
+aot_cmp(const void *x, const void *y)
+{
+    const struct
+    {
+        u32 prg;
+        u16 pc;
+        u8  cycles;
+    } *l = x, *r = y;
+
+    if (l->prg != r->prg) return l->prg < r->prg ? -1 : 1;
+    return (l->pc > r->pc) - (l->pc < r->pc);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c file.cdl] [-o dir] <rom.nes>\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *cdl = NULL;
+    const char *dir = "aot";
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "c:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                cdl = optarg;
+                break;
+            case 'o':
+                dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    u8 header[16];
+    if (fread(header, 16, 1, file) != 1 || memcmp(header, "NES\x1A", 4))
+    {
+        fprintf(stderr, "%s: not an iNES file\n", argv[optind]);
+        return 1;
+    }
+
+    if (header[6] & 0x04)
+    {
+        fseek(file, 512, SEEK_CUR); // skip trainer
+    }
+
+    struct aot *a = calloc(1, sizeof(struct aot));
+
+    size_t schr = header[5] * 0x2000;
+    a->sprg     = header[4] * 0x4000;
+    a->mapper   = (header[7] & 0xF0) | (header[6] >> 4);
+    a->prg      = malloc(a->sprg);
+    a->seen     = calloc(a->sprg, 1);
+
+    u8 *chr = malloc(schr ? schr : 1);
+    if (!a->sprg || fread(a->prg, a->sprg, 1, file) != 1 ||
+        (schr && fread(chr, schr, 1, file) != 1))
+    {
+        fprintf(stderr, "%s: truncated ROM\n", argv[optind]);
+        return 1;
+    }
+    fclose(file);
+
+    if (a->mapper > 1)
+    {
+        fprintf(stderr, "warning: mapper %d, only the vectors' bank and the "
+                        "code/data log are used\n", a->mapper);
+    }
+
+    u64 hash = rp2a03_aot_hash(a->prg, a->sprg, chr, schr);
+
+    // vectors, from the last bank
+    for (int i = 0; i < 3; i++)
+    {
+        u8 *v = &a->prg[a->sprg - 6 + i * 2];
+        aot_follow(a, a->sprg - 6 + i * 2, 0xFFFA + i * 2, v[0] | v[1] << 8);
+    }
+
+    // runs of code from the code/data log. Bits 2-3 of each byte say which
+    // 8KB of $8000-$FFFF it was run from
+    if (cdl)
+    {
+        FILE *f   = fopen(cdl, "rb");
+        u8   *log = calloc(a->sprg, 1);
+
+        if (f == NULL || fread(log, a->sprg, 1, f) != 1)
+        {
+            fprintf(stderr, "%s: can't read %zu bytes of PRG log\n", cdl,
+                    a->sprg);
+            return 1;
+        }
+        fclose(f);
+
+        for (size_t i = 0; i < a->sprg; i++)
+        {
+            if ((log[i] & 0x01) && (i == 0 || !(log[i - 1] & 0x01)) &&
+                a->nwork < AOT_WORK_MAX)
+            {
+                a->work[a->nwork].prg = i;
+                a->work[a->nwork].pc =
+                  0x8000 | ((log[i] >> 2) & 0x03) << 13 | (i & 0x1FFF);
+                a->nwork += 1;
+            }
+        }
+        free(log);
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%016llx.c", dir, (unsigned long long)hash);
+
+    a->out = fopen(path, "w");
+    if (a->out == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    fprintf(a->out, "/* Generated by nesaot from %s, do not edit */\n\n",
+            argv[optind]);
+    fprintf(a->out, "#include \"rp2a03op.h\"\n#include \"rp2a03aot.h\"\n\n");
+
+    while (a->nwork)
+    {
+        a->nwork -= 1;
+
+        u32 prg = a->work[a->nwork].prg;
+        u16 pc  = a->work[a->nwork].pc;
+        u8  bit = 1 << ((pc >> 14) & 1);
+
+        if (a->seen[prg] & bit)
+        {
+            continue;
+        }
+        a->seen[prg] |= bit;
+
+        aot_block(a, prg, pc);
+    }
+
+    qsort(a->blocks, a->nblocks, sizeof(*a->blocks), aot_cmp);
+
+    fprintf(a->out, "const u32 rp2a03_aot_abi   = RP2A03_AOT_ABI;\n");
+    fprintf(a->out, "const u32 rp2a03_aot_size  = sizeof(struct rp2a03);\n");
+    fprintf(a->out, "const u32 rp2a03_aot_count = %d;\n\n", a->nblocks);
+    fprintf(a->out, "const struct rp2a03_aot_block rp2a03_aot_blocks[] = {\n");
+    for (int i = 0; i < a->nblocks; i++)
+    {
+        fprintf(a->out, "    {0x%05X, 0x%04X, %3d, b_%05X_%04X},\n",
+                a->blocks[i].prg, a->blocks[i].pc, a->blocks[i].cycles,
+                a->blocks[i].prg, a->blocks[i].pc);
+    }
+    fprintf(a->out, "};\n");
+    fclose(a->out);
+
+    printf("%s: %d blocks, build with make %s/%016llx.so\n", path, a->nblocks,
+           dir, (unsigned long long)hash);
+
+    free(a->blocks);
+    free(a->seen);
+    free(a->prg);
+    free(chr);
+    free(a);
+    return 0;
+}
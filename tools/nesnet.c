@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: MIT */
+
+/*! @file nesnet.c
+ * Loopback test of rollback netplay
+ *
+ * Usage: nesnet [-d delay] [-f frames] [-l loss] [-p port] [-s seed] [-u]
+ *               rom.nes
+ *
+ * Plays two machines against each other over UDP on 127.0.0.1, ports port
+ * and port + 1, each on a thread of its own, for frames frames. Every packet
+ * is held back delay ms and dropped at loss percent, both ways (see
+ * netplay.h). Instead of keyboards, each side presses random buttons out of
+ * seed, changing every few frames. Both run at 60 frames per second, or as
+ * fast as they can with -u.
+ *
+ * At the end both sides wait for all inputs (see netplay_sync()), print how
+ * deep they rolled back and what re-simulating cost per frame, and are
+ * compared with a third machine that ran the same inputs without netplay.
+ * Exits with 1 if any of the three differ.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "netplay.h"
+#include "rom.h"
+#include "rp2a03.h"
+#include "rp2a03aot.h"
+#include "state.h"
+#include "util.h"
+
+#define NET_HOLD     6     //!< Frames each side holds its buttons for
+
+struct net_side
+{
+    struct nes *nes;
+    pthread_t   thread;
+    u32         player; //!< 0 or 1
+    u32         frames;
+    u32         seed;
+    u8          fast;
+};
+
+/*
+ * Buttons player holds in frame f, the same for both sides and the reference
+ */
+static u8
+net_buttons(u32 seed, u32 player, u32 f)
+{
+    u32 h = (f / NET_HOLD) * 2654435761u ^ (seed + player) * 0x9E3779B9u;
+
+    h ^= h >> 15;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+
+    return f ? h >> 24 : 0;
+}
+
+static void *
+net_side(void *in)
+{
+    struct net_side *s   = in;
+    struct nes      *nes = s->nes;
+    struct netplay  *np  = nes->netplay;
+    u64              at  = util_now_us();
+
+    while (np->frame < s->frames)
+    {
+        // sampled where the next frame starts
+        nes->btns = net_buttons(s->seed, s->player, np->frame + 1);
+        rp2a03_run(nes->core, np->next);
+        netplay_tick(np, nes);
+
+        at += NES_FRAME_US;
+        u64 now = util_now_us();
+        if (!s->fast && now < at)
+        {
+            usleep(at - now);
+        }
+    }
+
+    netplay_sync(np, nes);
+    return NULL;
+}
+
+/*
+ * Powers on a machine with the ROM in path, or exits
+ */
+static struct nes *
+net_boot(const char *path)
+{
+    struct nes *nes = rom_create();
+
+    if (!rom_load(nes, path))
+    {
+        exit(EXIT_FAILURE);
+    }
+    rp2a03_reset(nes->core);
+    return nes;
+}
+
+static u64
+net_hash(struct nes *nes)
+{
+    struct state s;
+
+    state_save(nes, &s);
+    return rp2a03_aot_hash((const u8 *)&s, sizeof(s), NULL, 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct net_side sides[2] = {0};
+    u32             delay    = 30;
+    u32             loss     = 5;
+    u32             frames   = 600;
+    u32             port     = 17000;
+    u32             seed     = 1;
+    u8              fast     = 0;
+    int             opt;
+
+    while ((opt = getopt(argc, argv, "d:f:l:p:s:u")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                delay = atoi(optarg);
+                break;
+            case 'f':
+                frames = MAX(atoi(optarg), 1);
+                break;
+            case 'l':
+                loss = MIN(atoi(optarg), 100);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            case 'u':
+                fast = 1;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-d delay] [-f frames] [-l loss] [-p port] "
+                        "[-s seed] [-u] <rom.nes>\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        fprintf(stderr, "Usage: %s <rom.nes>\n", argv[0]);
+        return 1;
+    }
+
+    for (u32 i = 0; i < 2; i++)
+    {
+        struct net_side *s = &sides[i];
+        char             spec[64];
+
+        snprintf(spec, sizeof(spec), "%u:%u:127.0.0.1:%u:%u:%u", i + 1,
+                 port + i, port + !i, delay, loss);
+
+        s->nes    = net_boot(argv[optind]);
+        s->player = i;
+        s->frames = frames;
+        s->seed   = seed;
+        s->fast   = fast;
+
+        if (!netplay_open(s->nes, spec))
+        {
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "%u frames, %u ms delay, %u%% loss\n", frames, delay,
+            loss);
+
+    u64 at = util_now_us();
+    for (u32 i = 0; i < 2; i++)
+    {
+        pthread_create(&sides[i].thread, NULL, net_side, &sides[i]);
+    }
+    for (u32 i = 0; i < 2; i++)
+    {
+        pthread_join(sides[i].thread, NULL);
+    }
+    double secs = (util_now_us() - at) / 1e6;
+
+    u64 hash[2];
+    for (u32 i = 0; i < 2; i++)
+    {
+        hash[i] = net_hash(sides[i].nes);
+        fprintf(stderr, "Player %u:\n", i + 1);
+        netplay_close(sides[i].nes);
+    }
+
+    // the same inputs, run straight through. Only the pads of the netplay
+    // are used, to drive the second controller
+    struct nes     *ref  = net_boot(argv[optind]);
+    struct netplay *np   = calloc(1, sizeof(struct netplay));
+    u64             base = ref->core->cycles;
+
+    ref->netplay = np;
+    for (u32 f = 0; f < frames; f++)
+    {
+        np->pads[0] = net_buttons(seed, 0, f);
+        np->pads[1] = net_buttons(seed, 1, f);
+        rp2a03_run(ref->core, base + (u64)(f + 1) * NES_FRAME_CYCLES);
+    }
+    ref->netplay = NULL;
+    free(np);
+
+    u64 want = net_hash(ref);
+
+    printf("%.2f s, player 1 %016llx, player 2 %016llx, plain run %016llx: "
+           "%s\n",
+           secs, (unsigned long long)hash[0], (unsigned long long)hash[1],
+           (unsigned long long)want,
+           hash[0] == want && hash[1] == want ? "in sync" : "DESYNC");
+
+    return hash[0] != want || hash[1] != want;
+}
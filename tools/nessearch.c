@@ -0,0 +1,604 @@
+/* SPDX-License-Identifier: MIT */
+
+/*! @file nessearch.c
+ * Parallel search for inputs that make a RAM predicate true
+ *
+ * Usage: nessearch [-b sets] [-d depth] [-f frames] [-j jobs] [-n count]
+ *                  [-s file.state] [-w frames] -p predicate... rom.nes
+ *
+ * Starts from power on after -w frames of no input, or from a state saved
+ * with F5 (-s), and tries every sequence of up to depth steps, each holding
+ * one of the button sets of -b for frames frames. A step that leaves CPU RAM
+ * the same as some step before it (by hash) goes no further, and neither does
+ * one that makes all predicates true. The first count of those are printed
+ * at the end, shortest first.
+ *
+ * A predicate compares a byte of CPU RAM, $0000-$07FF, with its value in the
+ * starting state or with a constant, both in hex:
+ *
+ *     0086+    increased       0086-    decreased      0086!    changed
+ *     0086=1F  equal to        0086>1F  greater than   0086<1F  less than
+ *
+ * Button sets are letters out of ABSTUDLR (T is start, S select), separated
+ * by commas, with . for no buttons. The default is .,R,L,A,B,AR,BR.
+ *
+ * Each worker thread runs a machine of its own with the PPU hidden (see
+ * ppu_set_hidden()), no SDL and no window. Nodes of the search are save
+ * states (see state.h) in one deque per worker. Workers take their own newest
+ * node, which keeps the search depth first and small, and steal the oldest
+ * node of another worker when they run out, which is the biggest subtree it
+ * has. Progress goes to stderr once a second, with the frames emulated per
+ * second over all workers.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ppu.h"
+#include "rom.h"
+#include "rp2a03.h"
+#include "rp2a03aot.h"
+#include "state.h"
+#include "util.h"
+
+#define SEARCH_DEPTH   32 //!< Most steps in a sequence
+#define SEARCH_SETS    16 //!< Most button sets
+#define SEARCH_PREDS   8
+#define SEARCH_MATCHES 4096
+#define SEARCH_SEEN    (1 << 22) //!< Slots of the visited set, 32MB
+#define SEARCH_PROBES  64
+
+struct search_pred
+{
+    u16  addr;
+    char op;
+    u8   value;
+};
+
+struct search_node
+{
+    struct state state;
+    u8           depth;
+    u8           path[SEARCH_DEPTH]; //!< Button set of each step
+};
+
+struct search_match
+{
+    u8 depth;
+    u8 value; //!< Byte of the first predicate, for ties
+    u8 path[SEARCH_DEPTH];
+};
+
+/*
+ * Ring of nodes, oldest at head. The owner pushes and pops the newest end,
+ * thieves take from the oldest
+ */
+struct search_deque
+{
+    pthread_mutex_t      lock;
+    struct search_node **nodes;
+    u32                  cap;
+    u32                  head;
+    u32                  count;
+};
+
+struct search_worker
+{
+    struct search      *s;
+    struct nes         *nes;
+    struct search_deque q;
+    pthread_t           thread;
+    u32                 id;
+
+    u64 frames; //!< Emulated, read by the progress report
+    u64 nodes;  //!< Steps run
+    u64 dups;   //!< Steps that led to RAM seen before
+};
+
+struct search
+{
+    const char *rom;
+    u8          sets[SEARCH_SETS];
+    const char *names[SEARCH_SETS];
+    u32         nsets;
+    u32         depth;
+    u32         frames;
+
+    struct search_pred preds[SEARCH_PREDS];
+    u32                npreds;
+    u8                 start[0x800]; //!< RAM of the starting state
+
+    u64 *seen;    //!< Open addressing set of RAM hashes, 0 is free
+    u64  pending; //!< Nodes pushed and not expanded yet
+
+    struct search_worker *workers;
+    u32                   jobs;
+
+    pthread_mutex_t     lock; //!< Over matches
+    struct search_match matches[SEARCH_MATCHES];
+    u32                 nmatches;
+};
+
+static int
+search_parse_pred(const char *arg, struct search_pred *p)
+{
+    char *end;
+
+    if (*arg == '$') arg++;
+    unsigned long addr = strtoul(arg, &end, 16);
+    if (end == arg || addr > 0x7FF || !strchr("+-!=<>", *end) || !*end)
+    {
+        return 0;
+    }
+
+    p->addr  = addr;
+    p->op    = *end;
+    p->value = 0;
+
+    if (strchr("=<>", p->op))
+    {
+        const char *v = end + 1;
+        unsigned long value = strtoul(v, &end, 16);
+        if (end == v || *end || value > 0xFF)
+        {
+            return 0;
+        }
+        p->value = value;
+    }
+    else if (end[1])
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int
+search_parse_sets(struct search *s, char *arg)
+{
+    static const char letters[] = "ABSTUDLR";
+    static const u8   btn[]     = {
+        NES_BTN_A,  NES_BTN_B,  NES_BTN_SEL, NES_BTN_STR,
+        NES_BTN_UP, NES_BTN_DN, NES_BTN_LF,  NES_BTN_RT,
+    };
+
+    s->nsets = 0;
+    for (char *set = strtok(arg, ","); set; set = strtok(NULL, ","))
+    {
+        u8 btns = 0;
+
+        if (s->nsets == SEARCH_SETS)
+        {
+            return 0;
+        }
+        if (strcmp(set, ".") != 0)
+        {
+            for (const char *c = set; *c; c++)
+            {
+                const char *l = strchr(letters, *c);
+                if (l == NULL)
+                {
+                    return 0;
+                }
+                btns |= btn[l - letters];
+            }
+        }
+
+        s->names[s->nsets] = set;
+        s->sets[s->nsets]  = btns;
+        s->nsets += 1;
+    }
+
+    return s->nsets > 0;
+}
+
+/*
+ * Whether every predicate holds for ram
+ */
+static int
+search_test(const struct search *s, const u8 *ram)
+{
+    for (u32 i = 0; i < s->npreds; i++)
+    {
+        const struct search_pred *p = &s->preds[i];
+
+        u8 v = ram[p->addr];
+        u8 w = s->start[p->addr];
+
+        switch (p->op)
+        {
+            case '+':
+                if (v <= w) return 0;
+                break;
+            case '-':
+                if (v >= w) return 0;
+                break;
+            case '!':
+                if (v == w) return 0;
+                break;
+            case '=':
+                if (v != p->value) return 0;
+                break;
+            case '<':
+                if (v >= p->value) return 0;
+                break;
+            case '>':
+                if (v <= p->value) return 0;
+                break;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Adds h to the visited set
+ *
+ * @returns 1 if it was in there already
+ */
+static int
+search_seen(struct search *s, u64 h)
+{
+    h |= 1; // 0 is a free slot
+
+    for (u32 i = 0; i < SEARCH_PROBES; i++)
+    {
+        u64 *slot = &s->seen[(h + i) & (SEARCH_SEEN - 1)];
+        u64  cur  = __atomic_load_n(slot, __ATOMIC_RELAXED);
+
+        if (cur == 0 && __atomic_compare_exchange_n(slot, &cur, h, 0,
+                                                    __ATOMIC_RELAXED,
+                                                    __ATOMIC_RELAXED))
+        {
+            return 0;
+        }
+        if (cur == h)
+        {
+            return 1;
+        }
+    }
+
+    // too full around h, search it again rather than lose it
+    return 0;
+}
+
+static void
+search_push(struct search_deque *q, struct search_node *n)
+{
+    pthread_mutex_lock(&q->lock);
+    q->nodes[(q->head + q->count) % q->cap] = n;
+    q->count += 1;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static struct search_node *
+search_pop(struct search_deque *q, u8 oldest)
+{
+    struct search_node *n = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count && oldest)
+    {
+        n       = q->nodes[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count -= 1;
+    }
+    else if (q->count)
+    {
+        q->count -= 1;
+        n = q->nodes[(q->head + q->count) % q->cap];
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return n;
+}
+
+static void
+search_match(struct search *s, const struct search_node *n, const u8 *ram)
+{
+    pthread_mutex_lock(&s->lock);
+    if (s->nmatches < SEARCH_MATCHES)
+    {
+        struct search_match *m = &s->matches[s->nmatches++];
+
+        m->depth = n->depth;
+        m->value = ram[s->preds[0].addr];
+        memcpy(m->path, n->path, sizeof(m->path));
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Runs every button set from n and queues the steps worth going on from
+ */
+static void
+search_expand(struct search_worker *w, const struct search_node *n)
+{
+    struct search *s   = w->s;
+    struct nes    *nes = w->nes;
+    struct rp2a03 *c   = nes->core;
+
+    for (u32 i = 0; i < s->nsets; i++)
+    {
+        state_load(nes, &n->state);
+        nes->btns = s->sets[i];
+        rp2a03_run(c, c->cycles + (u64)s->frames * NES_FRAME_CYCLES);
+
+        __atomic_store_n(&w->frames, w->frames + s->frames, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->nodes, w->nodes + 1, __ATOMIC_RELAXED);
+
+        if (search_seen(s, rp2a03_aot_hash(c->ram, 0x800, NULL, 0)))
+        {
+            __atomic_store_n(&w->dups, w->dups + 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        struct search_node *m = malloc(sizeof(struct search_node));
+
+        m->depth = n->depth + 1;
+        memcpy(m->path, n->path, sizeof(m->path));
+        m->path[n->depth] = i;
+
+        if (search_test(s, c->ram))
+        {
+            search_match(s, m, c->ram);
+            free(m);
+        }
+        else if (m->depth < s->depth)
+        {
+            state_save(nes, &m->state);
+            __atomic_add_fetch(&s->pending, 1, __ATOMIC_RELAXED);
+            search_push(&w->q, m);
+        }
+        else
+        {
+            free(m);
+        }
+    }
+}
+
+static void *
+search_worker(void *in)
+{
+    struct search_worker *w = in;
+    struct search        *s = w->s;
+
+    for (;;)
+    {
+        struct search_node *n = search_pop(&w->q, 0);
+
+        for (u32 i = 1; n == NULL && i < s->jobs; i++)
+        {
+            n = search_pop(&s->workers[(w->id + i) % s->jobs].q, 1);
+        }
+
+        if (n == NULL)
+        {
+            if (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE) == 0)
+            {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        search_expand(w, n);
+        free(n);
+        __atomic_sub_fetch(&s->pending, 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+/*
+ * Frames, nodes and duplicates over all workers
+ */
+static void
+search_totals(struct search *s, u64 *frames, u64 *nodes, u64 *dups)
+{
+    *frames = *nodes = *dups = 0;
+    for (u32 i = 0; i < s->jobs; i++)
+    {
+        *frames += __atomic_load_n(&s->workers[i].frames, __ATOMIC_RELAXED);
+        *nodes += __atomic_load_n(&s->workers[i].nodes, __ATOMIC_RELAXED);
+        *dups += __atomic_load_n(&s->workers[i].dups, __ATOMIC_RELAXED);
+    }
+}
+
+static int
+search_cmp(const void *x, const void *y)
+{
+    const struct search_match *l = x, *r = y;
+
+    if (l->depth != r->depth) return l->depth - r->depth;
+    return r->value - l->value;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-b sets] [-d depth] [-f frames] [-j jobs] "
+            "[-n count] [-s file.state] [-w frames] -p predicate... "
+            "<rom.nes>\n",
+            name);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct search *s      = calloc(1, sizeof(struct search));
+    char           sets[] = ".,R,L,A,B,AR,BR";
+    const char    *state  = NULL;
+    u32            warmup = 60;
+    u32            count  = 10;
+    int            opt;
+
+    s->depth  = 8;
+    s->frames = 8;
+    s->jobs   = sysconf(_SC_NPROCESSORS_ONLN);
+    search_parse_sets(s, sets);
+
+    while ((opt = getopt(argc, argv, "b:d:f:j:n:p:s:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                if (!search_parse_sets(s, optarg))
+                {
+                    fprintf(stderr, "Bad button sets: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                s->depth = MIN(MAX(atoi(optarg), 1), SEARCH_DEPTH);
+                break;
+            case 'f':
+                s->frames = MAX(atoi(optarg), 1);
+                break;
+            case 'j':
+                s->jobs = MAX(atoi(optarg), 1);
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'p':
+                if (s->npreds == SEARCH_PREDS ||
+                    !search_parse_pred(optarg, &s->preds[s->npreds++]))
+                {
+                    fprintf(stderr, "Bad predicate: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                state = optarg;
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc || s->npreds == 0)
+    {
+        usage(argv[0]);
+    }
+    s->rom = argv[optind];
+
+    s->workers = calloc(s->jobs, sizeof(struct search_worker));
+    for (u32 i = 0; i < s->jobs; i++)
+    {
+        struct search_worker *w = &s->workers[i];
+
+        w->s   = s;
+        w->id  = i;
+        w->nes = rom_create();
+        if (!rom_load(w->nes, s->rom))
+        {
+            exit(EXIT_FAILURE);
+        }
+        rp2a03_reset(w->nes->core);
+
+        // nobody looks at the pixels
+        ppu_set_hidden(w->nes->ppu, 1);
+
+        w->q.cap   = s->depth * s->nsets + 1;
+        w->q.nodes = calloc(w->q.cap, sizeof(struct search_node *));
+        pthread_mutex_init(&w->q.lock, NULL);
+    }
+
+    // the starting state, from the first worker's machine
+    struct nes         *nes  = s->workers[0].nes;
+    struct search_node *root = calloc(1, sizeof(struct search_node));
+
+    if (state && !state_read(nes, state))
+    {
+        fprintf(stderr, "%s isn't a state of this ROM\n", state);
+        return 1;
+    }
+    if (!state)
+    {
+        rp2a03_run(nes->core, nes->core->cycles + warmup * NES_FRAME_CYCLES);
+    }
+
+    state_save(nes, &root->state);
+    memcpy(s->start, nes->core->ram, sizeof(s->start));
+
+    s->seen = calloc(SEARCH_SEEN, sizeof(u64));
+    search_seen(s, rp2a03_aot_hash(s->start, 0x800, NULL, 0));
+    pthread_mutex_init(&s->lock, NULL);
+
+    s->pending = 1;
+    search_push(&s->workers[0].q, root);
+
+    double start = util_now_ns() / 1e9;
+    for (u32 i = 0; i < s->jobs; i++)
+    {
+        pthread_create(&s->workers[i].thread, NULL, search_worker,
+                       &s->workers[i]);
+    }
+
+    u64    frames, nodes, dups;
+    double last = start;
+    u64    prev = 0;
+
+    while (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE))
+    {
+        usleep(10000);
+        if (util_now_ns() / 1e9 - last < 1.0)
+        {
+            continue;
+        }
+
+        search_totals(s, &frames, &nodes, &dups);
+        fprintf(stderr,
+                "search frames=%llu fps=%.0f nodes=%llu dups=%llu "
+                "matches=%u pending=%llu\n",
+                (unsigned long long)frames,
+                (frames - prev) / (util_now_ns() / 1e9 - last),
+                (unsigned long long)nodes, (unsigned long long)dups,
+                __atomic_load_n(&s->nmatches, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&s->pending,
+                                                    __ATOMIC_RELAXED));
+        last = util_now_ns() / 1e9;
+        prev = frames;
+    }
+
+    for (u32 i = 0; i < s->jobs; i++)
+    {
+        pthread_join(s->workers[i].thread, NULL);
+    }
+
+    double secs = util_now_ns() / 1e9 - start;
+    search_totals(s, &frames, &nodes, &dups);
+    fprintf(stderr,
+            "Searched %llu steps (%llu repeats) in %.2f s on %u threads, "
+            "%.0f frames per second\n",
+            (unsigned long long)nodes, (unsigned long long)dups, secs,
+            s->jobs, frames / secs);
+
+    qsort(s->matches, s->nmatches, sizeof(struct search_match), search_cmp);
+
+    printf("%u matches, %u frames per step\n", s->nmatches, s->frames);
+    for (u32 i = 0; i < MIN(count, s->nmatches); i++)
+    {
+        const struct search_match *m = &s->matches[i];
+
+        printf("%02X:", m->value);
+        for (u32 d = 0; d < m->depth; d++)
+        {
+            printf(" %s", s->names[m->path[d]]);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
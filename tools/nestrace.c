@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: MIT */
+
+/*! @file nestrace.c
+ * Decoder for the binary instruction traces written by trace.c
+ *
+ * Usage: nestrace <file.trace>
+ *
+ * Prints one line per instruction in the layout of nestest.log, so traces of
+ * nestest.nes can be diffed against it. The memory values nestest appends to
+ * operands (e.g. "= 00") aren't recorded and are left out. Unofficial opcodes
+ * are marked with a *.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cpu.h>
+
+#include "trace.h"
+
+enum trace_mode
+{
+    D_IMP,
+    D_ACC,
+    D_IMM,
+    D_REL,
+    D_ZP,
+    D_ZPX,
+    D_ZPY,
+    D_ABS,
+    D_ABX,
+    D_ABY,
+    D_IND,
+    D_IZX,
+    D_IZY
+};
+
+static const u8 trace_lengths[] = {
+    [D_IMP] = 1, [D_ACC] = 1, [D_IMM] = 2, [D_REL] = 2, [D_ZP] = 2,
+    [D_ZPX] = 2, [D_ZPY] = 2, [D_ABS] = 3, [D_ABX] = 3, [D_ABY] = 3,
+    [D_IND] = 3, [D_IZX] = 2, [D_IZY] = 2,
+};
+
+// clang-format off
+static const struct
+{
+    const char *name;
+    u8          mode;
+} trace_ops[256] = {
+    /* 0 */ {"BRK", D_IMP}, {"ORA", D_IZX}, {"*KIL", D_IMP}, {"*SLO", D_IZX},
+            {"*NOP", D_ZP}, {"ORA", D_ZP}, {"ASL", D_ZP}, {"*SLO", D_ZP},
+            {"PHP", D_IMP}, {"ORA", D_IMM}, {"ASL", D_ACC}, {"*ANC", D_IMM},
+            {"*NOP", D_ABS}, {"ORA", D_ABS}, {"ASL", D_ABS}, {"*SLO", D_ABS},
+    /* 1 */ {"BPL", D_REL}, {"ORA", D_IZY}, {"*KIL", D_IMP}, {"*SLO", D_IZY},
+            {"*NOP", D_ZPX}, {"ORA", D_ZPX}, {"ASL", D_ZPX}, {"*SLO", D_ZPX},
+            {"CLC", D_IMP}, {"ORA", D_ABY}, {"*NOP", D_IMP}, {"*SLO", D_ABY},
+            {"*NOP", D_ABX}, {"ORA", D_ABX}, {"ASL", D_ABX}, {"*SLO", D_ABX},
+    /* 2 */ {"JSR", D_ABS}, {"AND", D_IZX}, {"*KIL", D_IMP}, {"*RLA", D_IZX},
+            {"BIT", D_ZP}, {"AND", D_ZP}, {"ROL", D_ZP}, {"*RLA", D_ZP},
+            {"PLP", D_IMP}, {"AND", D_IMM}, {"ROL", D_ACC}, {"*ANC", D_IMM},
+            {"BIT", D_ABS}, {"AND", D_ABS}, {"ROL", D_ABS}, {"*RLA", D_ABS},
+    /* 3 */ {"BMI", D_REL}, {"AND", D_IZY}, {"*KIL", D_IMP}, {"*RLA", D_IZY},
+            {"*NOP", D_ZPX}, {"AND", D_ZPX}, {"ROL", D_ZPX}, {"*RLA", D_ZPX},
+            {"SEC", D_IMP}, {"AND", D_ABY}, {"*NOP", D_IMP}, {"*RLA", D_ABY},
+            {"*NOP", D_ABX}, {"AND", D_ABX}, {"ROL", D_ABX}, {"*RLA", D_ABX},
+    /* 4 */ {"RTI", D_IMP}, {"EOR", D_IZX}, {"*KIL", D_IMP}, {"*SRE", D_IZX},
+            {"*NOP", D_ZP}, {"EOR", D_ZP}, {"LSR", D_ZP}, {"*SRE", D_ZP},
+            {"PHA", D_IMP}, {"EOR", D_IMM}, {"LSR", D_ACC}, {"*ALR", D_IMM},
+            {"JMP", D_ABS}, {"EOR", D_ABS}, {"LSR", D_ABS}, {"*SRE", D_ABS},
+    /* 5 */ {"BVC", D_REL}, {"EOR", D_IZY}, {"*KIL", D_IMP}, {"*SRE", D_IZY},
+            {"*NOP", D_ZPX}, {"EOR", D_ZPX}, {"LSR", D_ZPX}, {"*SRE", D_ZPX},
+            {"CLI", D_IMP}, {"EOR", D_ABY}, {"*NOP", D_IMP}, {"*SRE", D_ABY},
+            {"*NOP", D_ABX}, {"EOR", D_ABX}, {"LSR", D_ABX}, {"*SRE", D_ABX},
+    /* 6 */ {"RTS", D_IMP}, {"ADC", D_IZX}, {"*KIL", D_IMP}, {"*RRA", D_IZX},
+            {"*NOP", D_ZP}, {"ADC", D_ZP}, {"ROR", D_ZP}, {"*RRA", D_ZP},
+            {"PLA", D_IMP}, {"ADC", D_IMM}, {"ROR", D_ACC}, {"*ARR", D_IMM},
+            {"JMP", D_IND}, {"ADC", D_ABS}, {"ROR", D_ABS}, {"*RRA", D_ABS},
+    /* 7 */ {"BVS", D_REL}, {"ADC", D_IZY}, {"*KIL", D_IMP}, {"*RRA", D_IZY},
+            {"*NOP", D_ZPX}, {"ADC", D_ZPX}, {"ROR", D_ZPX}, {"*RRA", D_ZPX},
+            {"SEI", D_IMP}, {"ADC", D_ABY}, {"*NOP", D_IMP}, {"*RRA", D_ABY},
+            {"*NOP", D_ABX}, {"ADC", D_ABX}, {"ROR", D_ABX}, {"*RRA", D_ABX},
+    /* 8 */ {"*NOP", D_IMM}, {"STA", D_IZX}, {"*NOP", D_IMM}, {"*SAX", D_IZX},
+            {"STY", D_ZP}, {"STA", D_ZP}, {"STX", D_ZP}, {"*SAX", D_ZP},
+            {"DEY", D_IMP}, {"*NOP", D_IMM}, {"TXA", D_IMP}, {"*XAA", D_IMM},
+            {"STY", D_ABS}, {"STA", D_ABS}, {"STX", D_ABS}, {"*SAX", D_ABS},
+    /* 9 */ {"BCC", D_REL}, {"STA", D_IZY}, {"*KIL", D_IMP}, {"*AHX", D_IZY},
+            {"STY", D_ZPX}, {"STA", D_ZPX}, {"STX", D_ZPY}, {"*SAX", D_ZPY},
+            {"TYA", D_IMP}, {"STA", D_ABY}, {"TXS", D_IMP}, {"*TAS", D_ABY},
+            {"*SHY", D_ABX}, {"STA", D_ABX}, {"*SHX", D_ABY}, {"*AHX", D_ABY},
+    /* A */ {"LDY", D_IMM}, {"LDA", D_IZX}, {"LDX", D_IMM}, {"*LAX", D_IZX},
+            {"LDY", D_ZP}, {"LDA", D_ZP}, {"LDX", D_ZP}, {"*LAX", D_ZP},
+            {"TAY", D_IMP}, {"LDA", D_IMM}, {"TAX", D_IMP}, {"*LAX", D_IMM},
+            {"LDY", D_ABS}, {"LDA", D_ABS}, {"LDX", D_ABS}, {"*LAX", D_ABS},
+    /* B */ {"BCS", D_REL}, {"LDA", D_IZY}, {"*KIL", D_IMP}, {"*LAX", D_IZY},
+            {"LDY", D_ZPX}, {"LDA", D_ZPX}, {"LDX", D_ZPY}, {"*LAX", D_ZPY},
+            {"CLV", D_IMP}, {"LDA", D_ABY}, {"TSX", D_IMP}, {"*LAS", D_ABY},
+            {"LDY", D_ABX}, {"LDA", D_ABX}, {"LDX", D_ABY}, {"*LAX", D_ABY},
+    /* C */ {"CPY", D_IMM}, {"CMP", D_IZX}, {"*NOP", D_IMM}, {"*DCP", D_IZX},
+            {"CPY", D_ZP}, {"CMP", D_ZP}, {"DEC", D_ZP}, {"*DCP", D_ZP},
+            {"INY", D_IMP}, {"CMP", D_IMM}, {"DEX", D_IMP}, {"*AXS", D_IMM},
+            {"CPY", D_ABS}, {"CMP", D_ABS}, {"DEC", D_ABS}, {"*DCP", D_ABS},
+    /* D */ {"BNE", D_REL}, {"CMP", D_IZY}, {"*KIL", D_IMP}, {"*DCP", D_IZY},
+            {"*NOP", D_ZPX}, {"CMP", D_ZPX}, {"DEC", D_ZPX}, {"*DCP", D_ZPX},
+            {"CLD", D_IMP}, {"CMP", D_ABY}, {"*NOP", D_IMP}, {"*DCP", D_ABY},
+            {"*NOP", D_ABX}, {"CMP", D_ABX}, {"DEC", D_ABX}, {"*DCP", D_ABX},
+    /* E */ {"CPX", D_IMM}, {"SBC", D_IZX}, {"*NOP", D_IMM}, {"*ISB", D_IZX},
+            {"CPX", D_ZP}, {"SBC", D_ZP}, {"INC", D_ZP}, {"*ISB", D_ZP},
+            {"INX", D_IMP}, {"SBC", D_IMM}, {"NOP", D_IMP}, {"*SBC", D_IMM},
+            {"CPX", D_ABS}, {"SBC", D_ABS}, {"INC", D_ABS}, {"*ISB", D_ABS},
+    /* F */ {"BEQ", D_REL}, {"SBC", D_IZY}, {"*KIL", D_IMP}, {"*ISB", D_IZY},
+            {"*NOP", D_ZPX}, {"SBC", D_ZPX}, {"INC", D_ZPX}, {"*ISB", D_ZPX},
+            {"SED", D_IMP}, {"SBC", D_ABY}, {"*NOP", D_IMP}, {"*ISB", D_ABY},
+            {"*NOP", D_ABX}, {"SBC", D_ABX}, {"INC", D_ABX}, {"*ISB", D_ABX},
+};
+// clang-format on
+
+/*
+ * Formats the instruction as nestest does, e.g. "LDA $0300,X"
+ */
+static void
+trace_disasm(const struct trace_rec *r, char *out, size_t size)
+{
+    const char *name = trace_ops[r->op].name;
+
+    u16 abs = r->arg[0] | r->arg[1] << 8;
+    u8  zp  = r->arg[0];
+
+    switch (trace_ops[r->op].mode)
+    {
+        case D_IMP: snprintf(out, size, "%s", name); break;
+        case D_ACC: snprintf(out, size, "%s A", name); break;
+        case D_IMM: snprintf(out, size, "%s #$%02X", name, zp); break;
+        case D_ZP: snprintf(out, size, "%s $%02X", name, zp); break;
+        case D_ZPX: snprintf(out, size, "%s $%02X,X", name, zp); break;
+        case D_ZPY: snprintf(out, size, "%s $%02X,Y", name, zp); break;
+        case D_ABS: snprintf(out, size, "%s $%04X", name, abs); break;
+        case D_ABX: snprintf(out, size, "%s $%04X,X", name, abs); break;
+        case D_ABY: snprintf(out, size, "%s $%04X,Y", name, abs); break;
+        case D_IND: snprintf(out, size, "%s ($%04X)", name, abs); break;
+        case D_IZX: snprintf(out, size, "%s ($%02X,X)", name, zp); break;
+        case D_IZY: snprintf(out, size, "%s ($%02X),Y", name, zp); break;
+        case D_REL:
+            snprintf(out, size, "%s $%04X", name,
+                     (u16)(r->pc + 2 + (int8_t)zp));
+            break;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <file.trace>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct trace_header h;
+    if (fread(&h, sizeof(h), 1, file) != 1 || h.magic != TRACE_MAGIC ||
+        h.version != TRACE_VERSION || h.size != sizeof(struct trace_rec))
+    {
+        fprintf(stderr, "%s: not a version %d trace\n", argv[1],
+                TRACE_VERSION);
+        return 1;
+    }
+
+    struct trace_rec r;
+    while (fread(&r, sizeof(r), 1, file) == 1)
+    {
+        u8   len = trace_lengths[trace_ops[r.op].mode];
+        char bytes[16];
+        char text[40];
+
+        switch (len)
+        {
+            case 1:
+                snprintf(bytes, sizeof(bytes), "%02X", r.op);
+                break;
+            case 2:
+                snprintf(bytes, sizeof(bytes), "%02X %02X", r.op, r.arg[0]);
+                break;
+            default:
+                snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r.op,
+                         r.arg[0], r.arg[1]);
+                break;
+        }
+
+        trace_disasm(&r, text, sizeof(text));
+
+        // unofficial opcodes start a column early, over the *
+        printf("%04X  %-8s %c%-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X "
+               "PPU:%3d,%3d CYC:%llu\n",
+               r.pc, bytes, text[0] == '*' ? '*' : ' ',
+               text + (text[0] == '*'), r.A, r.X, r.Y, r.P, r.SP,
+               r.scanline < 0 ? 261 : r.scanline, r.dot,
+               (unsigned long long)r.cycle);
+    }
+
+    fclose(file);
+    return 0;
+}
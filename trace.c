@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/*
+ * Writes out every record up to head, in at most two pieces when the ring
+ * wraps
+ */
+static void
+trace_drain(struct trace *t)
+{
+    u64 head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    u64 tail = t->tail;
+
+    while (tail != head)
+    {
+        u64 at = tail & (TRACE_SIZE - 1);
+        u64 n  = head - tail;
+
+        if (at + n > TRACE_SIZE)
+        {
+            n = TRACE_SIZE - at;
+        }
+
+        fwrite(&t->ring[at], sizeof(struct trace_rec), n, t->file);
+        tail += n;
+        __atomic_store_n(&t->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Drain thread
+ */
+static void *
+trace_loop(void *in)
+{
+    struct trace *t = in;
+
+    while (__atomic_load_n(&t->enable, __ATOMIC_ACQUIRE))
+    {
+        if (__atomic_load_n(&t->head, __ATOMIC_ACQUIRE) == t->tail)
+        {
+            usleep(1000);
+            continue;
+        }
+
+        trace_drain(t);
+    }
+
+    trace_drain(t);
+    return NULL;
+}
+
+struct trace *
+trace_open(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    struct trace_header h = {
+        .magic   = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .size    = sizeof(struct trace_rec),
+    };
+    fwrite(&h, sizeof(h), 1, file);
+
+    struct trace *t = calloc(1, sizeof(struct trace));
+
+    t->file   = file;
+    t->enable = 1;
+    pthread_create(&t->thread, NULL, trace_loop, t);
+
+    return t;
+}
+
+void
+trace_close(struct trace *t)
+{
+    __atomic_store_n(&t->enable, 0, __ATOMIC_RELEASE);
+    pthread_join(t->thread, NULL);
+
+    fclose(t->file);
+    free(t);
+}
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef NES_TRACE_H_
+#define NES_TRACE_H_
+
+/*! @file trace.h
+ * Binary instruction trace
+ *
+ * rp2a03_run() appends one record per instruction to a single-producer,
+ * single-consumer ring, and a drain thread writes the ring to a file. The file
+ * is a struct trace_header followed by struct trace_rec records;
+ * tools/nestrace.c turns it into a nestest-style text log.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <cpu.h>
+
+#define TRACE_SIZE 0x10000 // records, power of 2
+
+#define TRACE_MAGIC   0x4543525453454Eull //!< "NESTRCE" in the file
+#define TRACE_VERSION 1
+
+struct trace_header
+{
+    u64 magic;
+    u32 version;
+    u32 size; //!< sizeof(struct trace_rec)
+};
+
+/*!
+ * CPU state right before an instruction runs
+ */
+struct trace_rec
+{
+    u64     cycle; //!< CPU cycle the instruction starts on
+    u16     pc;
+    u8      op;
+    u8      arg[2]; //!< Operand bytes, as many as the opcode has
+    u8      A;
+    u8      X;
+    u8      Y;
+    u8      P;
+    u8      SP;
+    int16_t scanline; //!< PPU position, -1 is the pre-render line
+    u16     dot;
+    u8      pad[2];
+};
+
+/*!
+ * @struct trace
+ * Ring between the emulation thread and the drain thread
+ */
+struct trace
+{
+    struct trace_rec ring[TRACE_SIZE];
+
+    u64 head; //!< Next record to write, owned by the emulation thread
+    u64 tail; //!< Next record to drain, owned by the drain thread
+
+    u64 stalls; //!< Times the ring was full and the emulation had to wait,
+                //!< reported when the trace is stopped
+
+    FILE     *file;
+    u8        enable;
+    pthread_t thread;
+};
+
+/*!
+ * Creates path and starts the drain thread
+ *
+ * @returns the trace, or NULL if path can't be written
+ */
+struct trace *
+trace_open(const char *path);
+
+/*!
+ * Drains whatever is left, stops the thread and closes the file
+ */
+void
+trace_close(struct trace *t);
+
+/*!
+ * Appends a record. Only waits if the drain thread is a whole ring behind,
+ * so no instruction is ever missing from the file
+ */
+static inline void
+trace_push(struct trace *t, const struct trace_rec *r)
+{
+    u64 head = t->head;
+
+    while (head - __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE) >= TRACE_SIZE)
+    {
+        t->stalls += 1;
+        sched_yield();
+    }
+
+    t->ring[head & (TRACE_SIZE - 1)] = *r;
+
+    __atomic_store_n(&t->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif // NES_TRACE_H_
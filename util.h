@@ -26,11 +26,36 @@
 #define NES_UTIL_H_
 
 /*! @file util.h
- * A bunch of preprocessor macros that i find useful
+ * A bunch of preprocessor macros that i find useful, and the clock
  */
 
+#include <stdint.h>
+#include <time.h>
+
 #define INRANGE(_num, _x, _y)        ((_num) >= (_x) && (_num) <= (_y))
 #define IFINRANGE(__num, __xx, __yy) if (INRANGE((__num), (__xx), (__yy)))
 #define MIN(_a, _b) ((_a) < (_b) ? (_a) : (_b))
+#define MAX(_a, _b) ((_a) > (_b) ? (_a) : (_b))
+
+/*!
+ * Monotonic time in nanoseconds, for measuring intervals
+ */
+static inline uint64_t
+util_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*!
+ * Monotonic time in microseconds
+ */
+static inline uint64_t
+util_now_us(void)
+{
+    return util_now_ns() / 1000;
+}
 
 #endif // NES_UTIL_H_